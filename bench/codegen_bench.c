@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asm_writer.h"
+#include "code_gen.h"
+#include "ir.h"
+#include "lexer.h"
+#include "parser.h"
+#include "semantic.h"
+
+// Runs generate_x64_code over the same IR into each writer target and reports
+// how many bytes of assembly per second come out.
+// usage: codegen_bench [-n iterations] <file.dc>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ir_instruction_list_t *load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buffer = malloc(size + 1);
+    size_t read = fread(buffer, 1, size, f);
+    buffer[read] = '\0';
+    fclose(f);
+
+    struct statement_list *ast = ast_parse(lexer_parse(buffer));
+    semantic_check(ast);
+    return generate_ir(ast);
+}
+
+static void report(const char *target, size_t bytes, int iterations, double seconds) {
+    printf("%-8s %10zu bytes x %d in %.3fs  %8.1f MB/s\n",
+           target, bytes, iterations, seconds, bytes * (double) iterations / seconds / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 1000;
+    const char *input = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) iterations = atoi(argv[++i]);
+        else input = argv[i];
+    }
+    if(!input || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [-n iterations] <file.dc>\n", argv[0]);
+        return 1;
+    }
+
+    ir_instruction_list_t *ir = load(input);
+    if(!ir) return 1;
+    codegen_options_t options = {0};
+
+    // memory
+    asm_writer_t w;
+    asm_writer_init_memory(&w);
+    size_t bytes = 0;
+    double start = now();
+    for(int i = 0; i < iterations; i++) {
+        generate_x64_code(ir, &w, &options);
+        free(asm_writer_take(&w, &bytes));
+    }
+    report("memory", bytes, iterations, now() - start);
+    asm_writer_close(&w);
+
+    // file
+    FILE *null = fopen("/dev/null", "w");
+    if(null) {
+        asm_writer_init_file(&w, null);
+        start = now();
+        for(int i = 0; i < iterations; i++) generate_x64_code(ir, &w, &options);
+        asm_writer_close(&w);
+        report("file", bytes, iterations, now() - start);
+        fclose(null);
+    }
+
+    // pipe, a child drains the read end like an assembler would
+    int fds[2];
+    if(pipe(fds) == 0) {
+        pid_t child = fork();
+        if(child == 0) {
+            close(fds[1]);
+            char sink[65536];
+            while(read(fds[0], sink, sizeof(sink)) > 0) {}
+            _exit(0);
+        }
+        close(fds[0]);
+        asm_writer_init_fd(&w, fds[1]);
+        start = now();
+        for(int i = 0; i < iterations; i++) generate_x64_code(ir, &w, &options);
+        asm_writer_close(&w);
+        close(fds[1]);
+        waitpid(child, NULL, 0);
+        report("pipe", bytes, iterations, now() - start);
+    }
+
+    return 0;
+}
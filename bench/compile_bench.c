@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alloc.h"
+#include "code_gen.h"
+#include "elf_writer.h"
+#include "ir.h"
+#include "lexer.h"
+#include "parser.h"
+#include "report.h"
+#include "semantic.h"
+
+// Compiles each input to an object file in memory, the way the driver does,
+// and reports lines and megabytes of source per second for every phase. Each
+// phase's time is the fastest of the iterations. Every iteration runs in an
+// arena that's reset afterwards, so the compiler's leaks don't pile up.
+// usage: compile_bench [-n iterations] [-o results.json] <file.dc>...
+
+typedef struct program {
+    const char *path;
+    char *source;
+    size_t bytes;
+    size_t lines;
+    report_t best; // per phase fastest wall and cpu time
+} program_t;
+
+static char *load(const char *path, size_t *size) {
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buffer = malloc(*size + 1);
+    *size = fread(buffer, 1, *size, f);
+    buffer[*size] = '\0';
+    fclose(f);
+    return buffer;
+}
+
+static int compile(program_t *program, report_t *report, FILE *null) {
+    char *buffer = malloc(program->bytes + 1);
+    memcpy(buffer, program->source, program->bytes + 1);
+
+    report_start(report);
+    report_enter(PHASE_LEX);
+    token_t *token = lexer_parse(buffer);
+    report_enter(PHASE_PARSE);
+    struct statement_list *ast = ast_parse(token);
+    report_enter(PHASE_SEMANTIC);
+    int errors = semantic_check(ast);
+    if(errors) {
+        report_stop();
+        fprintf(stderr, "%s: %d semantic errors\n", program->path, errors);
+        return 1;
+    }
+    report_enter(PHASE_IR_GEN);
+    ir_instruction_list_t *ir = generate_ir(ast);
+
+    codegen_options_t options = {.source_name = program->path};
+    x64_code_t code = {0};
+    generate_x64_binary(ir, &code, &options);
+    report_enter(PHASE_OUTPUT);
+    int status = elf_write_object(null, &code, options.source_name);
+    report_stop();
+    x64_code_free(&code);
+    return status;
+}
+
+static void keep_best(report_t *best, report_t *report, int first) {
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        phase_stats_t *b = &best->phases[i], *r = &report->phases[i];
+        if(first || r->wall_ns < b->wall_ns) b->wall_ns = r->wall_ns;
+        if(first || r->cpu_ns < b->cpu_ns) b->cpu_ns = r->cpu_ns;
+        b->bytes = r->bytes;
+        b->allocations = r->allocations;
+    }
+}
+
+static double per_second(double amount, uint64_t ns) {
+    return ns ? amount * 1e9 / (double) ns : 0;
+}
+
+static uint64_t total_ns(report_t *report) {
+    uint64_t total = 0;
+    for(int i = 0; i < PHASE_COUNT; i++) total += report->phases[i].wall_ns;
+    return total;
+}
+
+static void print_text(program_t *program) {
+    printf("%s: %zu lines, %zu bytes\n", program->path, program->lines, program->bytes);
+    printf(" %-12s %10s %14s %10s\n", "phase", "ms", "lines/s", "MB/s");
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        uint64_t ns = program->best.phases[i].wall_ns;
+        if(i == PHASE_DRIVER || !ns) continue; // only setup here, ir-read doesn't run
+        printf(" %-12s %10.3f %14.0f %10.2f\n", report_phase_name(i), ns / 1e6,
+               per_second(program->lines, ns), per_second(program->bytes / 1e6, ns));
+    }
+    uint64_t ns = total_ns(&program->best);
+    printf(" %-12s %10.3f %14.0f %10.2f\n\n", "total", ns / 1e6,
+           per_second(program->lines, ns), per_second(program->bytes / 1e6, ns));
+}
+
+static void print_json_phase(FILE *f, const char *name, uint64_t wall_ns, uint64_t cpu_ns, program_t *program) {
+    fprintf(f, "{\"name\": \"%s\", \"wall_ns\": %llu, \"cpu_ns\": %llu, \"lines_per_sec\": %.0f, \"mb_per_sec\": %.3f}",
+            name, (unsigned long long) wall_ns, (unsigned long long) cpu_ns,
+            per_second(program->lines, wall_ns), per_second(program->bytes / 1e6, wall_ns));
+}
+
+static int write_json(const char *path, program_t *programs, int count, int iterations) {
+    FILE *f = fopen(path, "w");
+    if(!f) {
+        fprintf(stderr, "Failed to open output file '%s'.\n", path);
+        return 1;
+    }
+
+    fprintf(f, "{\"timestamp\": %lld, \"iterations\": %d, \"programs\": [", (long long) time(NULL), iterations);
+    for(int p = 0; p < count; p++) {
+        program_t *program = &programs[p];
+        fprintf(f, "%s\n  {\"file\": \"%s\", \"lines\": %zu, \"bytes\": %zu, \"phases\": [",
+                p ? "," : "", program->path, program->lines, program->bytes);
+        int first = 1;
+        uint64_t cpu = 0;
+        for(int i = 0; i < PHASE_COUNT; i++) {
+            phase_stats_t *stats = &program->best.phases[i];
+            cpu += stats->cpu_ns;
+            if(i == PHASE_DRIVER || !stats->wall_ns) continue;
+            fprintf(f, "%s\n    ", first ? "" : ",");
+            print_json_phase(f, report_phase_name(i), stats->wall_ns, stats->cpu_ns, program);
+            first = 0;
+        }
+        fprintf(f, "],\n   \"total\": ");
+        print_json_phase(f, "total", total_ns(&program->best), cpu, program);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 5;
+    const char *json = NULL;
+    program_t *programs = calloc(argc, sizeof(program_t));
+    int count = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) iterations = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) json = argv[++i];
+        else programs[count++].path = argv[i];
+    }
+    if(count == 0 || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [-n iterations] [-o results.json] <file.dc>...\n", argv[0]);
+        return 1;
+    }
+
+    // nothing that outlives an iteration may come from the arena: the
+    // keyword trie and the stream's buffer are set up before
+    static char null_buffer[65536];
+    FILE *null = fopen("/dev/null", "wb");
+    arena_t *arena = arena_create();
+    if(!null || !arena) return 1;
+    setvbuf(null, null_buffer, _IOFBF, sizeof(null_buffer));
+    lexer_init();
+
+    for(int p = 0; p < count; p++) {
+        program_t *program = &programs[p];
+        program->source = load(program->path, &program->bytes);
+        if(!program->source) return 1;
+        for(size_t i = 0; i < program->bytes; i++) program->lines += program->source[i] == '\n';
+
+        for(int i = 0; i < iterations; i++) {
+            report_t report = {0};
+            arena_swap(arena);
+            int status = compile(program, &report, null);
+            arena_swap(NULL);
+            arena_reset(arena);
+            if(status) return 1;
+            keep_best(&program->best, &report, i == 0);
+        }
+        print_text(program);
+    }
+
+    fclose(null);
+    if(json && write_json(json, programs, count, iterations) != 0) return 1;
+    if(json) printf("results written to %s\n", json);
+    return 0;
+}
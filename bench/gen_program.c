@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes a large, valid DivC program for the compile throughput benchmark.
+// Every function takes three arguments, declares its locals from nested
+// expressions over the arguments, earlier locals and calls to earlier
+// functions, and returns one more such expression. main calls the last one.
+// usage: gen_program [-f functions] [-d depth] [-l locals] [-i ident_len]
+//                    [-s seed] [-o file]
+
+typedef struct gen {
+    FILE *out;
+    uint64_t state;
+    int depth;
+    int locals;
+    int ident_len;
+    int function; // the one being written, calls go to lower ones
+} gen_t;
+
+static uint32_t next_random(gen_t *gen) {
+    // xorshift64*, same program for the same seed everywhere
+    gen->state ^= gen->state >> 12;
+    gen->state ^= gen->state << 25;
+    gen->state ^= gen->state >> 27;
+    return (uint32_t) ((gen->state * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+// a prefix and number, padded out to ident_len with letters that only
+// depend on the name, so every use spells it the same
+static void name(gen_t *gen, char prefix, int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%c%d", prefix, n);
+    fputs(buf, gen->out);
+    uint32_t h = (uint32_t) n * 2654435761u + (uint32_t) prefix;
+    for(int i = len; i < gen->ident_len; i++) {
+        h = h * 1103515245u + 12345u;
+        fputc('a' + (h >> 16) % 26, gen->out);
+    }
+}
+
+static void leaf(gen_t *gen, int locals) {
+    uint32_t r = next_random(gen) % 8;
+    if(r < 2) fprintf(gen->out, "%u", next_random(gen) % 100);
+    else if(r < 4 || locals == 0) name(gen, 'a', (int) (next_random(gen) % 3));
+    else name(gen, 'v', (int) (next_random(gen) % (uint32_t) locals));
+}
+
+static void expression(gen_t *gen, int depth, int locals) {
+    if(depth == 0) {
+        // now and then a call instead of a plain operand
+        if(gen->function > 0 && next_random(gen) % 16 == 0) {
+            name(gen, 'f', (int) (next_random(gen) % (uint32_t) gen->function));
+            fputc('(', gen->out);
+            for(int i = 0; i < 3; i++) {
+                if(i) fputs(", ", gen->out);
+                leaf(gen, locals);
+            }
+            fputc(')', gen->out);
+            return;
+        }
+        leaf(gen, locals);
+        return;
+    }
+
+    static const char *ops[] = {" + ", " - ", " * "};
+    int parens = depth > 1;
+    if(parens) fputc('(', gen->out);
+    expression(gen, depth - 1, locals);
+    fputs(ops[next_random(gen) % 3], gen->out);
+    expression(gen, depth - 1, locals);
+    if(parens) fputc(')', gen->out);
+}
+
+static void function(gen_t *gen) {
+    fputs("int ", gen->out);
+    name(gen, 'f', gen->function);
+    fputc('(', gen->out);
+    for(int i = 0; i < 3; i++) {
+        fputs(i ? ", int " : "int ", gen->out);
+        name(gen, 'a', i);
+    }
+    fputs(") {\n", gen->out);
+
+    for(int i = 0; i < gen->locals; i++) {
+        fputs("    int ", gen->out);
+        name(gen, 'v', i);
+        fputs(" = ", gen->out);
+        expression(gen, gen->depth, i);
+        fputs(";\n", gen->out);
+    }
+    fputs("    return ", gen->out);
+    expression(gen, gen->depth, gen->locals);
+    fputs(";\n}\n\n", gen->out);
+}
+
+int main(int argc, char *argv[]) {
+    int functions = 1000;
+    gen_t gen = {.state = 1, .depth = 3, .locals = 16, .ident_len = 8};
+    const char *output = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        int valid = i + 1 < argc; // every option takes a value
+        if(!valid) {}
+        else if(strcmp(argv[i], "-f") == 0) functions = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-d") == 0) gen.depth = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-l") == 0) gen.locals = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-i") == 0) gen.ident_len = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-s") == 0) gen.state = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-o") == 0) output = argv[++i];
+        else valid = 0;
+        if(!valid) {
+            fprintf(stderr, "Usage: %s [-f functions] [-d depth] [-l locals] [-i ident_len] [-s seed] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(functions <= 0 || gen.depth < 0 || gen.depth > 16 || gen.locals < 0 || gen.ident_len > 255) {
+        fprintf(stderr, "%s: out of range, need -f > 0, -d 0..16, -l >= 0, -i <= 255\n", argv[0]);
+        return 1;
+    }
+    if(gen.state == 0) gen.state = 1; // xorshift never leaves zero
+
+    gen.out = output ? fopen(output, "w") : stdout;
+    if(!gen.out) {
+        fprintf(stderr, "Failed to open output file '%s'.\n", output);
+        return 1;
+    }
+
+    for(gen.function = 0; gen.function < functions; gen.function++) function(&gen);
+    fputs("int main(void) {\n    int r = ", gen.out);
+    name(&gen, 'f', functions - 1);
+    fputs("(1, 2, 3);\n    return r;\n}\n", gen.out);
+
+    return fclose(gen.out) == 0 ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Calls kernel() from one of the *.dc files in a loop, the same loop for every
+// compiler, and prints a checksum of the results and the seconds it took. The
+// kernel is linked in from its own object, so gcc can't inline it here.
+// usage: driver [iterations]
+
+int kernel(int a, int b, int c);
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned checksum = 0;
+    for(long i = 0; i < iterations; i++) {
+        checksum = checksum * 31 + (unsigned) kernel((int) i, (int) checksum, 7);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%u %.6f\n", checksum, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return 0;
+}
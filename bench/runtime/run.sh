@@ -0,0 +1,72 @@
+#!/bin/sh
+# Runs every kernel in bench/runtime/*.dc compiled by divc, gcc -O0 and
+# gcc -O2 under the same driver loop and compares the times. The kernels stay
+# within what DivC and C have in common, so gcc compiles the very same file;
+# a checksum mismatch means divc computed something else and fails the run.
+# usage: run.sh [iterations]    DIVC=./divc CC=gcc
+
+ITERATIONS=${1:-10000000}
+DIVC=${DIVC:-./divc}
+CC=${CC:-gcc}
+DIR=$(dirname "$0")
+BUILD=$DIR/build
+mkdir -p "$BUILD" || exit 1
+
+# with nasm, divc's assembly goes through it, otherwise its own object writer
+if command -v nasm > /dev/null; then ASSEMBLER="divc -S + nasm"; else ASSEMBLER="divc object writer"; fi
+if command -v perf > /dev/null && perf stat -x, -e instructions true > /dev/null 2>&1; then PERF=1; else PERF=0; fi
+
+$CC -O2 -c "$DIR/driver.c" -o "$BUILD/driver.o" || exit 1
+
+# prints "checksum seconds instructions" for one binary
+measure() {
+    if [ $PERF = 1 ]; then
+        result=$(perf stat -x, -e instructions -o "$BUILD/perf.txt" -- "$1" "$ITERATIONS") || return 1
+        instructions=$(grep instructions "$BUILD/perf.txt" | cut -d, -f1)
+    else
+        result=$("$1" "$ITERATIONS") || return 1
+        instructions=-
+    fi
+    echo "$result ${instructions:--}"
+}
+
+echo "$ITERATIONS calls per kernel, $ASSEMBLER$( [ $PERF = 1 ] || echo ', no perf: instruction counts skipped')"
+printf '%-10s %-8s %10s %10s %9s %16s\n' kernel build seconds ns/call vs-O2 instructions
+status=0
+for source in "$DIR"/*.dc; do
+    kernel=$(basename "$source" .dc)
+
+    if [ "$ASSEMBLER" = "divc object writer" ]; then
+        $DIVC "$source" -o "$BUILD/$kernel.divc.o" || { status=1; continue; }
+    else
+        $DIVC -S "$source" -o "$BUILD/$kernel.s" && nasm -f elf64 "$BUILD/$kernel.s" -o "$BUILD/$kernel.divc.o" || { status=1; continue; }
+    fi
+    $CC -O0 -fwrapv -x c -c "$source" -o "$BUILD/$kernel.O0.o" || { status=1; continue; }
+    $CC -O2 -fwrapv -x c -c "$source" -o "$BUILD/$kernel.O2.o" || { status=1; continue; }
+
+    o2_seconds=
+    o2_checksum=
+    # -O2 first, the others are relative to it
+    for build in O2 O0 divc; do
+        $CC "$BUILD/driver.o" "$BUILD/$kernel.$build.o" -o "$BUILD/$kernel.$build" || { status=1; continue; }
+        set -- $(measure "$BUILD/$kernel.$build")
+        if [ $# -ne 3 ]; then
+            echo "$kernel: $build failed to run"
+            status=1
+            continue
+        fi
+        checksum=$1 seconds=$2 instructions=$3
+        [ -z "$o2_seconds" ] && o2_seconds=$seconds o2_checksum=$checksum
+
+        name=$build
+        [ $build = divc ] || name=gcc-$build
+        printf '%-10s %-8s %10.3f %10.2f %8.2fx %16s\n' "$kernel" "$name" "$seconds" \
+            "$(echo "$seconds $ITERATIONS" | awk '{ print $1 * 1e9 / $2 }')" \
+            "$(echo "$seconds $o2_seconds" | awk '{ print ($2 > 0 ? $1 / $2 : 0) }')" "$instructions"
+        if [ "$checksum" != "$o2_checksum" ]; then
+            echo "$kernel: $name checksum $checksum, gcc -O2 got $o2_checksum"
+            status=1
+        fi
+    done
+done
+exit $status
@@ -0,0 +1,202 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "report.h"
+
+#define ARENA_CHUNK (1 << 20)
+#define ARENA_KEEP (32 << 20)  // chunk bytes an arena holds on to over a reset
+#define ARENA_MAGIC 0x6469766361726e61ull
+
+typedef struct chunk {
+    struct chunk *next;
+    size_t size;
+    size_t used;
+    size_t pad; // keeps data 16 byte aligned
+    uint8_t data[];
+} chunk_t;
+
+// in front of every arena allocation, the tag tells mem_free and
+// mem_realloc that the pointer isn't the heap's
+typedef struct block {
+    uint64_t size;
+    uint64_t tag;
+} block_t;
+
+// Arena memory is zeroed, like the fresh heap a one-shot compile gets, so a
+// request sees the same memory no matter what ran in the arena before it.
+struct arena {
+    chunk_t *chunks; // the first one is bumped, the rest are full
+    chunk_t *spare;  // emptied and cleared by a reset
+    size_t chunk_size;
+};
+
+static _Thread_local arena_t *current;
+// set by the first arena, before that no pointer can be an arena's
+static int arenas;
+
+static inline size_t round_up(size_t size) {
+    return (size + 15) & ~(size_t) 15;
+}
+
+// For heap memory the 16 bytes in front of the pointer are the allocator's
+// chunk header: mapped, but a redzone to ASan, so the read isn't checked.
+#if defined(__GNUC__)
+__attribute__((no_sanitize_address))
+#endif
+static block_t *arena_block(void *ptr) {
+    if(!ptr || ((uintptr_t) ptr & 15) || !__atomic_load_n(&arenas, __ATOMIC_RELAXED)) return NULL;
+    block_t *block = (block_t *) ptr - 1;
+    return block->tag == (ARENA_MAGIC ^ (uintptr_t) block) ? block : NULL;
+}
+
+static chunk_t *new_chunk(size_t size) {
+    chunk_t *chunk = calloc(1, sizeof(chunk_t) + size);
+    if(chunk) *chunk = (chunk_t) {NULL, size, 0, 0};
+    return chunk;
+}
+
+static void *bump(arena_t *arena, size_t size) {
+    size_t need = sizeof(block_t) + round_up(size ? size : 1);
+    chunk_t *chunk = arena->chunks;
+
+    if(!chunk || chunk->used + need > chunk->size) {
+        if(need > arena->chunk_size / 4) {
+            // big ones get a chunk of their own behind the one being bumped
+            chunk = new_chunk(need);
+            if(!chunk) return NULL;
+            if(arena->chunks) {
+                chunk->next = arena->chunks->next;
+                arena->chunks->next = chunk;
+            }
+            else {
+                arena->chunks = chunk;
+            }
+        }
+        else {
+            chunk = arena->spare;
+            if(chunk) arena->spare = chunk->next;
+            else chunk = new_chunk(arena->chunk_size);
+            if(!chunk) return NULL;
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+    }
+
+    block_t *block = (block_t *) (chunk->data + chunk->used);
+    chunk->used += need;
+    block->size = size;
+    block->tag = ARENA_MAGIC ^ (uintptr_t) block;
+    return block + 1;
+}
+
+arena_t *arena_create(void) {
+    return arena_create_sized(ARENA_CHUNK);
+}
+
+arena_t *arena_create_sized(size_t chunk_size) {
+    __atomic_store_n(&arenas, 1, __ATOMIC_RELAXED);
+    arena_t *arena = calloc(1, sizeof(arena_t));
+    if(arena) arena->chunk_size = chunk_size;
+    return arena;
+}
+
+void arena_destroy(arena_t *arena) {
+    arena_reset(arena);
+    while(arena->spare) {
+        chunk_t *next = arena->spare->next;
+        free(arena->spare);
+        arena->spare = next;
+    }
+    free(arena);
+}
+
+void arena_reset(arena_t *arena) {
+    size_t kept = 0;
+    for(chunk_t *spare = arena->spare; spare; spare = spare->next) kept += spare->size;
+
+    chunk_t *chunk = arena->chunks;
+    while(chunk) {
+        chunk_t *next = chunk->next;
+        if(chunk->size == arena->chunk_size && kept < ARENA_KEEP) {
+            memset(chunk->data, 0, chunk->used);
+            chunk->used = 0;
+            chunk->next = arena->spare;
+            arena->spare = chunk;
+            kept += chunk->size;
+        }
+        else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+arena_t *arena_swap(arena_t *arena) {
+    arena_t *previous = current;
+    current = arena;
+    return previous;
+}
+
+void *mem_alloc(size_t size) {
+    report_allocation(size, 1);
+    return current ? bump(current, size) : malloc(size);
+}
+
+void *mem_calloc(size_t count, size_t size) {
+    if(size && count > SIZE_MAX / size) return NULL;
+    report_allocation(count * size, 1);
+    return current ? bump(current, count * size) : calloc(count, size);
+}
+
+void *mem_realloc(void *ptr, size_t size) {
+    block_t *block = arena_block(ptr);
+    size_t old = block ? block->size : ptr ? malloc_usable_size(ptr) : 0;
+    report_allocation(size > old ? size - old : 0, ptr == NULL);
+    if(!block) {
+        // heap memory stays on the heap, it may have to outlive the arena
+        if(ptr || !current) return realloc(ptr, size);
+        return bump(current, size);
+    }
+
+    // the last allocation in the chunk being bumped grows in place
+    chunk_t *chunk = current ? current->chunks : NULL;
+    uint8_t *end = (uint8_t *) ptr + round_up(block->size ? block->size : 1);
+    if(chunk && end == chunk->data + chunk->used && (uint8_t *) ptr > chunk->data) {
+        size_t grown = (size_t) ((uint8_t *) ptr - chunk->data) + round_up(size ? size : 1);
+        if(grown <= chunk->size) {
+            if(grown < chunk->used) memset(chunk->data + grown, 0, chunk->used - grown);
+            chunk->used = grown;
+            block->size = size;
+            return ptr;
+        }
+    }
+
+    void *moved = current ? bump(current, size) : malloc(size);
+    if(moved) memcpy(moved, ptr, block->size < size ? block->size : size);
+    return moved;
+}
+
+void mem_free(void *ptr) {
+    if(!ptr || arena_block(ptr)) return;
+    free(ptr);
+}
+
+char *mem_strdup(const char *s) {
+    size_t len = strlen(s);
+    char *copy = mem_alloc(len + 1);
+    if(copy) memcpy(copy, s, len + 1);
+    return copy;
+}
+
+char *mem_strndup(const char *s, size_t n) {
+    size_t len = strnlen(s, n);
+    char *copy = mem_alloc(len + 1);
+    if(!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
@@ -0,0 +1,37 @@
+#ifndef _ALLOC_H
+#define _ALLOC_H
+
+#include <stddef.h>
+
+// The compiler allocates through mem_alloc and the rest of this family
+// instead of libc's. They go to the heap, or to the calling thread's arena
+// when it has one, and count what they hand out for -fmem-report. Memory of
+// either kind can be passed to any of them, and libc's own allocations
+// (open_memstream buffers, ...) to mem_free and mem_realloc.
+//
+// The compiler never frees its tokens, AST or IR, which is fine for a
+// process that exits after one file. The compile server runs each request
+// in an arena instead and resets it afterwards, so nothing accumulates and
+// the next request starts on memory that's already mapped. Nothing libc
+// allocates goes into an arena, what it hands out has to be freed.
+typedef struct arena arena_t;
+
+void *mem_alloc(size_t size);
+void *mem_calloc(size_t count, size_t size);
+void *mem_realloc(void *ptr, size_t size);
+// arena memory goes with the reset, heap memory back to libc
+void mem_free(void *ptr);
+char *mem_strdup(const char *s);
+char *mem_strndup(const char *s, size_t n);
+
+arena_t *arena_create(void);
+// for many small arenas alive at once, arena_create's chunks are 1 MiB
+arena_t *arena_create_sized(size_t chunk_size);
+void arena_destroy(arena_t *arena);
+// drops every allocation at once, keeps the chunks for reuse
+void arena_reset(arena_t *arena);
+// the calling thread's arena from now on, NULL for the heap; returns the
+// previous one, so code keeping memory past the request can step out
+arena_t *arena_swap(arena_t *arena);
+
+#endif
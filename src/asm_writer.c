@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "asm_writer.h"
+
+static void asm_writer_init(asm_writer_t *w, asm_target_t target) {
+    memset(w, 0, sizeof(asm_writer_t));
+    w->target = target;
+    w->fd = -1;
+    w->cap = ASM_WRITER_BUFFER;
+    w->buf = mem_alloc(w->cap);
+}
+
+void asm_writer_init_file(asm_writer_t *w, FILE *f) {
+    asm_writer_init(w, ASM_TARGET_FILE);
+    w->file = f;
+}
+
+void asm_writer_init_fd(asm_writer_t *w, int fd) {
+    asm_writer_init(w, ASM_TARGET_FD);
+    w->fd = fd;
+}
+
+void asm_writer_init_memory(asm_writer_t *w) {
+    asm_writer_init(w, ASM_TARGET_MEMORY);
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+int asm_writer_flush(asm_writer_t *w) {
+    if(w->len == 0 || w->target == ASM_TARGET_MEMORY) return w->error;
+
+    if(w->target == ASM_TARGET_FILE) {
+        if(fwrite(w->buf, 1, w->len, w->file) != w->len) w->error = 1;
+    }
+    else if(write_all(w->fd, w->buf, w->len) != 0) {
+        w->error = 1;
+    }
+    w->len = 0;
+    return w->error;
+}
+
+void asm_write(asm_writer_t *w, const char *data, size_t len) {
+    w->total += len;
+
+    if(w->len + len > w->cap) {
+        if(w->target == ASM_TARGET_MEMORY) {
+            while(w->len + len > w->cap) w->cap *= 2;
+            w->buf = mem_realloc(w->buf, w->cap);
+        }
+        else {
+            asm_writer_flush(w);
+            // bigger than the whole buffer, no point copying it
+            if(len > w->cap) {
+                if(w->target == ASM_TARGET_FILE) {
+                    if(fwrite(data, 1, len, w->file) != len) w->error = 1;
+                }
+                else if(write_all(w->fd, data, len) != 0) {
+                    w->error = 1;
+                }
+                return;
+            }
+        }
+    }
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+// digits go into the buffer back to front, two at a time
+void asm_write_int(asm_writer_t *w, int64_t value) {
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+
+    uint64_t u = value < 0 ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value;
+    while(u >= 100) {
+        unsigned i = (unsigned) (u % 100) * 2;
+        u /= 100;
+        *--p = pairs[i + 1];
+        *--p = pairs[i];
+    }
+    if(u >= 10) {
+        unsigned i = (unsigned) u * 2;
+        *--p = pairs[i + 1];
+        *--p = pairs[i];
+    }
+    else {
+        *--p = (char) ('0' + u);
+    }
+    if(value < 0) *--p = '-';
+
+    asm_write(w, p, (size_t) (end - p));
+}
+
+char *asm_writer_take(asm_writer_t *w, size_t *len) {
+    asm_write(w, "", 1);
+    char *data = w->buf;
+    if(len) *len = w->len - 1;
+
+    w->buf = mem_alloc(ASM_WRITER_BUFFER);
+    w->cap = ASM_WRITER_BUFFER;
+    w->len = 0;
+    w->total = 0;
+    return data;
+}
+
+int asm_writer_close(asm_writer_t *w) {
+    int error = asm_writer_flush(w);
+    mem_free(w->buf);
+    w->buf = NULL;
+    w->len = 0;
+    w->cap = 0;
+    return error;
+}
@@ -0,0 +1,55 @@
+#ifndef _ASM_WRITER_H
+#define _ASM_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ASM_WRITER_BUFFER (64 * 1024)
+
+typedef enum {
+    ASM_TARGET_FILE,   // FILE*, flushed with fwrite
+    ASM_TARGET_FD,     // pipe or socket, flushed with write(2)
+    ASM_TARGET_MEMORY, // grows until asm_writer_take
+} asm_target_t;
+
+// Buffered text output for the assembly printer, avoids stdio format parsing
+// for every operand.
+typedef struct asm_writer {
+    asm_target_t target;
+    FILE *file;
+    int fd;
+
+    char *buf;
+    size_t len;
+    size_t cap;
+
+    size_t total; // bytes written so far, flushed or not
+    int error;
+} asm_writer_t;
+
+void asm_writer_init_file(asm_writer_t *w, FILE *f);
+void asm_writer_init_fd(asm_writer_t *w, int fd);
+void asm_writer_init_memory(asm_writer_t *w);
+
+void asm_write(asm_writer_t *w, const char *data, size_t len);
+void asm_write_int(asm_writer_t *w, int64_t value);
+
+static inline void asm_putc(asm_writer_t *w, char c) {
+    if(w->len == w->cap) asm_write(w, &c, 1);
+    else {
+        w->buf[w->len++] = c;
+        w->total++;
+    }
+}
+
+// string literals only, the length is computed at compile time
+#define asm_puts(w, lit) asm_write((w), (lit), sizeof(lit) - 1)
+
+int asm_writer_flush(asm_writer_t *w);
+// memory target: hands over the buffer (NUL terminated), the writer is reset
+char *asm_writer_take(asm_writer_t *w, size_t *len);
+// flushes and frees, returns nonzero if any write failed
+int asm_writer_close(asm_writer_t *w);
+
+#endif
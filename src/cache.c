@@ -0,0 +1,584 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "cache.h"
+#include "diag.h"
+
+// Output cache for the driver. Content addressed, so there's nothing to
+// invalidate: a changed source, flag or compiler is a different key, and
+// entries nobody asks for anymore age out through eviction.
+
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void compress(cache_hash_t *hash, const uint8_t *block) {
+    uint32_t w[64];
+    for(int i = 0; i < 16; i++) {
+        w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16
+            | (uint32_t) block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for(int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t v[8];
+    memcpy(v, hash->state, sizeof(v));
+    for(int i = 0; i < 64; i++) {
+        uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+        uint32_t choose = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7] + s1 + choose + round_constants[i] + w[i];
+        uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+        uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(v + 1, v, sizeof(uint32_t) * 7);
+        v[4] += t1;
+        v[0] = t1 + s0 + majority;
+    }
+    for(int i = 0; i < 8; i++) hash->state[i] += v[i];
+}
+
+static void hash_start(cache_hash_t *hash) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(hash->state, initial, sizeof(initial));
+    hash->block_len = 0;
+    hash->total = 0;
+}
+
+// Every build of the compiler gets its own keys, codegen changes between
+// builds without anybody bumping a version. The linker's build ID is a hash
+// of the binary already, so the same sources built twice share a cache.
+static char compiler_id[CACHE_KEY_LEN + 1];
+static pthread_once_t compiler_id_once = PTHREAD_ONCE_INIT;
+
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void) size;
+    cache_hash_t *hash = arg;
+    // the executable comes first and is the only one looked at, 2 if it has
+    // a build ID
+    for(ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if(phdr->p_type != PT_NOTE) continue;
+        size_t align = phdr->p_align > 4 ? phdr->p_align : 4;
+        const uint8_t *note = (const uint8_t *) (info->dlpi_addr + phdr->p_vaddr);
+        const uint8_t *end = note + phdr->p_memsz;
+        while(note + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *header = (const ElfW(Nhdr) *) note;
+            const uint8_t *name = note + sizeof(ElfW(Nhdr));
+            const uint8_t *desc = name + ((header->n_namesz + align - 1) & ~(align - 1));
+            if(header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 && memcmp(name, "GNU", 4) == 0
+               && desc + header->n_descsz <= end) {
+                cache_hash_update(hash, desc, header->n_descsz);
+                return 2;
+            }
+            note = desc + ((header->n_descsz + align - 1) & ~(align - 1));
+        }
+    }
+    return 1;
+}
+
+static void compute_compiler_id(void) {
+    cache_hash_t hash;
+    hash_start(&hash);
+    cache_hash_string(&hash, "divc");
+    if(dl_iterate_phdr(find_build_id, &hash) != 2) {
+        // linked without --build-id, the binary itself then
+        int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+        char buffer[65536];
+        ssize_t got;
+        while(fd >= 0 && (got = read(fd, buffer, sizeof(buffer))) > 0) cache_hash_update(&hash, buffer, (size_t) got);
+        if(fd >= 0) close(fd);
+    }
+    cache_hash_final(&hash, compiler_id);
+}
+
+void cache_hash_init(cache_hash_t *hash) {
+    pthread_once(&compiler_id_once, compute_compiler_id);
+    hash_start(hash);
+    cache_hash_string(hash, compiler_id);
+}
+
+void cache_hash_update(cache_hash_t *hash, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    hash->total += len;
+    while(len > 0) {
+        size_t take = 64 - hash->block_len;
+        if(take > len) take = len;
+        memcpy(hash->block + hash->block_len, bytes, take);
+        hash->block_len += take;
+        bytes += take;
+        len -= take;
+        if(hash->block_len == 64) {
+            compress(hash, hash->block);
+            hash->block_len = 0;
+        }
+    }
+}
+
+void cache_hash_int(cache_hash_t *hash, int64_t value) {
+    cache_hash_update(hash, &value, sizeof(value));
+}
+
+void cache_hash_string(cache_hash_t *hash, const char *s) {
+    // length first, so ("ab", "c") and ("a", "bc") differ
+    cache_hash_int(hash, s ? (int64_t) strlen(s) : -1);
+    if(s) cache_hash_update(hash, s, strlen(s));
+}
+
+void cache_hash_final(cache_hash_t *hash, char key[CACHE_KEY_LEN + 1]) {
+    uint64_t bits = hash->total * 8;
+    uint8_t pad = 0x80;
+    cache_hash_update(hash, &pad, 1);
+    pad = 0;
+    while(hash->block_len != 56) cache_hash_update(hash, &pad, 1);
+    uint8_t length[8];
+    for(int i = 0; i < 8; i++) length[i] = (uint8_t) (bits >> (56 - 8 * i));
+    cache_hash_update(hash, length, 8);
+
+    static const char digits[] = "0123456789abcdef";
+    for(int i = 0; i < 32; i++) {
+        uint8_t byte = (uint8_t) (hash->state[i / 4] >> (24 - 8 * (i % 4)));
+        key[i * 2] = digits[byte >> 4];
+        key[i * 2 + 1] = digits[byte & 15];
+    }
+    key[CACHE_KEY_LEN] = '\0';
+}
+
+const char *cache_default_dir(void) {
+    static _Thread_local char dir[4096];
+    const char *env = getenv("DIVC_CACHE_DIR");
+    if(env && *env) return env;
+    env = getenv("XDG_CACHE_HOME");
+    if(env && *env) snprintf(dir, sizeof(dir), "%s/divc", env);
+    else snprintf(dir, sizeof(dir), "%s/.cache/divc", getenv("HOME") ? getenv("HOME") : ".");
+    return dir;
+}
+
+static char *entry_path(cache_t *cache, const char *key) {
+    size_t len = strlen(cache->dir) + CACHE_KEY_LEN + 3;
+    char *path = mem_alloc(len);
+    snprintf(path, len, "%s/%.2s/%s", cache->dir, key, key + 2);
+    return path;
+}
+
+// len bytes from in_fd at offset to out_fd, in the kernel where it can
+static int copy_range(int in_fd, off_t offset, int out_fd, uint64_t len) {
+    while(len > 0) {
+        ssize_t n = copy_file_range(in_fd, &offset, out_fd, NULL, len, 0);
+        if(n <= 0) break;
+        len -= (uint64_t) n;
+    }
+
+    // pipes, ttys and kernels without copy_file_range
+    char buffer[65536];
+    while(len > 0) {
+        size_t want = len < sizeof(buffer) ? (size_t) len : sizeof(buffer);
+        ssize_t got = pread(in_fd, buffer, want, offset);
+        if(got <= 0) return -1;
+        for(ssize_t done = 0; done < got;) {
+            ssize_t n = write(out_fd, buffer + done, (size_t) (got - done));
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return -1;
+            done += n;
+        }
+        offset += got;
+        len -= (uint64_t) got;
+    }
+    return 0;
+}
+
+// the cache directory and its parents, then the bucket of `key` if given
+static int make_dirs(cache_t *cache, const char *key) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s", cache->dir);
+    for(char *p = path + 1; *p; p++) {
+        if(*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+    if(key) {
+        mkdir(path, 0755);
+        snprintf(path + strlen(path), sizeof(path) - strlen(path), "/%.2s", key);
+    }
+    return mkdir(path, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+typedef struct entry {
+    char *path;
+    struct timespec used;
+    uint64_t size;
+} entry_t;
+
+static int compare_used(const void *a, const void *b) {
+    const entry_t *x = a;
+    const entry_t *y = b;
+    if(x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if(x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+// least recently used first until the cache is down to 90% of its limit,
+// recounting from disk since concurrent stores can race on the counters
+static void evict(cache_t *cache, cache_stats_t *stats) {
+    entry_t *entries = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t size = 0;
+
+    char path[4096];
+    for(int bucket = 0; bucket < 256; bucket++) {
+        snprintf(path, sizeof(path), "%s/%02x", cache->dir, bucket);
+        DIR *dir = opendir(path);
+        if(!dir) continue;
+        struct dirent *d;
+        while((d = readdir(dir)) != NULL) {
+            if(d->d_name[0] == '.') continue; // ., .. and stores in flight
+            struct stat st;
+            char *entry = mem_alloc(strlen(path) + strlen(d->d_name) + 2);
+            sprintf(entry, "%s/%s", path, d->d_name);
+            if(stat(entry, &st) != 0) {
+                mem_free(entry);
+                continue;
+            }
+            if(count == cap) {
+                cap = cap ? cap * 2 : 256;
+                entries = mem_realloc(entries, sizeof(entry_t) * cap);
+            }
+            entries[count++] = (entry_t) {entry, st.st_mtim, (uint64_t) st.st_size};
+            size += (uint64_t) st.st_size;
+        }
+        closedir(dir);
+    }
+
+    qsort(entries, count, sizeof(entry_t), compare_used);
+    uint64_t target = cache->max_size / 10 * 9;
+    size_t kept = count;
+    for(size_t i = 0; i < count; i++) {
+        if(size > target && unlink(entries[i].path) == 0) {
+            size -= entries[i].size;
+            kept--;
+        }
+        mem_free(entries[i].path);
+    }
+    mem_free(entries);
+
+    stats->size = size;
+    stats->entries = kept;
+}
+
+// runs `update` on dir/stats with the file locked
+static void update_stats(cache_t *cache, void (*update)(cache_t *, cache_stats_t *, void *), void *arg) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/stats", cache->dir);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0 && errno == ENOENT && make_dirs(cache, NULL) == 0) {
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if(fd < 0) return;
+    if(flock(fd, LOCK_EX) == 0) {
+        cache_stats_t stats = {0};
+        if(pread(fd, &stats, sizeof(stats), 0) != sizeof(stats)) memset(&stats, 0, sizeof(stats));
+        update(cache, &stats, arg);
+        if(pwrite(fd, &stats, sizeof(stats), 0) != sizeof(stats)) {
+            fprintf(diag_stream(), "Cache error: %s: cannot update\n", path);
+        }
+    }
+    close(fd); // drops the lock
+}
+
+static void add_pending(cache_t *cache, cache_stats_t *stats, void *arg) {
+    (void) arg;
+    stats->hits += cache->pending.hits;
+    stats->misses += cache->pending.misses;
+    stats->size += cache->pending.size;
+    stats->entries += cache->pending.entries;
+    if(stats->size > cache->max_size) evict(cache, stats);
+}
+
+void cache_flush(cache_t *cache) {
+    cache_stats_t *pending = &cache->pending;
+    if(pending->hits == 0 && pending->misses == 0 && pending->entries == 0) return;
+    update_stats(cache, add_pending, NULL);
+    memset(pending, 0, sizeof(*pending));
+}
+
+// Entries the compile server has seen lately, so a warm hit doesn't touch the
+// disk. Keyed like the files, evicted least recently used first.
+typedef struct memory_entry {
+    char key[CACHE_KEY_LEN + 1];
+    uint8_t *data; // the entry file's bytes
+    size_t len;
+    uint64_t used;
+    struct memory_entry *next;
+} memory_entry_t;
+
+#define MEMORY_BUCKETS 1024
+
+static struct {
+    pthread_mutex_t lock;
+    memory_entry_t *buckets[MEMORY_BUCKETS];
+    uint64_t size;
+    uint64_t max_size; // 0 while off
+    uint64_t tick;
+} memory = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void cache_keep_in_memory(uint64_t max_size) {
+    memory.max_size = max_size;
+}
+
+static memory_entry_t **memory_find(const char *key) {
+    // keys are hashes already
+    memory_entry_t **entry = &memory.buckets[strtoul((char[4]) {key[0], key[1], key[2], 0}, NULL, 16) % MEMORY_BUCKETS];
+    while(*entry && strcmp((*entry)->key, key) != 0) entry = &(*entry)->next;
+    return entry;
+}
+
+// a copy of the entry, so it can be written out without the lock
+static uint8_t *memory_get(const char *key, size_t *len) {
+    uint8_t *data = NULL;
+    pthread_mutex_lock(&memory.lock);
+    memory_entry_t *entry = *memory_find(key);
+    if(entry) {
+        entry->used = ++memory.tick;
+        data = mem_alloc(entry->len);
+        memcpy(data, entry->data, entry->len);
+        *len = entry->len;
+    }
+    pthread_mutex_unlock(&memory.lock);
+    return data;
+}
+
+static void memory_put(const char *key, const uint8_t *data, size_t len) {
+    // the entry outlives the request, so not from its arena
+    arena_t *request = arena_swap(NULL);
+    pthread_mutex_lock(&memory.lock);
+    memory_entry_t **slot = memory_find(key);
+    if(!*slot && len <= memory.max_size) {
+        memory_entry_t *entry = mem_calloc(1, sizeof(memory_entry_t));
+        memcpy(entry->key, key, CACHE_KEY_LEN + 1);
+        entry->data = mem_alloc(len);
+        memcpy(entry->data, data, len);
+        entry->len = len;
+        entry->used = ++memory.tick;
+        *slot = entry;
+        memory.size += len;
+    }
+
+    while(memory.size > memory.max_size) {
+        memory_entry_t **oldest = NULL;
+        for(size_t i = 0; i < MEMORY_BUCKETS; i++) {
+            for(memory_entry_t **e = &memory.buckets[i]; *e; e = &(*e)->next) {
+                if(!oldest || (*e)->used < (*oldest)->used) oldest = e;
+            }
+        }
+        memory_entry_t *victim = *oldest;
+        *oldest = victim->next;
+        memory.size -= victim->len;
+        mem_free(victim->data);
+        mem_free(victim);
+    }
+    pthread_mutex_unlock(&memory.lock);
+    arena_swap(request);
+}
+
+static int entry_valid(cache_entry_header_t *header, uint64_t size) {
+    if(memcmp(header->magic, CACHE_MAGIC, 4) != 0 || header->version != CACHE_VERSION) return 0;
+    return sizeof(*header) + header->diagnostics_len + header->output_len == size;
+}
+
+static int write_all(int fd, const uint8_t *data, uint64_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        data += n;
+        len -= (uint64_t) n;
+    }
+    return 0;
+}
+
+// an entry read into memory, written to the file `output` or to `stream`
+static int serve(const uint8_t *data, size_t len, const char *output, FILE *stream, FILE *diagnostics) {
+    cache_entry_header_t header;
+    if(len < sizeof(header)) return 0;
+    memcpy(&header, data, sizeof(header));
+    if(!entry_valid(&header, len)) return 0;
+
+    const uint8_t *bytes = data + sizeof(header) + header.diagnostics_len;
+    int ok;
+    if(output) {
+        int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        ok = fd >= 0 && write_all(fd, bytes, header.output_len) == 0;
+        if(fd >= 0) ok = close(fd) == 0 && ok;
+    }
+    else {
+        ok = fwrite(bytes, 1, header.output_len, stream) == header.output_len;
+    }
+    if(ok) fwrite(data + sizeof(header), 1, header.diagnostics_len, diagnostics);
+    return ok;
+}
+
+static int lookup_disk(cache_t *cache, const char *key, const char *output, FILE *stream, FILE *diagnostics) {
+    char *path = entry_path(cache, key);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    mem_free(path);
+    if(fd < 0) return 0;
+
+    cache_entry_header_t header;
+    struct stat st;
+    int hit = fstat(fd, &st) == 0
+        && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && entry_valid(&header, (uint64_t) st.st_size);
+
+    if(hit && (memory.max_size || !output)) {
+        // the whole entry, it's going into memory or onto a stream anyway
+        uint8_t *data = mem_alloc((size_t) st.st_size);
+        hit = pread(fd, data, (size_t) st.st_size, 0) == st.st_size
+            && serve(data, (size_t) st.st_size, output, stream, diagnostics);
+        if(hit && memory.max_size) memory_put(key, data, (size_t) st.st_size);
+        mem_free(data);
+    }
+    else if(hit) {
+        // straight from file to file, the diagnostics are the only read
+        char *text = mem_alloc(header.diagnostics_len + 1);
+        int out = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        hit = pread(fd, text, header.diagnostics_len, sizeof(header)) == (ssize_t) header.diagnostics_len
+            && out >= 0
+            && copy_range(fd, (off_t) (sizeof(header) + header.diagnostics_len), out, header.output_len) == 0;
+        if(out >= 0) hit = close(out) == 0 && hit;
+        if(hit) fwrite(text, 1, header.diagnostics_len, diagnostics);
+        mem_free(text);
+    }
+    if(hit) futimens(fd, NULL); // most recently used now
+    close(fd);
+    return hit;
+}
+
+int cache_lookup(cache_t *cache, const char *key, const char *output, FILE *stream, FILE *diagnostics) {
+    int hit = 0;
+    if(memory.max_size) {
+        size_t len;
+        uint8_t *data = memory_get(key, &len);
+        if(data) hit = serve(data, len, output, stream, diagnostics);
+        mem_free(data);
+    }
+    if(!hit) hit = lookup_disk(cache, key, output, stream, diagnostics);
+
+    // counted here, written to dir/stats by cache_flush
+    __atomic_fetch_add(hit ? &cache->pending.hits : &cache->pending.misses, 1, __ATOMIC_RELAXED);
+    return hit;
+}
+
+void cache_store(cache_t *cache, const char *key, const char *output, const char *diagnostics, size_t diagnostics_len) {
+    int in = open(output, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(in < 0 || fstat(in, &st) != 0 || !S_ISREG(st.st_mode) || make_dirs(cache, key) != 0) {
+        if(in >= 0) close(in);
+        return;
+    }
+
+    char *path = entry_path(cache, key);
+    char *tmp = mem_alloc(strlen(path) + 16);
+    snprintf(tmp, strlen(path) + 16, "%.*s.tmp.XXXXXX", (int) (strlen(cache->dir) + 4), path);
+    int fd = mkstemp(tmp);
+
+    cache_entry_header_t header = {
+        .version = CACHE_VERSION,
+        .diagnostics_len = diagnostics_len,
+        .output_len = (uint64_t) st.st_size,
+    };
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    size_t size = sizeof(header) + diagnostics_len + header.output_len;
+
+    // the server keeps a copy, so the entry is put together in memory first
+    uint8_t *data = NULL;
+    if(memory.max_size) {
+        data = mem_alloc(size);
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + sizeof(header), diagnostics, diagnostics_len);
+        if(pread(in, data + sizeof(header) + diagnostics_len, header.output_len, 0) != (ssize_t) header.output_len) {
+            mem_free(data);
+            data = NULL;
+        }
+    }
+
+    int ok = fd >= 0;
+    if(ok && data) {
+        ok = write_all(fd, data, size) == 0;
+    }
+    else if(ok) {
+        ok = write(fd, &header, sizeof(header)) == sizeof(header)
+            && (diagnostics_len == 0 || write(fd, diagnostics, diagnostics_len) == (ssize_t) diagnostics_len)
+            && copy_range(in, 0, fd, header.output_len) == 0;
+    }
+    if(fd >= 0) ok = close(fd) == 0 && ok;
+    close(in);
+
+    // rename is atomic, a concurrent reader sees the old entry or the new one
+    if(ok && rename(tmp, path) == 0) {
+        __atomic_fetch_add(&cache->pending.size, size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cache->pending.entries, 1, __ATOMIC_RELAXED);
+        if(data) memory_put(key, data, size);
+    }
+    else if(fd >= 0) {
+        unlink(tmp);
+    }
+    mem_free(data);
+    mem_free(tmp);
+    mem_free(path);
+}
+
+static void print_size(FILE *f, uint64_t size) {
+    if(size >= 1 << 30) fprintf(f, "%.1f GiB", (double) size / (1 << 30));
+    else if(size >= 1 << 20) fprintf(f, "%.1f MiB", (double) size / (1 << 20));
+    else fprintf(f, "%.1f KiB", (double) size / (1 << 10));
+}
+
+int cache_print_stats(cache_t *cache, FILE *f) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/stats", cache->dir);
+    cache_stats_t stats = {0};
+    FILE *in = fopen(path, "rb");
+    if(in) {
+        if(fread(&stats, sizeof(stats), 1, in) != 1) memset(&stats, 0, sizeof(stats));
+        fclose(in);
+    }
+
+    uint64_t lookups = stats.hits + stats.misses;
+    fprintf(f, "cache directory  %s\n", cache->dir);
+    fprintf(f, "hits             %llu\n", (unsigned long long) stats.hits);
+    fprintf(f, "misses           %llu\n", (unsigned long long) stats.misses);
+    fprintf(f, "hit rate         %.1f%%\n", lookups ? 100.0 * (double) stats.hits / (double) lookups : 0.0);
+    fprintf(f, "entries          %llu\n", (unsigned long long) stats.entries);
+    fprintf(f, "size             ");
+    print_size(f, stats.size);
+    fprintf(f, " of ");
+    print_size(f, cache->max_size);
+    fprintf(f, "\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CACHE_MAGIC "DVCC"
+#define CACHE_VERSION 1
+#define CACHE_KEY_LEN 64 // hex digits of a SHA-256
+#define CACHE_DEFAULT_SIZE (256ull << 20)
+
+// SHA-256 over everything that decides an output: the compiler build, the
+// flags, the input name and the source bytes
+typedef struct cache_hash {
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t block_len;
+    uint64_t total;
+} cache_hash_t;
+
+void cache_hash_init(cache_hash_t *hash); // already covers the compiler build
+void cache_hash_update(cache_hash_t *hash, const void *data, size_t len);
+void cache_hash_int(cache_hash_t *hash, int64_t value);
+void cache_hash_string(cache_hash_t *hash, const char *s); // NULL hashes apart from ""
+void cache_hash_final(cache_hash_t *hash, char key[CACHE_KEY_LEN + 1]);
+
+// An entry is one file, dir/ab/cdef..., named after its key:
+//   header | diagnostics | output
+// It's written to a temporary file and renamed into place, so readers never
+// see half of one. Hits bump the mtime, eviction drops the oldest first.
+typedef struct cache_entry_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t diagnostics_len;
+    uint64_t output_len;
+} cache_entry_header_t;
+
+// dir/stats, updated under flock once per run
+typedef struct cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t size;    // bytes in entries
+    uint64_t entries;
+} cache_stats_t;
+
+typedef struct cache {
+    const char *dir;
+    uint64_t max_size;
+    cache_stats_t pending; // this run's, until cache_flush
+} cache_t;
+
+// $DIVC_CACHE_DIR, else $XDG_CACHE_HOME/divc, else ~/.cache/divc
+const char *cache_default_dir(void);
+
+// On a hit copies the output to the file `output` (to `stream` if NULL) and
+// the diagnostics recorded with it to `diagnostics`, returns 1. Counts a hit
+// or a miss either way, a miss doesn't touch the output.
+int cache_lookup(cache_t *cache, const char *key, const char *output, FILE *stream, FILE *diagnostics);
+// Records `output` (a file) and the diagnostics printed while compiling it
+void cache_store(cache_t *cache, const char *key, const char *output, const char *diagnostics, size_t diagnostics_len);
+// Adds the hits, misses and stores counted since the last flush to
+// dir/stats, then evicts down to 90% of max_size if the cache grew past it.
+// Lookups and stores don't touch dir/stats themselves, the driver flushes
+// once at the end of a run.
+void cache_flush(cache_t *cache);
+int cache_print_stats(cache_t *cache, FILE *f);
+
+// Keeps up to max_size bytes of recently used entries in memory as well, for
+// the compile server. Lookups try memory before the disk.
+void cache_keep_in_memory(uint64_t max_size);
+
+#endif
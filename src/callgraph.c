@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "callgraph.h"
+
+void callgraph_init(callgraph_t *graph) {
+    *graph = (callgraph_t) {0};
+    graph->current = SIZE_MAX;
+}
+
+void callgraph_free(callgraph_t *graph) {
+    for(size_t i = 0; i < graph->node_count; i++) {
+        mem_free(graph->nodes[i].name);
+        mem_free(graph->nodes[i].callees);
+    }
+    mem_free(graph->nodes);
+    mem_free(graph->slots);
+    mem_free(graph->roots);
+    *graph = (callgraph_t) {0};
+}
+
+static size_t name_hash(const char *name) {
+    size_t h = 14695981039346656037ull;
+    for(; *name; name++) h = (h ^ (unsigned char) *name) * 1099511628211ull;
+    return h;
+}
+
+static void grow_slots(callgraph_t *graph) {
+    mem_free(graph->slots);
+    graph->slot_cap = graph->slot_cap ? graph->slot_cap * 2 : 64;
+    graph->slots = mem_calloc(graph->slot_cap, sizeof(uint32_t));
+    for(size_t i = 0; i < graph->node_count; i++) {
+        size_t s = name_hash(graph->nodes[i].name) & (graph->slot_cap - 1);
+        while(graph->slots[s]) s = (s + 1) & (graph->slot_cap - 1);
+        graph->slots[s] = (uint32_t) i + 1;
+    }
+}
+
+// the node of `name`, made if it's new; a name that's only called stays
+// non-static, which keeps externals out of the dead set
+static size_t node(callgraph_t *graph, const char *name) {
+    if(graph->slot_cap) {
+        size_t s = name_hash(name) & (graph->slot_cap - 1);
+        for(; graph->slots[s]; s = (s + 1) & (graph->slot_cap - 1)) {
+            size_t i = graph->slots[s] - 1;
+            if(strcmp(graph->nodes[i].name, name) == 0) return i;
+        }
+    }
+
+    if((graph->node_count + 1) * 2 > graph->slot_cap) grow_slots(graph);
+    if(graph->node_count == graph->node_cap) {
+        graph->node_cap = graph->node_cap ? graph->node_cap * 2 : 16;
+        graph->nodes = mem_realloc(graph->nodes, sizeof(callgraph_node_t) * graph->node_cap);
+    }
+    size_t i = graph->node_count++;
+    graph->nodes[i] = (callgraph_node_t) {.name = mem_strdup(name)};
+
+    size_t s = name_hash(name) & (graph->slot_cap - 1);
+    while(graph->slots[s]) s = (s + 1) & (graph->slot_cap - 1);
+    graph->slots[s] = (uint32_t) i + 1;
+    return i;
+}
+
+static void push(size_t **list, size_t *count, size_t *cap, size_t value) {
+    if(*count == *cap) {
+        *cap = *cap ? *cap * 2 : 8;
+        *list = mem_realloc(*list, sizeof(size_t) * *cap);
+    }
+    (*list)[(*count)++] = value;
+}
+
+void callgraph_function(callgraph_t *graph, const char *name, int is_static) {
+    if(name == NULL) {
+        graph->current = SIZE_MAX;
+        return;
+    }
+
+    size_t count = graph->node_count;
+    size_t i = node(graph, name);
+    callgraph_node_t *n = &graph->nodes[i];
+    // a redefinition that isn't static keeps the name exported
+    if(i == count) n->is_static = is_static;
+    else n->is_static = n->is_static && is_static;
+    graph->current = i;
+}
+
+void callgraph_call(callgraph_t *graph, const char *callee) {
+    size_t i = node(graph, callee);
+    if(graph->current == SIZE_MAX) {
+        push(&graph->roots, &graph->root_count, &graph->root_cap, i);
+        return;
+    }
+    callgraph_node_t *caller = &graph->nodes[graph->current];
+    push(&caller->callees, &caller->callee_count, &caller->callee_cap, i);
+}
+
+static void reach(callgraph_t *graph, size_t i, size_t **stack, size_t *count, size_t *cap) {
+    if(graph->nodes[i].reached) return;
+    graph->nodes[i].reached = 1;
+    push(stack, count, cap, i);
+}
+
+void callgraph_solve(callgraph_t *graph) {
+    size_t *stack = NULL, count = 0, cap = 0;
+    for(size_t i = 0; i < graph->node_count; i++) {
+        if(!graph->nodes[i].is_static) reach(graph, i, &stack, &count, &cap);
+    }
+    for(size_t i = 0; i < graph->root_count; i++) reach(graph, graph->roots[i], &stack, &count, &cap);
+
+    while(count > 0) {
+        callgraph_node_t *n = &graph->nodes[stack[--count]];
+        for(size_t i = 0; i < n->callee_count; i++) reach(graph, n->callees[i], &stack, &count, &cap);
+    }
+    mem_free(stack);
+}
+
+int callgraph_dead(callgraph_t *graph, const char *name) {
+    if(!graph->slot_cap) return 0;
+    size_t s = name_hash(name) & (graph->slot_cap - 1);
+    for(; graph->slots[s]; s = (s + 1) & (graph->slot_cap - 1)) {
+        callgraph_node_t *n = &graph->nodes[graph->slots[s] - 1];
+        if(strcmp(n->name, name) == 0) return !n->reached;
+    }
+    return 0;
+}
+
+ir_instruction_list_t *ir_drop_dead_functions(ir_instruction_list_t *ir, size_t *dropped) {
+    callgraph_t graph;
+    callgraph_init(&graph);
+
+    int any_static = 0;
+    for(ir_instruction_list_t *current = ir; current != NULL; current = current->next) {
+        ir_instruction_t *inst = current->instruction;
+        if(inst == NULL) continue;
+        if(inst->opcode == IR_FUNC_START) {
+            callgraph_function(&graph, inst->func.func_name, inst->func.is_static);
+            any_static |= inst->func.is_static;
+        }
+        else if(inst->opcode == IR_FUNC_END) callgraph_function(&graph, NULL, 0);
+        else if(inst->opcode == IR_CALL) callgraph_call(&graph, inst->src1->func_name);
+    }
+
+    *dropped = 0;
+    if(any_static) {
+        callgraph_solve(&graph);
+
+        // a dead function goes from its IR_FUNC_START through its IR_FUNC_END
+        ir_instruction_list_t *before = NULL;
+        for(ir_instruction_list_t *current = ir; current != NULL; current = current->next) {
+            ir_instruction_t *inst = current->instruction;
+            if(inst == NULL || inst->opcode != IR_FUNC_START || !callgraph_dead(&graph, inst->func.func_name)) {
+                before = current;
+                continue;
+            }
+
+            ir_instruction_list_t *end = current;
+            while(end->next && !(end->instruction && end->instruction->opcode == IR_FUNC_END)) end = end->next;
+            if(before) before->next = end->next;
+            else ir = end->next;
+            current = end;
+            (*dropped)++;
+        }
+    }
+
+    callgraph_free(&graph);
+    return ir;
+}
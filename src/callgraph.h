@@ -0,0 +1,44 @@
+#ifndef _CALLGRAPH_H
+#define _CALLGRAPH_H
+
+#include "ir.h"
+
+// Which functions can run at all. Every function that isn't `static` is a
+// root, main and _start included, since another object may call it; so are
+// calls made outside any function. A static function no root reaches is dead.
+typedef struct callgraph_node {
+    char *name;
+    int is_static; // every definition of the name is static
+    int reached;
+    size_t *callees; // node indices
+    size_t callee_count;
+    size_t callee_cap;
+} callgraph_node_t;
+
+typedef struct callgraph {
+    callgraph_node_t *nodes;
+    size_t node_count;
+    size_t node_cap;
+    uint32_t *slots; // open addressing on the name, index + 1, 0 = empty
+    size_t slot_cap;
+    size_t current; // caller of the calls added next, SIZE_MAX if none
+    size_t *roots; // callees of calls outside any function
+    size_t root_count;
+    size_t root_cap;
+} callgraph_t;
+
+void callgraph_init(callgraph_t *graph);
+void callgraph_free(callgraph_t *graph);
+// calls added from here on are made by `name`, or by no function if NULL
+void callgraph_function(callgraph_t *graph, const char *name, int is_static);
+void callgraph_call(callgraph_t *graph, const char *callee);
+// marks what the roots reach, call once every function has been added
+void callgraph_solve(callgraph_t *graph);
+// names the graph hasn't seen count as live
+int callgraph_dead(callgraph_t *graph, const char *name);
+
+// Unlinks the functions nothing reaches, counted in `dropped`, and returns
+// the list's new head
+ir_instruction_list_t *ir_drop_dead_functions(ir_instruction_list_t *ir, size_t *dropped);
+
+#endif
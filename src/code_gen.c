@@ -1,37 +1,39 @@
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "alloc.h"
 #include "code_gen.h"
 #include "ir.h"
 #include "parser.h"
+#include "report.h"
 
 #define debug 0
 
-// Using NASM
-
-const char *get_register(x64_registers_t reg, int size) {
-    static const char *reg_64[] = {"rax", "rbx", "rcx", "rdx", "rsi", "rdi",
-        "rsp", "rbp", "r8",  "r9",  "r10", "r11"};
-
-    static const char *reg_32[] = {"eax", "ebx", "ecx", "edx", "esi", "edi",
-        "esp", "ebp", "r8d",  "r9d",  "r10d", "r11d"};
-
-    static const char *reg_16[] = {"ax", "bx", "cx", "dx", "si", "di",
-        "sp", "bp", "r8w",  "r9w",  "r10w", "r11w"};
+#define PROFILE_LABEL "__divc_profile"
+#define PROFILE_HOOK "__divc_profile_write"
 
-    static const char *reg_8[] = {"al", "bl", "cl", "dl", "sil", "dil",
-        "spl", "bpl", "r8b",  "r9b",  "r10b", "r11b"};
+// Using NASM
 
-    switch(size) {
-        case 1: return reg_8[reg];
-        case 2: return reg_16[reg];
-        case 4: return reg_32[reg];
-        case 8: return reg_64[reg];
-        default: return reg_64[reg];
+static void emit(codegen_context_t *ctx, x64_opcode_t op, x64_operand_t dst, x64_operand_t src) {
+    if(ctx->inst_count == ctx->inst_cap) {
+        ctx->inst_cap = ctx->inst_cap ? ctx->inst_cap * 2 : 256;
+        ctx->insts = mem_realloc(ctx->insts, sizeof(x64_inst_t) * ctx->inst_cap);
     }
+    ctx->insts[ctx->inst_count++] = (x64_inst_t) {
+        .op = op, .dst = dst, .src = src, .part = ctx->part, .line = ctx->pos.line, .column = ctx->pos.column,
+    };
+}
+
+// like emit, for filling in the rest of the instruction afterwards
+static size_t emit_index(codegen_context_t *ctx, x64_opcode_t op, x64_operand_t dst, x64_operand_t src) {
+    emit(ctx, op, dst, src);
+    return ctx->inst_count - 1;
 }
 
+static const x64_operand_t none = {0};
+
 static inline int align_up(int value, int alignment) {
     return (value + alignment - 1) & -alignment;
 }
@@ -40,6 +42,118 @@ static inline int align_down(int value, int alignment) {
     return value & -alignment;
 }
 
+static void emit_comment(codegen_context_t *ctx, const char *fmt, const char *arg) {
+    char text[256];
+    snprintf(text, sizeof(text), fmt, arg);
+    emit(ctx, X64_COMMENT, x64_sym(mem_strdup(text)), none);
+}
+
+static void print_cfi_label(codegen_context_t *ctx, size_t label) {
+    asm_puts(ctx->output, "..@cfi");
+    asm_write_int(ctx->output, (int64_t) label);
+    asm_puts(ctx->output, ":\n");
+}
+
+// NASM can't take .cfi directives, so unwind rules are attached to labels and
+// the .eh_frame section is written out as data at the end
+static void print_function(codegen_context_t *ctx) {
+    eh_function_t *fn = NULL;
+    int at_label = 0; // no instruction since the last ..@cfi label
+    int32_t line = 0;  // of the last %line directive
+
+    for(size_t i = 0; i < ctx->inst_count; i++) {
+        x64_inst_t *inst = &ctx->insts[i];
+
+        if(inst->op == X64_CFI && fn) {
+            if(!at_label) {
+                print_cfi_label(ctx, ++ctx->cfi_label);
+                at_label = 1;
+            }
+            if(fn->rule_count == ctx->rule_cap) {
+                ctx->rule_cap = ctx->rule_cap ? ctx->rule_cap * 2 : 16;
+                fn->rules = mem_realloc(fn->rules, sizeof(x64_cfi_t) * ctx->rule_cap);
+            }
+            fn->rules[fn->rule_count++] = (x64_cfi_t) {
+                ctx->cfi_label, (x64_cfi_op_t) inst->dst.imm, inst->src.mem.base, inst->src.mem.disp
+            };
+            continue;
+        }
+
+        // nasm -g -F dwarf turns these into .debug_line
+        if(ctx->options->debug_info && inst->line > 0 && inst->op < X64_FUNC && inst->line != line) {
+            line = inst->line;
+            asm_puts(ctx->output, "%line ");
+            asm_write_int(ctx->output, line);
+            asm_puts(ctx->output, "+0 ");
+            asm_write(ctx->output, ctx->options->source_name, strlen(ctx->options->source_name));
+            asm_putc(ctx->output, '\n');
+        }
+
+        x64_print(ctx->output, inst);
+        if(inst->op == X64_COMMENT) continue;
+        at_label = 0;
+
+        if(inst->op == X64_FUNC) {
+            if(ctx->eh_count == ctx->eh_cap) {
+                ctx->eh_cap = ctx->eh_cap ? ctx->eh_cap * 2 : 16;
+                ctx->eh = mem_realloc(ctx->eh, sizeof(eh_function_t) * ctx->eh_cap);
+            }
+            fn = &ctx->eh[ctx->eh_count++];
+            // its own copy, the IR may be gone by the time the table is printed
+            *fn = (eh_function_t) {mem_strdup(inst->dst.sym), ++ctx->cfi_label, 0, NULL, 0};
+            ctx->rule_cap = 0;
+            print_cfi_label(ctx, fn->start);
+            at_label = 1;
+        }
+    }
+
+    if(fn) {
+        fn->end = ++ctx->cfi_label;
+        print_cfi_label(ctx, fn->end);
+        asm_puts(ctx->output, "..@");
+        asm_write(ctx->output, fn->name, strlen(fn->name));
+        asm_puts(ctx->output, ".end:\n");
+    }
+}
+
+// peephole and frame lowering over the buffered function, then hand it to the backend
+static void flush_function(codegen_context_t *ctx) {
+    if(ctx->inst_count == 0) return;
+
+    phase_t outer = report_enter(PHASE_PEEPHOLE);
+    if(!ctx->options->no_peephole) {
+        ctx->inst_count = peephole_optimize(ctx->insts, ctx->inst_count, &ctx->options->peephole_stats);
+    }
+
+    // the frame is whatever the colored slots need, not the parser's estimate
+    report_enter(PHASE_STACK_SLOTS);
+    int32_t frame_size = stack_slots_color(ctx->insts, ctx->inst_count, ctx->objects, ctx->object_count,
+                                           !ctx->options->no_stack_reuse);
+    for(size_t i = 0; i < ctx->inst_count; i++) {
+        if(ctx->insts[i].part == X64_PROLOGUE && ctx->insts[i].op == X64_SUB) {
+            ctx->insts[i].src.imm = align_up(frame_size, STACK_ALIGNMENT);
+            break;
+        }
+    }
+    ctx->object_count = 0;
+    report_enter(PHASE_FRAME);
+    ctx->inst_count = frame_lower(&ctx->insts, ctx->inst_count, &ctx->inst_cap, &ctx->options->frame);
+
+    report_enter(PHASE_EMIT);
+    if(ctx->code) {
+        for(size_t i = 0; i < ctx->inst_count; i++) x64_encode(ctx->code, &ctx->insts[i]);
+    }
+    else {
+        print_function(ctx);
+    }
+
+    for(size_t i = 0; i < ctx->inst_count; i++) {
+        if(ctx->insts[i].op == X64_COMMENT) mem_free((char *) ctx->insts[i].dst.sym);
+    }
+    ctx->inst_count = 0;
+    report_leave(outer);
+}
+
 static inline int natural_align(int size) {
     if (size >= 8) return 8;
     if (size >= 4) return 4;
@@ -47,85 +161,102 @@ static inline int natural_align(int size) {
     return 1;
 }
 
-const char *get_size_spec(int size) {
-    switch(size) {
-        case 1: return "byte";
-        case 2: return "word";
-        case 4: return "dword";
-        case 8: return "qword";
-        default: return "dword";
+// a fresh slot below rbp, every one is recorded for stack_slots_color
+static int new_object(codegen_context_t *ctx, int size) {
+    ctx->stack_offset = align_down(ctx->stack_offset - size, natural_align(size));
+    if(ctx->object_count == ctx->object_cap) {
+        ctx->object_cap = ctx->object_cap ? ctx->object_cap * 2 : 64;
+        ctx->objects = mem_realloc(ctx->objects, sizeof(frame_object_t) * ctx->object_cap);
     }
+    ctx->objects[ctx->object_count++] = (frame_object_t) {ctx->stack_offset, size};
+    return ctx->stack_offset;
 }
 
-var_location_t *find_local(codegen_context_t *ctx, char *id) {
-    var_location_t *var = ctx->locals;
-    while (var) {
-        if (strcmp(var->identifier, id) == 0) {
-            return var;
-        }
-        var = var->next;
+static uint32_t name_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while(*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
     }
-    return NULL;
+    return h;
 }
 
-tmp_location_t *find_tmp(codegen_context_t *ctx, int id) {
-    tmp_location_t *temp = ctx->temps;
-    while (temp) {
-        if (temp->temp_id == id) {
-            return temp;
-        }
-        temp = temp->next;
+static void local_rehash(codegen_context_t *ctx) {
+    mem_free(ctx->local_slots);
+    ctx->local_slot_cap = ctx->local_slot_cap ? ctx->local_slot_cap * 2 : 64;
+    ctx->local_slots = mem_calloc(ctx->local_slot_cap, sizeof(uint32_t));
+    for(size_t i = 0; i < ctx->local_count; i++) {
+        size_t slot = name_hash(ctx->locals[i].identifier) & (ctx->local_slot_cap - 1);
+        while(ctx->local_slots[slot]) slot = (slot + 1) & (ctx->local_slot_cap - 1);
+        ctx->local_slots[slot] = i + 1;
     }
+}
 
-    return NULL;
+// hash slot holding `id`, or the empty one where it would go
+static size_t local_slot(codegen_context_t *ctx, const char *id) {
+    size_t slot = name_hash(id) & (ctx->local_slot_cap - 1);
+    while(ctx->local_slots[slot]) {
+        if(strcmp(ctx->locals[ctx->local_slots[slot] - 1].identifier, id) == 0) break;
+        slot = (slot + 1) & (ctx->local_slot_cap - 1);
+    }
+    return slot;
 }
 
-int find_tmp_offset(codegen_context_t *ctx, int id) {
-    tmp_location_t *temp = ctx->temps;
-    while (temp) {
-        if (temp->temp_id == id) {
-            return temp->offset;
-        }
-        temp = temp->next;
+// forget the previous function's slots, O(previous locals) rather than O(table)
+// newest first, so probe chains are still intact when each name is looked up
+static void reset_slots(codegen_context_t *ctx) {
+    for(size_t i = ctx->local_count; i > 0; i--) {
+        ctx->local_slots[local_slot(ctx, ctx->locals[i - 1].identifier)] = 0;
     }
+    ctx->local_count = 0;
 
-    return 0;
+    size_t temp_count = ctx->regs.temp_count;
+    if(temp_count > ctx->temp_cap) {
+        ctx->temp_cap = temp_count;
+        ctx->temps = mem_realloc(ctx->temps, sizeof(tmp_location_t) * ctx->temp_cap);
+    }
+    memset(ctx->temps, 0, sizeof(tmp_location_t) * temp_count);
 }
 
+var_location_t *find_local(codegen_context_t *ctx, char *id) {
+    if(!ctx->local_slot_cap) return NULL;
+    uint32_t index = ctx->local_slots[local_slot(ctx, id)];
+    return index ? &ctx->locals[index - 1] : NULL;
+}
+
+tmp_location_t *find_tmp(codegen_context_t *ctx, int id) {
+    int index = id - ctx->regs.base_temp;
+    if(index < 0 || index >= ctx->regs.temp_count) return NULL;
+    return &ctx->temps[index];
+}
+
+// the pointer is only good until the next alloc_local
 var_location_t *alloc_local(codegen_context_t *ctx, char *id, int size, expr_type_t type) {
-    var_location_t *var = malloc(sizeof(var_location_t));
-    var->size = size;
-    var->identifier = strdup(id);
+    if((ctx->local_count + 1) * 2 > ctx->local_slot_cap) local_rehash(ctx);
+    if(ctx->local_count == ctx->local_cap) {
+        ctx->local_cap = ctx->local_cap ? ctx->local_cap * 2 : 16;
+        ctx->locals = mem_realloc(ctx->locals, sizeof(var_location_t) * ctx->local_cap);
+    }
 
-    int alignment = natural_align(size);
-    ctx->stack_offset = align_down(ctx->stack_offset - size, alignment);
-    var->offset = ctx->stack_offset;
+    var_location_t *var = &ctx->locals[ctx->local_count];
+    var->size = size;
+    var->identifier = id;
 
+    var->offset = new_object(ctx, size);
     var->type = type;
-    var->next = ctx->locals;
-    ctx->locals = var;
 
+    // a redeclaration takes over the name, like it did with the old list
+    ctx->local_slots[local_slot(ctx, id)] = ++ctx->local_count;
     return var;
 }
 
-int alloc_temp(codegen_context_t *ctx, int id, int size) {
-    tmp_location_t *temp = ctx->temps;
-    while (temp) {
-        if (temp->temp_id == id) {
-            return temp->offset;
-        }
-        temp = temp->next;
-    }
+// offset of the temp's stack slot, allocated on first use
+int alloc_temp(codegen_context_t *ctx, tmp_location_t *tmp, int size) {
+    if(tmp->has_slot) return tmp->offset;
 
-    tmp_location_t *tmp = malloc(sizeof(tmp_location_t));
+    tmp->offset = new_object(ctx, size);
     tmp->size = size;
-
-    int alignment = natural_align(size);
-    ctx->stack_offset = align_down(ctx->stack_offset - size, alignment);
-    tmp->offset = ctx->stack_offset;
-    tmp->temp_id = id;
-    tmp->next = ctx->temps;
-    ctx->temps = tmp;
+    tmp->has_slot = 1;
 
     return tmp->offset;
 }
@@ -133,41 +264,38 @@ int alloc_temp(codegen_context_t *ctx, int id, int size) {
 void generate_operand_load(codegen_context_t *ctx, ir_operand_t *op, x64_registers_t reg, int dst_size) {
     switch(op->kind) {
         case IR_OPERAND_CONST: {
-            fprintf(ctx->output, "    mov %s, %ld\n",
-                    get_register(reg, dst_size),
-                    op->constant.int_val); // TODO : support other types :)
+            emit(ctx, X64_MOV, x64_reg(reg, dst_size), x64_imm(op->constant.int_val, dst_size)); // TODO : support other types :)
             break;
         }
 
         case IR_OPERAND_VAR: {
             var_location_t *var = find_local(ctx, op->var_name);
             if (var) {
-                fprintf(ctx->output, "    mov %s, %s [rbp%d]\n",
-                        get_register(reg, dst_size),
-                        get_size_spec(dst_size),
-                        var->offset);
+                emit(ctx, X64_MOV, x64_reg(reg, dst_size), x64_mem(REG_RBP, var->offset, dst_size));
             } else {
-                fprintf(ctx->output, "    # Error: Operand %s not found\n",
-                        op->var_name);
+                emit_comment(ctx, "Error: Operand %s not found", op->var_name);
             }
             break;
         }
 
         case IR_OPERAND_TEMP: {
-            int offset = find_tmp_offset(ctx, op->temp_id);
-            if (offset == 0) {
-                offset = alloc_temp(ctx, op->temp_id, dst_size);
+            live_interval_t *it = regalloc_lookup(&ctx->regs, op->temp_id);
+            if(it && !it->spilled) {
+                if(it->reg != reg) emit(ctx, X64_MOV, x64_reg(reg, dst_size), x64_reg(it->reg, dst_size));
+                break;
+            }
+            tmp_location_t *tmp = find_tmp(ctx, op->temp_id);
+            if(!tmp) {
+                emit_comment(ctx, "Error: Temp not allocated%s", "");
+                break;
             }
-            fprintf(ctx->output, "    mov %s, %s [rbp%d]\n",
-                    get_register(reg, dst_size),
-                    get_size_spec(dst_size),
-                    offset
-                    );
+            int offset = alloc_temp(ctx, tmp, dst_size);
+            emit(ctx, X64_MOV, x64_reg(reg, dst_size), x64_mem(REG_RBP, offset, dst_size));
             break;
         }
 
         default: {
-            fprintf(ctx->output, "    # Unsupported operand kind\n");
+            emit_comment(ctx, "Unsupported operand kind%s", "");
             break;
         }
     }
@@ -179,33 +307,31 @@ void generate_operand_store(codegen_context_t *ctx, ir_operand_t *op) {
         case IR_OPERAND_VAR: {
             var_location_t *var = find_local(ctx, op->var_name);
             if(!var) {
-                fprintf(ctx->output, "    # Error: Operand %s not found\n",
-                        op->var_name);
+                emit_comment(ctx, "Error: Operand %s not found", op->var_name);
             } else {
-                fprintf(ctx->output, "    mov %s [rbp%d], %s\n",
-                        get_size_spec(size),
-                        var->offset,
-                        get_register(REG_RAX, size)
-                        );
+                emit(ctx, X64_MOV, x64_mem(REG_RBP, var->offset, size), x64_reg(REG_RAX, size));
             }
             break;
         }
 
         case IR_OPERAND_TEMP: {
-            int offset = find_tmp_offset(ctx, op->temp_id);
-            if (offset == 0) {
-                offset = alloc_temp(ctx, op->temp_id, size);
+            live_interval_t *it = regalloc_lookup(&ctx->regs, op->temp_id);
+            if(it && !it->spilled) {
+                emit(ctx, X64_MOV, x64_reg(it->reg, size), x64_reg(REG_RAX, size));
+                break;
             }
-            fprintf(ctx->output, "    mov %s [rbp%d], %s\n",
-                    get_size_spec(size),
-                    offset,
-                    get_register(REG_RAX, size)
-                    );
+            tmp_location_t *tmp = find_tmp(ctx, op->temp_id);
+            if(!tmp) {
+                emit_comment(ctx, "Error: Temp not allocated%s", "");
+                break;
+            }
+            int offset = alloc_temp(ctx, tmp, size);
+            emit(ctx, X64_MOV, x64_mem(REG_RBP, offset, size), x64_reg(REG_RAX, size));
             break;
         }
 
         default: {
-            fprintf(ctx->output, "    # Unsupported operand kind\n");
+            emit_comment(ctx, "Unsupported operand kind%s", "");
             break;
         }
     }
@@ -214,44 +340,304 @@ void generate_operand_store(codegen_context_t *ctx, ir_operand_t *op) {
 
 
 
+// register of a temp operand that didn't get spilled
+static int operand_reg(codegen_context_t *ctx, ir_operand_t *op, x64_registers_t *reg) {
+    if(op->kind != IR_OPERAND_TEMP) return 0;
+    live_interval_t *it = regalloc_lookup(&ctx->regs, op->temp_id);
+    if(!it || it->spilled) return 0;
+    *reg = it->reg;
+    return 1;
+}
+
+// register or frame slot an operand already lives in, nothing is emitted
+static int operand_rm(codegen_context_t *ctx, ir_operand_t *op, int size, x64_operand_t *out) {
+    x64_registers_t reg;
+    if(operand_reg(ctx, op, &reg)) {
+        *out = x64_reg(reg, size);
+        return 1;
+    }
+    if(op->kind == IR_OPERAND_VAR) {
+        var_location_t *var = find_local(ctx, op->var_name);
+        if(!var) return 0;
+        *out = x64_mem(REG_RBP, var->offset, size);
+        return 1;
+    }
+    if(op->kind == IR_OPERAND_TEMP) {
+        tmp_location_t *tmp = find_tmp(ctx, op->temp_id);
+        if(!tmp) return 0;
+        *out = x64_mem(REG_RBP, alloc_temp(ctx, tmp, size), size);
+        return 1;
+    }
+    return 0;
+}
+
+static inline int is_const(ir_operand_t *op) {
+    return op && op->kind == IR_OPERAND_CONST;
+}
+
+static inline int is_temp(ir_operand_t *op, ir_operand_t *temp) {
+    return op && temp && op->kind == IR_OPERAND_TEMP && op->temp_id == temp->temp_id;
+}
+
+static inline int fits_i32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Instruction selection for + - *.
+// Expression temps are used exactly once, and a temp that is the last operand
+// evaluated is used by the very next instruction. So when that instruction
+// can fold it (x*4 into `y + x*4`, y+z into `y + z + 8`) nothing is emitted
+// for it at all, the consumer does it with a single lea. Between the two no
+// other temp gets defined, so the registers the folded operands live in are
+// still intact.
+
+static int addr_add(isel_addr_t *addr, ir_operand_t *op, int scale) {
+    if(scale == 1 && !addr->base) {
+        addr->base = op;
+        return 1;
+    }
+    if(!addr->index) {
+        addr->index = op;
+        addr->scale = scale;
+        return 1;
+    }
+    return 0;
+}
+
+// adds a constant, the folded temp or a plain operand to the address
+static int addr_term(codegen_context_t *ctx, isel_addr_t *addr, ir_operand_t *op) {
+    if(is_const(op)) {
+        addr->disp += op->constant.int_val;
+        return 1;
+    }
+    if(is_temp(op, ctx->folded_dst)) {
+        isel_addr_t *folded = &ctx->folded;
+        addr->disp += folded->disp;
+        return (!folded->base || addr_add(addr, folded->base, 1))
+            && (!folded->index || addr_add(addr, folded->index, folded->scale));
+    }
+    return addr_add(addr, op, 1);
+}
+
+// address computed by an add or sub, 0 if it doesn't fit a lea
+static int build_addr(codegen_context_t *ctx, ir_instruction_t *inst, isel_addr_t *addr) {
+    *addr = (isel_addr_t) {0};
+    if(inst->opcode == IR_MINUS) {
+        if(!is_const(inst->src2) || !addr_term(ctx, addr, inst->src1)) return 0;
+        addr->disp -= inst->src2->constant.int_val;
+    }
+    else if(!addr_term(ctx, addr, inst->src1) || !addr_term(ctx, addr, inst->src2)) {
+        return 0;
+    }
+
+    if(!addr->base && addr->index && addr->scale <= 2) {
+        // [x*2] is [x + x]
+        addr->base = addr->index;
+        addr->index = addr->scale == 2 ? addr->base : NULL;
+        addr->scale = addr->index ? 1 : 0;
+    }
+    return addr->base && fits_i32(addr->disp);
+}
+
+// whether the next instruction is `dst + c` or `dst - c`
+static int next_adds_const(codegen_context_t *ctx, ir_operand_t *dst) {
+    ir_instruction_t *next = ctx->next_ir;
+    if(!next) return 0;
+    if(next->opcode == IR_ADD) {
+        return (is_temp(next->src1, dst) && is_const(next->src2))
+            || (is_temp(next->src2, dst) && is_const(next->src1));
+    }
+    return next->opcode == IR_MINUS && is_temp(next->src1, dst) && is_const(next->src2);
+}
+
+// whether the next instruction is `dst + y` with y not a constant
+static int next_adds_operand(codegen_context_t *ctx, ir_operand_t *dst) {
+    ir_instruction_t *next = ctx->next_ir;
+    if(!next || next->opcode != IR_ADD) return 0;
+    if(is_temp(next->src1, dst)) return !is_const(next->src2);
+    if(is_temp(next->src2, dst)) return !is_const(next->src1);
+    return 0;
+}
+
+static void fold_into_next(codegen_context_t *ctx, ir_instruction_t *inst, isel_addr_t *addr) {
+    ctx->folded_dst = inst->dst;
+    ctx->folded = *addr;
+}
+
+static void generate_lea(codegen_context_t *ctx, ir_operand_t *dst_op, isel_addr_t *addr) {
+    int size = get_type_size(dst_op->type);
+    // there is no 8 bit lea, the low byte of the 32 bit one is the same
+    int lea_size = size == 8 ? 8 : 4;
+
+    x64_registers_t base = REG_RAX;
+    if(!operand_reg(ctx, addr->base, &base)) generate_operand_load(ctx, addr->base, REG_RAX, size);
+
+    x64_registers_t index = REG_RCX;
+    if(addr->index == addr->base) index = base;
+    else if(addr->index && !operand_reg(ctx, addr->index, &index)) {
+        generate_operand_load(ctx, addr->index, REG_RCX, size);
+    }
+
+    x64_registers_t dst = REG_RAX;
+    int in_reg = operand_reg(ctx, dst_op, &dst);
+    emit(ctx, X64_LEA, x64_reg(dst, lea_size),
+         x64_addr(base, index, addr->index ? addr->scale : 0, (int32_t) addr->disp, lea_size));
+
+    if(!in_reg) generate_operand_store(ctx, dst_op);
+}
+
+// a temp folded into this instruction that it can't use after all gets computed on its own
+static void flush_folded(codegen_context_t *ctx) {
+    if(!ctx->folded_dst) return;
+    ir_operand_t *dst = ctx->folded_dst;
+    ctx->folded_dst = NULL;
+    generate_lea(ctx, dst, &ctx->folded);
+}
+
+static void generate_binary_op(codegen_context_t *ctx, ir_instruction_t *instruction, x64_opcode_t op) {
+    int size = get_type_size(instruction->dst->type);
+    ir_operand_t *lhs = instruction->src1;
+    ir_operand_t *rhs = instruction->src2;
+
+    // x64 only takes the constant as the last operand
+    if(op != X64_SUB && is_const(lhs) && !is_const(rhs)) {
+        lhs = instruction->src2;
+        rhs = instruction->src1;
+    }
+
+    // dst, src1 and src2 never share a register, compute straight into dst
+    x64_registers_t dst = REG_RAX;
+    int in_reg = operand_reg(ctx, instruction->dst, &dst);
+    x64_operand_t src;
+
+    if(is_const(rhs) && fits_i32(rhs->constant.int_val)) {
+        x64_operand_t imm = x64_imm(rhs->constant.int_val, size);
+        x64_registers_t reg;
+
+        if(op == X64_IMUL && operand_rm(ctx, lhs, size, &src) && (src.kind == X64_REG || size > 1)) {
+            size_t imul = emit_index(ctx, X64_IMUL, x64_reg(dst, size), src);
+            ctx->insts[imul].src2 = imm;
+        }
+        else if(op != X64_IMUL && operand_reg(ctx, lhs, &reg) && fits_i32(-rhs->constant.int_val)) {
+            // mov + add becomes one lea when lhs already sits in another register
+            int64_t disp = op == X64_SUB ? -rhs->constant.int_val : rhs->constant.int_val;
+            int lea_size = size == 8 ? 8 : 4;
+            emit(ctx, X64_LEA, x64_reg(dst, lea_size), x64_mem(reg, (int32_t) disp, lea_size));
+        }
+        else {
+            generate_operand_load(ctx, lhs, dst, size);
+            emit(ctx, op, x64_reg(dst, size), imm);
+        }
+    }
+    else {
+        generate_operand_load(ctx, lhs, dst, size);
+        // the 8 bit multiply is done in 32 bits, which can't read a byte from memory
+        if(!operand_rm(ctx, rhs, size, &src) || (op == X64_IMUL && size == 1 && src.kind == X64_MEM)) {
+            generate_operand_load(ctx, rhs, REG_RCX, size);
+            src = x64_reg(REG_RCX, size);
+        }
+        emit(ctx, op, x64_reg(dst, size), src);
+    }
+
+    if(!in_reg) generate_operand_store(ctx, instruction->dst);
+}
+
+static void generate_add(codegen_context_t *ctx, ir_instruction_t *instruction) {
+    isel_addr_t addr;
+    int folds = build_addr(ctx, instruction, &addr);
+    int folded = ctx->folded_dst != NULL;
+
+    if(!folds) {
+        flush_folded(ctx);
+        generate_binary_op(ctx, instruction, instruction->opcode == IR_MINUS ? X64_SUB : X64_ADD);
+        return;
+    }
+    ctx->folded_dst = NULL;
+
+    if(next_adds_const(ctx, instruction->dst) && (addr.index || folded)) {
+        fold_into_next(ctx, instruction, &addr);
+        return;
+    }
+
+    // a + b with one of them in memory is just as short as mov + add [m]
+    x64_registers_t reg;
+    int in_regs = operand_reg(ctx, addr.base, &reg) && (!addr.index || operand_reg(ctx, addr.index, &reg));
+    if(folded || (addr.index && (addr.disp || in_regs))) {
+        generate_lea(ctx, instruction->dst, &addr);
+        return;
+    }
+    generate_binary_op(ctx, instruction, instruction->opcode == IR_MINUS ? X64_SUB : X64_ADD);
+}
+
+static void generate_mult(codegen_context_t *ctx, ir_instruction_t *instruction) {
+    flush_folded(ctx);
+
+    ir_operand_t *x = instruction->src1;
+    ir_operand_t *k = instruction->src2;
+    if(is_const(x)) {
+        x = instruction->src2;
+        k = instruction->src1;
+    }
+
+    if(is_const(k) && !is_const(x)) {
+        int64_t value = k->constant.int_val;
+        isel_addr_t addr = {0};
+
+        // x*{1,2,4,8} + y is one lea, x*{3,5,9} is [x + x*{2,4,8}]
+        if((value == 1 || value == 2 || value == 4 || value == 8) && next_adds_operand(ctx, instruction->dst)) {
+            addr.index = x;
+            addr.scale = (int) value;
+            fold_into_next(ctx, instruction, &addr);
+            return;
+        }
+        if(value == 2 || value == 3 || value == 5 || value == 9) {
+            addr.base = x;
+            addr.index = x;
+            addr.scale = value == 2 ? 1 : (int) value - 1;
+            if(next_adds_const(ctx, instruction->dst)) fold_into_next(ctx, instruction, &addr);
+            else generate_lea(ctx, instruction->dst, &addr);
+            return;
+        }
+    }
+
+    generate_binary_op(ctx, instruction, X64_IMUL);
+}
+
+// preserved registers picked by the allocator live in frame slots meanwhile
+static void restore_callee_saved(codegen_context_t *ctx) {
+    for(size_t i = 0; i < callee_saved_count; i++) {
+        x64_registers_t reg = callee_saved_regs[i];
+        if(!(ctx->regs.used_callee_saved & (1u << reg))) continue;
+        emit(ctx, X64_MOV, x64_reg(reg, 8), x64_mem(REG_RBP, ctx->saved_offsets[reg], 8));
+    }
+}
+
 void generate_instruction(ir_instruction_t *instruction, codegen_context_t *ctx) {
+    // there are no branches, so the rest of the body after a return is dead
+    if(ctx->returned && instruction->opcode != IR_FUNC_START && instruction->opcode != IR_FUNC_END) return;
+
     switch (instruction->opcode) {
         case IR_ADD: {
-            if(debug) fprintf(ctx->output, "\n    ; IR_ADD\n");
-            int size = get_type_size(instruction->dst->type);
-            generate_operand_load(ctx, instruction->src1, REG_RAX, size);
-            generate_operand_load(ctx, instruction->src2, REG_RCX, size);
-            fprintf(ctx->output, "    add %s, %s\n", get_register(REG_RAX, size), get_register(REG_RCX, size));
-
-            generate_operand_store(ctx, instruction->dst);
+            if(debug) emit_comment(ctx, "%s", "IR_ADD");
+            generate_add(ctx, instruction);
             break;
         }
 
         case IR_MULT: {
-            if(debug) fprintf(ctx->output, "\n    ; IR_MULT\n");
-            int size = get_type_size(instruction->dst->type);
-            generate_operand_load(ctx, instruction->src1, REG_RAX, size);
-            generate_operand_load(ctx, instruction->src2, REG_RCX, size);
+            if(debug) emit_comment(ctx, "%s", "IR_MULT");
             // TODO: This is signed mul, support unsigned etc.
-            fprintf(ctx->output, "    imul %s, %s\n", get_register(REG_RAX, size), get_register(REG_RCX, size));
-
-            generate_operand_store(ctx, instruction->dst);
+            generate_mult(ctx, instruction);
             break;
         }
 
         case IR_MINUS: {
-            if(debug) fprintf(ctx->output, "\n    ; IR_MINUS\n");
-            int size = get_type_size(instruction->dst->type);
-            generate_operand_load(ctx, instruction->src1, REG_RAX, size);
-            generate_operand_load(ctx, instruction->src2, REG_RCX, size);
-            fprintf(ctx->output, "    sub %s, %s\n", get_register(REG_RAX, size), get_register(REG_RCX, size));
-
-            generate_operand_store(ctx, instruction->dst);
+            if(debug) emit_comment(ctx, "%s", "IR_MINUS");
+            generate_add(ctx, instruction);
             break;
         }
 
         case IR_ALLOC: {
-            if(debug) fprintf(ctx->output, "\n    ; IR_ALLOC\n");
+            if(debug) emit_comment(ctx, "%s", "IR_ALLOC");
             expr_type_t type = instruction->dst->type;
             int size = get_type_size(type);
             alloc_local(ctx, instruction->dst->var_name, size, type);
@@ -259,46 +645,77 @@ void generate_instruction(ir_instruction_t *instruction, codegen_context_t *ctx)
         }
 
         case IR_STORE: {
-            if(debug) fprintf(ctx->output, "\n    ; IR_STORE\n");
+            if(debug) emit_comment(ctx, "%s", "IR_STORE");
             generate_operand_load(ctx, instruction->src1, REG_RAX, get_type_size(instruction->dst->type));
             generate_operand_store(ctx, instruction->dst);
             break;
         }
 
         case IR_CALL: {
-            if(debug) fprintf(ctx->output, "\n    ; IR_CALL\n");
-            for(size_t i = 0; i < instruction->call.arg_count && i < 6; i++) {
+            if(debug) emit_comment(ctx, "%s", "IR_CALL");
+            for(size_t i = 0; i < instruction->call.arg_count && i < MAX_REG_ARGS; i++) {
                 int size = get_type_size(instruction->call.args[i]->type);
                 x64_registers_t call_regs[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
                 generate_operand_load(ctx, instruction->call.args[i], call_regs[i], size);
             }
-            fprintf(ctx->output, "    call %s\n", instruction->src1->func_name);
+
+            if(ctx->options->profile_generate) {
+                size_t counter = profile_add_call(&ctx->counters, instruction->src1->func_name);
+                emit(ctx, X64_INC, x64_rip(PROFILE_LABEL, ctx->counter_base + (int32_t) counter, 8), none);
+            }
+
+            // tail call: tear down our frame and let the callee return to our caller
+            // _start has no caller to return to, and stack args would live in our frame
+            if(regalloc_tail_jump(instruction, ctx->current_function)) {
+                ctx->part = X64_EPILOGUE;
+                restore_callee_saved(ctx);
+                emit(ctx, X64_LEAVE, none, none);
+                ctx->part = X64_BODY;
+                emit(ctx, X64_JMP, x64_sym(instruction->src1->func_name), none);
+                ctx->returned = ctx->tail_jumped = 1;
+                break;
+            }
+
+            emit(ctx, X64_CALL, x64_sym(instruction->src1->func_name), none);
             generate_operand_store(ctx, instruction->dst);
             break;
         }
 
         case IR_FUNC_START: {
-            if(debug) fprintf(ctx->output, "\n; FUNC_START\n");
+            if(debug) emit_comment(ctx, "%s", "FUNC_START");
             ctx->current_function = instruction->func.func_name;
+            ctx->returned = ctx->tail_jumped = 0;
             ctx->stack_offset = 0;
+            reset_slots(ctx);
             ctx->max_offset = align_up(instruction->func.stack_size, 16); // ik rsp has to be aligned to 16 by callee but this? idk
 
-            fprintf(ctx->output, "\nglobal %s\n", instruction->func.func_name);
-            fprintf(ctx->output, "%s:\n", instruction->func.func_name);
+            mem_free(ctx->end_label);
+            size_t label_len = strlen(ctx->current_function) + 6;
+            ctx->end_label = mem_alloc(label_len);
+            snprintf(ctx->end_label, label_len, ".%s_end", ctx->current_function);
 
-            // TODO: when needed
-            fprintf(ctx->output, "    push rbp\n");
-            fprintf(ctx->output, "    mov rbp, rsp\n");
+            emit(ctx, X64_FUNC, x64_sym(instruction->func.func_name), instruction->func.is_static ? x64_imm(1, 1) : none);
 
-            // TODO: when needed
-            // if(instruction->func.stack_size > 0) {
-            // TODO: make this correctly >:(
-            size_t tmp = 0;
-            for(size_t i = 0; i < instruction->func.param_count && i < 6; i++) {
-                tmp += get_type_size(instruction->func.params[i]->type);
+            // frame_lower drops or shrinks whatever the body turns out not to need
+            ctx->part = X64_PROLOGUE;
+            emit(ctx, X64_PUSH, x64_reg(REG_RBP, 8), none);
+            emit(ctx, X64_MOV, x64_reg(REG_RBP, 8), x64_reg(REG_RSP, 8));
+
+            // the size is filled in once the slots are colored
+            emit(ctx, X64_SUB, x64_reg(REG_RSP, 8), x64_imm(0, 8));
+
+            for(size_t i = 0; i < callee_saved_count; i++) {
+                x64_registers_t reg = callee_saved_regs[i];
+                if(!(ctx->regs.used_callee_saved & (1u << reg))) continue;
+                ctx->saved_offsets[reg] = new_object(ctx, WORD_SIZE);
+                emit(ctx, X64_MOV, x64_mem(REG_RBP, ctx->saved_offsets[reg], 8), x64_reg(reg, 8));
+            }
+            ctx->part = X64_BODY;
+
+            if(ctx->options->profile_generate) {
+                size_t counter = profile_add_function(&ctx->counters, instruction->func.func_name);
+                emit(ctx, X64_INC, x64_rip(PROFILE_LABEL, ctx->counter_base + (int32_t) counter, 8), none);
             }
-            fprintf(ctx->output, "    sub rsp, %d\n", align_up(instruction->func.stack_size+tmp, 16));
-            // }
 
             // TODO: Only when needed :)
             for(size_t i = 0; i < instruction->func.param_count && i < 6; i++) {
@@ -310,55 +727,245 @@ void generate_instruction(ir_instruction_t *instruction, codegen_context_t *ctx)
 
                 x64_registers_t call_regs[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
 
-                fprintf(ctx->output, "    mov %s [rbp%d], %s\n",
-                        get_size_spec(size),
-                        var->offset,
-                        get_register(call_regs[i], size));
+                emit(ctx, X64_MOV, x64_mem(REG_RBP, var->offset, size), x64_reg(call_regs[i], size));
             }
 
             break;
         }
 
         case IR_FUNC_END: {
-            if(debug) fprintf(ctx->output, "\n; FUNC_END\n");
-            fprintf(ctx->output, ".%s_end:\n", ctx->current_function);
-            fprintf(ctx->output, "    leave\n"); // TODO: only when needed
+            if(debug) emit_comment(ctx, "%s", "FUNC_END");
+            // the tail call's own epilogue is the only one the function needs
+            if(ctx->tail_jumped) {
+                flush_function(ctx);
+                break;
+            }
+            emit(ctx, X64_LABEL, x64_sym(ctx->end_label), none);
+            ctx->part = X64_EPILOGUE;
+            restore_callee_saved(ctx);
+            emit(ctx, X64_LEAVE, none, none);
+            ctx->part = X64_BODY;
             if(strcmp(ctx->current_function, "_start") == 0) {
-                fprintf(ctx->output, "    mov rdi, rax\n");
-                fprintf(ctx->output, "    mov rax, 60\n");
-                fprintf(ctx->output, "    syscall\n");
+                emit(ctx, X64_MOV, x64_reg(REG_RDI, 8), x64_reg(REG_RAX, 8));
+                emit(ctx, X64_MOV, x64_reg(REG_RAX, 8), x64_imm(60, 8));
+                emit(ctx, X64_SYSCALL, none, none);
             }
             else {
-                fprintf(ctx->output, "    ret\n");
+                emit(ctx, X64_RET, none, none);
             }
+
+            flush_function(ctx);
             break;
         }
 
         // TODO: get function return size, not the src size
         case IR_RETURN: {
-            if(debug) fprintf(ctx->output, "\n    ; IR_RETURN\n");
+            if(debug) emit_comment(ctx, "%s", "IR_RETURN");
             generate_operand_load(ctx, instruction->src1, REG_RAX, get_type_size(INT32)); // TODO : get function type
-            fprintf(ctx->output, "    jmp .%s_end\n", ctx->current_function);
+            emit(ctx, X64_JMP, x64_sym(ctx->end_label), none);
+            ctx->returned = 1;
             break;
         }
 
-        default:
-            fprintf(ctx->output, "    # Unknown opcode: %d\n", instruction->opcode);
+        default: {
+            char opcode[16];
+            snprintf(opcode, sizeof(opcode), "%d", instruction->opcode);
+            emit_comment(ctx, "Unknown opcode: %s", opcode);
             break;
+        }
+    }
+}
+
+// Exit hook of an instrumented program, runs from .fini_array and writes the
+// counter image to the profile file with raw syscalls, nothing to link against.
+// It goes before the functions so it doesn't end up in the last one's size.
+static void generate_profile_hook(codegen_context_t *ctx) {
+    const char *path = ctx->options->profile_generate;
+    ctx->counter_base = align_up((int) strlen(path) + 1, 8);
+
+    emit(ctx, X64_LABEL, x64_sym(PROFILE_HOOK), none);
+    emit(ctx, X64_MOV, x64_reg(REG_RAX, 4), x64_imm(2, 4)); // open
+    emit(ctx, X64_LEA, x64_reg(REG_RDI, 8), x64_rip(PROFILE_LABEL, 0, 8));
+    emit(ctx, X64_MOV, x64_reg(REG_RSI, 4), x64_imm(01101, 4)); // O_WRONLY | O_CREAT | O_TRUNC
+    emit(ctx, X64_MOV, x64_reg(REG_RDX, 4), x64_imm(0644, 4));
+    emit(ctx, X64_SYSCALL, none, none);
+    // a failed open leaves a negative fd, write and close just fail too
+    emit(ctx, X64_MOV, x64_reg(REG_RDI, 4), x64_reg(REG_RAX, 4));
+    emit(ctx, X64_MOV, x64_reg(REG_RAX, 4), x64_imm(1, 4)); // write
+    emit(ctx, X64_LEA, x64_reg(REG_RSI, 8), x64_rip(PROFILE_LABEL, ctx->counter_base, 8));
+    emit(ctx, X64_MOV, x64_reg(REG_RDX, 4),
+         x64_rip(PROFILE_LABEL, ctx->counter_base + (int32_t) offsetof(profile_header_t, size), 4));
+    emit(ctx, X64_SYSCALL, none, none);
+    emit(ctx, X64_MOV, x64_reg(REG_RAX, 4), x64_imm(3, 4)); // close
+    emit(ctx, X64_SYSCALL, none, none);
+    emit(ctx, X64_RET, none, none);
+
+    for(size_t i = 0; i < ctx->inst_count; i++) {
+        if(ctx->code) x64_encode(ctx->code, &ctx->insts[i]);
+        else x64_print(ctx->output, &ctx->insts[i]);
     }
+    ctx->inst_count = 0;
+}
+
+// the file name, then the counter image at counter_base
+static uint8_t *profile_data(codegen_context_t *ctx, size_t *len) {
+    size_t image_len;
+    uint8_t *image = profile_image(&ctx->counters, &image_len);
+    *len = (size_t) ctx->counter_base + image_len;
+    uint8_t *data = mem_calloc(1, *len);
+    memcpy(data, ctx->options->profile_generate, strlen(ctx->options->profile_generate));
+    memcpy(data + ctx->counter_base, image, image_len);
+    mem_free(image);
+    return data;
 }
 
-void generate_x64_code(ir_instruction_list_t *inst, FILE *f) {
-    codegen_context_t ctx = {0};
-    ctx.output = f;
+static void generate_function(ir_instruction_list_t *start, codegen_context_t *ctx) {
+    phase_t outer = report_enter(PHASE_REGALLOC);
+    regalloc_function(start, &ctx->regs, ctx->options->no_regalloc);
+    report_leave(outer);
 
-    ir_instruction_list_t *current = inst;
-    while(current != NULL) {
-        if(current->instruction != NULL) {
-            generate_instruction(current->instruction, &ctx);
+    for(ir_instruction_list_t *current = start; current != NULL; current = current->next) {
+        if(current->instruction == NULL) continue;
+        ir_instruction_list_t *next = current->next;
+        while(next && !next->instruction) next = next->next;
+        ctx->next_ir = next ? next->instruction : NULL;
+        ctx->pos = current->instruction->pos;
+
+        generate_instruction(current->instruction, ctx);
+        if(current->instruction->opcode == IR_FUNC_END) break;
+    }
+}
+
+void codegen_begin(codegen_context_t *ctx, asm_writer_t *out, x64_code_t *code, codegen_options_t *options) {
+    *ctx = (codegen_context_t) {0};
+    ctx->output = out;
+    ctx->code = code;
+    ctx->options = options ? options : &ctx->defaults;
+    if(code) code->debug_lines = ctx->options->debug_info;
+
+    if(ctx->options->profile_generate) {
+        phase_t outer = report_enter(PHASE_ISEL);
+        generate_profile_hook(ctx);
+        report_leave(outer);
+    }
+}
+
+void codegen_functions(codegen_context_t *ctx, ir_instruction_list_t *inst) {
+    phase_t outer = report_enter(PHASE_ISEL);
+    for(ir_instruction_list_t *current = inst; current != NULL; current = current->next) {
+        if(current->instruction && current->instruction->opcode == IR_FUNC_START) generate_function(current, ctx);
+    }
+    report_leave(outer);
+}
+
+void codegen_end(codegen_context_t *ctx) {
+    phase_t outer = report_enter(PHASE_ISEL);
+    flush_function(ctx);
+
+    mem_free(ctx->insts);
+    mem_free(ctx->objects);
+    mem_free(ctx->end_label);
+    regalloc_free(&ctx->regs);
+    mem_free(ctx->locals);
+    mem_free(ctx->local_slots);
+    mem_free(ctx->temps);
+    report_leave(outer);
+
+    if(ctx->output) {
+        asm_writer_t *out = ctx->output;
+        asm_putc(out, '\n');
+        eh_frame_print(out, ctx->eh, ctx->eh_count);
+    }
+    for(size_t i = 0; i < ctx->eh_count; i++) {
+        mem_free((char *) ctx->eh[i].name);
+        mem_free(ctx->eh[i].rules);
+    }
+    mem_free(ctx->eh);
+
+    if(!ctx->options->profile_generate) return;
+    size_t len;
+    uint8_t *data = profile_data(ctx, &len);
+    profile_counters_free(&ctx->counters);
+    if(ctx->code) {
+        ctx->code->rw = data;
+        ctx->code->rw_len = len;
+        ctx->code->fini = PROFILE_HOOK;
+        return;
+    }
+
+    asm_writer_t *out = ctx->output;
+    asm_puts(out, "\nsection .data progbits alloc noexec write align=8\n" PROFILE_LABEL ":\n");
+    for(size_t i = 0; i < len; i += 16) {
+        asm_puts(out, "    db ");
+        for(size_t j = i; j < len && j < i + 16; j++) {
+            if(j > i) asm_puts(out, ", ");
+            asm_write_int(out, data[j]);
+        }
+        asm_putc(out, '\n');
+    }
+    asm_puts(out, "\nsection .fini_array progbits alloc noexec write align=8\n    dq " PROFILE_HOOK "\n");
+    mem_free(data);
+}
+
+// the functions a profile saw never run go into .text.unlikely, out of the
+// way of the ones that did
+static void start_cold(codegen_context_t *ctx) {
+    flush_function(ctx);
+    if(ctx->code) ctx->code->cold = ctx->code->len;
+    else asm_puts(ctx->output, "\nsection .text.unlikely progbits alloc exec nowrite align=16\n");
+}
+
+// the whole file's functions, laid out by the profile if there is one
+static void generate(ir_instruction_list_t *inst, codegen_context_t *ctx) {
+    phase_t outer = report_enter(PHASE_ISEL);
+
+    ir_instruction_list_t **functions = NULL;
+    const char **names = NULL;
+    size_t function_count = 0, function_cap = 0;
+    for(ir_instruction_list_t *current = inst; current != NULL; current = current->next) {
+        if(current->instruction == NULL || current->instruction->opcode != IR_FUNC_START) continue;
+        if(function_count == function_cap) {
+            function_cap = function_cap ? function_cap * 2 : 16;
+            functions = mem_realloc(functions, sizeof(ir_instruction_list_t *) * function_cap);
+            names = mem_realloc(names, sizeof(const char *) * function_cap);
+        }
+        names[function_count] = current->instruction->func.func_name;
+        functions[function_count++] = current;
+    }
+
+    // source order unless a profile says otherwise
+    size_t *order = mem_alloc(sizeof(size_t) * (function_count + 1));
+    for(size_t i = 0; i < function_count; i++) order[i] = i;
+    if(ctx->options->profile) profile_order(ctx->options->profile, names, function_count, order);
+
+    // never run comes last in that order
+    int cold = 0;
+    for(size_t i = 0; i < function_count; i++) {
+        uint64_t count;
+        if(!cold && ctx->options->profile && profile_entry_count(ctx->options->profile, names[order[i]], &count)
+           && count == 0) {
+            start_cold(ctx);
+            cold = 1;
         }
-        current = current->next;
+        generate_function(functions[order[i]], ctx);
     }
 
-    fprintf(f, "\n");
+    mem_free(order);
+    mem_free(names);
+    mem_free(functions);
+    report_leave(outer);
+}
+
+void generate_x64_code(ir_instruction_list_t *inst, asm_writer_t *out, codegen_options_t *options) {
+    codegen_context_t ctx;
+    codegen_begin(&ctx, out, NULL, options);
+    generate(inst, &ctx);
+    codegen_end(&ctx);
+}
+
+void generate_x64_binary(ir_instruction_list_t *inst, x64_code_t *code, codegen_options_t *options) {
+    codegen_context_t ctx;
+    codegen_begin(&ctx, NULL, code, options);
+    generate(inst, &ctx);
+    codegen_end(&ctx);
 }
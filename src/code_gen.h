@@ -2,49 +2,116 @@
 #define _CODE_GEN_H
 
 #include <stdio.h>
+#include "asm_writer.h"
+#include "eh_frame.h"
+#include "frame.h"
+#include "ir.h"
 #include "parser.h"
+#include "peephole.h"
+#include "profile.h"
+#include "regalloc.h"
+#include "stack_slots.h"
+#include "x64.h"
 
 #define WORD_SIZE 8
 #define STACK_ALIGNMENT 16
-
-typedef enum {
-    REG_RAX, // return value, arithmetic
-    REG_RBX, // preserved
-    REG_RCX, // arg 4
-    REG_RDX, // arg 3
-    REG_RSI, // arg 2
-    REG_RDI, // arg 1
-    REG_RSP, // stack pointer
-    REG_RBP, // base pointer (stack frame)
-    REG_R8,  // arg 5
-    REG_R9,  // arg 6
-    REG_10,  // temp
-    REG_11,  // temp
-} x64_registers_t;
+#define MAX_REG_ARGS 6
 
 typedef struct var_location {
     int offset; // RBP
     expr_type_t type;
     int size;
     char *identifier;
-    struct var_location *next;
 } var_location_t;
 
 typedef struct tmp_location {
-    int offset; // RBP
+    int offset; // RBP, only valid with has_slot
     int size;
-    int temp_id;
-    struct tmp_location *next;
+    int has_slot;
 } tmp_location_t;
 
+// base + index*scale + disp over IR operands, what a lea can compute at once
+typedef struct isel_addr {
+    ir_operand_t *base;  // NULL if none
+    ir_operand_t *index; // NULL if none
+    int scale;
+    int64_t disp;
+} isel_addr_t;
+
+typedef struct codegen_options {
+    int no_peephole;
+    int no_regalloc; // every temp in a stack slot
+    int no_stack_reuse; // -fstack-reuse=none, objects never share a slot
+    int debug_info; // -g, line tables for the source
+    int keep_static_functions; // -fkeep-static-functions, even the ones nothing calls
+    const char *source_name;
+    const char *profile_generate; // -fprofile-generate, file the counters go to, NULL if off
+    profile_t *profile;           // -fprofile-use, orders the functions in .text
+    frame_options_t frame;
+    peephole_stats_t peephole_stats;
+} codegen_options_t;
+
 typedef struct codegen_context {
-    tmp_location_t *temps;
-    var_location_t *locals;
-    var_location_t *params;
+    // slot tables of the current function, reset at IR_FUNC_START
+    var_location_t *locals;   // in declaration order
+    size_t local_count;
+    size_t local_cap;
+    uint32_t *local_slots;    // open addressing on the name, index + 1, 0 = empty
+    size_t local_slot_cap;
+    tmp_location_t *temps;    // indexed by temp_id - regs.base_temp
+    size_t temp_cap;
+
     int stack_offset;
     int max_offset;
     char *current_function;
-    FILE *output;
+    char *end_label;
+    int returned;    // the body returned, nothing after it can run
+    int tail_jumped; // by a tail call, which is the function's epilogue
+    asm_writer_t *output;
+    x64_code_t *code; // encode machine code instead of printing NASM
+    codegen_options_t *options;
+
+    regalloc_t regs;          // temp -> register, rebuilt at IR_FUNC_START
+    frame_object_t *objects;  // every slot handed out, colored when the function is flushed
+    size_t object_count;
+    size_t object_cap;
+    int saved_offsets[16];    // frame slot of each preserved register we use
+    x64_frame_part_t part;    // what emit() marks new instructions as
+
+    // instruction selection
+    ir_instruction_t *next_ir; // the one after the instruction being generated
+    pos_t pos;                 // of the instruction being generated, stamped on everything emit() adds
+    ir_operand_t *folded_dst;  // temp left for the next instruction to fold, NULL if none
+    isel_addr_t folded;        // the address it stands for
+
+    profile_counters_t counters; // -fprofile-generate
+    int32_t counter_base;        // of the counter image in the profile data
+
+    // unwind tables for the NASM output, one entry per function
+    eh_function_t *eh;
+    size_t eh_count;
+    size_t eh_cap;
+    size_t rule_cap;          // of the last entry's rules
+    size_t cfi_label;         // last ..@cfiN used
+
+    // current function, flushed to output/code at IR_FUNC_END
+    x64_inst_t *insts;
+    size_t inst_count;
+    size_t inst_cap;
+
+    codegen_options_t defaults; // when the caller passes no options
 } codegen_context_t;
 
+void generate_x64_code(ir_instruction_list_t *inst, asm_writer_t *out, codegen_options_t *options);
+void generate_x64_binary(ir_instruction_list_t *inst, x64_code_t *code, codegen_options_t *options);
+
+// Function at a time, for the pipelined driver: codegen_begin writes NASM to
+// `out` or encodes into `code`, codegen_functions takes the IR as it comes and
+// codegen_end adds what follows the last function. Nothing of the IR is kept
+// once codegen_functions returns. Functions stay in the order they come in,
+// so -fprofile-use needs generate_x64_*.
+void codegen_begin(codegen_context_t *ctx, asm_writer_t *out, x64_code_t *code, codegen_options_t *options);
+void codegen_functions(codegen_context_t *ctx, ir_instruction_list_t *inst);
+void codegen_end(codegen_context_t *ctx);
+
 #endif
@@ -147,6 +147,11 @@ void print_ast_statement(ast_statement_t *stmt, int depth) {
             for (int i = 0; i < depth + 1; i++) printf("  ");
             printf("+- RETURN TYPE: %s\n", expr_type_to_string(stmt->statement.function.type));
 
+            if (stmt->statement.function.is_static) {
+                for (int i = 0; i < depth + 1; i++) printf("  ");
+                printf("+- STATIC\n");
+            }
+
             for (int i = 0; i < depth + 1; i++) printf("  ");
             printf("+- IDENTIFIER: %s\n", stmt->statement.function.identifier ? stmt->statement.function.identifier : "(null)");
 
@@ -173,6 +178,10 @@ void print_ast_statement(ast_statement_t *stmt, int depth) {
             }
             break;
 
+        case AST_IMPORT:
+            printf("IMPORT: %s\n", stmt->statement.import.module);
+            break;
+
         default:
             printf("UNKNOWN_STATEMENT_TYPE: %d\n", stmt->type);
             break;
@@ -280,7 +289,7 @@ void print_ir_instruction(ir_instruction_t *inst) {
             print_operand(inst->src1);
             break;
         case IR_FUNC_START:
-            printf("function %s(", inst->func.func_name);
+            printf("%sfunction %s(", inst->func.is_static ? "static " : "", inst->func.func_name);
             for (size_t i = 0; i < inst->func.param_count; i++) {
                 if (i > 0) printf(", ");
                 print_operand(inst->func.params[i]);
@@ -302,6 +311,7 @@ void print_ir_instruction(ir_instruction_t *inst) {
                 print_operand(inst->call.args[i]);
             }
             printf(")");
+            if (inst->call.tail) printf(" [tail]");
             break;
 
         default:
@@ -0,0 +1,11 @@
+#include "diag.h"
+
+static _Thread_local FILE *stream;
+
+FILE *diag_stream(void) {
+    return stream ? stream : stderr;
+}
+
+void diag_set_stream(FILE *f) {
+    stream = f;
+}
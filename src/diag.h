@@ -0,0 +1,11 @@
+#ifndef _DIAG_H
+#define _DIAG_H
+
+#include <stdio.h>
+
+// Where errors and warnings go. stderr unless the calling thread set its own
+// stream, parallel compile jobs collect theirs and print them in input order.
+FILE *diag_stream(void);
+void diag_set_stream(FILE *f);
+
+#endif
@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "dwarf.h"
+
+// Just enough DWARF for addr2line, perf and gdb to map code back to the
+// source: a compile unit with one subprogram per function, and a line table
+// with one sequence covering the whole .text, and one more for
+// .text.unlikely if there is one.
+
+#define DW_TAG_compile_unit 0x11
+#define DW_TAG_subprogram   0x2e
+
+#define DW_AT_name      0x03
+#define DW_AT_stmt_list 0x10
+#define DW_AT_low_pc    0x11
+#define DW_AT_high_pc   0x12
+#define DW_AT_language  0x13
+#define DW_AT_comp_dir  0x1b
+#define DW_AT_producer  0x25
+#define DW_AT_decl_file 0x3a
+#define DW_AT_decl_line 0x3b
+#define DW_AT_external  0x3f
+#define DW_AT_ranges    0x55
+
+#define DW_FORM_addr         0x01
+#define DW_FORM_data4        0x06
+#define DW_FORM_data8        0x07
+#define DW_FORM_string       0x08
+#define DW_FORM_data1        0x0b
+#define DW_FORM_sec_offset   0x17
+#define DW_FORM_flag_present 0x19
+
+#define DW_LANG_C99 0x0c
+
+#define DW_LNS_copy       0x01
+#define DW_LNS_advance_pc 0x02
+#define DW_LNS_advance_line 0x03
+#define DW_LNS_set_column 0x05
+#define DW_LNE_end_sequence 0x01
+#define DW_LNE_set_address  0x02
+
+#define LINE_BASE   -5
+#define LINE_RANGE  14
+#define OPCODE_BASE 13
+
+enum {
+    ABBREV_UNIT = 1,
+    ABBREV_FUNCTION,
+    ABBREV_UNIT_RANGES, // the unit spans .text and .text.unlikely
+};
+
+static void put_u8(dwarf_buffer_t *b, uint8_t byte) {
+    if(b->len == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 256;
+        b->data = mem_realloc(b->data, b->cap);
+    }
+    b->data[b->len++] = byte;
+}
+
+static void put_uint(dwarf_buffer_t *b, uint64_t value, int size) {
+    for(int i = 0; i < size; i++) put_u8(b, (value >> (8 * i)) & 0xff);
+}
+
+static void put_uleb(dwarf_buffer_t *b, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if(value) byte |= 0x80;
+        put_u8(b, byte);
+    } while(value);
+}
+
+static void put_sleb(dwarf_buffer_t *b, int64_t value) {
+    for(;;) {
+        uint8_t byte = value & 0x7f;
+        value >>= 7; // arithmetic shift, keeps the sign
+        if((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+            put_u8(b, byte);
+            return;
+        }
+        put_u8(b, byte | 0x80);
+    }
+}
+
+static void put_string(dwarf_buffer_t *b, const char *s) {
+    do put_u8(b, (uint8_t) *s); while(*s++);
+}
+
+static void patch_u32(dwarf_buffer_t *b, size_t offset, uint32_t value) {
+    memcpy(b->data + offset, &value, 4);
+}
+
+// a relocated field, written as 0 since the addend lives in the relocation
+static void put_reloc(dwarf_unit_t *unit, dwarf_section_t section, int size, dwarf_target_t target, int64_t addend) {
+    dwarf_buffer_t *b = section == DWARF_IN_INFO ? &unit->info : section == DWARF_IN_LINE ? &unit->line : &unit->ranges;
+    if(unit->reloc_count == unit->reloc_cap) {
+        unit->reloc_cap = unit->reloc_cap ? unit->reloc_cap * 2 : 16;
+        unit->relocs = mem_realloc(unit->relocs, sizeof(dwarf_reloc_t) * unit->reloc_cap);
+    }
+    unit->relocs[unit->reloc_count++] = (dwarf_reloc_t) {section, b->len, size, target, addend};
+    put_uint(b, 0, size);
+}
+
+// an address in .text, or in .text.unlikely from code->cold on
+static void put_address(dwarf_unit_t *unit, dwarf_section_t section, x64_code_t *code, size_t offset) {
+    if(code->cold && offset >= code->cold) {
+        put_reloc(unit, section, 8, DWARF_TARGET_TEXT_UNLIKELY, (int64_t) (offset - code->cold));
+    }
+    else {
+        put_reloc(unit, section, 8, DWARF_TARGET_TEXT, (int64_t) offset);
+    }
+}
+
+static void build_abbrev(dwarf_buffer_t *b) {
+    static const uint8_t abbrev[] = {
+        ABBREV_UNIT, DW_TAG_compile_unit, 1, // has children
+        DW_AT_producer, DW_FORM_string,
+        DW_AT_language, DW_FORM_data1,
+        DW_AT_name, DW_FORM_string,
+        DW_AT_comp_dir, DW_FORM_string,
+        DW_AT_stmt_list, DW_FORM_sec_offset,
+        DW_AT_low_pc, DW_FORM_addr,
+        DW_AT_high_pc, DW_FORM_data8,
+        0, 0,
+
+        ABBREV_FUNCTION, DW_TAG_subprogram, 0,
+        DW_AT_name, DW_FORM_string,
+        DW_AT_decl_file, DW_FORM_data1,
+        DW_AT_decl_line, DW_FORM_data4,
+        DW_AT_external, DW_FORM_flag_present,
+        DW_AT_low_pc, DW_FORM_addr,
+        DW_AT_high_pc, DW_FORM_data8,
+        0, 0,
+
+        ABBREV_UNIT_RANGES, DW_TAG_compile_unit, 1,
+        DW_AT_producer, DW_FORM_string,
+        DW_AT_language, DW_FORM_data1,
+        DW_AT_name, DW_FORM_string,
+        DW_AT_comp_dir, DW_FORM_string,
+        DW_AT_stmt_list, DW_FORM_sec_offset,
+        DW_AT_low_pc, DW_FORM_addr, // 0, the ranges are addresses
+        DW_AT_ranges, DW_FORM_sec_offset,
+        0, 0,
+
+        0,
+    };
+    for(size_t i = 0; i < sizeof(abbrev); i++) put_u8(b, abbrev[i]);
+}
+
+// first line recorded inside [start, end), 0 if none
+static int32_t first_line(x64_code_t *code, size_t start, size_t end) {
+    for(size_t i = 0; i < code->line_count; i++) {
+        if(code->lines[i].offset >= end) break;
+        if(code->lines[i].offset >= start) return code->lines[i].line;
+    }
+    return 0;
+}
+
+static void build_info(dwarf_unit_t *unit, x64_code_t *code, const char *source_name, const char *comp_dir) {
+    dwarf_buffer_t *b = &unit->info;
+    put_uint(b, 0, 4); // unit_length, patched below
+    put_uint(b, 4, 2); // version
+    put_reloc(unit, DWARF_IN_INFO, 4, DWARF_TARGET_ABBREV, 0);
+    put_u8(b, 8); // address size
+
+    put_uleb(b, code->cold ? ABBREV_UNIT_RANGES : ABBREV_UNIT);
+    put_string(b, "divc");
+    put_u8(b, DW_LANG_C99);
+    put_string(b, source_name);
+    put_string(b, comp_dir);
+    put_reloc(unit, DWARF_IN_INFO, 4, DWARF_TARGET_LINE, 0);
+    if(code->cold) {
+        put_uint(b, 0, 8);
+        put_reloc(unit, DWARF_IN_INFO, 4, DWARF_TARGET_RANGES, 0);
+        // begin and end of each part, then the end of the list
+        put_reloc(unit, DWARF_IN_RANGES, 8, DWARF_TARGET_TEXT, 0);
+        put_reloc(unit, DWARF_IN_RANGES, 8, DWARF_TARGET_TEXT, (int64_t) code->cold);
+        put_reloc(unit, DWARF_IN_RANGES, 8, DWARF_TARGET_TEXT_UNLIKELY, 0);
+        put_reloc(unit, DWARF_IN_RANGES, 8, DWARF_TARGET_TEXT_UNLIKELY, (int64_t) (code->len - code->cold));
+        put_uint(&unit->ranges, 0, 16);
+    }
+    else {
+        put_reloc(unit, DWARF_IN_INFO, 8, DWARF_TARGET_TEXT, 0);
+        put_uint(b, code->len, 8);
+    }
+
+    for(size_t i = 0; i < code->symbol_count; i++) {
+        x64_symbol_t *fn = &code->symbols[i];
+        put_uleb(b, ABBREV_FUNCTION);
+        put_string(b, fn->name);
+        put_u8(b, 1); // file 1 of the line table
+        put_uint(b, (uint32_t) first_line(code, fn->offset, fn->offset + fn->size), 4);
+        put_address(unit, DWARF_IN_INFO, code, fn->offset);
+        put_uint(b, fn->size, 8);
+    }
+    put_u8(b, 0); // end of the unit's children
+
+    patch_u32(b, 0, (uint32_t) (b->len - 4));
+}
+
+static void advance_pc(dwarf_buffer_t *b, size_t delta) {
+    if(delta == 0) return;
+    put_u8(b, DW_LNS_advance_pc);
+    put_uleb(b, delta);
+}
+
+static void end_sequence(dwarf_buffer_t *b) {
+    put_u8(b, 0);
+    put_uleb(b, 1);
+    put_u8(b, DW_LNE_end_sequence);
+}
+
+// .text ends at code->cold, the registers start over for .text.unlikely
+static void start_cold_sequence(dwarf_unit_t *unit, x64_code_t *code, size_t address) {
+    dwarf_buffer_t *b = &unit->line;
+    advance_pc(b, code->cold - address);
+    end_sequence(b);
+    put_u8(b, 0);
+    put_uleb(b, 9);
+    put_u8(b, DW_LNE_set_address);
+    put_address(unit, DWARF_IN_LINE, code, code->cold);
+}
+
+static void build_line(dwarf_unit_t *unit, x64_code_t *code, const char *source_name) {
+    static const uint8_t opcode_lengths[OPCODE_BASE - 1] = {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
+
+    dwarf_buffer_t *b = &unit->line;
+    put_uint(b, 0, 4); // unit_length
+    put_uint(b, 4, 2); // version
+    size_t header_length = b->len;
+    put_uint(b, 0, 4);
+    put_u8(b, 1); // minimum_instruction_length
+    put_u8(b, 1); // maximum_operations_per_instruction
+    put_u8(b, 1); // default_is_stmt
+    put_u8(b, (uint8_t) LINE_BASE);
+    put_u8(b, LINE_RANGE);
+    put_u8(b, OPCODE_BASE);
+    for(size_t i = 0; i < sizeof(opcode_lengths); i++) put_u8(b, opcode_lengths[i]);
+    put_u8(b, 0); // no include directories
+    put_string(b, source_name);
+    put_uleb(b, 0); // directory: the compile directory
+    put_uleb(b, 0); // mtime
+    put_uleb(b, 0); // length
+    put_u8(b, 0);
+    patch_u32(b, header_length, (uint32_t) (b->len - header_length - 4));
+
+    put_u8(b, 0);
+    put_uleb(b, 9);
+    put_u8(b, DW_LNE_set_address);
+    put_reloc(unit, DWARF_IN_LINE, 8, DWARF_TARGET_TEXT, 0);
+
+    size_t address = 0;
+    int64_t line = 1;
+    int32_t column = 0;
+    for(size_t i = 0; i < code->line_count; i++) {
+        x64_line_t *row = &code->lines[i];
+        if(code->cold && address < code->cold && row->offset >= code->cold) {
+            start_cold_sequence(unit, code, address);
+            address = code->cold;
+            line = 1;
+            column = 0;
+        }
+        if(row->column != column) {
+            column = row->column;
+            put_u8(b, DW_LNS_set_column);
+            put_uleb(b, (uint64_t) column);
+        }
+
+        int64_t line_delta = row->line - line;
+        size_t pc_delta = row->offset - address;
+        int64_t special = (line_delta - LINE_BASE) + (int64_t) LINE_RANGE * (int64_t) pc_delta + OPCODE_BASE;
+        if(line_delta >= LINE_BASE && line_delta < LINE_BASE + LINE_RANGE && special <= 255) {
+            put_u8(b, (uint8_t) special);
+        }
+        else {
+            if(line_delta != 0) {
+                put_u8(b, DW_LNS_advance_line);
+                put_sleb(b, line_delta);
+            }
+            advance_pc(b, pc_delta);
+            put_u8(b, DW_LNS_copy);
+        }
+        line = row->line;
+        address = row->offset;
+    }
+
+    if(code->cold && address < code->cold) {
+        start_cold_sequence(unit, code, address);
+        address = code->cold;
+    }
+    advance_pc(b, code->len - address);
+    end_sequence(b);
+
+    patch_u32(b, 0, (uint32_t) (b->len - 4));
+}
+
+void dwarf_build(dwarf_unit_t *unit, x64_code_t *code, const char *source_name, const char *comp_dir) {
+    memset(unit, 0, sizeof(dwarf_unit_t));
+    if(!source_name) source_name = "";
+    if(!comp_dir) comp_dir = "";
+    build_abbrev(&unit->abbrev);
+    build_info(unit, code, source_name, comp_dir);
+    build_line(unit, code, source_name);
+}
+
+void dwarf_free(dwarf_unit_t *unit) {
+    mem_free(unit->info.data);
+    mem_free(unit->abbrev.data);
+    mem_free(unit->line.data);
+    mem_free(unit->ranges.data);
+    mem_free(unit->relocs);
+    memset(unit, 0, sizeof(dwarf_unit_t));
+}
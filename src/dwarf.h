@@ -0,0 +1,55 @@
+#ifndef _DWARF_H
+#define _DWARF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "x64.h"
+
+// What a relocated field in the debug sections points at
+typedef enum {
+    DWARF_TARGET_TEXT,
+    DWARF_TARGET_TEXT_UNLIKELY,
+    DWARF_TARGET_ABBREV,
+    DWARF_TARGET_LINE,
+    DWARF_TARGET_RANGES,
+} dwarf_target_t;
+
+typedef enum {
+    DWARF_IN_INFO,
+    DWARF_IN_LINE,
+    DWARF_IN_RANGES,
+} dwarf_section_t;
+
+// a 4 or 8 byte field the object writer has to relocate, section + addend
+typedef struct dwarf_reloc {
+    dwarf_section_t section;
+    size_t offset;
+    int size;
+    dwarf_target_t target;
+    int64_t addend;
+} dwarf_reloc_t;
+
+typedef struct dwarf_buffer {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} dwarf_buffer_t;
+
+// .debug_info, .debug_abbrev and .debug_line (DWARF 4) for one compile unit:
+// the unit, a subprogram per function and the line table x64_encode recorded.
+// When code->cold splits the code, .debug_ranges lists the unit's two parts.
+typedef struct dwarf_unit {
+    dwarf_buffer_t info;
+    dwarf_buffer_t abbrev;
+    dwarf_buffer_t line;
+    dwarf_buffer_t ranges;
+    dwarf_reloc_t *relocs;
+    size_t reloc_count;
+    size_t reloc_cap;
+} dwarf_unit_t;
+
+void dwarf_build(dwarf_unit_t *unit, x64_code_t *code, const char *source_name, const char *comp_dir);
+void dwarf_free(dwarf_unit_t *unit);
+
+#endif
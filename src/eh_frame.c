@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "eh_frame.h"
+
+// .eh_frame: one CIE shared by every function, then one FDE per function.
+// Location advances always use DW_CFA_advance_loc4 so the size of an FDE is
+// known before the code offsets are, NASM fills those in from label differences.
+
+#define DW_CFA_advance_loc4    0x04
+#define DW_CFA_offset          0x80
+#define DW_CFA_restore         0xc0
+#define DW_CFA_remember_state  0x0a
+#define DW_CFA_restore_state   0x0b
+#define DW_CFA_def_cfa         0x0c
+#define DW_CFA_def_cfa_register 0x0d
+#define DW_CFA_def_cfa_offset  0x0e
+
+#define DW_EH_PE_pcrel_sdata4  0x1b
+#define DW_REG_RSP 7
+#define DW_REG_RA 16
+#define DATA_ALIGN -8
+
+static const uint8_t dwarf_reg[] = {
+    [REG_RAX] = 0, [REG_RDX] = 1, [REG_RCX] = 2, [REG_RBX] = 3,
+    [REG_RSI] = 4, [REG_RDI] = 5, [REG_RBP] = 6, [REG_RSP] = 7,
+    [REG_R8] = 8, [REG_R9] = 9, [REG_10] = 10, [REG_11] = 11,
+    [REG_R12] = 12, [REG_R13] = 13, [REG_R14] = 14, [REG_R15] = 15,
+};
+
+// bytes go either into a buffer or out as `db` lines
+typedef struct eh_out {
+    asm_writer_t *text;
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+
+    uint8_t line[16]; // pending db bytes
+    size_t line_len;
+} eh_out_t;
+
+static void flush_line(eh_out_t *out) {
+    if(!out->text || out->line_len == 0) return;
+    asm_puts(out->text, "    db ");
+    for(size_t i = 0; i < out->line_len; i++) {
+        if(i) asm_puts(out->text, ", ");
+        asm_write_int(out->text, out->line[i]);
+    }
+    asm_putc(out->text, '\n');
+    out->line_len = 0;
+}
+
+static void put_u8(eh_out_t *out, uint8_t byte) {
+    if(out->text) {
+        if(out->line_len == sizeof(out->line)) flush_line(out);
+        out->line[out->line_len++] = byte;
+        out->len++;
+        return;
+    }
+    if(out->len == out->cap) {
+        out->cap = out->cap ? out->cap * 2 : 256;
+        out->data = mem_realloc(out->data, out->cap);
+    }
+    out->data[out->len++] = byte;
+}
+
+static void put_u32(eh_out_t *out, uint32_t value) {
+    for(int i = 0; i < 4; i++) put_u8(out, (value >> (8 * i)) & 0xff);
+}
+
+static size_t uleb_size(uint32_t value) {
+    size_t size = 1;
+    while(value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static void put_uleb(eh_out_t *out, uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if(value) byte |= 0x80;
+        put_u8(out, byte);
+    } while(value);
+}
+
+// 4 byte `to - from`, two code offsets or two labels
+static void put_delta(eh_out_t *out, size_t from, size_t to) {
+    if(!out->text) {
+        put_u32(out, (uint32_t) (to - from));
+        return;
+    }
+    flush_line(out);
+    asm_puts(out->text, "    dd ..@cfi");
+    asm_write_int(out->text, (int64_t) to);
+    asm_puts(out->text, " - ..@cfi");
+    asm_write_int(out->text, (int64_t) from);
+    asm_putc(out->text, '\n');
+    out->len += 4;
+}
+
+static void put_pc_begin(eh_out_t *out, eh_function_t *fn) {
+    if(!out->text) {
+        put_u32(out, 0); // relocation
+        return;
+    }
+    flush_line(out);
+    asm_puts(out->text, "    dd ");
+    asm_write(out->text, fn->name, strlen(fn->name));
+    asm_puts(out->text, " - $\n");
+    out->len += 4;
+}
+
+static size_t rule_size(x64_cfi_t *rule) {
+    switch(rule->op) {
+        case CFI_DEF_CFA: return 1 + uleb_size(dwarf_reg[rule->reg]) + uleb_size(rule->value);
+        case CFI_DEF_CFA_OFFSET: return 1 + uleb_size(rule->value);
+        case CFI_DEF_CFA_REGISTER: return 1 + uleb_size(dwarf_reg[rule->reg]);
+        case CFI_OFFSET: return 1 + uleb_size(rule->value / DATA_ALIGN);
+        default: return 1;
+    }
+}
+
+static void put_rule(eh_out_t *out, x64_cfi_t *rule) {
+    switch(rule->op) {
+        case CFI_DEF_CFA:
+            put_u8(out, DW_CFA_def_cfa);
+            put_uleb(out, dwarf_reg[rule->reg]);
+            put_uleb(out, rule->value);
+            break;
+        case CFI_DEF_CFA_OFFSET:
+            put_u8(out, DW_CFA_def_cfa_offset);
+            put_uleb(out, rule->value);
+            break;
+        case CFI_DEF_CFA_REGISTER:
+            put_u8(out, DW_CFA_def_cfa_register);
+            put_uleb(out, dwarf_reg[rule->reg]);
+            break;
+        case CFI_OFFSET:
+            put_u8(out, DW_CFA_offset | dwarf_reg[rule->reg]);
+            put_uleb(out, rule->value / DATA_ALIGN);
+            break;
+        case CFI_RESTORE:
+            put_u8(out, DW_CFA_restore | dwarf_reg[rule->reg]);
+            break;
+        case CFI_REMEMBER_STATE:
+            put_u8(out, DW_CFA_remember_state);
+            break;
+        case CFI_RESTORE_STATE:
+            put_u8(out, DW_CFA_restore_state);
+            break;
+    }
+}
+
+static void put_cie(eh_out_t *out) {
+    static const uint8_t cie[] = {
+        20, 0, 0, 0,       // length
+        0, 0, 0, 0,        // CIE id
+        1,                 // version
+        'z', 'R', 0,       // augmentation
+        1,                 // code alignment
+        DATA_ALIGN & 0x7f, // data alignment, sleb128 -8
+        DW_REG_RA,
+        1,                 // augmentation data length
+        DW_EH_PE_pcrel_sdata4,
+        DW_CFA_def_cfa, DW_REG_RSP, 8,     // cfa = rsp + 8
+        DW_CFA_offset | DW_REG_RA, 1,      // return address at cfa - 8
+        0, 0,              // DW_CFA_nop padding
+    };
+    for(size_t i = 0; i < sizeof(cie); i++) put_u8(out, cie[i]);
+}
+
+static void put_fde(eh_out_t *out, eh_function_t *fn, size_t *pc_field) {
+    size_t body = 0;
+    size_t at = fn->start;
+    for(size_t i = 0; i < fn->rule_count; i++) {
+        if(fn->rules[i].offset != at) {
+            body += 5;
+            at = fn->rules[i].offset;
+        }
+        body += rule_size(&fn->rules[i]);
+    }
+
+    // length, CIE pointer, pc_begin, pc_range, augmentation length, rules, padding
+    size_t size = 4 + 4 + 4 + 4 + 1 + body;
+    size_t padded = (size + 7) & ~(size_t) 7;
+
+    size_t fde = out->len;
+    put_u32(out, (uint32_t) (padded - 4));
+    put_u32(out, (uint32_t) (fde + 4)); // back to the CIE at 0
+    if(pc_field) *pc_field = out->len;
+    put_pc_begin(out, fn);
+    put_delta(out, fn->start, fn->end);
+    put_uleb(out, 0);
+
+    at = fn->start;
+    for(size_t i = 0; i < fn->rule_count; i++) {
+        if(fn->rules[i].offset != at) {
+            put_u8(out, DW_CFA_advance_loc4);
+            put_delta(out, at, fn->rules[i].offset);
+            at = fn->rules[i].offset;
+        }
+        put_rule(out, &fn->rules[i]);
+    }
+    for(size_t i = size; i < padded; i++) put_u8(out, 0);
+}
+
+uint8_t *eh_frame_build(eh_function_t *functions, size_t count, size_t *len, size_t *pc_fields) {
+    eh_out_t out = {0};
+    put_cie(&out);
+    for(size_t i = 0; i < count; i++) {
+        put_fde(&out, &functions[i], &pc_fields[i]);
+    }
+    *len = out.len;
+    return out.data;
+}
+
+void eh_frame_print(asm_writer_t *w, eh_function_t *functions, size_t count) {
+    if(count == 0) return;
+
+    eh_out_t out = {0};
+    out.text = w;
+    asm_puts(w, "\nsection .eh_frame progbits alloc noexec nowrite align=8\n");
+    put_cie(&out);
+    for(size_t i = 0; i < count; i++) {
+        put_fde(&out, &functions[i], NULL);
+    }
+    flush_line(&out);
+}
@@ -0,0 +1,27 @@
+#ifndef _EH_FRAME_H
+#define _EH_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asm_writer.h"
+#include "x64.h"
+
+// One FDE worth of unwind rules. start/end and the rule offsets are code
+// offsets for object files, label numbers (..@cfiN) for NASM output.
+typedef struct eh_function {
+    const char *name;
+    size_t start;
+    size_t end;
+    x64_cfi_t *rules;
+    size_t rule_count;
+} eh_function_t;
+
+// .eh_frame contents for an object file. pc_fields[i] gets the position of
+// function i's pc_begin, which needs an R_X86_64_PC32 against .text + start.
+uint8_t *eh_frame_build(eh_function_t *functions, size_t count, size_t *len, size_t *pc_fields);
+
+// the same section as NASM data directives
+void eh_frame_print(asm_writer_t *w, eh_function_t *functions, size_t count);
+
+#endif
@@ -0,0 +1,351 @@
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "dwarf.h"
+#include "eh_frame.h"
+#include "elf_writer.h"
+#include "x64.h"
+
+// ELF64 relocatable object straight from the encoded .text, no nasm needed.
+// Layout: header, section contents, section header table. With a profile the
+// functions that never ran end the buffer and go into .text.unlikely.
+
+enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_RELA_TEXT,
+    SEC_TEXT_UNLIKELY,   // only with code->cold
+    SEC_RELA_TEXT_UNLIKELY,
+    SEC_DATA,            // only with -fprofile-generate
+    SEC_FINI_ARRAY,      // likewise
+    SEC_RELA_FINI_ARRAY,
+    SEC_EH_FRAME,
+    SEC_RELA_EH_FRAME,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_NOTE_STACK,
+    SEC_DEBUG_INFO,      // only with -g
+    SEC_RELA_DEBUG_INFO,
+    SEC_DEBUG_ABBREV,
+    SEC_DEBUG_LINE,
+    SEC_RELA_DEBUG_LINE,
+    SEC_DEBUG_RANGES,    // only with -g and code->cold
+    SEC_RELA_DEBUG_RANGES,
+    SEC_COUNT,
+};
+
+typedef struct elf_section_kind {
+    const char *name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t align;
+    int relocates; // section a SHT_RELA applies to
+} elf_section_kind_t;
+
+static const elf_section_kind_t section_kinds[SEC_COUNT] = {
+    [SEC_TEXT] = {".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16, 0},
+    [SEC_RELA_TEXT] = {".rela.text", SHT_RELA, SHF_INFO_LINK, 8, SEC_TEXT},
+    [SEC_TEXT_UNLIKELY] = {".text.unlikely", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16, 0},
+    [SEC_RELA_TEXT_UNLIKELY] = {".rela.text.unlikely", SHT_RELA, SHF_INFO_LINK, 8, SEC_TEXT_UNLIKELY},
+    [SEC_DATA] = {".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 8, 0},
+    [SEC_FINI_ARRAY] = {".fini_array", SHT_FINI_ARRAY, SHF_ALLOC | SHF_WRITE, 8, 0},
+    [SEC_RELA_FINI_ARRAY] = {".rela.fini_array", SHT_RELA, SHF_INFO_LINK, 8, SEC_FINI_ARRAY},
+    [SEC_EH_FRAME] = {".eh_frame", SHT_X86_64_UNWIND, SHF_ALLOC, 8, 0},
+    [SEC_RELA_EH_FRAME] = {".rela.eh_frame", SHT_RELA, SHF_INFO_LINK, 8, SEC_EH_FRAME},
+    [SEC_SYMTAB] = {".symtab", SHT_SYMTAB, 0, 8, 0},
+    [SEC_STRTAB] = {".strtab", SHT_STRTAB, 0, 1, 0},
+    [SEC_SHSTRTAB] = {".shstrtab", SHT_STRTAB, 0, 1, 0},
+    // empty, marks the stack as non executable
+    [SEC_NOTE_STACK] = {".note.GNU-stack", SHT_PROGBITS, 0, 1, 0},
+    [SEC_DEBUG_INFO] = {".debug_info", SHT_PROGBITS, 0, 1, 0},
+    [SEC_RELA_DEBUG_INFO] = {".rela.debug_info", SHT_RELA, SHF_INFO_LINK, 8, SEC_DEBUG_INFO},
+    [SEC_DEBUG_ABBREV] = {".debug_abbrev", SHT_PROGBITS, 0, 1, 0},
+    [SEC_DEBUG_LINE] = {".debug_line", SHT_PROGBITS, 0, 1, 0},
+    [SEC_RELA_DEBUG_LINE] = {".rela.debug_line", SHT_RELA, SHF_INFO_LINK, 8, SEC_DEBUG_LINE},
+    [SEC_DEBUG_RANGES] = {".debug_ranges", SHT_PROGBITS, 0, 1, 0},
+    [SEC_RELA_DEBUG_RANGES] = {".rela.debug_ranges", SHT_RELA, SHF_INFO_LINK, 8, SEC_DEBUG_RANGES},
+};
+
+typedef struct elf_buffer {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} elf_buffer_t;
+
+static size_t buffer_append(elf_buffer_t *b, const void *data, size_t len) {
+    if(b->len + len > b->cap) {
+        while(b->len + len > b->cap) b->cap = b->cap ? b->cap * 2 : 256;
+        b->data = mem_realloc(b->data, b->cap);
+    }
+    size_t offset = b->len;
+    memcpy(b->data + offset, data, len);
+    b->len += len;
+    return offset;
+}
+
+static uint32_t strtab_add(elf_buffer_t *strtab, const char *s) {
+    return (uint32_t) buffer_append(strtab, s, strlen(s) + 1);
+}
+
+static inline size_t align_to(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+static void write_padding(FILE *f, size_t from, size_t to) {
+    while(from++ < to) fputc(0, f);
+}
+
+static size_t add_section_symbol(elf_buffer_t *symtab, uint16_t index) {
+    Elf64_Sym sym = {0};
+    sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    sym.st_shndx = index;
+    return buffer_append(symtab, &sym, sizeof(sym)) / sizeof(Elf64_Sym);
+}
+
+static void add_rela(elf_buffer_t *rela, size_t offset, size_t symbol, uint32_t type, int64_t addend) {
+    Elf64_Rela r = {0};
+    r.r_offset = offset;
+    r.r_info = ELF64_R_INFO(symbol, type);
+    r.r_addend = addend;
+    buffer_append(rela, &r, sizeof(r));
+}
+
+// where a code offset ends up: .text, or .text.unlikely from code->cold on
+static int is_cold(x64_code_t *code, size_t offset) {
+    return code->cold && offset >= code->cold;
+}
+
+static size_t section_offset(x64_code_t *code, size_t offset) {
+    return is_cold(code, offset) ? offset - code->cold : offset;
+}
+
+int elf_write_object(FILE *f, x64_code_t *code, const char *source_name) {
+    size_t unresolved = x64_resolve(code);
+
+    // sections that are left out don't get a header, the rest are numbered in enum order
+    int profile = code->rw_len > 0;
+    int debug = code->debug_lines;
+    int cold = code->cold > 0;
+    uint16_t index[SEC_COUNT] = {0};
+    uint16_t section_count = 0;
+    for(int i = 0; i < SEC_COUNT; i++) {
+        if(!cold && (i == SEC_TEXT_UNLIKELY || i == SEC_RELA_TEXT_UNLIKELY)) continue;
+        if(!profile && i >= SEC_DATA && i <= SEC_RELA_FINI_ARRAY) continue;
+        if(!debug && i >= SEC_DEBUG_INFO) continue;
+        if(!cold && i >= SEC_DEBUG_RANGES) continue;
+        index[i] = section_count++;
+    }
+
+    elf_buffer_t contents[SEC_COUNT] = {0};
+    elf_buffer_t *strtab = &contents[SEC_STRTAB];
+    elf_buffer_t *shstrtab = &contents[SEC_SHSTRTAB];
+    elf_buffer_t *symtab = &contents[SEC_SYMTAB];
+
+    strtab_add(strtab, "");
+    strtab_add(shstrtab, "");
+
+    // locals first: null, file, then section symbols for whatever relocations point into
+    Elf64_Sym sym = {0};
+    buffer_append(symtab, &sym, sizeof(sym));
+
+    sym = (Elf64_Sym) {0};
+    sym.st_name = strtab_add(strtab, source_name ? source_name : "");
+    sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_FILE);
+    sym.st_shndx = SHN_ABS;
+    buffer_append(symtab, &sym, sizeof(sym));
+
+    size_t text_symbol = add_section_symbol(symtab, index[SEC_TEXT]);
+    size_t cold_symbol = cold ? add_section_symbol(symtab, index[SEC_TEXT_UNLIKELY]) : 0;
+    size_t data_symbol = profile ? add_section_symbol(symtab, index[SEC_DATA]) : 0;
+    size_t abbrev_symbol = debug ? add_section_symbol(symtab, index[SEC_DEBUG_ABBREV]) : 0;
+    size_t line_symbol = debug ? add_section_symbol(symtab, index[SEC_DEBUG_LINE]) : 0;
+    size_t ranges_symbol = debug && cold ? add_section_symbol(symtab, index[SEC_DEBUG_RANGES]) : 0;
+    #define CODE_SYMBOL(offset) (is_cold(code, offset) ? cold_symbol : text_symbol)
+    #define CODE_RELA(offset) (&contents[is_cold(code, offset) ? SEC_RELA_TEXT_UNLIKELY : SEC_RELA_TEXT])
+
+    // static functions are local too, the rest `global` like the NASM output
+    size_t first_global = 0;
+    for(int global = 0; global <= 1; global++) {
+        if(global) first_global = symtab->len / sizeof(Elf64_Sym);
+        for(size_t i = 0; i < code->symbol_count; i++) {
+            if(code->symbols[i].local == global) continue;
+            sym = (Elf64_Sym) {0};
+            sym.st_name = strtab_add(strtab, code->symbols[i].name);
+            sym.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, STT_FUNC);
+            sym.st_shndx = index[is_cold(code, code->symbols[i].offset) ? SEC_TEXT_UNLIKELY : SEC_TEXT];
+            sym.st_value = section_offset(code, code->symbols[i].offset);
+            sym.st_size = code->symbols[i].size;
+            buffer_append(symtab, &sym, sizeof(sym));
+        }
+    }
+
+    // undefined externals, one symbol per name
+    size_t first_external = symtab->len / sizeof(Elf64_Sym);
+    char **externals = mem_calloc(unresolved + 1, sizeof(char*));
+    size_t external_count = 0;
+
+    for(size_t i = 0; i < unresolved; i++) {
+        char *name = code->fixups[i].name;
+        size_t j = 0;
+        while(j < external_count && strcmp(externals[j], name) != 0) j++;
+        if(j == external_count) {
+            externals[external_count++] = name;
+            sym = (Elf64_Sym) {0};
+            sym.st_name = strtab_add(strtab, name);
+            sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+            sym.st_shndx = SHN_UNDEF;
+            buffer_append(symtab, &sym, sizeof(sym));
+        }
+        size_t offset = code->fixups[i].offset;
+        add_rela(CODE_RELA(offset), section_offset(code, offset), first_external + j, R_X86_64_PLT32, -4);
+    }
+    mem_free(externals);
+
+    // calls between .text and .text.unlikely
+    for(size_t i = 0; i < code->cross_count; i++) {
+        size_t offset = code->cross[i].offset;
+        size_t target = (size_t) code->cross[i].target;
+        add_rela(CODE_RELA(offset), section_offset(code, offset), CODE_SYMBOL(target), R_X86_64_PC32,
+                 (int64_t) section_offset(code, target) - 4);
+    }
+
+    // rip-relative data, the displacement ends the instruction
+    for(size_t i = 0; i < code->data_ref_count; i++) {
+        size_t offset = code->data_refs[i].offset;
+        add_rela(CODE_RELA(offset), section_offset(code, offset), data_symbol, R_X86_64_PC32,
+                 code->data_refs[i].target - 4);
+    }
+
+    size_t fini = 0;
+    if(profile) {
+        buffer_append(&contents[SEC_DATA], code->rw, code->rw_len);
+        if(code->fini && x64_find_label(code, code->fini, &fini)) {
+            buffer_append(&contents[SEC_FINI_ARRAY], &(uint64_t) {0}, 8);
+            add_rela(&contents[SEC_RELA_FINI_ARRAY], 0, CODE_SYMBOL(fini), R_X86_64_64,
+                     (int64_t) section_offset(code, fini));
+        }
+    }
+
+    // one FDE per function, the rules are in code order like the symbols
+    eh_function_t *functions = mem_calloc(code->symbol_count + 1, sizeof(eh_function_t));
+    size_t *pc_fields = mem_calloc(code->symbol_count + 1, sizeof(size_t));
+    size_t rule = 0;
+    for(size_t i = 0; i < code->symbol_count; i++) {
+        x64_symbol_t *fn = &code->symbols[i];
+        functions[i] = (eh_function_t) {fn->name, fn->offset, fn->offset + fn->size, &code->cfi[rule], 0};
+        while(rule < code->cfi_count
+              && (i + 1 == code->symbol_count || code->cfi[rule].offset < code->symbols[i + 1].offset)) {
+            functions[i].rule_count++;
+            rule++;
+        }
+    }
+
+    elf_buffer_t *eh_frame = &contents[SEC_EH_FRAME];
+    eh_frame->data = eh_frame_build(functions, code->symbol_count, &eh_frame->len, pc_fields);
+    for(size_t i = 0; i < code->symbol_count; i++) {
+        size_t start = functions[i].start;
+        add_rela(&contents[SEC_RELA_EH_FRAME], pc_fields[i], CODE_SYMBOL(start), R_X86_64_PC32,
+                 (int64_t) section_offset(code, start));
+    }
+    mem_free(functions);
+    mem_free(pc_fields);
+
+    dwarf_unit_t dwarf = {0};
+    if(debug) {
+        char cwd[4096];
+        dwarf_build(&dwarf, code, source_name, getcwd(cwd, sizeof(cwd)));
+        for(size_t i = 0; i < dwarf.reloc_count; i++) {
+            dwarf_reloc_t *reloc = &dwarf.relocs[i];
+            size_t symbol = reloc->target == DWARF_TARGET_TEXT ? text_symbol
+                : reloc->target == DWARF_TARGET_TEXT_UNLIKELY ? cold_symbol
+                : reloc->target == DWARF_TARGET_ABBREV ? abbrev_symbol
+                : reloc->target == DWARF_TARGET_LINE ? line_symbol : ranges_symbol;
+            int section = reloc->section == DWARF_IN_INFO ? SEC_RELA_DEBUG_INFO
+                : reloc->section == DWARF_IN_LINE ? SEC_RELA_DEBUG_LINE : SEC_RELA_DEBUG_RANGES;
+            add_rela(&contents[section], reloc->offset, symbol, reloc->size == 8 ? R_X86_64_64 : R_X86_64_32,
+                     reloc->addend);
+        }
+        // borrowed, dwarf_free releases them
+        contents[SEC_DEBUG_INFO] = (elf_buffer_t) {dwarf.info.data, dwarf.info.len, 0};
+        contents[SEC_DEBUG_ABBREV] = (elf_buffer_t) {dwarf.abbrev.data, dwarf.abbrev.len, 0};
+        contents[SEC_DEBUG_LINE] = (elf_buffer_t) {dwarf.line.data, dwarf.line.len, 0};
+        contents[SEC_DEBUG_RANGES] = (elf_buffer_t) {dwarf.ranges.data, dwarf.ranges.len, 0};
+    }
+
+    // offsets up front so the object can be streamed, no seeking back
+    Elf64_Shdr sections[SEC_COUNT] = {0};
+    size_t end = sizeof(Elf64_Ehdr);
+    for(int i = SEC_TEXT; i < SEC_COUNT; i++) {
+        if(index[i] == 0) continue;
+        const elf_section_kind_t *kind = &section_kinds[i];
+        Elf64_Shdr *section = &sections[i];
+        section->sh_name = strtab_add(shstrtab, kind->name);
+        section->sh_type = kind->type;
+        section->sh_flags = kind->flags;
+        section->sh_addralign = kind->align;
+        if(kind->type == SHT_RELA) {
+            section->sh_link = index[SEC_SYMTAB];
+            section->sh_info = index[kind->relocates];
+            section->sh_entsize = sizeof(Elf64_Rela);
+        }
+    }
+    // shstrtab is complete only now
+    for(int i = SEC_TEXT; i < SEC_COUNT; i++) {
+        if(index[i] == 0) continue;
+        Elf64_Shdr *section = &sections[i];
+        section->sh_offset = align_to(end, section->sh_addralign);
+        section->sh_size = i == SEC_TEXT ? (cold ? code->cold : code->len)
+            : i == SEC_TEXT_UNLIKELY ? code->len - code->cold : contents[i].len;
+        end = section->sh_offset + section->sh_size;
+    }
+    sections[SEC_SYMTAB].sh_link = index[SEC_STRTAB];
+    sections[SEC_SYMTAB].sh_info = first_global;
+    sections[SEC_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+
+    Elf64_Ehdr header = {0};
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = align_to(end, 8);
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = section_count;
+    header.e_shstrndx = index[SEC_SHSTRTAB];
+
+    fwrite(&header, sizeof(header), 1, f);
+    size_t written = sizeof(header);
+    for(int i = SEC_TEXT; i < SEC_COUNT; i++) {
+        if(index[i] == 0) continue;
+        write_padding(f, written, sections[i].sh_offset);
+        const uint8_t *data = i == SEC_TEXT ? code->data : i == SEC_TEXT_UNLIKELY ? code->data + code->cold : contents[i].data;
+        fwrite(data, 1, sections[i].sh_size, f);
+        written = sections[i].sh_offset + sections[i].sh_size;
+    }
+    write_padding(f, written, header.e_shoff);
+
+    fwrite(&sections[SEC_NULL], sizeof(Elf64_Shdr), 1, f);
+    for(int i = SEC_TEXT; i < SEC_COUNT; i++) {
+        if(index[i] != 0) fwrite(&sections[i], sizeof(Elf64_Shdr), 1, f);
+    }
+
+    for(int i = SEC_TEXT; i < SEC_DEBUG_INFO; i++) mem_free(contents[i].data);
+    mem_free(contents[SEC_RELA_DEBUG_INFO].data);
+    mem_free(contents[SEC_RELA_DEBUG_LINE].data);
+    mem_free(contents[SEC_RELA_DEBUG_RANGES].data);
+    dwarf_free(&dwarf);
+    #undef CODE_SYMBOL
+    #undef CODE_RELA
+
+    return ferror(f) ? -1 : 0;
+}
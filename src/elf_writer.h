@@ -0,0 +1,10 @@
+#ifndef _ELF_WRITER_H
+#define _ELF_WRITER_H
+
+#include <stdio.h>
+
+#include "x64.h"
+
+int elf_write_object(FILE *f, x64_code_t *code, const char *source_name);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "frame.h"
+
+// code_gen always emits `push rbp; mov rbp, rsp; sub rsp, N`, callee-saved
+// register saves, and `leave` on every exit, all marked X64_PROLOGUE or
+// X64_EPILOGUE. Once the peephole pass has run we know what the body really
+// needs and pick one of:
+//  - leaf: no calls and the frame fits the red zone, nothing is set up and
+//    slots are addressed below rsp
+//  - -fomit-frame-pointer: a single `sub rsp`, slots addressed off rsp
+//  - the rbp frame as emitted
+// Shrink-wrapping then moves the prologue down and each epilogue up past
+// instructions that touch neither the stack nor preserved registers. DivC has
+// no branches, so this is what's left of it: the frame covers only the part
+// of the path that needs it.
+
+#define RED_ZONE 128
+#define FRAME_WORD 8
+
+static const x64_registers_t preserved[] = {REG_RBX, REG_RBP, REG_RSP, REG_R12, REG_R13, REG_R14, REG_R15};
+
+static int is_preserved(x64_operand_t *op) {
+    if(op->kind != X64_REG) return 0;
+    for(size_t i = 0; i < sizeof(preserved) / sizeof(preserved[0]); i++) {
+        if(preserved[i] == op->reg) return 1;
+    }
+    return 0;
+}
+
+static int address_is_preserved(x64_operand_t *op) {
+    x64_operand_t base = x64_reg(op->mem.base, 8);
+    x64_operand_t index = x64_reg(op->mem.index, 8);
+    return is_preserved(&base) || (op->mem.scale && is_preserved(&index));
+}
+
+static int is_jump_target(x64_inst_t *insts, size_t count, const char *label) {
+    for(size_t i = 0; i < count; i++) {
+        if(insts[i].op == X64_JMP && strcmp(insts[i].dst.sym, label) == 0) return 1;
+    }
+    return 0;
+}
+
+// whether the instruction has to stay inside the frame
+static int needs_frame(x64_inst_t *insts, size_t count, x64_inst_t *inst) {
+    switch(inst->op) {
+        case X64_COMMENT:
+            return 0;
+        case X64_LABEL:
+            return is_jump_target(insts, count, inst->dst.sym);
+        case X64_MOV:
+        case X64_ADD:
+        case X64_SUB:
+        case X64_IMUL:
+            return inst->dst.kind == X64_MEM || inst->src.kind == X64_MEM
+                || is_preserved(&inst->dst) || is_preserved(&inst->src);
+        case X64_INC:
+            return inst->dst.kind == X64_MEM || is_preserved(&inst->dst);
+        case X64_LEA:
+            // only computes an address, it never touches the memory
+            return is_preserved(&inst->dst) || address_is_preserved(&inst->src);
+        default:
+            return 1;
+    }
+}
+
+static void rotate(x64_inst_t *insts, size_t from, size_t middle, size_t to) {
+    // [from, middle) [middle, to) -> [middle, to) [from, middle)
+    size_t left = middle - from;
+    if(left == 0 || middle == to) return;
+    x64_inst_t *tmp = mem_alloc(sizeof(x64_inst_t) * left);
+    memcpy(tmp, insts + from, sizeof(x64_inst_t) * left);
+    memmove(insts + from, insts + middle, sizeof(x64_inst_t) * (to - middle));
+    memcpy(insts + from + (to - middle), tmp, sizeof(x64_inst_t) * left);
+    mem_free(tmp);
+}
+
+static void shrink_wrap(x64_inst_t *insts, size_t count) {
+    // prologue down to the first instruction that needs it
+    size_t start = 0;
+    while(start < count && insts[start].part != X64_PROLOGUE) start++;
+    size_t end = start;
+    while(end < count && insts[end].part == X64_PROLOGUE) end++;
+
+    size_t sink = end;
+    while(sink < count && insts[sink].part == X64_BODY && !needs_frame(insts, count, &insts[sink])) sink++;
+    rotate(insts, start, end, sink);
+
+    // every epilogue up to right after the last instruction that needs the frame
+    for(size_t i = 0; i < count; i++) {
+        if(insts[i].part != X64_EPILOGUE) continue;
+        size_t run = i;
+        while(i < count && insts[i].part == X64_EPILOGUE) i++;
+
+        size_t hoist = run;
+        while(hoist > 0 && insts[hoist - 1].part == X64_BODY && !needs_frame(insts, count, &insts[hoist - 1])) {
+            hoist--;
+        }
+        rotate(insts, hoist, run, i);
+        i--;
+    }
+}
+
+typedef struct frame_out {
+    x64_inst_t *insts;
+    size_t count;
+    size_t cap;
+} frame_out_t;
+
+static void push(frame_out_t *out, x64_inst_t inst) {
+    if(out->count == out->cap) {
+        out->cap = out->cap ? out->cap * 2 : 64;
+        out->insts = mem_realloc(out->insts, sizeof(x64_inst_t) * out->cap);
+    }
+    out->insts[out->count++] = inst;
+}
+
+// code after the exit an epilogue belongs to still runs inside the frame
+static int code_after_exit(x64_inst_t *insts, size_t count, size_t i, size_t *exit) {
+    for(; i < count; i++) {
+        x64_opcode_t op = insts[i].op;
+        if(op == X64_RET || op == X64_SYSCALL || op == X64_JMP) break;
+    }
+    *exit = i;
+    for(i++; i < count; i++) {
+        if(insts[i].op != X64_COMMENT && insts[i].op != X64_CFI) return 1;
+    }
+    return 0;
+}
+
+size_t frame_lower(x64_inst_t **insts_ptr, size_t count, size_t *cap, frame_options_t *options) {
+    x64_inst_t *insts = *insts_ptr;
+
+    int32_t frame_size = 0;
+    int has_call = 0;
+    for(size_t i = 0; i < count; i++) {
+        x64_inst_t *inst = &insts[i];
+        if(inst->part == X64_PROLOGUE && inst->op == X64_SUB) frame_size = (int32_t) inst->src.imm;
+        if(inst->op == X64_CALL) has_call = 1;
+    }
+
+    // the red zone has to hold rbp's slot too, it's where the frame would be
+    int leaf = !has_call && !options->keep_leaf_frame && frame_size + FRAME_WORD <= RED_ZONE;
+    int omit = leaf || options->omit_frame_pointer;
+
+    // slots stay where they were relative to the entry rsp
+    int32_t rebase = leaf ? -FRAME_WORD : frame_size;
+
+    size_t kept = 0;
+    for(size_t i = 0; i < count; i++) {
+        x64_inst_t inst = insts[i];
+
+        if(omit && inst.part != X64_BODY) {
+            if(inst.op == X64_PUSH || (inst.op == X64_MOV && inst.dst.kind == X64_REG && inst.dst.reg == REG_RBP)) {
+                continue;
+            }
+            if(inst.op == X64_SUB && inst.dst.kind == X64_REG) {
+                if(leaf) continue;
+                inst.src.imm = frame_size + FRAME_WORD;
+            }
+            if(inst.op == X64_LEAVE) {
+                if(leaf) continue;
+                inst = (x64_inst_t) {
+                    .op = X64_ADD, .dst = x64_reg(REG_RSP, 8), .src = x64_imm(frame_size + FRAME_WORD, 8),
+                    .part = X64_EPILOGUE, .line = inst.line, .column = inst.column,
+                };
+            }
+        }
+
+        // nothing left in the frame, rbp alone keeps rsp aligned
+        if(!omit && inst.part == X64_PROLOGUE && inst.op == X64_SUB && frame_size == 0) continue;
+
+        if(omit) {
+            if(inst.dst.kind == X64_MEM && inst.dst.mem.base == REG_RBP) {
+                inst.dst.mem.base = REG_RSP;
+                inst.dst.mem.disp += rebase;
+            }
+            if(inst.src.kind == X64_MEM && inst.src.mem.base == REG_RBP) {
+                inst.src.mem.base = REG_RSP;
+                inst.src.mem.disp += rebase;
+            }
+        }
+        insts[kept++] = inst;
+    }
+    count = kept;
+
+    if(!options->no_shrink_wrap) shrink_wrap(insts, count);
+
+    // unwind rules after every instruction that moves the CFA or saves a register
+    frame_out_t out = {NULL, 0, 0};
+    x64_registers_t cfa_reg = REG_RSP;
+    int32_t cfa_offset = FRAME_WORD;
+    int remembered = 0;
+    size_t exit_index = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        x64_inst_t *inst = &insts[i];
+
+        if(inst->part == X64_EPILOGUE && (i == 0 || insts[i - 1].part != X64_EPILOGUE)) {
+            remembered = code_after_exit(insts, count, i, &exit_index);
+            if(remembered) push(&out, x64_cfi(CFI_REMEMBER_STATE, REG_RSP, 0));
+        }
+
+        push(&out, *inst);
+
+        if(inst->part == X64_PROLOGUE) {
+            if(inst->op == X64_PUSH) {
+                cfa_offset += FRAME_WORD;
+                push(&out, x64_cfi(CFI_DEF_CFA_OFFSET, REG_RSP, cfa_offset));
+                push(&out, x64_cfi(CFI_OFFSET, inst->dst.reg, -cfa_offset));
+            }
+            else if(inst->op == X64_MOV && inst->dst.kind == X64_REG && inst->dst.reg == REG_RBP) {
+                cfa_reg = REG_RBP;
+                push(&out, x64_cfi(CFI_DEF_CFA_REGISTER, REG_RBP, 0));
+            }
+            else if(inst->op == X64_SUB && cfa_reg == REG_RSP) {
+                cfa_offset += (int32_t) inst->src.imm;
+                push(&out, x64_cfi(CFI_DEF_CFA_OFFSET, REG_RSP, cfa_offset));
+            }
+            else if(inst->op == X64_MOV && inst->dst.kind == X64_MEM) {
+                // rbp sits 16 below the CFA, rsp cfa_offset below it
+                int32_t base = inst->dst.mem.base == REG_RBP ? 2 * FRAME_WORD : cfa_offset;
+                push(&out, x64_cfi(CFI_OFFSET, inst->src.reg, inst->dst.mem.disp - base));
+            }
+        }
+        else if(inst->part == X64_EPILOGUE) {
+            if(inst->op == X64_MOV && inst->dst.kind == X64_REG) {
+                push(&out, x64_cfi(CFI_RESTORE, inst->dst.reg, 0));
+            }
+            else if(inst->op == X64_LEAVE) {
+                push(&out, x64_cfi(CFI_DEF_CFA, REG_RSP, FRAME_WORD));
+                push(&out, x64_cfi(CFI_RESTORE, REG_RBP, 0));
+            }
+            else if(inst->op == X64_ADD) {
+                push(&out, x64_cfi(CFI_DEF_CFA_OFFSET, REG_RSP, FRAME_WORD));
+            }
+        }
+
+        if(remembered && i == exit_index) {
+            push(&out, x64_cfi(CFI_RESTORE_STATE, REG_RSP, 0));
+            remembered = 0;
+        }
+    }
+
+    mem_free(insts);
+    *insts_ptr = out.insts;
+    *cap = out.cap;
+    return out.count;
+}
@@ -0,0 +1,18 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stddef.h>
+
+#include "x64.h"
+
+typedef struct frame_options {
+    int omit_frame_pointer; // -fomit-frame-pointer, address the frame off rsp
+    int keep_leaf_frame;    // -mno-omit-leaf-frame-pointer
+    int no_shrink_wrap;     // -fno-shrink-wrap
+} frame_options_t;
+
+// Turns the rbp frame code_gen emits into the final prologue/epilogue and adds
+// X64_CFI rules. *insts is reallocated, returns the new count.
+size_t frame_lower(x64_inst_t **insts, size_t count, size_t *cap, frame_options_t *options);
+
+#endif
@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "alloc.h"
 #include "hashmap.h"
 #include "semantic.h"
 
@@ -34,7 +35,7 @@ int map_add(struct scope *s, char *key, symbol_t *value) {
     struct node *n = s->table[idx];
 
     if(n == NULL) {
-        n = malloc(sizeof(struct node));
+        n = mem_alloc(sizeof(struct node));
         n->key = key; // no strdup cuz i dont have to
         n->value = value;
         n->next = NULL;
@@ -48,7 +49,7 @@ int map_add(struct scope *s, char *key, symbol_t *value) {
             if(strcmp(current->key, key) == 0) return -1;
             current = current->next;
         }
-        struct node *new = malloc(sizeof(struct node));
+        struct node *new = mem_alloc(sizeof(struct node));
         new->key = key;
         new->value = value;
         new->next = NULL;
@@ -0,0 +1,501 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "callgraph.h"
+#include "ipa.h"
+
+// names to whatever a pass keeps about them, open addressing
+typedef struct name_entry {
+    const char *name;
+    int64_t value;
+    int set;
+} name_entry_t;
+
+typedef struct name_table {
+    name_entry_t *entries;
+    size_t cap;
+    size_t count;
+} name_table_t;
+
+static size_t name_hash(const char *name) {
+    size_t h = 14695981039346656037ull;
+    for(; *name; name++) h = (h ^ (unsigned char) *name) * 1099511628211ull;
+    return h;
+}
+
+static name_entry_t *name_find(name_table_t *table, const char *name, int create) {
+    if(create && (table->count + 1) * 2 > table->cap) {
+        name_entry_t *old = table->entries;
+        size_t old_cap = table->cap;
+        table->cap = table->cap ? table->cap * 2 : 64;
+        table->entries = mem_calloc(table->cap, sizeof(name_entry_t));
+        for(size_t i = 0; i < old_cap; i++) {
+            if(!old[i].name) continue;
+            size_t s = name_hash(old[i].name) & (table->cap - 1);
+            while(table->entries[s].name) s = (s + 1) & (table->cap - 1);
+            table->entries[s] = old[i];
+        }
+        mem_free(old);
+    }
+    if(!table->cap) return NULL;
+
+    size_t s = name_hash(name) & (table->cap - 1);
+    for(; table->entries[s].name; s = (s + 1) & (table->cap - 1)) {
+        if(strcmp(table->entries[s].name, name) == 0) return &table->entries[s];
+    }
+    if(!create) return NULL;
+    table->count++;
+    table->entries[s] = (name_entry_t) {.name = name};
+    return &table->entries[s];
+}
+
+static void name_table_clear(name_table_t *table) {
+    if(table->count) memset(table->entries, 0, sizeof(name_entry_t) * table->cap);
+    table->count = 0;
+}
+
+static int integer_type(expr_type_t type) {
+    return type >= INT8 && type <= UINT64;
+}
+
+// what a register of `type` holds after the arithmetic wrapped
+static int64_t normalize(int64_t value, expr_type_t type) {
+    switch(type) {
+        case INT8: return (int8_t) value;
+        case INT16: return (int16_t) value;
+        case INT32: return (int32_t) value;
+        case UINT8: return (uint8_t) value;
+        case UINT16: return (uint16_t) value;
+        case UINT32: return (uint32_t) value;
+        default: return value;
+    }
+}
+
+static ir_instruction_list_t *insert_after(ir_instruction_list_t *node, ir_instruction_t *inst) {
+    ir_instruction_list_t *added = mem_calloc(1, sizeof(ir_instruction_list_t));
+    added->instruction = inst;
+    added->next = node->next;
+    node->next = added;
+    return added;
+}
+
+// temps of the function starting at `start`, -1 if it has none
+static void temp_range(ir_instruction_list_t *start, int *min, int *max) {
+    *min = *max = -1;
+    for(ir_instruction_list_t *node = start->next; node; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst || inst->opcode == IR_FUNC_END) break;
+        ir_operand_t *ops[3] = {inst->dst, inst->src1, inst->src2};
+        if(inst->opcode == IR_CALL) ops[1] = NULL; // the callee, not a temp
+        for(int i = 0; i < 3; i++) {
+            if(!ops[i] || ops[i]->kind != IR_OPERAND_TEMP) continue;
+            int id = ops[i]->temp_id;
+            if(*min < 0 || id < *min) *min = id;
+            if(id > *max) *max = id;
+        }
+        for(size_t i = 0; inst->opcode == IR_CALL && i < inst->call.arg_count; i++) {
+            ir_operand_t *arg = inst->call.args[i];
+            if(!arg || arg->kind != IR_OPERAND_TEMP) continue;
+            if(*min < 0 || arg->temp_id < *min) *min = arg->temp_id;
+            if(arg->temp_id > *max) *max = arg->temp_id;
+        }
+    }
+}
+
+// constant propagation
+
+typedef struct fold_state {
+    name_table_t vars;
+    int64_t *temps;
+    char *known; // temps[i] holds the value of temp base + i
+    int base;
+    size_t count;
+    size_t cap;
+} fold_state_t;
+
+// the operand to use instead of `op`, a constant if its value is known
+static ir_operand_t *known_operand(fold_state_t *state, ir_operand_t *op) {
+    if(!op) return op;
+    if(op->kind == IR_OPERAND_TEMP) {
+        int64_t i = (int64_t) op->temp_id - state->base;
+        if(i >= 0 && (size_t) i < state->count && state->known[i]) return create_const_operand(state->temps[i], op->type);
+    }
+    else if(op->kind == IR_OPERAND_VAR) {
+        name_entry_t *var = name_find(&state->vars, op->var_name, 0);
+        if(var && var->set) return create_const_operand(var->value, op->type);
+    }
+    return op;
+}
+
+static int fold(enum ir_opcode opcode, int64_t a, int64_t b, expr_type_t type, int64_t *result) {
+    if(!integer_type(type)) return 0;
+    uint64_t x = (uint64_t) a, y = (uint64_t) b; // wraps instead of overflowing
+    switch(opcode) {
+        case IR_ADD: *result = normalize((int64_t) (x + y), type); return 1;
+        case IR_MINUS: *result = normalize((int64_t) (x - y), type); return 1;
+        case IR_MULT: *result = normalize((int64_t) (x * y), type); return 1;
+        default: return 0;
+    }
+}
+
+static void fold_function(ir_instruction_list_t *start, fold_state_t *state, ipa_stats_t *stats) {
+    int min, max;
+    temp_range(start, &min, &max);
+    state->base = min;
+    state->count = min < 0 ? 0 : (size_t) (max - min + 1);
+    if(state->count > state->cap) {
+        state->cap = state->count;
+        state->temps = mem_realloc(state->temps, sizeof(int64_t) * state->cap);
+        state->known = mem_realloc(state->known, state->cap);
+    }
+    if(state->count) memset(state->known, 0, state->count);
+    name_table_clear(&state->vars);
+
+    ir_instruction_list_t *prev = start;
+    for(ir_instruction_list_t *node = start->next; node; prev = node, node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst || inst->opcode == IR_FUNC_END) break;
+
+        switch(inst->opcode) {
+            case IR_ADD:
+            case IR_MINUS:
+            case IR_MULT: {
+                inst->src1 = known_operand(state, inst->src1);
+                inst->src2 = known_operand(state, inst->src2);
+                int64_t value;
+                if(inst->src1 && inst->src1->kind == IR_OPERAND_CONST && inst->src2 && inst->src2->kind == IR_OPERAND_CONST
+                    && inst->dst && inst->dst->kind == IR_OPERAND_TEMP
+                    && fold(inst->opcode, inst->src1->constant.int_val, inst->src2->constant.int_val, inst->result_type, &value)) {
+                    size_t i = (size_t) (inst->dst->temp_id - state->base);
+                    state->temps[i] = value;
+                    state->known[i] = 1;
+                    // every use comes later in the block and gets the constant
+                    prev->next = node->next;
+                    node = prev;
+                    stats->folded++;
+                }
+                break;
+            }
+
+            case IR_STORE: {
+                inst->src1 = known_operand(state, inst->src1);
+                name_entry_t *var = name_find(&state->vars, inst->dst->var_name, 1);
+                var->set = inst->src1 && inst->src1->kind == IR_OPERAND_CONST && integer_type(inst->dst->type);
+                if(var->set) var->value = normalize(inst->src1->constant.int_val, inst->dst->type);
+                break;
+            }
+
+            case IR_ALLOC: {
+                name_entry_t *var = name_find(&state->vars, inst->dst->var_name, 0);
+                if(var) var->set = 0;
+                break;
+            }
+
+            case IR_CALL: {
+                for(size_t i = 0; i < inst->call.arg_count; i++) {
+                    inst->call.args[i] = known_operand(state, inst->call.args[i]);
+                }
+                break;
+            }
+
+            case IR_RETURN: {
+                inst->src1 = known_operand(state, inst->src1);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+}
+
+void ipa_fold_constants(ir_instruction_list_t *ir, ipa_stats_t *stats) {
+    fold_state_t state = {0};
+    for(ir_instruction_list_t *node = ir; node; node = node->next) {
+        if(node->instruction && node->instruction->opcode == IR_FUNC_START) fold_function(node, &state, stats);
+    }
+    mem_free(state.vars.entries);
+    mem_free(state.temps);
+    mem_free(state.known);
+}
+
+// what the inliner and IPA-CP need to know about every function
+typedef struct function_info {
+    ir_instruction_list_t *start; // IR_FUNC_START
+    ir_instruction_list_t *end;   // IR_FUNC_END
+    size_t size;                  // instructions in between
+    int has_calls;
+    int definitions;
+    size_t call_sites;
+    int temp_min, temp_max;
+    size_t inlined; // copies made so far, names their variables apart
+} function_info_t;
+
+typedef struct function_table {
+    name_table_t names; // value: index into infos
+    function_info_t *infos;
+    size_t count;
+} function_table_t;
+
+static function_info_t *find_function(function_table_t *table, const char *name) {
+    name_entry_t *entry = name_find(&table->names, name, 0);
+    return entry ? &table->infos[entry->value] : NULL;
+}
+
+static void collect_functions(function_table_t *table, ir_instruction_list_t *ir) {
+    size_t cap = 0;
+    for(ir_instruction_list_t *node = ir; node; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst || inst->opcode != IR_FUNC_START) continue;
+
+        name_entry_t *entry = name_find(&table->names, inst->func.func_name, 1);
+        if(entry->set) {
+            table->infos[entry->value].definitions++;
+            continue;
+        }
+        if(table->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            table->infos = mem_realloc(table->infos, sizeof(function_info_t) * cap);
+        }
+        entry->set = 1;
+        entry->value = (int64_t) table->count;
+        function_info_t *info = &table->infos[table->count++];
+        *info = (function_info_t) {.start = node, .definitions = 1};
+        temp_range(node, &info->temp_min, &info->temp_max);
+
+        for(ir_instruction_list_t *body = node->next; body; body = body->next) {
+            if(!body->instruction) continue;
+            if(body->instruction->opcode == IR_FUNC_END) {
+                info->end = body;
+                break;
+            }
+            info->size++;
+            if(body->instruction->opcode == IR_CALL) info->has_calls = 1;
+        }
+    }
+
+    for(ir_instruction_list_t *node = ir; node; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst || inst->opcode != IR_CALL) continue;
+        function_info_t *callee = find_function(table, inst->src1->func_name);
+        if(callee) callee->call_sites++;
+    }
+}
+
+static void free_functions(function_table_t *table) {
+    mem_free(table->names.entries);
+    mem_free(table->infos);
+    *table = (function_table_t) {0};
+}
+
+// inlining
+
+typedef struct inline_copy {
+    const char *prefix; // callee.N. ahead of every variable of the copy
+    int temp_offset;
+} inline_copy_t;
+
+static ir_operand_t *copy_operand(inline_copy_t *copy, ir_operand_t *op) {
+    if(!op) return NULL;
+    if(op->kind == IR_OPERAND_TEMP) return create_tmp_operand(op->temp_id + copy->temp_offset, op->type);
+    if(op->kind == IR_OPERAND_VAR) {
+        size_t len = strlen(copy->prefix) + strlen(op->var_name) + 1;
+        char *name = mem_alloc(len);
+        snprintf(name, len, "%s%s", copy->prefix, op->var_name);
+        ir_operand_t *var = create_var_operand(name, op->type);
+        mem_free(name);
+        return var;
+    }
+    ir_operand_t *same = mem_alloc(sizeof(ir_operand_t));
+    *same = *op;
+    return same;
+}
+
+static ir_instruction_t *new_instruction(enum ir_opcode opcode, expr_type_t type, pos_t pos) {
+    ir_instruction_t *inst = mem_calloc(1, sizeof(ir_instruction_t));
+    inst->opcode = opcode;
+    inst->result_type = type;
+    inst->pos = pos;
+    return inst;
+}
+
+static int can_inline(function_info_t *callee, function_info_t *caller, ir_instruction_t *call, profile_t *profile) {
+    if(!callee || callee == caller || callee->definitions != 1 || callee->has_calls || !callee->end) return 0;
+    ir_instruction_t *start = callee->start->instruction;
+    if(start->func.param_count != call->call.arg_count || start->func.param_count > 6) return 0;
+
+    // calls the profile doesn't know get the default
+    size_t limit = IPA_INLINE_LIMIT;
+    uint64_t count;
+    if(profile && profile_call_count(profile, caller->start->instruction->func.func_name, start->func.func_name, &count)) {
+        if(count == 0) limit = 0;
+        else if(count >= profile->hottest_call / IPA_HOT_SHARE) limit = IPA_INLINE_HOT_LIMIT;
+    }
+    return callee->size <= limit || (start->func.is_static && callee->call_sites == 1);
+}
+
+// the call becomes: the parameters as locals of the caller, the callee's
+// body up to its return, and the call's temp set to the returned value
+static ir_instruction_list_t *inline_call(ir_instruction_list_t *call_node, function_info_t *callee, int *next_temp) {
+    ir_instruction_t *call = call_node->instruction;
+    ir_instruction_t *start = callee->start->instruction;
+
+    char prefix[512];
+    snprintf(prefix, sizeof(prefix), "%s.%zu.", start->func.func_name, callee->inlined++);
+    inline_copy_t copy = {prefix, 0};
+    if(callee->temp_min >= 0) {
+        copy.temp_offset = *next_temp - callee->temp_min;
+        *next_temp += callee->temp_max - callee->temp_min + 1;
+    }
+
+    ir_instruction_list_t *tail = NULL;
+    #define APPEND(inst) do { \
+        if(tail) tail = insert_after(tail, inst); \
+        else { call_node->instruction = inst; tail = call_node; } \
+    } while(0)
+
+    for(size_t i = 0; i < start->func.param_count; i++) {
+        ir_operand_t *param = start->func.params[i];
+        ir_instruction_t *alloc = new_instruction(IR_ALLOC, param->type, call->pos);
+        alloc->dst = copy_operand(&copy, param);
+        APPEND(alloc);
+        ir_instruction_t *store = new_instruction(IR_STORE, param->type, call->pos);
+        store->dst = copy_operand(&copy, param);
+        store->src1 = call->call.args[i];
+        APPEND(store);
+    }
+
+    ir_operand_t *result = NULL;
+    for(ir_instruction_list_t *node = callee->start->next; node != callee->end; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst) continue;
+        if(inst->opcode == IR_RETURN) {
+            result = copy_operand(&copy, inst->src1);
+            break;
+        }
+        ir_instruction_t *body = mem_alloc(sizeof(ir_instruction_t));
+        *body = *inst;
+        body->dst = copy_operand(&copy, inst->dst);
+        body->src1 = copy_operand(&copy, inst->src1);
+        body->src2 = copy_operand(&copy, inst->src2);
+        APPEND(body);
+    }
+
+    // `t = value + 0` is the only way to give a temp a value; it folds or
+    // becomes a single mov
+    ir_instruction_t *move = new_instruction(IR_ADD, call->result_type, call->pos);
+    move->dst = call->dst;
+    move->src1 = result ? result : create_const_operand(0, INT32);
+    move->src2 = create_const_operand(0, INT32);
+    APPEND(move);
+    #undef APPEND
+
+    return tail;
+}
+
+static size_t inline_round(ir_instruction_list_t *ir, profile_t *profile) {
+    function_table_t table = {0};
+    collect_functions(&table, ir);
+
+    size_t inlined = 0;
+    for(size_t f = 0; f < table.count; f++) {
+        function_info_t *caller = &table.infos[f];
+        if(!caller->has_calls || !caller->end) continue;
+        int next_temp = caller->temp_max + 1;
+
+        for(ir_instruction_list_t *node = caller->start->next; node && node != caller->end; node = node->next) {
+            ir_instruction_t *inst = node->instruction;
+            if(!inst || inst->opcode != IR_CALL) continue;
+            function_info_t *callee = find_function(&table, inst->src1->func_name);
+            if(!can_inline(callee, caller, inst, profile)) continue;
+            node = inline_call(node, callee, &next_temp);
+            callee->call_sites--;
+            inlined++;
+        }
+    }
+
+    free_functions(&table);
+    return inlined;
+}
+
+// interprocedural constant propagation: a parameter of a static function
+// that every call passes the same constant is set to it on entry
+static size_t propagate_params(ir_instruction_list_t *ir) {
+    function_table_t table = {0};
+    collect_functions(&table, ir);
+
+    // per function and parameter: 0 nothing seen, 1 constant, 2 varies
+    char **seen = mem_calloc(table.count + 1, sizeof(char *));
+    int64_t **values = mem_calloc(table.count + 1, sizeof(int64_t *));
+    for(size_t f = 0; f < table.count; f++) {
+        size_t params = table.infos[f].start->instruction->func.param_count;
+        seen[f] = mem_calloc(params + 1, 1);
+        values[f] = mem_calloc(params + 1, sizeof(int64_t));
+    }
+
+    for(ir_instruction_list_t *node = ir; node; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst || inst->opcode != IR_CALL) continue;
+        function_info_t *callee = find_function(&table, inst->src1->func_name);
+        if(!callee) continue;
+        size_t f = (size_t) (callee - table.infos);
+        ir_instruction_t *start = callee->start->instruction;
+
+        for(size_t i = 0; i < start->func.param_count; i++) {
+            ir_operand_t *arg = i < inst->call.arg_count ? inst->call.args[i] : NULL;
+            expr_type_t type = start->func.params[i]->type;
+            if(inst->call.arg_count != start->func.param_count || !arg || arg->kind != IR_OPERAND_CONST || !integer_type(type)) {
+                seen[f][i] = 2;
+                continue;
+            }
+            int64_t value = normalize(arg->constant.int_val, type);
+            if(seen[f][i] == 0) {
+                seen[f][i] = 1;
+                values[f][i] = value;
+            }
+            else if(seen[f][i] == 1 && values[f][i] != value) seen[f][i] = 2;
+        }
+    }
+
+    size_t propagated = 0;
+    for(size_t f = 0; f < table.count; f++) {
+        function_info_t *info = &table.infos[f];
+        ir_instruction_t *start = info->start->instruction;
+        if(!start->func.is_static || info->definitions != 1) continue;
+        ir_instruction_list_t *at = info->start;
+        for(size_t i = 0; i < start->func.param_count; i++) {
+            if(seen[f][i] != 1) continue;
+            ir_operand_t *param = start->func.params[i];
+            ir_instruction_t *store = new_instruction(IR_STORE, param->type, start->pos);
+            store->dst = create_var_operand(param->var_name, param->type);
+            store->src1 = create_const_operand(values[f][i], param->type);
+            at = insert_after(at, store);
+            propagated++;
+        }
+    }
+
+    for(size_t f = 0; f < table.count; f++) {
+        mem_free(seen[f]);
+        mem_free(values[f]);
+    }
+    mem_free(seen);
+    mem_free(values);
+    free_functions(&table);
+    return propagated;
+}
+
+void ipa_optimize(ir_instruction_list_t *ir, profile_t *profile, ipa_stats_t *stats) {
+    ipa_fold_constants(ir, stats);
+    for(int round = 0; round < IPA_INLINE_ROUNDS; round++) {
+        size_t inlined = inline_round(ir, profile);
+        if(!inlined) break;
+        stats->inlined += inlined;
+        ipa_fold_constants(ir, stats);
+    }
+
+    stats->params += propagate_params(ir);
+    ipa_fold_constants(ir, stats);
+}
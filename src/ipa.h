@@ -0,0 +1,38 @@
+#ifndef _IPA_H
+#define _IPA_H
+
+#include <stddef.h>
+
+#include "ir.h"
+#include "profile.h"
+
+// callees up to this many IR instructions are inlined, longer ones only
+// when they're static and called once
+#define IPA_INLINE_LIMIT 32
+#define IPA_INLINE_ROUNDS 3
+// with a profile, call sites that ran at least 1/IPA_HOT_SHARE as often as
+// the hottest one take callees up to IPA_INLINE_HOT_LIMIT, and ones that
+// never ran only static callees called once
+#define IPA_INLINE_HOT_LIMIT 128
+#define IPA_HOT_SHARE 16
+
+typedef struct ipa_stats {
+    size_t inlined;    // call sites replaced by the callee's body
+    size_t folded;     // arithmetic on constants done at compile time
+    size_t params;     // parameters every caller passes the same constant
+    size_t dropped;    // static functions nothing calls any more
+} ipa_stats_t;
+
+// Interprocedural passes over a whole program, for -flto. The IR has no
+// branches, so every function is a single block: constants are propagated
+// and folded in one forward walk, and a callee without calls of its own can
+// be spliced into its caller as is. Only static functions are known to have
+// every caller in the IR; the rest keep their bodies and their parameters.
+// Static functions left without callers are for ir_drop_dead_functions.
+// `profile`, from -fprofile-use, may be NULL.
+void ipa_optimize(ir_instruction_list_t *ir, profile_t *profile, ipa_stats_t *stats);
+
+// the constant propagation and folding on its own
+void ipa_fold_constants(ir_instruction_list_t *ir, ipa_stats_t *stats);
+
+#endif
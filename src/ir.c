@@ -3,12 +3,13 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "alloc.h"
 #include "ir.h"
 #include "lexer.h"
 #include "parser.h"
 
 ir_operand_t *create_const_operand(int64_t value, expr_type_t type) {
-    ir_operand_t *op = malloc(sizeof(ir_operand_t));
+    ir_operand_t *op = mem_alloc(sizeof(ir_operand_t));
     op->kind = IR_OPERAND_CONST;
     op->type = type;
     op->constant.int_val = value;
@@ -16,15 +17,15 @@ ir_operand_t *create_const_operand(int64_t value, expr_type_t type) {
 }
 
 ir_operand_t *create_var_operand(char *name, expr_type_t type) {
-    ir_operand_t *op = malloc(sizeof(ir_operand_t));
+    ir_operand_t *op = mem_alloc(sizeof(ir_operand_t));
     op->kind = IR_OPERAND_VAR;
     op->type = type;
-    op->var_name = strdup(name);
+    op->var_name = mem_strdup(name);
     return op;
 }
 
 ir_operand_t *create_tmp_operand(int id, expr_type_t type) {
-    ir_operand_t *op = malloc(sizeof(ir_operand_t));
+    ir_operand_t *op = mem_alloc(sizeof(ir_operand_t));
     op->kind = IR_OPERAND_TEMP;
     op->type = type;
     op->temp_id = id;
@@ -36,14 +37,16 @@ int new_temp(ir_context_t *ctx) {
 }
 
 char *new_label(ir_context_t *ctx) {
-    char *label = malloc(32); // TODO: uhh, i hope this is enough :)
+    char *label = mem_alloc(32); // TODO: uhh, i hope this is enough :)
     snprintf(label, 32, "L%d", ctx->label_counter++);
     return label;
 }
 
 void emit_instruction(ir_context_t *ctx, ir_instruction_t *inst) {
+    if(inst->pos.line == 0) inst->pos = ctx->pos;
     ctx->instructions->instruction = inst;
-    ctx->instructions->next = calloc(1, sizeof(ir_instruction_list_t));
+    ctx->last = inst;
+    ctx->instructions->next = mem_calloc(1, sizeof(ir_instruction_list_t));
     ctx->instructions = ctx->instructions->next;
 }
 
@@ -56,17 +59,18 @@ ir_operand_t *generate_expr_ir(ast_node_t *expr, ir_context_t *ctx) {
         }
 
         case AST_FUNCTION_CALL: {
-            ir_instruction_t *inst = calloc(1, sizeof(ir_instruction_t));
+            ir_instruction_t *inst = mem_calloc(1, sizeof(ir_instruction_t));
             ir_operand_t *dst = create_tmp_operand(new_temp(ctx), INT32); // support types :)
             ir_operand_t *res = create_tmp_operand(new_temp(ctx), INT32); // support types :)
             res->func_name = expr->expr.identifier;
 
             inst->opcode = IR_CALL;
+            inst->pos = expr->pos;
             inst->dst = dst;
             inst->src1 = res;
             inst->result_type = INT32; // TODO: get this (add in semantics)
             inst->call.arg_count = expr->expr.call.arg_count;
-            inst->call.args = malloc(sizeof(ir_operand_t*) * inst->call.arg_count);
+            inst->call.args = mem_alloc(sizeof(ir_operand_t*) * inst->call.arg_count);
             for(size_t i = 0; i < inst->call.arg_count; i++) {
                     inst->call.args[i] = generate_expr_ir(expr->expr.call.args[i], ctx);
             }
@@ -87,7 +91,8 @@ ir_operand_t *generate_expr_ir(ast_node_t *expr, ir_context_t *ctx) {
             int temp_id = new_temp(ctx);
             ir_operand_t *res = create_tmp_operand(temp_id, expr->resolved_type);
 
-            ir_instruction_t *inst = calloc(1, sizeof(ir_instruction_t));
+            ir_instruction_t *inst = mem_calloc(1, sizeof(ir_instruction_t));
+            inst->pos = expr->pos;
             inst->dst = res;
             inst->src1 = left;
             inst->src2 = right;
@@ -132,10 +137,11 @@ void generate_block_ir(struct block_member *blck_meber, ir_context_t *ctx) {
 
 void generate_statement_ir(ast_statement_t *stmt, ir_context_t *ctx) {
     if(!stmt) return;
+    ctx->pos = stmt->pos;
 
     switch (stmt->type) {
         case AST_VAR_DECLARATION: {
-            ir_instruction_t *inst = calloc(1, sizeof(ir_instruction_t));
+            ir_instruction_t *inst = mem_calloc(1, sizeof(ir_instruction_t));
             inst->opcode = IR_ALLOC;
             inst->result_type = stmt->statement.declaration.t;
             inst->dst = create_var_operand(stmt->statement.declaration.identifier, stmt->statement.declaration.t);
@@ -150,7 +156,7 @@ void generate_statement_ir(ast_statement_t *stmt, ir_context_t *ctx) {
 
         case AST_VAR_ASSIGNMENT: {
             ir_operand_t *value = generate_expr_ir(stmt->statement.assignment.value, ctx);
-            ir_instruction_t *inst = calloc(1, sizeof(ir_instruction_t));
+            ir_instruction_t *inst = mem_calloc(1, sizeof(ir_instruction_t));
             inst->opcode = IR_STORE;
             inst->result_type = stmt->statement.assignment.resolved_var_type;
             inst->dst = create_var_operand(stmt->statement.assignment.identifier, stmt->statement.assignment.resolved_var_type);
@@ -164,7 +170,13 @@ void generate_statement_ir(ast_statement_t *stmt, ir_context_t *ctx) {
         case AST_RETURN_STMT: {
             ir_operand_t *val = generate_expr_ir(stmt->statement.ret.value, ctx);
 
-            ir_instruction_t *inst = calloc(1, sizeof(ir_instruction_t));
+            // return f(x); -> the call is the last thing the function does
+            ast_node_t *value = stmt->statement.ret.value;
+            if(value && value->type == AST_FUNCTION_CALL && ctx->last && ctx->last->opcode == IR_CALL) {
+                ctx->last->call.tail = 1;
+            }
+
+            ir_instruction_t *inst = mem_calloc(1, sizeof(ir_instruction_t));
             inst->opcode = IR_RETURN;
             inst->result_type = val ? val->type : VOID_T;
             inst->src1 = val;
@@ -174,16 +186,17 @@ void generate_statement_ir(ast_statement_t *stmt, ir_context_t *ctx) {
         }
 
         case AST_FUNC_DECLARATION: {
-            ir_instruction_t *inst_start = calloc(1, sizeof(ir_instruction_t));
+            ir_instruction_t *inst_start = mem_calloc(1, sizeof(ir_instruction_t));
             inst_start->opcode = IR_FUNC_START;
             inst_start->result_type = stmt->statement.function.type;
-            inst_start->func.func_name = strdup(stmt->statement.function.identifier);
+            inst_start->func.func_name = mem_strdup(stmt->statement.function.identifier);
             inst_start->func.param_count = stmt->statement.function.arg_count;
             inst_start->func.return_type = stmt->statement.function.type;
             inst_start->func.stack_size = stmt->statement.function.stack_size;
+            inst_start->func.is_static = stmt->statement.function.is_static;
 
             if (stmt->statement.function.arg_count > 0) {
-                inst_start->func.params = malloc(sizeof(ir_operand_t*) * stmt->statement.function.arg_count);
+                inst_start->func.params = mem_alloc(sizeof(ir_operand_t*) * stmt->statement.function.arg_count);
                 for (size_t i = 0; i < stmt->statement.function.arg_count; i++) {
                     inst_start->func.params[i] = create_var_operand(
                         stmt->statement.function.args[i].identifier,
@@ -195,7 +208,7 @@ void generate_statement_ir(ast_statement_t *stmt, ir_context_t *ctx) {
             emit_instruction(ctx, inst_start);
             generate_block_ir(stmt->statement.function.block, ctx);
 
-            ir_instruction_t *inst_end = calloc(1, sizeof(ir_instruction_t));
+            ir_instruction_t *inst_end = mem_calloc(1, sizeof(ir_instruction_t));
             inst_end->opcode = IR_FUNC_END;
             inst_end->result_type = VOID_T;
             emit_instruction(ctx, inst_end);
@@ -209,11 +222,19 @@ void generate_statement_ir(ast_statement_t *stmt, ir_context_t *ctx) {
     }
 }
 
+ir_instruction_list_t *generate_ir_statement(ir_context_t *ctx, ast_statement_t *stmt) {
+    ctx->instructions = mem_calloc(1, sizeof(struct ir_instruction_list));
+    ctx->last = NULL;
+    ir_instruction_list_t *head = ctx->instructions;
+    generate_statement_ir(stmt, ctx);
+    return head;
+}
+
 ir_instruction_list_t *generate_ir(struct statement_list *ast) {
     ir_context_t ctx = {0};
     ctx.label_counter = 0;
     ctx.temp_counter = 0;
-    ctx.instructions = malloc(sizeof(struct ir_instruction_list));
+    ctx.instructions = mem_calloc(1, sizeof(struct ir_instruction_list));
     ir_instruction_list_t *head = ctx.instructions;
 
     struct statement_list *current = ast;
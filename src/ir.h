@@ -50,6 +50,7 @@ typedef struct {
 typedef struct {
     enum ir_opcode opcode;
     expr_type_t result_type;
+    pos_t pos; // source position, line 0 if unknown
     ir_operand_t *dst;
     ir_operand_t *src1;
     ir_operand_t *src2;
@@ -58,6 +59,7 @@ typedef struct {
         struct {
             ir_operand_t **args;
             size_t arg_count;
+            int tail; // call in tail position (return f(x);)
         } call;
 
         struct {
@@ -66,6 +68,7 @@ typedef struct {
             size_t param_count;
             size_t stack_size;
             expr_type_t return_type;
+            int is_static; // no global symbol, and dropped if nothing calls it
         } func;
     };
 } ir_instruction_t;
@@ -77,10 +80,19 @@ typedef struct ir_instruction_list {
 
 typedef struct ir_context {
     struct ir_instruction_list *instructions;
+    ir_instruction_t *last;
+    pos_t pos; // of the statement being lowered
     int temp_counter;
     int label_counter;
 } ir_context_t;
 
+ir_operand_t *create_const_operand(int64_t value, expr_type_t type);
+ir_operand_t *create_var_operand(char *name, expr_type_t type);
+ir_operand_t *create_tmp_operand(int id, expr_type_t type);
+
 ir_instruction_list_t *generate_ir(struct statement_list *ast);
+// one top-level statement on a list of its own; temps and labels carry on
+// from the statements before, as if generate_ir had lowered them together
+ir_instruction_list_t *generate_ir_statement(ir_context_t *ctx, ast_statement_t *stmt);
 
 #endif
@@ -0,0 +1,538 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "diag.h"
+#include "ir_binary.h"
+#include "ir.h"
+
+// Writer
+
+typedef struct ir_writer {
+    // string table, open addressing on top of the offsets array
+    char **strings;
+    uint32_t string_count;
+    uint32_t string_cap;
+    uint32_t *string_slots; // index + 1, 0 = empty
+    uint32_t slot_cap;
+    uint64_t string_bytes;
+
+    ir_binary_operand_t *operands;
+    uint32_t operand_count;
+    uint32_t operand_cap;
+
+    uint32_t *lists;
+    uint32_t list_count;
+    uint32_t list_cap;
+
+    ir_binary_instruction_t *instructions;
+    uint32_t instruction_count;
+    uint32_t instruction_cap;
+
+    ir_binary_function_t *functions;
+    uint32_t function_count;
+    uint32_t function_cap;
+} ir_writer_t;
+
+#define GROW(array, count, cap) \
+    do { \
+        if((count) == (cap)) { \
+            (cap) = (cap) ? (cap) * 2 : 64; \
+            (array) = mem_realloc((array), sizeof(*(array)) * (cap)); \
+        } \
+    } while(0)
+
+static uint32_t string_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while(*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void string_rehash(ir_writer_t *w) {
+    mem_free(w->string_slots);
+    w->slot_cap = w->slot_cap ? w->slot_cap * 2 : 256;
+    w->string_slots = mem_calloc(w->slot_cap, sizeof(uint32_t));
+    for(uint32_t i = 0; i < w->string_count; i++) {
+        uint32_t slot = string_hash(w->strings[i]) & (w->slot_cap - 1);
+        while(w->string_slots[slot]) slot = (slot + 1) & (w->slot_cap - 1);
+        w->string_slots[slot] = i + 1;
+    }
+}
+
+static uint32_t intern_string(ir_writer_t *w, char *s) {
+    if((w->string_count + 1) * 2 > w->slot_cap) string_rehash(w);
+
+    uint32_t slot = string_hash(s) & (w->slot_cap - 1);
+    while(w->string_slots[slot]) {
+        uint32_t index = w->string_slots[slot] - 1;
+        if(strcmp(w->strings[index], s) == 0) return index;
+        slot = (slot + 1) & (w->slot_cap - 1);
+    }
+
+    GROW(w->strings, w->string_count, w->string_cap);
+    w->strings[w->string_count] = s;
+    w->string_slots[slot] = w->string_count + 1;
+    w->string_bytes += strlen(s) + 1;
+    return w->string_count++;
+}
+
+static uint32_t write_operand(ir_writer_t *w, ir_operand_t *op) {
+    if(!op) return IR_NO_OPERAND;
+
+    ir_binary_operand_t rec = {0};
+    rec.kind = op->kind;
+    rec.type = (uint32_t) op->type;
+    switch(op->kind) {
+        case IR_OPERAND_TEMP: rec.value = op->temp_id; break;
+        case IR_OPERAND_CONST: rec.value = op->constant.int_val; break;
+        case IR_OPERAND_VAR: rec.value = intern_string(w, op->var_name); break;
+        case IR_OPERAND_LABEL: rec.value = intern_string(w, op->label_name); break;
+        case IR_OPERAND_FUNC: rec.value = intern_string(w, op->func_name); break;
+    }
+
+    GROW(w->operands, w->operand_count, w->operand_cap);
+    w->operands[w->operand_count] = rec;
+    return w->operand_count++;
+}
+
+static uint32_t write_operand_list(ir_writer_t *w, ir_operand_t **ops, size_t count) {
+    uint32_t *indices = mem_alloc(sizeof(uint32_t) * (count + 1));
+    for(size_t i = 0; i < count; i++) {
+        indices[i] = write_operand(w, ops[i]);
+    }
+
+    uint32_t first = w->list_count;
+    for(size_t i = 0; i < count; i++) {
+        GROW(w->lists, w->list_count, w->list_cap);
+        w->lists[w->list_count++] = indices[i];
+    }
+    mem_free(indices);
+    return first;
+}
+
+static void write_instruction(ir_writer_t *w, ir_instruction_t *inst) {
+    ir_binary_instruction_t rec = {0};
+    rec.opcode = inst->opcode;
+    rec.result_type = (uint32_t) inst->result_type;
+    rec.line = (uint32_t) inst->pos.line;
+    rec.column = (uint32_t) inst->pos.column;
+    rec.dst = write_operand(w, inst->dst);
+    rec.src2 = write_operand(w, inst->src2);
+    rec.src1 = IR_NO_OPERAND;
+    rec.function = IR_NO_OPERAND;
+
+    switch(inst->opcode) {
+        case IR_CALL: {
+            // src1 is a temp carrying the callee name, store it as what it is
+            ir_operand_t callee = {.kind = IR_OPERAND_FUNC, .type = inst->src1->type};
+            callee.func_name = inst->src1->func_name;
+            rec.src1 = write_operand(w, &callee);
+            rec.tail = inst->call.tail;
+            rec.arg_count = inst->call.arg_count;
+            rec.args = write_operand_list(w, inst->call.args, inst->call.arg_count);
+            break;
+        }
+
+        case IR_FUNC_START: {
+            ir_binary_function_t fn = {0};
+            fn.name = intern_string(w, inst->func.func_name);
+            fn.return_type = (uint32_t) inst->func.return_type;
+            fn.param_count = inst->func.param_count;
+            fn.params = write_operand_list(w, inst->func.params, inst->func.param_count);
+            fn.stack_size = inst->func.stack_size;
+            fn.flags = inst->func.is_static ? IR_FUNCTION_STATIC : 0;
+            fn.first_instruction = w->instruction_count;
+
+            GROW(w->functions, w->function_count, w->function_cap);
+            rec.function = w->function_count;
+            w->functions[w->function_count++] = fn;
+            break;
+        }
+
+        case IR_FUNC_END: {
+            if(w->function_count > 0) {
+                ir_binary_function_t *fn = &w->functions[w->function_count - 1];
+                fn->instruction_count = w->instruction_count + 1 - fn->first_instruction;
+            }
+            rec.src1 = write_operand(w, inst->src1);
+            break;
+        }
+
+        default:
+            rec.src1 = write_operand(w, inst->src1);
+            break;
+    }
+
+    GROW(w->instructions, w->instruction_count, w->instruction_cap);
+    w->instructions[w->instruction_count++] = rec;
+}
+
+static inline uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+static void write_padding(FILE *f, uint64_t from, uint64_t to) {
+    while(from++ < to) fputc(0, f);
+}
+
+int ir_write_binary(ir_instruction_list_t *ir, const char *source_name, FILE *f) {
+    ir_writer_t w = {0};
+    uint32_t source = source_name ? intern_string(&w, (char *) source_name) : IR_NO_OPERAND;
+
+    for(ir_instruction_list_t *cur = ir; cur && cur->instruction; cur = cur->next) {
+        write_instruction(&w, cur->instruction);
+    }
+
+    ir_binary_header_t header = {0};
+    memcpy(header.magic, IR_BINARY_MAGIC, 4);
+    header.version = IR_BINARY_VERSION;
+    header.string_count = w.string_count;
+    header.operand_count = w.operand_count;
+    header.list_count = w.list_count;
+    header.instruction_count = w.instruction_count;
+    header.function_count = w.function_count;
+    header.source = source;
+
+    header.string_offsets = align8(sizeof(header));
+    header.string_data = align8(header.string_offsets + sizeof(uint32_t) * w.string_count);
+    header.operands = align8(header.string_data + w.string_bytes);
+    header.lists = align8(header.operands + sizeof(ir_binary_operand_t) * w.operand_count);
+    header.instructions = align8(header.lists + sizeof(uint32_t) * w.list_count);
+    header.functions = align8(header.instructions + sizeof(ir_binary_instruction_t) * w.instruction_count);
+    header.file_size = header.functions + sizeof(ir_binary_function_t) * w.function_count;
+
+    fwrite(&header, sizeof(header), 1, f);
+    write_padding(f, sizeof(header), header.string_offsets);
+
+    uint32_t offset = 0;
+    for(uint32_t i = 0; i < w.string_count; i++) {
+        fwrite(&offset, sizeof(offset), 1, f);
+        offset += strlen(w.strings[i]) + 1;
+    }
+    write_padding(f, header.string_offsets + sizeof(uint32_t) * w.string_count, header.string_data);
+
+    for(uint32_t i = 0; i < w.string_count; i++) {
+        fwrite(w.strings[i], 1, strlen(w.strings[i]) + 1, f);
+    }
+    write_padding(f, header.string_data + w.string_bytes, header.operands);
+
+    fwrite(w.operands, sizeof(ir_binary_operand_t), w.operand_count, f);
+    fwrite(w.lists, sizeof(uint32_t), w.list_count, f);
+    write_padding(f, header.lists + sizeof(uint32_t) * w.list_count, header.instructions);
+    fwrite(w.instructions, sizeof(ir_binary_instruction_t), w.instruction_count, f);
+    fwrite(w.functions, sizeof(ir_binary_function_t), w.function_count, f);
+
+    mem_free(w.strings);
+    mem_free(w.string_slots);
+    mem_free(w.operands);
+    mem_free(w.lists);
+    mem_free(w.instructions);
+    mem_free(w.functions);
+
+    return ferror(f) ? -1 : 0;
+}
+
+// Reader
+
+static int read_error(const char *path, const char *msg) {
+    fprintf(diag_stream(), "IR error: %s: %s\n", path, msg);
+    return -1;
+}
+
+int ir_is_binary(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if(!f) return 0;
+    char magic[4] = {0};
+    size_t n = fread(magic, 1, 4, f);
+    fclose(f);
+    return n == 4 && memcmp(magic, IR_BINARY_MAGIC, 4) == 0;
+}
+
+static int table_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / size && offset % 4 == 0;
+}
+
+static int validate_header(const char *path, ir_binary_header_t *h, size_t size) {
+    if(size < sizeof(ir_binary_header_t) || memcmp(h->magic, IR_BINARY_MAGIC, 4) != 0) {
+        return read_error(path, "not a DivC IR file");
+    }
+    if(h->version != IR_BINARY_VERSION) {
+        return read_error(path, "unsupported IR version");
+    }
+    if(h->file_size > size
+        || !table_fits(h->string_offsets, h->string_count, sizeof(uint32_t), size)
+        || h->string_data > size
+        || !table_fits(h->operands, h->operand_count, sizeof(ir_binary_operand_t), size)
+        || !table_fits(h->lists, h->list_count, sizeof(uint32_t), size)
+        || !table_fits(h->instructions, h->instruction_count, sizeof(ir_binary_instruction_t), size)
+        || !table_fits(h->functions, h->function_count, sizeof(ir_binary_function_t), size)) {
+        return read_error(path, "truncated or corrupt IR file");
+    }
+    return 0;
+}
+
+static char *read_string(uint8_t *base, ir_binary_header_t *h, size_t size, int64_t index) {
+    if(index < 0 || (uint64_t) index >= h->string_count) return NULL;
+    uint32_t offset = ((uint32_t *) (base + h->string_offsets))[index];
+    if(h->string_data + offset >= size) return NULL;
+    char *s = (char *) base + h->string_data + offset;
+    if(memchr(s, '\0', size - (h->string_data + offset)) == NULL) return NULL;
+    return s;
+}
+
+// a type the records may carry at all, and one a value can be loaded with
+static int valid_type(uint32_t type) {
+    return (type & ~(uint32_t) TYPE_POINTER) < UNKNOWN_TYPE;
+}
+
+static int value_type(expr_type_t type) {
+    int size = get_type_size(type);
+    return size > 0 && size <= 8;
+}
+
+static int is_value(ir_operand_t *op) {
+    return op && op->kind != IR_OPERAND_LABEL && op->kind != IR_OPERAND_FUNC && value_type(op->type);
+}
+
+static int is_kind(ir_operand_t *op, enum ir_operand_kind kind) {
+    return op && op->kind == kind && (kind == IR_OPERAND_FUNC || value_type(op->type));
+}
+
+// the operands an opcode takes, as lowered by generate_ir
+static int check_instruction(ir_instruction_t *inst) {
+    switch(inst->opcode) {
+        case IR_ADD:
+        case IR_MINUS:
+        case IR_MULT:
+            return is_kind(inst->dst, IR_OPERAND_TEMP) && is_value(inst->src1) && is_value(inst->src2);
+
+        case IR_ALLOC:
+            return is_kind(inst->dst, IR_OPERAND_VAR) && !inst->src1 && !inst->src2;
+
+        case IR_STORE:
+            return is_kind(inst->dst, IR_OPERAND_VAR) && is_value(inst->src1) && !inst->src2;
+
+        case IR_CALL:
+            if(!is_kind(inst->dst, IR_OPERAND_TEMP) || !is_kind(inst->src1, IR_OPERAND_FUNC) || inst->src2) return 0;
+            for(size_t i = 0; i < inst->call.arg_count; i++) {
+                if(!is_value(inst->call.args[i])) return 0;
+            }
+            return 1;
+
+        case IR_FUNC_START:
+            for(size_t i = 0; i < inst->func.param_count; i++) {
+                if(!is_kind(inst->func.params[i], IR_OPERAND_VAR)) return 0;
+            }
+            return !inst->dst && !inst->src1 && !inst->src2;
+
+        case IR_FUNC_END:
+            return !inst->dst && !inst->src1 && !inst->src2;
+
+        case IR_RETURN:
+            return !inst->dst && (!inst->src1 || is_value(inst->src1)) && !inst->src2;
+
+        default:
+            return 0;
+    }
+}
+
+static int compare_temp(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// Temps are renumbered densely, keeping their order. Passes size per
+// function tables by the spread of its temp ids, a file could otherwise
+// make that anything.
+static void renumber_temps(ir_operand_t *operands, uint32_t count) {
+    int *ids = mem_alloc(sizeof(int) * (count + 1));
+    size_t n = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        if(operands[i].kind == IR_OPERAND_TEMP) ids[n++] = operands[i].temp_id;
+    }
+    qsort(ids, n, sizeof(int), compare_temp);
+
+    size_t unique = 0;
+    for(size_t i = 0; i < n; i++) {
+        if(unique == 0 || ids[unique - 1] != ids[i]) ids[unique++] = ids[i];
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        if(operands[i].kind != IR_OPERAND_TEMP) continue;
+        int *rank = bsearch(&operands[i].temp_id, ids, unique, sizeof(int), compare_temp);
+        operands[i].temp_id = (int) (rank - ids);
+    }
+    mem_free(ids);
+}
+
+ir_file_t *ir_read_binary(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        read_error(path, "cannot open");
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(ir_binary_header_t)) {
+        close(fd);
+        read_error(path, "not a DivC IR file");
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    uint8_t *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        read_error(path, "mmap failed");
+        return NULL;
+    }
+
+    ir_binary_header_t *h = (ir_binary_header_t *) base;
+    if(validate_header(path, h, size) != 0) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    ir_binary_operand_t *operands = (ir_binary_operand_t *) (base + h->operands);
+    uint32_t *lists = (uint32_t *) (base + h->lists);
+    ir_binary_instruction_t *instructions = (ir_binary_instruction_t *) (base + h->instructions);
+    ir_binary_function_t *functions = (ir_binary_function_t *) (base + h->functions);
+
+    ir_file_t *file = mem_calloc(1, sizeof(ir_file_t));
+    file->map = base;
+    file->size = size;
+
+    file->operands = mem_calloc(h->operand_count + 1, sizeof(ir_operand_t));
+    file->lists = mem_calloc(h->list_count + 1, sizeof(ir_operand_t*));
+    file->instructions = mem_calloc(h->instruction_count + 1, sizeof(ir_instruction_t));
+    file->ir = mem_calloc(h->instruction_count + 1, sizeof(ir_instruction_list_t));
+
+    int corrupt = 0;
+    if(h->source != IR_NO_OPERAND) {
+        file->source = read_string(base, h, size, h->source);
+        if(!file->source) corrupt = 1;
+    }
+
+    for(uint32_t i = 0; i < h->operand_count; i++) {
+        ir_operand_t *op = &file->operands[i];
+        op->kind = operands[i].kind;
+        op->type = (expr_type_t) operands[i].type;
+        if(!valid_type(operands[i].type)) corrupt = 1;
+        switch(op->kind) {
+            case IR_OPERAND_TEMP:
+                if(operands[i].value < 0 || operands[i].value > INT32_MAX) corrupt = 1;
+                op->temp_id = (int) operands[i].value;
+                break;
+            case IR_OPERAND_CONST: op->constant.int_val = operands[i].value; break;
+            case IR_OPERAND_VAR:
+            case IR_OPERAND_LABEL:
+            case IR_OPERAND_FUNC:
+                // all three share the union slot
+                op->var_name = read_string(base, h, size, operands[i].value);
+                if(!op->var_name) corrupt = 1;
+                break;
+            default:
+                corrupt = 1;
+                break;
+        }
+    }
+
+    if(!corrupt) renumber_temps(file->operands, h->operand_count);
+
+#define OPERAND(index) ((index) == IR_NO_OPERAND ? NULL : (index) < h->operand_count ? &file->operands[(index)] : (corrupt = 1, NULL))
+
+    for(uint32_t i = 0; i < h->list_count; i++) {
+        file->lists[i] = OPERAND(lists[i]);
+    }
+
+    ir_instruction_t *function = NULL; // FUNC_START of the function being read
+    for(uint32_t i = 0; i < h->instruction_count && !corrupt; i++) {
+        ir_binary_instruction_t *rec = &instructions[i];
+        ir_instruction_t *inst = &file->instructions[i];
+
+        if(!valid_type(rec->result_type) || rec->line > INT32_MAX || rec->column > INT32_MAX) {
+            corrupt = 1;
+            break;
+        }
+        inst->opcode = rec->opcode;
+        inst->result_type = (expr_type_t) rec->result_type;
+        inst->pos = (pos_t) {(int) rec->line, (int) rec->column};
+        inst->dst = OPERAND(rec->dst);
+        inst->src1 = OPERAND(rec->src1);
+        inst->src2 = OPERAND(rec->src2);
+
+        if(inst->opcode == IR_CALL) {
+            if(!inst->src1 || (uint64_t) rec->args + rec->arg_count > h->list_count) {
+                corrupt = 1;
+                break;
+            }
+            inst->call.args = &file->lists[rec->args];
+            inst->call.arg_count = rec->arg_count;
+            inst->call.tail = rec->tail;
+        }
+        else if(inst->opcode == IR_FUNC_START) {
+            if(rec->function >= h->function_count) {
+                corrupt = 1;
+                break;
+            }
+            ir_binary_function_t *fn = &functions[rec->function];
+            if((uint64_t) fn->params + fn->param_count > h->list_count) {
+                corrupt = 1;
+                break;
+            }
+            inst->func.func_name = read_string(base, h, size, fn->name);
+            inst->func.return_type = (expr_type_t) fn->return_type;
+            inst->func.params = &file->lists[fn->params];
+            inst->func.param_count = fn->param_count;
+            inst->func.stack_size = fn->stack_size;
+            inst->func.is_static = (fn->flags & IR_FUNCTION_STATIC) != 0;
+            // the frame holds the function's locals, at most 8 bytes each
+            if(!inst->func.func_name || !*inst->func.func_name || !valid_type(fn->return_type)
+                || fn->stack_size > (uint64_t) h->instruction_count * 8) {
+                corrupt = 1;
+                break;
+            }
+        }
+
+        // functions don't nest, and everything else is inside one
+        if(!check_instruction(inst) || (inst->opcode == IR_FUNC_START) != !function) {
+            corrupt = 1;
+            break;
+        }
+        if(inst->opcode == IR_FUNC_START) function = inst;
+        if(inst->opcode == IR_FUNC_END) function = NULL;
+
+        file->ir[i].instruction = inst;
+        file->ir[i].next = &file->ir[i + 1];
+    }
+
+#undef OPERAND
+
+    if(function) corrupt = 1;
+    if(corrupt) {
+        read_error(path, "corrupt IR file");
+        ir_file_close(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+void ir_file_close(ir_file_t *file) {
+    if(!file) return;
+    mem_free(file->ir);
+    mem_free(file->instructions);
+    mem_free(file->operands);
+    mem_free(file->lists);
+    munmap(file->map, file->size);
+    mem_free(file);
+}
@@ -0,0 +1,89 @@
+#ifndef _IR_BINARY_H
+#define _IR_BINARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ir.h"
+
+#define IR_BINARY_MAGIC "DVIR"
+#define IR_BINARY_VERSION 3
+#define IR_NO_OPERAND 0xFFFFFFFFu
+
+// On disk layout, little endian, every table 8 byte aligned:
+//   header | string offsets | string data | operands | operand lists | instructions | functions
+// Strings are NUL terminated so a mapped file can be used without copying them.
+typedef struct ir_binary_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t string_count;
+    uint32_t operand_count;
+    uint32_t list_count;
+    uint32_t instruction_count;
+    uint32_t function_count;
+    uint32_t source; // string index of the source file name, IR_NO_OPERAND if unknown
+    uint64_t string_offsets; // file offsets of each table
+    uint64_t string_data;
+    uint64_t operands;
+    uint64_t lists;
+    uint64_t instructions;
+    uint64_t functions;
+    uint64_t file_size;
+} ir_binary_header_t;
+
+typedef struct ir_binary_operand {
+    uint8_t kind;
+    uint8_t pad[3];
+    uint32_t type;
+    int64_t value; // temp id, constant or string index
+} ir_binary_operand_t;
+
+typedef struct ir_binary_instruction {
+    uint8_t opcode;
+    uint8_t tail;
+    uint16_t pad;
+    uint32_t result_type;
+    uint32_t dst; // operand index or IR_NO_OPERAND
+    uint32_t src1;
+    uint32_t src2;
+    uint32_t args; // call args, first index into the operand lists
+    uint32_t arg_count;
+    uint32_t function; // IR_FUNC_START only, index of the function record
+    uint32_t line;
+    uint32_t column;
+} ir_binary_instruction_t;
+
+typedef struct ir_binary_function {
+    uint32_t name;
+    uint32_t return_type;
+    uint32_t params; // first index into the operand lists
+    uint32_t param_count;
+    uint64_t stack_size;
+    uint32_t first_instruction;
+    uint32_t instruction_count;
+    uint32_t flags; // IR_FUNCTION_STATIC
+    uint32_t pad;
+} ir_binary_function_t;
+
+#define IR_FUNCTION_STATIC 1u
+
+// A mapped .ir file, the IR borrows strings from the mapping
+typedef struct ir_file {
+    void *map;
+    size_t size;
+    ir_instruction_list_t *ir;
+    const char *source; // file the IR was compiled from, NULL if unknown
+
+    // decoded records
+    ir_instruction_t *instructions;
+    ir_operand_t *operands;
+    ir_operand_t **lists;
+} ir_file_t;
+
+int ir_write_binary(ir_instruction_list_t *ir, const char *source_name, FILE *f);
+int ir_is_binary(const char *path);
+ir_file_t *ir_read_binary(const char *path);
+void ir_file_close(ir_file_t *file);
+
+#endif
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "jit.h"
+#include "code_gen.h"
+#include "ir.h"
+#include "x64.h"
+
+// Same instruction selection as the NASM output, encoded straight into memory.
+// Calls between functions are patched directly, anything external goes through
+// a stub at the end of the buffer since libc can be further than rel32 away.
+
+static size_t page_align(size_t size) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+static void jit_write_perf_map(jit_module_t *module, char **externals, size_t external_count) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+
+    FILE *f = fopen(path, "a");
+    if(!f) return;
+
+    uintptr_t base = (uintptr_t) module->memory;
+    for(size_t i = 0; i < module->code.symbol_count; i++) {
+        x64_symbol_t *sym = &module->code.symbols[i];
+        fprintf(f, "%lx %lx %s\n", base + sym->offset, sym->size, sym->name);
+    }
+
+    size_t stubs = (module->code.len + JIT_STUB_SIZE - 1) & ~(size_t) (JIT_STUB_SIZE - 1);
+    for(size_t i = 0; i < external_count; i++) {
+        fprintf(f, "%lx %x %s@plt\n", base + stubs + i * JIT_STUB_SIZE, JIT_STUB_SIZE, externals[i]);
+    }
+
+    fclose(f);
+}
+
+jit_module_t *jit_compile(ir_instruction_list_t *ir) {
+    jit_module_t *module = mem_calloc(1, sizeof(jit_module_t));
+    x64_code_t *code = &module->code;
+
+    generate_x64_binary(ir, code, NULL);
+    size_t unresolved = x64_resolve(code);
+
+    // one stub per distinct external symbol
+    char **externals = mem_calloc(unresolved + 1, sizeof(char*));
+    void **addresses = mem_calloc(unresolved + 1, sizeof(void*));
+    size_t external_count = 0;
+    int failed = 0;
+
+    for(size_t i = 0; i < unresolved; i++) {
+        char *name = code->fixups[i].name;
+        size_t j = 0;
+        while(j < external_count && strcmp(externals[j], name) != 0) j++;
+        if(j < external_count) continue;
+
+        void *address = dlsym(RTLD_DEFAULT, name);
+        if(!address) {
+            fprintf(stderr, "JIT error: Undefined symbol '%s'\n", name);
+            failed = 1;
+            continue;
+        }
+        externals[external_count] = name;
+        addresses[external_count++] = address;
+    }
+
+    if(failed) {
+        mem_free(externals);
+        mem_free(addresses);
+        jit_free(module);
+        return NULL;
+    }
+
+    size_t stubs = (code->len + JIT_STUB_SIZE - 1) & ~(size_t) (JIT_STUB_SIZE - 1);
+    module->size = page_align(stubs + external_count * JIT_STUB_SIZE + 1);
+    module->memory = mmap(NULL, module->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(module->memory == MAP_FAILED) {
+        perror("JIT error: mmap");
+        module->memory = NULL;
+        mem_free(externals);
+        mem_free(addresses);
+        jit_free(module);
+        return NULL;
+    }
+
+    uint8_t *mem = module->memory;
+    memset(mem, 0xCC, module->size); // int3 padding
+    memcpy(mem, code->data, code->len);
+
+    for(size_t i = 0; i < external_count; i++) {
+        uint8_t *stub = mem + stubs + i * JIT_STUB_SIZE;
+        static const uint8_t jmp_indirect[] = {0xFF, 0x25, 0x02, 0x00, 0x00, 0x00}; // jmp [rip+2]
+        memcpy(stub, jmp_indirect, sizeof(jmp_indirect));
+        memcpy(stub + 8, &addresses[i], sizeof(void*));
+    }
+
+    for(size_t i = 0; i < unresolved; i++) {
+        size_t j = 0;
+        while(strcmp(externals[j], code->fixups[i].name) != 0) j++;
+        size_t offset = code->fixups[i].offset;
+        int32_t rel = (int32_t) ((int64_t) (stubs + j * JIT_STUB_SIZE) - (int64_t) (offset + 4));
+        memcpy(mem + offset, &rel, 4);
+    }
+
+    if(mprotect(mem, module->size, PROT_READ | PROT_EXEC) != 0) {
+        perror("JIT error: mprotect");
+        mem_free(externals);
+        mem_free(addresses);
+        jit_free(module);
+        return NULL;
+    }
+
+    jit_write_perf_map(module, externals, external_count);
+
+    mem_free(externals);
+    mem_free(addresses);
+    return module;
+}
+
+void *jit_lookup(jit_module_t *module, const char *name) {
+    for(size_t i = 0; i < module->code.symbol_count; i++) {
+        if(strcmp(module->code.symbols[i].name, name) == 0) {
+            return (uint8_t *) module->memory + module->code.symbols[i].offset;
+        }
+    }
+    return NULL;
+}
+
+jit_main_t jit_main(jit_module_t *module) {
+    jit_main_t fn = NULL;
+    void *address = jit_lookup(module, "main");
+    // POSIX allows this, ISO C does not
+    *(void **) (&fn) = address;
+    return fn;
+}
+
+void jit_free(jit_module_t *module) {
+    if(!module) return;
+    if(module->memory) munmap(module->memory, module->size);
+    x64_code_free(&module->code);
+    mem_free(module);
+}
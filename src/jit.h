@@ -0,0 +1,24 @@
+#ifndef _JIT_H
+#define _JIT_H
+
+#include <stddef.h>
+
+#include "ir.h"
+#include "x64.h"
+
+#define JIT_STUB_SIZE 16 // jmp [rip+2] ; padding ; absolute address
+
+typedef int (*jit_main_t)(void);
+
+typedef struct jit_module {
+    void *memory; // PROT_READ | PROT_EXEC once compiled
+    size_t size;
+    x64_code_t code;
+} jit_module_t;
+
+jit_module_t *jit_compile(ir_instruction_list_t *ir);
+void *jit_lookup(jit_module_t *module, const char *name);
+jit_main_t jit_main(jit_module_t *module);
+void jit_free(jit_module_t *module);
+
+#endif
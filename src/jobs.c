@@ -0,0 +1,153 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "jobs.h"
+
+// The GNU make jobserver hands out one byte per extra job through a pipe
+// (--jobserver-auth=R,W) or a named fifo (--jobserver-auth=fifo:PATH), a job
+// reads one before it starts and writes it back when it's done.
+typedef struct jobserver {
+    int read_fd; // ours and non-blocking, see jobserver_open
+    int write_fd;
+    int owned_write; // write_fd is the fifo we opened, not make's pipe
+} jobserver_t;
+
+static int fd_is_open(int fd) {
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+// Another of make's children can take the token between our poll and
+// read, so reads must not block. make's pipe is shared with every child,
+// setting O_NONBLOCK on it would change it for them too; the read end is
+// opened again through /proc instead, which gives us a description of our
+// own. 1 with a jobserver, 0 without, -1 if there's one we can't use.
+static int jobserver_open(jobserver_t *server) {
+    const char *flags = getenv("MAKEFLAGS");
+    if(!flags) return 0;
+
+    // the last one wins, make passes them down through nested makes
+    const char *auth = NULL;
+    for(const char *p = flags; (p = strstr(p, "--jobserver-")) != NULL; p++) {
+        const char *value = strchr(p, '=');
+        if(value && (strncmp(p, "--jobserver-auth=", 17) == 0 || strncmp(p, "--jobserver-fds=", 16) == 0)) {
+            auth = value + 1;
+        }
+    }
+    if(!auth) return 0;
+
+    if(strncmp(auth, "fifo:", 5) == 0) {
+        size_t len = strcspn(auth + 5, " ");
+        char *path = mem_strndup(auth + 5, len);
+        // our writer keeps reads from seeing the fifo closed, and opening
+        // it doesn't wait for a reader since there's ours
+        server->read_fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        server->write_fd = server->read_fd >= 0 ? open(path, O_WRONLY | O_CLOEXEC) : -1;
+        mem_free(path);
+        server->owned_write = 1;
+        if(server->read_fd >= 0 && server->write_fd >= 0) return 1;
+        if(server->read_fd >= 0) close(server->read_fd);
+        if(server->write_fd >= 0) close(server->write_fd);
+        return -1;
+    }
+
+    // make closes the pipe for commands it doesn't consider recursive
+    char *end;
+    int read_fd = (int) strtol(auth, &end, 10);
+    if(*end != ',') return 0;
+    server->write_fd = (int) strtol(end + 1, NULL, 10);
+    server->owned_write = 0;
+    if(!fd_is_open(read_fd) || !fd_is_open(server->write_fd)) return 0;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", read_fd);
+    server->read_fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    return server->read_fd >= 0 ? 1 : -1;
+}
+
+static void jobserver_close(jobserver_t *server) {
+    close(server->read_fd);
+    if(server->owned_write) close(server->write_fd);
+}
+
+// 0 once `done` says there's nothing left to take a token for
+static int jobserver_acquire(jobserver_t *server, char *token, int (*done)(void *), void *arg) {
+    while(!done(arg)) {
+        ssize_t got = read(server->read_fd, token, 1);
+        if(got == 1) return 1;
+        if(got == 0 || (errno != EINTR && errno != EAGAIN)) return 0;
+        // someone else got it, wait for the next one but look at `done` again
+        struct pollfd fd = {server->read_fd, POLLIN, 0};
+        poll(&fd, 1, 100);
+    }
+    return 0;
+}
+
+// the byte that was read goes back, make may tell tokens apart
+static void jobserver_release(jobserver_t *server, char token) {
+    while(write(server->write_fd, &token, 1) < 0 && errno == EINTR);
+}
+
+typedef struct pool {
+    size_t count;
+    size_t next; // next index to hand out, taken with an atomic add
+    job_fn_t fn;
+    void *arg;
+    jobserver_t *server; // NULL without make
+} pool_t;
+
+static int pool_done(void *arg) {
+    pool_t *pool = arg;
+    return __atomic_load_n(&pool->next, __ATOMIC_RELAXED) >= pool->count;
+}
+
+static void run_jobs(pool_t *pool, int has_token) {
+    for(;;) {
+        if(pool_done(pool)) return;
+        char token;
+        if(!has_token && pool->server && !jobserver_acquire(pool->server, &token, pool_done, pool)) return;
+
+        size_t index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if(index < pool->count) pool->fn(pool->arg, index);
+
+        if(!has_token && pool->server) jobserver_release(pool->server, token);
+        if(index >= pool->count) return;
+    }
+}
+
+static void *worker(void *arg) {
+    run_jobs(arg, 0);
+    return NULL;
+}
+
+void jobs_run(size_t count, int threads, job_fn_t fn, void *arg) {
+    if(threads > (int) count) threads = (int) count;
+    jobserver_t server;
+    int jobserver = threads > 1 ? jobserver_open(&server) : 0;
+    // make's limit holds, and all we can be sure of is our own token
+    if(jobserver < 0) threads = 1;
+    if(threads <= 1) {
+        for(size_t i = 0; i < count; i++) fn(arg, i);
+        return;
+    }
+    pool_t pool = {count, 0, fn, arg, jobserver ? &server : NULL};
+
+    pthread_t *workers = mem_alloc(sizeof(pthread_t) * (size_t) threads);
+    int started = 0;
+    for(int i = 1; i < threads; i++) {
+        if(pthread_create(&workers[started], NULL, worker, &pool) == 0) started++;
+    }
+
+    // this thread runs on the token make gave the whole process
+    run_jobs(&pool, 1);
+    for(int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+    mem_free(workers);
+    if(pool.server) jobserver_close(&server);
+}
@@ -0,0 +1,14 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <stddef.h>
+
+typedef void (*job_fn_t)(void *arg, size_t index);
+
+// Runs fn(arg, 0) ... fn(arg, count - 1) on up to `threads` threads, the
+// calling one included, and returns once all of them are done. Under
+// `make -jN` every thread past the first also holds a jobserver token, so the
+// whole build stays within make's limit.
+void jobs_run(size_t count, int threads, job_fn_t fn, void *arg);
+
+#endif
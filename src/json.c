@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "json.h"
+
+typedef struct json_parser {
+    const char *text;
+    size_t len;
+    size_t i;
+    int depth;
+} json_parser_t;
+
+#define JSON_MAX_DEPTH 128
+
+static void skip_space(json_parser_t *p) {
+    while(p->i < p->len && (p->text[p->i] == ' ' || p->text[p->i] == '\t' || p->text[p->i] == '\n' || p->text[p->i] == '\r')) {
+        p->i++;
+    }
+}
+
+static int literal(json_parser_t *p, const char *word) {
+    size_t n = strlen(word);
+    if(p->len - p->i < n || memcmp(p->text + p->i, word, n) != 0) return 0;
+    p->i += n;
+    return 1;
+}
+
+static int hex4(json_parser_t *p, uint32_t *out) {
+    if(p->len - p->i < 4) return 0;
+    uint32_t value = 0;
+    for(int k = 0; k < 4; k++) {
+        char c = p->text[p->i++];
+        value <<= 4;
+        if(c >= '0' && c <= '9') value |= (uint32_t) (c - '0');
+        else if(c >= 'a' && c <= 'f') value |= (uint32_t) (c - 'a' + 10);
+        else if(c >= 'A' && c <= 'F') value |= (uint32_t) (c - 'A' + 10);
+        else return 0;
+    }
+    *out = value;
+    return 1;
+}
+
+static size_t put_utf8(char *out, uint32_t cp) {
+    if(cp < 0x80) {
+        out[0] = (char) cp;
+        return 1;
+    }
+    if(cp < 0x800) {
+        out[0] = (char) (0xC0 | (cp >> 6));
+        out[1] = (char) (0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if(cp < 0x10000) {
+        out[0] = (char) (0xE0 | (cp >> 12));
+        out[1] = (char) (0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char) (0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char) (0xF0 | (cp >> 18));
+    out[1] = (char) (0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char) (0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char) (0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// the opening quote is already consumed; escapes only shrink the text, so
+// the decoded string fits in what's left of it
+static char *parse_string(json_parser_t *p, size_t *length) {
+    size_t start = p->i;
+    size_t end = start;
+    while(end < p->len && p->text[end] != '"') end += p->text[end] == '\\' ? 2 : 1;
+    if(end >= p->len) return NULL;
+
+    char *out = mem_alloc(end - start + 1);
+    size_t n = 0;
+    while(p->i < end) {
+        char c = p->text[p->i++];
+        if((unsigned char) c < 0x20) return NULL;
+        if(c != '\\') {
+            out[n++] = c;
+            continue;
+        }
+
+        c = p->text[p->i++];
+        switch(c) {
+            case '"': out[n++] = '"'; break;
+            case '\\': out[n++] = '\\'; break;
+            case '/': out[n++] = '/'; break;
+            case 'b': out[n++] = '\b'; break;
+            case 'f': out[n++] = '\f'; break;
+            case 'n': out[n++] = '\n'; break;
+            case 'r': out[n++] = '\r'; break;
+            case 't': out[n++] = '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if(!hex4(p, &cp)) return NULL;
+                // a surrogate pair is one character, \uXXXX\uXXXX
+                if(cp >= 0xD800 && cp < 0xDC00 && p->len - p->i >= 6 && p->text[p->i] == '\\' && p->text[p->i + 1] == 'u') {
+                    uint32_t low;
+                    p->i += 2;
+                    if(!hex4(p, &low) || low < 0xDC00 || low > 0xDFFF) return NULL;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                n += put_utf8(out + n, cp);
+                break;
+            }
+            default:
+                return NULL;
+        }
+    }
+    p->i = end + 1;
+    out[n] = '\0';
+    *length = n;
+    return out;
+}
+
+static json_t *parse_value(json_parser_t *p);
+
+static json_t *parse_container(json_parser_t *p, json_t *value, char close) {
+    if(++p->depth > JSON_MAX_DEPTH) return NULL;
+    size_t cap = 0;
+    skip_space(p);
+    if(p->i < p->len && p->text[p->i] == close) {
+        p->i++;
+        p->depth--;
+        return value;
+    }
+
+    for(;;) {
+        char *key = NULL;
+        if(close == '}') {
+            skip_space(p);
+            size_t key_len;
+            if(p->i >= p->len || p->text[p->i++] != '"') return NULL;
+            key = parse_string(p, &key_len);
+            if(key == NULL) return NULL;
+            skip_space(p);
+            if(p->i >= p->len || p->text[p->i++] != ':') return NULL;
+        }
+
+        json_t *item = parse_value(p);
+        if(item == NULL) return NULL;
+        if(value->count == cap) {
+            cap = cap ? cap * 2 : 8;
+            value->items = mem_realloc(value->items, sizeof(json_t *) * cap);
+            if(close == '}') value->keys = mem_realloc(value->keys, sizeof(char *) * cap);
+        }
+        value->items[value->count] = item;
+        if(close == '}') value->keys[value->count] = key;
+        value->count++;
+
+        skip_space(p);
+        if(p->i >= p->len) return NULL;
+        char c = p->text[p->i++];
+        if(c == close) break;
+        if(c != ',') return NULL;
+    }
+    p->depth--;
+    return value;
+}
+
+static json_t *parse_value(json_parser_t *p) {
+    skip_space(p);
+    if(p->i >= p->len) return NULL;
+
+    json_t *value = mem_calloc(1, sizeof(json_t));
+    char c = p->text[p->i];
+    switch(c) {
+        case '{':
+            p->i++;
+            value->kind = JSON_OBJECT;
+            return parse_container(p, value, '}');
+        case '[':
+            p->i++;
+            value->kind = JSON_ARRAY;
+            return parse_container(p, value, ']');
+        case '"':
+            p->i++;
+            value->kind = JSON_STRING;
+            value->string = parse_string(p, &value->length);
+            return value->string ? value : NULL;
+        case 't':
+        case 'f':
+            value->kind = JSON_BOOL;
+            value->number = c == 't';
+            return literal(p, c == 't' ? "true" : "false") ? value : NULL;
+        case 'n':
+            value->kind = JSON_NULL;
+            return literal(p, "null") ? value : NULL;
+        default: {
+            // strtod wants a terminated string, numbers are short
+            char buffer[64];
+            size_t n = 0;
+            while(p->i + n < p->len && n < sizeof(buffer) - 1 && strchr("+-0123456789.eE", p->text[p->i + n])) {
+                buffer[n] = p->text[p->i + n];
+                n++;
+            }
+            buffer[n] = '\0';
+            char *end;
+            value->kind = JSON_NUMBER;
+            value->number = strtod(buffer, &end);
+            if(n == 0 || end != buffer + n) return NULL;
+            p->i += n;
+            return value;
+        }
+    }
+}
+
+json_t *json_parse(const char *text, size_t len) {
+    json_parser_t p = {text, len, 0, 0};
+    json_t *value = parse_value(&p);
+    skip_space(&p);
+    return value && p.i == len ? value : NULL;
+}
+
+json_t *json_get(json_t *object, const char *key) {
+    if(object == NULL || object->kind != JSON_OBJECT) return NULL;
+    for(size_t i = 0; i < object->count; i++) {
+        if(strcmp(object->keys[i], key) == 0) return object->items[i];
+    }
+    return NULL;
+}
+
+const char *json_string(json_t *value) {
+    return value && value->kind == JSON_STRING ? value->string : NULL;
+}
+
+int64_t json_int(json_t *value, int64_t fallback) {
+    return value && value->kind == JSON_NUMBER ? (int64_t) value->number : fallback;
+}
+
+// length of the UTF-8 sequence at s, 0 if it isn't a valid one
+static size_t utf8_length(const unsigned char *s, size_t len) {
+    size_t n = s[0] >= 0xF0 && s[0] < 0xF5 ? 4 : s[0] >= 0xE0 ? 3 : s[0] >= 0xC2 && s[0] < 0xE0 ? 2 : 0;
+    if(n == 0 || n > len) return 0;
+    for(size_t k = 1; k < n; k++) {
+        if((s[k] & 0xC0) != 0x80) return 0;
+    }
+    // no overlong forms or surrogates
+    if((s[0] == 0xE0 && s[1] < 0xA0) || (s[0] == 0xED && s[1] >= 0xA0)) return 0;
+    if((s[0] == 0xF0 && s[1] < 0x90) || (s[0] == 0xF4 && s[1] >= 0x90)) return 0;
+    return n;
+}
+
+void json_write_string(FILE *f, const char *s, size_t len) {
+    fputc('"', f);
+    for(size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) s[i];
+        if(c >= 0x80) {
+            // the lexer splits a character it doesn't know into its bytes
+            size_t n = utf8_length((const unsigned char *) s + i, len - i);
+            if(n == 0) {
+                fputs("\\ufffd", f);
+                continue;
+            }
+            fwrite(s + i, 1, n, f);
+            i += n - 1;
+            continue;
+        }
+        switch(c) {
+            case '"': fputs("\\\"", f); break;
+            case '\\': fputs("\\\\", f); break;
+            case '\n': fputs("\\n", f); break;
+            case '\r': fputs("\\r", f); break;
+            case '\t': fputs("\\t", f); break;
+            default:
+                if(c < 0x20) fprintf(f, "\\u%04x", c);
+                else fputc(c, f);
+                break;
+        }
+    }
+    fputc('"', f);
+}
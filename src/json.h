@@ -0,0 +1,43 @@
+#ifndef _JSON_H
+#define _JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum json_kind {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} json_kind_t;
+
+// A parsed value. Nothing is freed on its own, the language server parses
+// each message in an arena and drops it as a whole.
+typedef struct json {
+    json_kind_t kind;
+    double number; // also JSON_BOOL, 0 or 1
+    char *string;  // decoded, NUL terminated; length counts embedded NULs
+    size_t length;
+
+    // arrays and objects, keys is NULL for an array
+    struct json **items;
+    char **keys;
+    size_t count;
+} json_t;
+
+// NULL if the text isn't one well-formed value
+json_t *json_parse(const char *text, size_t len);
+
+// the member called `key`, NULL if `object` isn't an object or has none
+json_t *json_get(json_t *object, const char *key);
+// the value's string, NULL unless it is one
+const char *json_string(json_t *value);
+int64_t json_int(json_t *value, int64_t fallback);
+
+// `s` as a quoted JSON string, bytes that aren't valid UTF-8 become U+FFFD
+void json_write_string(FILE *f, const char *s, size_t len);
+
+#endif
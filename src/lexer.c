@@ -1,13 +1,15 @@
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "alloc.h"
 #include "lexer.h"
 #include "trie.h"
 
 
 void lexer_push(token_t **n, token_type_t type, char *val, pos_t pos) {
-    (*n)->next = malloc(sizeof(token_t));
+    (*n)->next = mem_alloc(sizeof(token_t));
     (*n)->next->type = type;
     (*n)->next->value = val;
     (*n)->next->next = NULL;
@@ -16,8 +18,11 @@ void lexer_push(token_t **n, token_type_t type, char *val, pos_t pos) {
     *n = (*n)->next;
 }
 
-token_t *lexer_parse(char *src) {
-    struct trie keywords = {0};
+// built once and only read afterwards, shared by every job and server request
+static struct trie keywords;
+static pthread_once_t keywords_once = PTHREAD_ONCE_INIT;
+
+static void build_keywords(void) {
     trie_insert(&keywords, "void", VOID);
     trie_insert(&keywords, "i8", I8);
     trie_insert(&keywords, "i16", I16);
@@ -32,17 +37,34 @@ token_t *lexer_parse(char *src) {
     trie_insert(&keywords, "short", SHORT);
     trie_insert(&keywords, "long", LONG);
     trie_insert(&keywords, "return", RETURN);
+    trie_insert(&keywords, "static", STATIC);
+    trie_insert(&keywords, "import", IMPORT);
+}
 
-    token_t *list = calloc(1, sizeof(token_t));
-    token_t *head = list;
+void lexer_init(void) {
+    pthread_once(&keywords_once, build_keywords);
+}
 
-    pos_t pos = {1, 1};
+void lexer_start(lexer_t *lexer, char *src) {
+    lexer_init();
+    *lexer = (lexer_t) {src, strlen(src), 0, 0, {1, 1}};
+}
+
+void lexer_start_at(lexer_t *lexer, char *src, size_t len, size_t offset, pos_t pos) {
+    lexer_init();
+    *lexer = (lexer_t) {src, len, offset, offset, pos};
+}
 
-    size_t len = strlen(src);
-    size_t i = 0;
-    size_t i2 = 0;
+// appends the next token to *list, 0 once the source is used up
+static int lexer_next(lexer_t *lexer, token_t **list) {
+    char *src = lexer->src;
+    size_t len = lexer->len;
+    size_t i = lexer->i;
+    size_t i2 = lexer->i2;
+    pos_t pos = lexer->pos;
+    token_t *before = *list;
 
-    while(i < len) {
+    while(i < len && *list == before) {
         char current = src[i];
         char next = (i+1) < len ? src[i+1] : '\0';
         pos.column += i - i2;
@@ -62,49 +84,49 @@ token_t *lexer_parse(char *src) {
         switch(current) {
             case '+': {
                 if(next == '+') {
-                    lexer_push(&list, PLUS_PLUS, "++", pos);
+                    lexer_push(list, PLUS_PLUS, "++", pos);
                     i++;
                 }
                 else if(next == '=') {
-                    lexer_push(&list, PLUS_EQ, "+=", pos);
+                    lexer_push(list, PLUS_EQ, "+=", pos);
                     i++;
                 }
                 else {
-                    lexer_push(&list, PLUS, "+", pos);
+                    lexer_push(list, PLUS, "+", pos);
                 }
                 break;
             }
             case '-': {
                 if(next == '-') {
-                    lexer_push(&list, MINUS_MINUS, "--", pos);
+                    lexer_push(list, MINUS_MINUS, "--", pos);
                     i++;
                 }
                 else if(next == '>') {
-                    lexer_push(&list, ARROW, "->", pos);
+                    lexer_push(list, ARROW, "->", pos);
                     i++;
                 }
                 else if(next == '=') {
-                    lexer_push(&list, MINUS_EQ, "-=", pos);
+                    lexer_push(list, MINUS_EQ, "-=", pos);
                     i++;
                 }
                 else {
-                    lexer_push(&list, MINUS, "-", pos);
+                    lexer_push(list, MINUS, "-", pos);
                 }
                 break;
             }
             case '*': {
                 if(next == '=') {
-                    lexer_push(&list, STAR_EQ, "*=", pos);
+                    lexer_push(list, STAR_EQ, "*=", pos);
                     i++;
                 }
                 else {
-                    lexer_push(&list, STAR, "*", pos);
+                    lexer_push(list, STAR, "*", pos);
                 }
                 break;
             }
             case '/': {
                 if(next == '=') {
-                    lexer_push(&list, SLASH_EQ, "/=", pos);
+                    lexer_push(list, SLASH_EQ, "/=", pos);
                     i++;
                 }
                 else if(next == '/') {
@@ -113,74 +135,74 @@ token_t *lexer_parse(char *src) {
                     continue;
                 }
                 else {
-                    lexer_push(&list, SLASH, "/", pos);
+                    lexer_push(list, SLASH, "/", pos);
                 }
                 break;
             }
             case '=': {
                 if(next == '=') {
-                    lexer_push(&list, EQUAL, "==", pos);
+                    lexer_push(list, EQUAL, "==", pos);
                     i++;
                 }
                 else {
-                    lexer_push(&list, ASSIGN, "=", pos);
+                    lexer_push(list, ASSIGN, "=", pos);
                 }
                 break;
             }
 
             case '!': {
                 if(next == '=') {
-                    lexer_push(&list, NOT_EQ, "!=", pos);
+                    lexer_push(list, NOT_EQ, "!=", pos);
                     i++;
                 }
                 else {
-                    lexer_push(&list, NOT, "!", pos);
+                    lexer_push(list, NOT, "!", pos);
                 }
                 break;
             }
 
             case '(': {
-                lexer_push(&list, LEFT_PAREN, "(", pos);
+                lexer_push(list, LEFT_PAREN, "(", pos);
                 break;
             }
 
             case '{': {
-                lexer_push(&list, LEFT_CURLY, "{", pos);
+                lexer_push(list, LEFT_CURLY, "{", pos);
                 break;
             }
 
             case '[': {
-                lexer_push(&list, LEFT_SQUARE, "[", pos);
+                lexer_push(list, LEFT_SQUARE, "[", pos);
                 break;
             }
 
             case ')': {
-                lexer_push(&list, RIGHT_PAREN, ")", pos);
+                lexer_push(list, RIGHT_PAREN, ")", pos);
                 break;
             }
 
             case '}': {
-                lexer_push(&list, RIGHT_CURLY, "}", pos);
+                lexer_push(list, RIGHT_CURLY, "}", pos);
                 break;
             }
 
             case ']': {
-                lexer_push(&list, RIGHT_SQUARE, "]", pos);
+                lexer_push(list, RIGHT_SQUARE, "]", pos);
                 break;
             }
 
             case ';': {
-                lexer_push(&list, SEMICOLON, ";", pos);
+                lexer_push(list, SEMICOLON, ";", pos);
                 break;
             }
 
             case ',': {
-                lexer_push(&list, COMMA, ",", pos);
+                lexer_push(list, COMMA, ",", pos);
                 break;
             }
 
             case '.': {
-                lexer_push(&list, DOT, ".", pos);
+                lexer_push(list, DOT, ".", pos);
                 break;
             }
 
@@ -191,10 +213,10 @@ token_t *lexer_parse(char *src) {
                         i++;
                     }
                     size_t length = i - start;
-                    char *val = malloc(length + 1);
+                    char *val = mem_alloc(length + 1);
                     strncpy(val, src + start, length);
                     val[length] = '\0';
-                    lexer_push(&list, NUMBER, val, pos);
+                    lexer_push(list, NUMBER, val, pos);
                     i--;
                 }
                 else if(isalpha(current) || current == '_') {
@@ -203,26 +225,56 @@ token_t *lexer_parse(char *src) {
                         i++;
                     }
                     size_t length = i - start;
-                    char *val = malloc(length + 1);
+                    char *val = mem_alloc(length + 1);
                     strncpy(val, src+start, length);
                     val[length] = '\0';
                     i--;
 
                     token_type_t token_type = trie_get(&keywords, val);
-                    lexer_push(&list, token_type, val, pos);
+                    lexer_push(list, token_type, val, pos);
                 }
                 else {
-                    char *val = malloc(2);
+                    char *val = mem_alloc(2);
                     val[0] = current;
                     val[1] = '\0';
-                    lexer_push(&list, TOKEN_UNKNOWN, val, pos);
+                    lexer_push(list, TOKEN_UNKNOWN, val, pos);
                 }
             }
         }
         i++;
     }
 
-    lexer_push(&list, TOKEN_EOF, "token-eof", pos);
+    lexer->i = i;
+    lexer->i2 = i2;
+    lexer->pos = pos;
+    return *list != before;
+}
+
+token_t *lexer_parse(char *src) {
+    lexer_t lexer;
+    lexer_start(&lexer, src);
+
+    token_t *list = mem_calloc(1, sizeof(token_t));
+    token_t *head = list;
+    while(lexer_next(&lexer, &list)) {}
+    lexer_push(&list, TOKEN_EOF, "token-eof", lexer.pos);
+
+    return head;
+}
+
+token_t *lexer_parse_item(lexer_t *lexer) {
+    token_t *list = mem_calloc(1, sizeof(token_t));
+    token_t *head = list;
+
+    // a function ends with the brace that closes its body, anything else at
+    // the top level with a semicolon
+    int depth = 0;
+    while(lexer_next(lexer, &list)) {
+        if(list->type == LEFT_CURLY) depth++;
+        else if(list->type == RIGHT_CURLY && --depth <= 0) break;
+        else if(list->type == SEMICOLON && depth == 0) break;
+    }
+    lexer_push(&list, TOKEN_EOF, "token-eof", lexer->pos);
 
     return head;
 }
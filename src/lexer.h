@@ -1,6 +1,8 @@
 #ifndef _LEXER_H
 #define _LEXER_H
 
+#include <stddef.h>
+
 typedef enum token_type {
     // literals
     IDENTIFIER,
@@ -53,6 +55,8 @@ typedef enum token_type {
     LONG,
     SHORT,
     RETURN,
+    STATIC,
+    IMPORT,
 
     // special
     COMMENT,
@@ -88,6 +92,25 @@ typedef struct keyword_entry {
     token_type_t type;
 } keyword_entry_t;
 
+// where lexing a source stopped, for taking it one top-level item at a time
+typedef struct lexer {
+    char *src;
+    size_t len;
+    size_t i;
+    size_t i2; // start of the previous token, for the column
+    pos_t pos;
+} lexer_t;
+
+// builds the keyword trie, lexer_parse does it on first use otherwise
+void lexer_init(void);
 token_t *lexer_parse(char *src);
 
+void lexer_start(lexer_t *lexer, char *src);
+// from `offset` on, which is at `pos`; src[len] has to be a NUL
+void lexer_start_at(lexer_t *lexer, char *src, size_t len, size_t offset, pos_t pos);
+// The tokens of the next function, declaration or whatever else stands at
+// the top level, as a list like lexer_parse's. Only the EOF token is left
+// once the source is used up.
+token_t *lexer_parse_item(lexer_t *lexer);
+
 #endif
@@ -0,0 +1,890 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "alloc.h"
+#include "diag.h"
+#include "hashmap.h"
+#include "json.h"
+#include "lexer.h"
+#include "lsp.h"
+#include "module.h"
+#include "parser.h"
+#include "semantic.h"
+
+#define LSP_BATCH_CHUNK (16 << 10) // an edit re-lexes an item or two
+#define LSP_MAX_CHECKS 256          // before the symbol table is built again
+#define LSP_NAME_BITS 256           // per item, to find the users of a name
+
+// The tokens, ASTs and diagnostics of the items one lex made. They go
+// together once the last of those items has been replaced.
+typedef struct lsp_batch {
+    arena_t *arena;
+    size_t items;
+} lsp_batch_t;
+
+typedef struct lsp_diagnostic {
+    int line; // as lexed, like the item's tokens
+    int column;
+    int length;
+    int severity; // 1 error, 2 warning
+    char *message;
+} lsp_diagnostic_t;
+
+// What lexer_parse_item makes of the text, one function, declaration or
+// import. Items follow each other without gaps, each starts right after
+// the ; or } that ended the one before.
+typedef struct lsp_item {
+    size_t start;
+    size_t end;
+    int line_shift; // lines added above it since it was lexed
+    lsp_batch_t *batch;
+    token_t *tokens;
+    struct statement_list *statements;
+    char *syntax; // what parsing it reported, open_memstream's and so the heap's
+    size_t syntax_len;
+    uint64_t owns; // bit n: statement n declares the first of its name
+    uint64_t names[LSP_NAME_BITS / 64]; // the identifiers in it, a bit per hash
+    int stale;     // its semantic check is due
+    lsp_diagnostic_t *diagnostics;
+    size_t diagnostic_count;
+} lsp_item_t;
+
+typedef struct lsp_document {
+    char *uri;
+    char *text; // NUL terminated, the lexer reads one past a number
+    size_t len;
+    size_t cap;
+    size_t *lines; // offset of every line's start
+    size_t line_count;
+    size_t line_cap;
+    lsp_item_t *items;
+    size_t item_count;
+    size_t item_cap;
+    arena_t *globals; // the symbol table, built again when a declaration changes
+    arena_t *retired; // the one before, compared with the new one
+    symbol_table_t table;
+    int checks; // since the table was built
+    int redeclare; // an edit changed what the items declare
+    struct lsp_document *next;
+} lsp_document_t;
+
+typedef struct lsp_server {
+    FILE *in;
+    FILE *out;
+    FILE *null; // the declaration pass reports nothing, the checks do
+    lsp_document_t *documents;
+    int shutdown;
+} lsp_server_t;
+
+// Messages are handled in a scratch arena that's dropped after each one;
+// documents live on the heap, so whatever outlives a message steps out.
+#define ON_HEAP(stmt) do { arena_t *scratch_ = arena_swap(NULL); stmt; arena_swap(scratch_); } while(0)
+
+// Text
+
+static int count_lines(const char *s, size_t len) {
+    int count = 0;
+    const char *end = s + len;
+    while((s = memchr(s, '\n', (size_t) (end - s))) != NULL) {
+        count++;
+        s++;
+    }
+    return count;
+}
+
+static size_t line_after(lsp_document_t *doc, size_t offset) {
+    size_t lo = 0, hi = doc->line_count;
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(doc->lines[mid] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Replaces bytes [from, to) with `insert`. The line starts behind the edit
+// only move, the ones in it are counted again.
+static void splice_text(lsp_document_t *doc, size_t from, size_t to, const char *insert, size_t insert_len) {
+    size_t len = doc->len - (to - from) + insert_len;
+    if(len + 1 > doc->cap) {
+        doc->cap = doc->cap * 2 > len + 1 ? doc->cap * 2 : len + 1;
+        ON_HEAP(doc->text = mem_realloc(doc->text, doc->cap));
+    }
+    memmove(doc->text + from + insert_len, doc->text + to, doc->len - to + 1);
+    memcpy(doc->text + from, insert, insert_len);
+    doc->len = len;
+
+    size_t first = line_after(doc, from);
+    size_t last = line_after(doc, to);
+    size_t added = (size_t) count_lines(insert, insert_len);
+    size_t count = doc->line_count - (last - first) + added;
+    if(count > doc->line_cap) {
+        doc->line_cap = doc->line_cap * 2 > count ? doc->line_cap * 2 : count;
+        ON_HEAP(doc->lines = mem_realloc(doc->lines, sizeof(size_t) * doc->line_cap));
+    }
+    memmove(doc->lines + first + added, doc->lines + last, sizeof(size_t) * (doc->line_count - last));
+    size_t n = first;
+    const char *end = insert + insert_len;
+    for(const char *p = insert; (p = memchr(p, '\n', (size_t) (end - p))) != NULL; p++) {
+        doc->lines[n++] = from + (size_t) (p - insert) + 1;
+    }
+    for(n = first + added; n < count; n++) doc->lines[n] += insert_len - (to - from);
+    doc->line_count = count;
+}
+
+// LSP positions count from 0, characters are taken as bytes
+static size_t offset_at(lsp_document_t *doc, int64_t line, int64_t character) {
+    if(line < 0) return 0;
+    if((size_t) line >= doc->line_count) return doc->len;
+    size_t start = doc->lines[line];
+    size_t end = (size_t) line + 1 < doc->line_count ? doc->lines[line + 1] - 1 : doc->len;
+    if(character < 0) return start;
+    return start + (size_t) character < end ? start + (size_t) character : end;
+}
+
+// the lexer's position, lines and columns from 1
+static pos_t pos_at(lsp_document_t *doc, size_t offset) {
+    size_t line = line_after(doc, offset) - 1;
+    return (pos_t) {(int) line + 1, (int) (offset - doc->lines[line]) + 1};
+}
+
+// Items
+
+static char *declared_name(ast_statement_t *stmt) {
+    if(stmt->type == AST_FUNC_DECLARATION) return stmt->statement.function.identifier;
+    if(stmt->type == AST_VAR_DECLARATION) return stmt->statement.declaration.identifier;
+    return NULL;
+}
+
+static token_t *token_at_pos(lsp_item_t *item, int line, int column) {
+    for(token_t *t = item->tokens->next; t != NULL; t = t->next) {
+        if(t->pos.line == line && t->pos.column == column) return t;
+    }
+    return NULL;
+}
+
+// "... on line 3:7" at the end, as every diagnostic of the compiler has it;
+// without a position it goes on the item's first token
+static void add_diagnostics(lsp_item_t *item, const char *text, size_t len) {
+    const char *end = text + len;
+    for(const char *line = text; line < end;) {
+        const char *eol = memchr(line, '\n', (size_t) (end - line));
+        if(eol == NULL) eol = end;
+        // the message, the text is read again on the item's next check
+        char *message = mem_strndup(line, (size_t) (eol - line));
+        line = eol + 1;
+        if(*message == '\0') continue;
+
+        lsp_diagnostic_t d = {0};
+        d.severity = strstr(message, "warning") ? 2 : 1;
+        char *at = NULL;
+        for(char *found = message; (found = strstr(found, " on line ")) != NULL; found++) at = found;
+        if(at && sscanf(at, " on line %d:%d", &d.line, &d.column) == 2) {
+            *at = '\0';
+        }
+        else {
+            d.line = item->tokens->next->pos.line;
+            d.column = item->tokens->next->pos.column;
+        }
+        if(d.column < 1) d.column = 1; // the EOF token after a newline
+        d.message = message;
+
+        token_t *token = token_at_pos(item, d.line, d.column);
+        d.length = token && token->type != TOKEN_EOF && token->value[0] ? (int) strlen(token->value) : 1;
+
+        item->diagnostics = mem_realloc(item->diagnostics, sizeof(lsp_diagnostic_t) * (item->diagnostic_count + 1));
+        item->diagnostics[item->diagnostic_count++] = d;
+    }
+}
+
+// the next item from where the lexer is, 0 once only whitespace is left
+static int lex_item(lexer_t *lexer, lsp_batch_t *batch, lsp_item_t *item) {
+    arena_t *outer = arena_swap(batch->arena);
+    size_t start = lexer->i;
+    token_t *tokens = lexer_parse_item(lexer);
+    if(tokens->next->type == TOKEN_EOF) {
+        arena_swap(outer);
+        return 0;
+    }
+
+    *item = (lsp_item_t) {0};
+    item->start = start;
+    item->end = lexer->i;
+    item->batch = batch;
+    item->tokens = tokens;
+    item->stale = 1;
+    batch->items++;
+    for(token_t *t = tokens->next; t != NULL; t = t->next) {
+        if(t->type != IDENTIFIER) continue;
+        unsigned long bit = hash(t->value) % LSP_NAME_BITS;
+        item->names[bit / 64] |= 1ull << (bit % 64);
+    }
+
+    FILE *capture = open_memstream(&item->syntax, &item->syntax_len);
+    FILE *previous = diag_stream();
+    diag_set_stream(capture);
+    // the diagnostics are the count, the item keeps what did parse
+    int errors = 0;
+    item->statements = ast_parse(tokens, &errors);
+    diag_set_stream(previous);
+    fclose(capture);
+
+    arena_swap(outer);
+    return 1;
+}
+
+static void release_item(lsp_item_t *item) {
+    lsp_batch_t *batch = item->batch;
+    mem_free(item->syntax);
+    if(--batch->items == 0) {
+        arena_destroy(batch->arena);
+        ON_HEAP(mem_free(batch));
+    }
+}
+
+static int newline_between(lsp_document_t *doc, size_t from, size_t to) {
+    return to > from && memchr(doc->text + from, '\n', to - from) != NULL;
+}
+
+// The statements that put something in the symbol table, in text order,
+// with where each is among its item's statements.
+typedef struct lsp_declaration {
+    ast_statement_t *stmt;
+    lsp_item_t *item;
+    int index;
+} lsp_declaration_t;
+
+static size_t collect_declarations(lsp_item_t *items, size_t count, lsp_declaration_t **out) {
+    size_t n = 0, cap = 0;
+    *out = NULL;
+    for(size_t i = 0; i < count; i++) {
+        int index = 0;
+        for(struct statement_list *cur = items[i].statements; cur && cur->next; cur = cur->next, index++) {
+            ast_statement_t *stmt = cur->statement;
+            if(stmt == NULL || (stmt->type != AST_IMPORT && declared_name(stmt) == NULL)) continue;
+            if(n == cap) {
+                cap = cap ? cap * 2 : 16;
+                *out = mem_realloc(*out, sizeof(lsp_declaration_t) * cap);
+            }
+            (*out)[n++] = (lsp_declaration_t) {stmt, &items[i], index};
+        }
+    }
+    return n;
+}
+
+static int same_declaration(ast_statement_t *a, ast_statement_t *b) {
+    if(a->type != b->type) return 0;
+    if(a->type == AST_IMPORT) return strcmp(a->statement.import.module, b->statement.import.module) == 0;
+    if(strcmp(declared_name(a), declared_name(b)) != 0) return 0;
+    if(a->type == AST_FUNC_DECLARATION) return a->statement.function.type == b->statement.function.type;
+    return a->statement.declaration.t == b->statement.declaration.t;
+}
+
+// Edits inside a body leave the symbol table as it is. Then only the symbols
+// declared by the replaced items move over to the new statements, 0 if the
+// table has to be built again.
+static int keep_declarations(lsp_document_t *doc, size_t first, size_t last, lsp_item_t *fresh, size_t fresh_count) {
+    if(doc->redeclare || doc->table.global_scope == NULL) return 0;
+
+    lsp_declaration_t *before, *after;
+    size_t count = collect_declarations(doc->items + first, last - first, &before);
+    int same = collect_declarations(fresh, fresh_count, &after) == count;
+    for(size_t i = 0; same && i < count; i++) same = same_declaration(before[i].stmt, after[i].stmt);
+
+    for(size_t i = 0; same && i < count; i++) {
+        if(after[i].stmt->type == AST_IMPORT) continue;
+        symbol_t *sym = map_get(doc->table.global_scope, declared_name(after[i].stmt));
+        if(sym == NULL || sym->declaration != before[i].stmt) continue;
+        sym->declaration = after[i].stmt;
+        if(after[i].index < 64) after[i].item->owns |= 1ull << after[i].index;
+    }
+    mem_free(before);
+    mem_free(after);
+    return same;
+}
+
+// Replaces bytes [from, to) with `insert` and lexes again what that touched:
+// from the first item the edit reaches up to where the new item boundaries
+// meet old ones behind the edit. An edit right after an item's ; or } can't
+// change that token, so the item before it stays.
+static void apply_change(lsp_document_t *doc, size_t from, size_t to, const char *insert, size_t insert_len) {
+    size_t old_len = doc->len;
+    int line_delta = count_lines(insert, insert_len) - count_lines(doc->text + from, to - from);
+    ptrdiff_t delta = (ptrdiff_t) insert_len - (ptrdiff_t) (to - from);
+    splice_text(doc, from, to, insert, insert_len);
+
+    size_t count = doc->item_count;
+    size_t first = 0, hi = count;
+    while(first < hi) {
+        size_t mid = (first + hi) / 2;
+        if(doc->items[mid].end > from) hi = mid;
+        else first = mid + 1;
+    }
+    // the last item can run to the end of the text, a comment goes on
+    if(first == count && count > 0 && doc->items[count - 1].end == old_len) first--;
+    size_t start = first < count ? doc->items[first].start : count ? doc->items[count - 1].end : 0;
+
+    lsp_batch_t *batch;
+    ON_HEAP(batch = mem_calloc(1, sizeof(lsp_batch_t)));
+    batch->arena = arena_create_sized(LSP_BATCH_CHUNK);
+
+    lexer_t lexer;
+    lexer_start_at(&lexer, doc->text, doc->len, start, pos_at(doc, start));
+    size_t edit_end = from + insert_len;
+    lsp_item_t *fresh = NULL;
+    size_t fresh_count = 0;
+    size_t old = first, last = count;
+    for(;;) {
+        lsp_item_t item;
+        if(!lex_item(&lexer, batch, &item)) {
+            last = count;
+            break;
+        }
+        ON_HEAP(fresh = mem_realloc(fresh, sizeof(lsp_item_t) * (fresh_count + 1)));
+        fresh[fresh_count++] = item;
+        if(item.end < edit_end) continue;
+
+        // behind the edit the text is the old one, so is lexing it as long
+        // as the edit's line ended before; the columns there haven't moved
+        while(old < count && (doc->items[old].end < to || (ptrdiff_t) doc->items[old].end + delta < (ptrdiff_t) item.end)) old++;
+        if(old < count && (ptrdiff_t) doc->items[old].end + delta == (ptrdiff_t) item.end && newline_between(doc, edit_end, item.end)) {
+            last = old + 1;
+            break;
+        }
+    }
+
+    int kept = keep_declarations(doc, first, last, fresh, fresh_count);
+    for(size_t i = first; i < last; i++) release_item(&doc->items[i]);
+    size_t new_count = count - (last - first) + fresh_count;
+    if(new_count > doc->item_cap) {
+        doc->item_cap = doc->item_cap * 2 > new_count ? doc->item_cap * 2 : new_count;
+        ON_HEAP(doc->items = mem_realloc(doc->items, sizeof(lsp_item_t) * doc->item_cap));
+    }
+    memmove(doc->items + first + fresh_count, doc->items + last, sizeof(lsp_item_t) * (count - last));
+    memcpy(doc->items + first, fresh, sizeof(lsp_item_t) * fresh_count);
+    doc->item_count = new_count;
+    ON_HEAP(mem_free(fresh));
+    if(batch->items == 0) {
+        arena_destroy(batch->arena);
+        ON_HEAP(mem_free(batch));
+    }
+
+    for(size_t i = first + fresh_count; i < new_count; i++) {
+        doc->items[i].start += delta;
+        doc->items[i].end += delta;
+        doc->items[i].line_shift += line_delta;
+    }
+    if(!kept) doc->redeclare = 1;
+}
+
+static int uses_name(lsp_item_t *item, const char *name) {
+    unsigned long bit = hash((char *) name) % LSP_NAME_BITS;
+    if(!(item->names[bit / 64] & (1ull << (bit % 64)))) return 0;
+    for(token_t *t = item->tokens->next; t != NULL; t = t->next) {
+        if(t->type == IDENTIFIER && strcmp(t->value, name) == 0) return 1;
+    }
+    return 0;
+}
+
+static int same_symbol(symbol_t *a, symbol_t *b) {
+    return a && b && a->kind == b->kind && a->type == b->type;
+}
+
+// A check only depends on the symbols of the names it uses: the items that
+// use one that came, went or changed type are due again. Different imports
+// can change any call.
+static void mark_changed(lsp_document_t *doc, symbol_table_t *previous) {
+    module_t *a = doc->table.imports, *b = previous->imports;
+    while(a && b && strcmp(a->name, b->name) == 0) {
+        a = a->next;
+        b = b->next;
+    }
+    if(a || b) {
+        for(size_t i = 0; i < doc->item_count; i++) doc->items[i].stale = 1;
+        return;
+    }
+
+    char **changed = NULL;
+    size_t count = 0;
+    struct scope *scopes[2] = {doc->table.global_scope, previous->global_scope};
+    for(int k = 0; k < 2; k++) {
+        for(size_t slot = 0; slot < HASHMAP_TABLE_SIZE; slot++) {
+            for(struct node *n = scopes[k]->table[slot]; n != NULL; n = n->next) {
+                // taken from an import on first use, the imports are the same
+                if(n->value->declaration == NULL) continue;
+                if(same_symbol(n->value, map_get(scopes[!k], n->key))) continue;
+                changed = mem_realloc(changed, sizeof(char *) * (count + 1));
+                changed[count++] = n->key;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < doc->item_count; i++) {
+        lsp_item_t *item = &doc->items[i];
+        for(size_t k = 0; k < count && !item->stale; k++) {
+            if(uses_name(item, changed[k])) item->stale = 1;
+        }
+    }
+    mem_free(changed);
+}
+
+// Every top-level name into a new symbol table, the first of each wins like
+// semantic_check's pre-pass. An item whose names now win or lose is stale,
+// so is one using a symbol that changed.
+static void declare_items(lsp_server_t *server, lsp_document_t *doc) {
+    symbol_table_t previous = doc->table;
+    arena_t *retired = doc->globals;
+    doc->globals = doc->retired;
+    doc->retired = retired;
+    doc->checks = 0;
+    doc->redeclare = 0;
+
+    arena_t *outer = arena_swap(doc->globals);
+    semantic_begin(&doc->table);
+    FILE *stream = diag_stream();
+    diag_set_stream(server->null);
+
+    for(size_t i = 0; i < doc->item_count; i++) {
+        lsp_item_t *item = &doc->items[i];
+        uint64_t owns = 0;
+        int n = 0;
+        for(struct statement_list *cur = item->statements; cur && cur->next; cur = cur->next, n++) {
+            ast_statement_t *stmt = cur->statement;
+            if(stmt == NULL) continue;
+            if(stmt->type == AST_IMPORT) {
+                semantic_import(&doc->table, stmt->statement.import.module, stmt->pos);
+                continue;
+            }
+
+            char *name = declared_name(stmt);
+            if(name == NULL || map_get(doc->table.global_scope, name) != NULL) continue;
+            if(stmt->type == AST_FUNC_DECLARATION) semantic_declare(&doc->table, SYMBOL_FUNC, name, stmt->statement.function.type);
+            else semantic_declare(&doc->table, SYMBOL_VAR, name, stmt->statement.declaration.t);
+            map_get(doc->table.global_scope, name)->declaration = stmt;
+            if(n < 64) owns |= 1ull << n;
+        }
+        if(owns != item->owns) {
+            item->owns = owns;
+            item->stale = 1;
+        }
+    }
+
+    diag_set_stream(stream);
+    arena_swap(outer);
+
+    if(previous.global_scope) mark_changed(doc, &previous);
+    semantic_end(&previous);
+    arena_reset(doc->retired);
+}
+
+static void check_item(lsp_document_t *doc, lsp_item_t *item) {
+    // scopes and locals go with the symbol table
+    arena_t *outer = arena_swap(doc->globals);
+    char *text;
+    size_t len;
+    FILE *capture = open_memstream(&text, &len);
+    FILE *previous = diag_stream();
+    diag_set_stream(capture);
+
+    for(struct statement_list *cur = item->statements; cur && cur->next; cur = cur->next) {
+        ast_statement_t *stmt = cur->statement;
+        if(stmt == NULL) continue;
+        if(stmt->type == AST_IMPORT) {
+            // reports the import again if it failed
+            semantic_import(&doc->table, stmt->statement.import.module, stmt->pos);
+            continue;
+        }
+
+        // only the first declaration of a name passes without a warning
+        char *name = declared_name(stmt);
+        symbol_t *sym = name ? map_get(doc->table.global_scope, name) : NULL;
+        if(sym) sym->ahead = sym->declaration == stmt;
+        semantic_check_statement(stmt, &doc->table);
+    }
+    diag_set_stream(previous);
+    fclose(capture);
+
+    arena_swap(item->batch->arena);
+    item->diagnostics = NULL;
+    item->diagnostic_count = 0;
+    add_diagnostics(item, item->syntax, item->syntax_len);
+    add_diagnostics(item, text, len);
+    arena_swap(outer);
+    mem_free(text);
+    item->stale = 0;
+    doc->checks++;
+}
+
+static void check_document(lsp_server_t *server, lsp_document_t *doc) {
+    if(doc->redeclare) declare_items(server, doc);
+    for(size_t i = 0; i < doc->item_count; i++) {
+        if(doc->items[i].stale) check_item(doc, &doc->items[i]);
+    }
+    // their scopes pile up with the table, a new one drops them
+    if(doc->checks >= LSP_MAX_CHECKS) declare_items(server, doc);
+}
+
+static lsp_document_t *find_document(lsp_server_t *server, const char *uri) {
+    for(lsp_document_t *doc = server->documents; doc != NULL; doc = doc->next) {
+        if(uri && strcmp(doc->uri, uri) == 0) return doc;
+    }
+    return NULL;
+}
+
+static void close_document(lsp_server_t *server, lsp_document_t *doc) {
+    lsp_document_t **link = &server->documents;
+    while(*link != doc) link = &(*link)->next;
+    *link = doc->next;
+
+    for(size_t i = 0; i < doc->item_count; i++) release_item(&doc->items[i]);
+    semantic_end(&doc->table);
+    arena_destroy(doc->globals);
+    arena_destroy(doc->retired);
+    ON_HEAP(mem_free(doc->uri); mem_free(doc->text); mem_free(doc->lines); mem_free(doc->items); mem_free(doc));
+}
+
+static lsp_document_t *open_document(lsp_server_t *server, const char *uri, const char *text, size_t len) {
+    lsp_document_t *doc = find_document(server, uri);
+    if(doc) close_document(server, doc);
+
+    ON_HEAP(
+        doc = mem_calloc(1, sizeof(lsp_document_t));
+        doc->uri = mem_strdup(uri);
+        doc->text = mem_calloc(1, 1);
+        doc->cap = 1;
+        doc->lines = mem_calloc(1, sizeof(size_t));
+        doc->line_count = doc->line_cap = 1;
+    );
+    doc->globals = arena_create();
+    doc->retired = arena_create();
+    doc->next = server->documents;
+    server->documents = doc;
+    apply_change(doc, 0, 0, text, len);
+    return doc;
+}
+
+// Definitions
+
+static int is_type_token(token_type_t type) {
+    switch(type) {
+        case I8: case I16: case I32: case I64:
+        case U8: case U16: case U32: case U64:
+        case SHORT: case LONG: case UNSIGNED: case VOID: case STAR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// the name in the first top-level statement declaring it as a function, or
+// as a variable
+static token_t *find_global(lsp_document_t *doc, const char *name, int function, lsp_item_t **found) {
+    for(size_t i = 0; i < doc->item_count; i++) {
+        lsp_item_t *item = &doc->items[i];
+        for(struct statement_list *cur = item->statements; cur && cur->next; cur = cur->next) {
+            ast_statement_t *stmt = cur->statement;
+            if(stmt == NULL || (stmt->type == AST_FUNC_DECLARATION) != function) continue;
+            char *declared = declared_name(stmt);
+            if(declared == NULL || strcmp(declared, name) != 0) continue;
+
+            for(token_t *t = item->tokens->next; t != NULL; t = t->next) {
+                if(t->type == IDENTIFIER && strcmp(t->value, name) == 0) {
+                    *found = item;
+                    return t;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// the first `type name` of a parameter or local before the use
+static token_t *find_local(lsp_item_t *item, token_t *use) {
+    token_t *prev = NULL;
+    for(token_t *t = item->tokens->next; t != NULL && t != use->next; prev = t, t = t->next) {
+        if(t->type == IDENTIFIER && prev && is_type_token(prev->type) && strcmp(t->value, use->value) == 0) return t;
+    }
+    return NULL;
+}
+
+static token_t *definition(lsp_document_t *doc, int64_t line, int64_t character, lsp_item_t **found) {
+    size_t offset = offset_at(doc, line, character);
+    size_t lo = 0, hi = doc->item_count;
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(doc->items[mid].end > offset) hi = mid;
+        else lo = mid + 1;
+    }
+    if(lo == doc->item_count) return NULL;
+    lsp_item_t *item = &doc->items[lo];
+
+    // the identifier the cursor is on or right behind
+    token_t *use = NULL;
+    for(token_t *t = item->tokens->next; t != NULL; t = t->next) {
+        int64_t column = character + 1;
+        if(t->type == IDENTIFIER && t->pos.line + item->line_shift == line + 1
+            && t->pos.column <= column && column <= t->pos.column + (int64_t) strlen(t->value)) {
+            use = t;
+            break;
+        }
+    }
+    if(use == NULL) return NULL;
+
+    if(use->next && use->next->type == LEFT_PAREN) return find_global(doc, use->value, 1, found);
+    token_t *local = find_local(item, use);
+    if(local) {
+        *found = item;
+        return local;
+    }
+    return find_global(doc, use->value, 0, found);
+}
+
+// Protocol
+
+static char *read_message(lsp_server_t *server, size_t *len) {
+    char header[256];
+    size_t length = SIZE_MAX;
+    for(;;) {
+        if(!fgets(header, sizeof(header), server->in)) return NULL;
+        if(strcmp(header, "\r\n") == 0 || strcmp(header, "\n") == 0) {
+            if(length != SIZE_MAX) break;
+            continue;
+        }
+        if(strncasecmp(header, "Content-Length:", 15) == 0) length = strtoull(header + 15, NULL, 10);
+    }
+
+    char *body = mem_alloc(length + 1);
+    if(body == NULL || fread(body, 1, length, server->in) != length) return NULL;
+    body[length] = '\0';
+    *len = length;
+    return body;
+}
+
+static void send_message(lsp_server_t *server, char *body, size_t len) {
+    fprintf(server->out, "Content-Length: %zu\r\n\r\n", len);
+    fwrite(body, 1, len, server->out);
+    fflush(server->out);
+}
+
+static void write_id(FILE *f, json_t *id) {
+    if(id && id->kind == JSON_STRING) json_write_string(f, id->string, id->length);
+    else if(id && id->kind == JSON_NUMBER) fprintf(f, "%lld", (long long) id->number);
+    else fputs("null", f);
+}
+
+// `result` is JSON text already
+static void respond(lsp_server_t *server, json_t *id, const char *result) {
+    char *body;
+    size_t len;
+    FILE *f = open_memstream(&body, &len);
+    fputs("{\"jsonrpc\":\"2.0\",\"id\":", f);
+    write_id(f, id);
+    fprintf(f, ",\"result\":%s}", result);
+    fclose(f);
+    send_message(server, body, len);
+    mem_free(body);
+}
+
+static void respond_error(lsp_server_t *server, json_t *id, int code, const char *message) {
+    char *body;
+    size_t len;
+    FILE *f = open_memstream(&body, &len);
+    fputs("{\"jsonrpc\":\"2.0\",\"id\":", f);
+    write_id(f, id);
+    fprintf(f, ",\"error\":{\"code\":%d,\"message\":", code);
+    json_write_string(f, message, strlen(message));
+    fputs("}}", f);
+    fclose(f);
+    send_message(server, body, len);
+    mem_free(body);
+}
+
+static void write_range(FILE *f, int line, int column, int length) {
+    fprintf(f, "{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}}",
+            line - 1, column - 1, line - 1, column - 1 + length);
+}
+
+static void publish(lsp_server_t *server, const char *uri, lsp_document_t *doc) {
+    char *body;
+    size_t len;
+    FILE *f = open_memstream(&body, &len);
+    fputs("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":", f);
+    json_write_string(f, uri, strlen(uri));
+    fputs(",\"diagnostics\":[", f);
+    int first = 1;
+    for(size_t i = 0; doc && i < doc->item_count; i++) {
+        lsp_item_t *item = &doc->items[i];
+        for(size_t k = 0; k < item->diagnostic_count; k++) {
+            lsp_diagnostic_t *d = &item->diagnostics[k];
+            if(!first) fputc(',', f);
+            first = 0;
+            fputs("{\"range\":", f);
+            write_range(f, d->line + item->line_shift, d->column, d->length);
+            fprintf(f, ",\"severity\":%d,\"source\":\"divc\",\"message\":", d->severity);
+            json_write_string(f, d->message, strlen(d->message));
+            fputc('}', f);
+        }
+    }
+    fputs("]}}", f);
+    fclose(f);
+    send_message(server, body, len);
+    mem_free(body);
+}
+
+static void initialize(lsp_server_t *server, json_t *id, json_t *params) {
+    // characters are bytes here, which is what utf-8 positions mean
+    json_t *encodings = json_get(json_get(json_get(params, "capabilities"), "general"), "positionEncodings");
+    int utf8 = 0;
+    for(size_t i = 0; encodings && encodings->kind == JSON_ARRAY && i < encodings->count; i++) {
+        const char *encoding = json_string(encodings->items[i]);
+        if(encoding && strcmp(encoding, "utf-8") == 0) utf8 = 1;
+    }
+
+    char result[512];
+    snprintf(result, sizeof(result),
+             "{\"capabilities\":{%s\"textDocumentSync\":{\"openClose\":true,\"change\":2},\"definitionProvider\":true},"
+             "\"serverInfo\":{\"name\":\"divc\"}}",
+             utf8 ? "\"positionEncoding\":\"utf-8\"," : "");
+    respond(server, id, result);
+}
+
+static void did_change(lsp_server_t *server, json_t *params) {
+    const char *uri = json_string(json_get(json_get(params, "textDocument"), "uri"));
+    lsp_document_t *doc = find_document(server, uri);
+    json_t *changes = json_get(params, "contentChanges");
+    if(doc == NULL || changes == NULL || changes->kind != JSON_ARRAY) return;
+
+    for(size_t i = 0; i < changes->count; i++) {
+        json_t *change = changes->items[i];
+        json_t *text = json_get(change, "text");
+        if(text == NULL || text->kind != JSON_STRING) continue;
+
+        // without a range the change is the whole new text
+        json_t *range = json_get(change, "range");
+        size_t from = 0, to = doc->len;
+        if(range) {
+            json_t *start = json_get(range, "start");
+            json_t *end = json_get(range, "end");
+            from = offset_at(doc, json_int(json_get(start, "line"), 0), json_int(json_get(start, "character"), 0));
+            to = offset_at(doc, json_int(json_get(end, "line"), 0), json_int(json_get(end, "character"), 0));
+            if(to < from) to = from;
+        }
+        apply_change(doc, from, to, text->string, text->length);
+    }
+
+    check_document(server, doc);
+    publish(server, uri, doc);
+}
+
+static void goto_definition(lsp_server_t *server, json_t *id, json_t *params) {
+    lsp_document_t *doc = find_document(server, json_string(json_get(json_get(params, "textDocument"), "uri")));
+    json_t *position = json_get(params, "position");
+    lsp_item_t *item = NULL;
+    token_t *name = doc ? definition(doc, json_int(json_get(position, "line"), -1), json_int(json_get(position, "character"), -1), &item) : NULL;
+    if(name == NULL) {
+        respond(server, id, "null");
+        return;
+    }
+
+    char *result;
+    size_t len;
+    FILE *f = open_memstream(&result, &len);
+    fputs("{\"uri\":", f);
+    json_write_string(f, doc->uri, strlen(doc->uri));
+    fputs(",\"range\":", f);
+    write_range(f, name->pos.line + item->line_shift, name->pos.column, (int) strlen(name->value));
+    fputc('}', f);
+    fclose(f);
+    respond(server, id, result);
+    mem_free(result);
+}
+
+// 1 once the client said exit
+static int handle(lsp_server_t *server, json_t *message) {
+    const char *method = json_string(json_get(message, "method"));
+    json_t *id = json_get(message, "id");
+    json_t *params = json_get(message, "params");
+    if(method == NULL) return 0; // a response, the server asks nothing
+
+    if(strcmp(method, "initialize") == 0) {
+        initialize(server, id, params);
+    }
+    else if(strcmp(method, "shutdown") == 0) {
+        server->shutdown = 1;
+        respond(server, id, "null");
+    }
+    else if(strcmp(method, "exit") == 0) {
+        return 1;
+    }
+    else if(strcmp(method, "textDocument/didOpen") == 0) {
+        json_t *document = json_get(params, "textDocument");
+        const char *uri = json_string(json_get(document, "uri"));
+        json_t *text = json_get(document, "text");
+        if(uri && text && text->kind == JSON_STRING) {
+            lsp_document_t *doc = open_document(server, uri, text->string, text->length);
+            check_document(server, doc);
+            publish(server, uri, doc);
+        }
+    }
+    else if(strcmp(method, "textDocument/didChange") == 0) {
+        did_change(server, params);
+    }
+    else if(strcmp(method, "textDocument/didClose") == 0) {
+        const char *uri = json_string(json_get(json_get(params, "textDocument"), "uri"));
+        lsp_document_t *doc = find_document(server, uri);
+        if(doc) {
+            close_document(server, doc);
+            publish(server, uri, NULL);
+        }
+    }
+    else if(strcmp(method, "textDocument/definition") == 0) {
+        goto_definition(server, id, params);
+    }
+    else if(id != NULL) {
+        respond_error(server, id, -32601, "method not found");
+    }
+    return 0;
+}
+
+int lsp_serve(FILE *in, FILE *out, char **import_dirs, size_t import_dir_count) {
+    lsp_server_t server = {in, out, fopen("/dev/null", "w"), NULL, 0};
+    arena_t *scratch = arena_create();
+    if(!server.null || !scratch) {
+        fprintf(stderr, "Failed to set up the language server\n");
+        return 1;
+    }
+    module_set_path(import_dirs, import_dir_count);
+
+    // the keyword trie outlives the scratch arena
+    lexer_init();
+
+    int status = 1;
+    for(;;) {
+        arena_swap(scratch);
+        size_t len;
+        char *body = read_message(&server, &len);
+        if(body == NULL) {
+            arena_swap(NULL);
+            break;
+        }
+
+        json_t *message = json_parse(body, len);
+        int done = 0;
+        if(message == NULL) respond_error(&server, NULL, -32700, "parse error");
+        else done = handle(&server, message);
+        arena_swap(NULL);
+        arena_reset(scratch);
+        if(done) {
+            status = server.shutdown ? 0 : 1;
+            break;
+        }
+    }
+
+    while(server.documents) close_document(&server, server.documents);
+    arena_destroy(scratch);
+    fclose(server.null);
+    return status;
+}
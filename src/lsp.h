@@ -0,0 +1,15 @@
+#ifndef _LSP_H
+#define _LSP_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// divc --lsp: a language server speaking JSON-RPC over `in` and `out`.
+// An open document is kept as its top-level items, each with its tokens,
+// AST and diagnostics. An edit re-lexes and re-parses the items it touches
+// and checks them again; the others only move. Diagnostics are published
+// after every change, and definitions are found for calls and variables.
+// Returns the exit status, 0 after a shutdown request.
+int lsp_serve(FILE *in, FILE *out, char **import_dirs, size_t import_dir_count);
+
+#endif
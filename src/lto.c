@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "diag.h"
+#include "jobs.h"
+#include "lto.h"
+#include "peephole.h"
+
+typedef struct definition {
+    const char *name;
+    size_t unit;
+    int is_static;
+} definition_t;
+
+static int compare_definitions(const void *a, const void *b) {
+    const definition_t *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+    if(c) return c;
+    return x->unit < y->unit ? -1 : x->unit > y->unit;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+// unit u's static function `name` from here on
+static char *local_name(const char *name, size_t unit) {
+    size_t len = strlen(name) + 32;
+    char *local = mem_alloc(len);
+    snprintf(local, len, "%s.lto.%zu", name, unit);
+    return local;
+}
+
+// every FUNC_START of the unit and every call in it to one of `names`
+// (sorted) gets the unit-local name
+static void rename_statics(ir_instruction_list_t *ir, const char **names, size_t count, size_t unit) {
+    for(ir_instruction_list_t *node = ir; node; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst) continue;
+        char **name = NULL;
+        if(inst->opcode == IR_FUNC_START) name = &inst->func.func_name;
+        else if(inst->opcode == IR_CALL) name = &inst->src1->func_name;
+        if(!name || !bsearch(name, names, count, sizeof(char *), compare_names)) continue;
+        *name = local_name(*name, unit);
+    }
+}
+
+ir_instruction_list_t *lto_merge(lto_unit_t *units, size_t count, int whole_program) {
+    definition_t *defs = NULL;
+    size_t def_count = 0, def_cap = 0;
+    for(size_t u = 0; u < count; u++) {
+        for(ir_instruction_list_t *node = units[u].ir; node; node = node->next) {
+            ir_instruction_t *inst = node->instruction;
+            if(!inst || inst->opcode != IR_FUNC_START) continue;
+            if(def_count == def_cap) {
+                def_cap = def_cap ? def_cap * 2 : 64;
+                defs = mem_realloc(defs, sizeof(definition_t) * def_cap);
+            }
+            defs[def_count++] = (definition_t) {inst->func.func_name, u, inst->func.is_static};
+        }
+    }
+    qsort(defs, def_count, sizeof(definition_t), compare_definitions);
+
+    // per unit, the static names that another unit defines too; they come
+    // out of the sorted definitions sorted as well
+    const char ***renames = mem_calloc(count + 1, sizeof(char **));
+    size_t *rename_count = mem_calloc(count + 1, sizeof(size_t));
+    int errors = 0;
+    for(size_t i = 0; i < def_count;) {
+        size_t end = i + 1;
+        while(end < def_count && strcmp(defs[end].name, defs[i].name) == 0) end++;
+
+        // redefinitions within a unit were a warning already
+        const definition_t *exported = NULL;
+        int units_defining = 1;
+        for(size_t j = i; j < end; j++) {
+            if(j > i && defs[j].unit != defs[j - 1].unit) units_defining++;
+            if(defs[j].is_static) continue;
+            if(exported && exported->unit != defs[j].unit) {
+                fprintf(diag_stream(), "LTO error: '%s' is defined in both %s and %s\n",
+                        defs[j].name, units[exported->unit].name, units[defs[j].unit].name);
+                errors++;
+                break;
+            }
+            if(!exported) exported = &defs[j];
+        }
+
+        for(size_t j = i; j < end && units_defining > 1; j++) {
+            if(!defs[j].is_static || (j > i && defs[j].unit == defs[j - 1].unit && defs[j - 1].is_static)) continue;
+            size_t u = defs[j].unit;
+            renames[u] = mem_realloc(renames[u], sizeof(char *) * (rename_count[u] + 1));
+            renames[u][rename_count[u]++] = defs[j].name;
+        }
+        i = end;
+    }
+
+    for(size_t u = 0; u < count && !errors; u++) {
+        if(rename_count[u]) rename_statics(units[u].ir, renames[u], rename_count[u], u);
+    }
+    for(size_t u = 0; u < count; u++) mem_free(renames[u]);
+    mem_free(renames);
+    mem_free(rename_count);
+    mem_free(defs);
+    if(errors) return NULL;
+
+    // one list, without the empty node every unit ends in
+    ir_instruction_list_t *head = NULL, *last = NULL;
+    for(size_t u = 0; u < count; u++) {
+        ir_instruction_list_t *node = units[u].ir;
+        if(!node || !node->instruction) continue;
+        if(last) last->next = node;
+        else head = node;
+        while(node->next && node->next->instruction) node = node->next;
+        last = node;
+    }
+    if(!head) return mem_calloc(1, sizeof(ir_instruction_list_t));
+    last->next = mem_calloc(1, sizeof(ir_instruction_list_t));
+
+    if(whole_program) {
+        for(ir_instruction_list_t *node = head; node; node = node->next) {
+            ir_instruction_t *inst = node->instruction;
+            if(!inst || inst->opcode != IR_FUNC_START) continue;
+            if(strcmp(inst->func.func_name, "main") != 0 && strcmp(inst->func.func_name, "_start") != 0) inst->func.is_static = 1;
+        }
+    }
+    return head;
+}
+
+typedef struct partition {
+    ir_instruction_list_t *start; // FUNC_START of its first function
+    ir_instruction_list_t *end;   // FUNC_END of its last
+    ir_instruction_list_t *after; // what came after `end` in the list
+    codegen_options_t options;
+    x64_code_t code;
+    report_t report;
+} partition_t;
+
+typedef struct partition_run {
+    partition_t *parts;
+    int report;
+} partition_run_t;
+
+static void generate_partition(void *arg, size_t index) {
+    partition_run_t *run = arg;
+    partition_t *part = &run->parts[index];
+    if(run->report) report_start(&part->report);
+    generate_x64_binary(part->start, &part->code, &part->options);
+    report_stop();
+}
+
+void lto_generate_binary(ir_instruction_list_t *ir, x64_code_t *code, codegen_options_t *options,
+                         int partitions, report_t *report) {
+    // whole functions and their sizes, a partition gets about the same share
+    // of instructions as any other
+    size_t functions = 0, total = 0;
+    for(ir_instruction_list_t *node = ir; node; node = node->next) {
+        if(!node->instruction) continue;
+        functions += node->instruction->opcode == IR_FUNC_START;
+        total++;
+    }
+    if(partitions > (int) functions) partitions = (int) functions;
+    if(partitions <= 1) {
+        generate_x64_binary(ir, code, options);
+        return;
+    }
+
+    partition_t *parts = mem_calloc((size_t) partitions, sizeof(partition_t));
+    int count = 0;
+    size_t seen = 0;
+    for(ir_instruction_list_t *node = ir; node; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst) continue;
+        seen++;
+        if(inst->opcode == IR_FUNC_START && !parts[count].start) parts[count].start = node;
+        if(inst->opcode == IR_FUNC_END && parts[count].start) {
+            parts[count].end = node;
+            // full once its share is reached, the last one takes the rest
+            if(count + 1 < partitions && seen * (size_t) partitions >= total * (size_t) (count + 1)) count++;
+        }
+    }
+    if(parts[count].start) count++;
+
+    for(int i = 0; i < count; i++) {
+        parts[i].after = parts[i].end->next;
+        parts[i].end->next = NULL;
+        parts[i].options = *options;
+        parts[i].options.peephole_stats = (peephole_stats_t) {0};
+    }
+
+    // the caller's report resumes once the partitions are done
+    if(report) report_stop();
+    partition_run_t run = {parts, report != NULL};
+    jobs_run((size_t) count, count, generate_partition, &run);
+    if(report) report_start(report);
+
+    for(int i = 0; i < count; i++) {
+        parts[i].end->next = parts[i].after;
+        x64_code_append(code, &parts[i].code);
+        peephole_stats_add(&options->peephole_stats, &parts[i].options.peephole_stats);
+        if(report) report_add(report, &parts[i].report);
+    }
+    mem_free(parts);
+}
@@ -0,0 +1,31 @@
+#ifndef _LTO_H
+#define _LTO_H
+
+#include <stddef.h>
+
+#include "code_gen.h"
+#include "ir.h"
+#include "report.h"
+
+// -flto: the IR of every input is linked into one program, optimized across
+// files by ipa_optimize and compiled to a single output.
+typedef struct lto_unit {
+    const char *name; // input, for diagnostics
+    ir_instruction_list_t *ir;
+} lto_unit_t;
+
+// Chains the units together. A function defined in several of them is an
+// error unless all but one are static; static ones get unit-local names
+// (f.lto.N) so they keep apart. With `whole_program` nothing but main and
+// _start can be called from outside, so everything else is made static.
+// Returns NULL after printing the errors.
+ir_instruction_list_t *lto_merge(lto_unit_t *units, size_t count, int whole_program);
+
+// Encodes the program in up to `partitions` runs of whole functions, one
+// thread each, and appends them in order; the bytes are the same for any
+// count. Every partition's time goes to `report` if it's not NULL, which
+// must be the calling thread's; it's restarted in PHASE_DRIVER afterwards.
+void lto_generate_binary(ir_instruction_list_t *ir, x64_code_t *code, codegen_options_t *options,
+                         int partitions, report_t *report);
+
+#endif
@@ -1,26 +1,81 @@
+#include "alloc.h"
+#include "cache.h"
+#include "callgraph.h"
+#include "code_gen.h"
+#include "diag.h"
+#include "elf_writer.h"
 #include "ir.h"
+#include "ipa.h"
+#include "ir_binary.h"
+#include "jit.h"
+#include "jobs.h"
 #include "lexer.h"
+#include "lsp.h"
+#include "lto.h"
+#include "module.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "report.h"
 #include "semantic.h"
+#include "server.h"
+#include "vm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 void print_ast(struct statement_list *statements);
 void print_ast_types(struct statement_list *statements);
 void print_tokens(token_t *token);
 void print_ir(ir_instruction_list_t *list);
-void generate_x64_code(ir_instruction_list_t *inst, FILE *f);
 
-int main(int argc, char *argv[]) {
-    if(argc < 2) {
-        printf("Usage: %s <file>\n", argv[0]);
+int run_program(ir_instruction_list_t *ir) {
+    vm_program_t *program = vm_compile(ir);
+    if(!program) return 1;
+
+    const char *entry = vm_find_function(program, "main") >= 0 ? "main" : "_start";
+    int64_t result = 0;
+    int status = vm_run(program, entry, &result);
+    vm_free(program);
+
+    return status == 0 ? (int) (result & 0xff) : 1;
+}
+
+int jit_program(ir_instruction_list_t *ir) {
+    jit_module_t *module = jit_compile(ir);
+    if(!module) return 1;
+
+    jit_main_t entry = jit_main(module);
+    if(!entry) {
+        fprintf(stderr, "JIT error: No main function\n");
+        jit_free(module);
         return 1;
     }
 
-    FILE *f = fopen(argv[1], "r");
+    int result = entry();
+    jit_free(module);
+    return result & 0xff;
+}
+
+// the input "-" is read from `in`
+char *read_source(char *input, FILE *in, size_t *len) {
+    if(strcmp(input, "-") == 0) {
+        size_t size = 0, cap = 4096;
+        char *buffer = mem_alloc(cap);
+        size_t got;
+        while((got = fread(buffer + size, 1, cap - size - 1, in)) > 0) {
+            size += got;
+            if(size + 1 == cap) buffer = mem_realloc(buffer, cap *= 2);
+        }
+        buffer[size] = '\0';
+        *len = size;
+        return buffer;
+    }
+
+    FILE *f = fopen(input, "r");
     if(!f) {
-        printf("Failed to open specified file.\n");
-        return 1;
+        fprintf(diag_stream(), "Failed to open specified file '%s'.\n", input);
+        return NULL;
     }
 
     size_t size = 0;
@@ -28,26 +83,650 @@ int main(int argc, char *argv[]) {
     size = ftell(f);
     fseek(f, 0, SEEK_SET);
 
-    char *buffer = (char *) malloc(size+1);
-    fread(buffer, size, 1, f);
+    char *buffer = (char *) mem_alloc(size+1);
+    size = fread(buffer, 1, size, f);
     buffer[size] = '\0';
 
     fclose(f);
+    *len = size;
+    return buffer;
+}
 
+ir_instruction_list_t *compile_source(char *buffer) {
+    phase_t outer = report_enter(PHASE_LEX);
     token_t *token = lexer_parse(buffer);
     // print_tokens(token);
 
-    struct statement_list *statement = ast_parse(token);
+    report_enter(PHASE_PARSE);
+    int errors = 0;
+    struct statement_list *statement = ast_parse(token, &errors);
     // print_ast(statement);
 
-    semantic_check(statement);
+    // what did parse is still checked, for its errors
+    report_enter(PHASE_SEMANTIC);
+    errors += semantic_check(statement);
+
+    ir_instruction_list_t *ir = NULL;
+    if(errors == 0) {
+        report_enter(PHASE_IR_GEN);
+        ir = generate_ir(statement);
+        // print_ir(ir);
+    }
+
+    report_leave(outer);
+    return ir;
+}
+
+// static functions that nothing reachable calls never get to codegen
+static ir_instruction_list_t *drop_dead_functions(ir_instruction_list_t *ir, codegen_options_t *options) {
+    if(!ir || options->keep_static_functions) return ir;
+    phase_t outer = report_enter(PHASE_IR_GEN);
+    size_t dropped;
+    ir = ir_drop_dead_functions(ir, &dropped);
+    report_leave(outer);
+    return ir;
+}
+
+// a serialized .ir skips lexing, parsing and semantic analysis
+static ir_instruction_list_t *load_ir(char *input, FILE *in, char *source, ir_file_t **ir_file) {
+    *ir_file = NULL;
+    if(strcmp(input, "-") != 0 && ir_is_binary(input)) {
+        phase_t outer = report_enter(PHASE_IR_READ);
+        *ir_file = ir_read_binary(input);
+        report_leave(outer);
+        return *ir_file ? (*ir_file)->ir : NULL;
+    }
+
+    size_t len;
+    if(!source) source = read_source(input, in, &len);
+    return source ? compile_source(source) : NULL;
+}
+
+typedef enum {
+    OUTPUT_OBJECT,
+    OUTPUT_ASSEMBLY,
+    OUTPUT_IR,
+    OUTPUT_INTERFACE,
+} output_kind_t;
+
+// one input of the command line and what became of it
+typedef struct compile_job {
+    char *input;
+    char *output;
+    int status;
+    char *diagnostics; // printed in input order once every job is done
+    size_t diagnostics_len;
+    peephole_stats_t peephole_stats;
+    report_t report;
+
+    // -flto, what the link step takes from the input
+    ir_instruction_list_t *ir;
+    ir_file_t *ir_file;
+} compile_job_t;
+
+typedef struct driver {
+    compile_job_t *jobs;
+    output_kind_t kind;
+    codegen_options_t *options; // shared, each job works on a copy
+    cache_t *cache; // NULL without --cache
+    int report; // -ftime-report or -fmem-report
+    int pipeline; // -fpipeline
+    driver_io_t *io;
+    char **import_dirs; // -I, searched after the current directory
+    size_t import_dir_count;
+
+    // -flto: the jobs only load their input's IR, one more links them all
+    int lto;
+    int lto_partitions;
+    int whole_program; // -fwhole-program
+    size_t input_count;
+    ipa_stats_t ipa_stats;
+} driver_t;
+
+// everything the output depends on besides the source bytes
+static void output_key(driver_t *driver, compile_job_t *job, char *source, size_t len, char key[CACHE_KEY_LEN + 1]) {
+    codegen_options_t *options = driver->options;
+    cache_hash_t hash;
+    cache_hash_init(&hash);
+    cache_hash_int(&hash, driver->kind);
+    cache_hash_int(&hash, options->no_peephole);
+    cache_hash_int(&hash, options->no_regalloc);
+    cache_hash_int(&hash, options->no_stack_reuse);
+    cache_hash_int(&hash, options->frame.omit_frame_pointer);
+    cache_hash_int(&hash, options->frame.keep_leaf_frame);
+    cache_hash_int(&hash, options->frame.no_shrink_wrap);
+    cache_hash_int(&hash, options->debug_info);
+    cache_hash_int(&hash, options->keep_static_functions);
+    cache_hash_string(&hash, options->profile_generate);
+    cache_hash_int(&hash, options->profile ? (int64_t) options->profile->size : -1);
+    if(options->profile) cache_hash_update(&hash, options->profile->data, options->profile->size);
+
+    // the object names its source, and -g also the directory it was built in
+    cache_hash_string(&hash, job->input);
+    char cwd[4096];
+    cache_hash_string(&hash, options->debug_info ? getcwd(cwd, sizeof(cwd)) : NULL);
+
+    // the interfaces it imports decide the types of calls
+    size_t at = 0;
+    for(char *name; (name = module_scan_import(source, len, &at)) != NULL; mem_free(name)) {
+        char *path = module_find(name);
+        cache_hash_string(&hash, path);
+        FILE *f = path ? fopen(path, "rb") : NULL;
+        if(f) {
+            char buffer[4096];
+            size_t got;
+            while((got = fread(buffer, 1, sizeof(buffer), f)) > 0) cache_hash_update(&hash, buffer, got);
+            fclose(f);
+        }
+        mem_free(path);
+    }
+
+    cache_hash_update(&hash, source, len);
+    cache_hash_final(&hash, key);
+}
+
+static int compile_file(driver_t *driver, compile_job_t *job) {
+    // -o - writes to stdout, which is usually a pipe into the assembler
+    int to_stdout = strcmp(job->output, "-") == 0;
+
+    // a hit is one read of the input and one copy out of the cache
+    char *source = NULL;
+    char key[CACHE_KEY_LEN + 1];
+    if(driver->cache) {
+        size_t len;
+        source = read_source(job->input, driver->io->in, &len);
+        if(!source) return 1;
+        output_key(driver, job, source, len, key);
+        if(cache_lookup(driver->cache, key, to_stdout ? NULL : job->output, driver->io->out, diag_stream())) return 0;
+    }
+
+    // -fprofile-use lays out the whole file at once, and a .ir has nothing
+    // left to pipeline
+    int pipelined = driver->pipeline && (driver->kind == OUTPUT_OBJECT || driver->kind == OUTPUT_ASSEMBLY) && !driver->options->profile
+        && (strcmp(job->input, "-") == 0 || !ir_is_binary(job->input));
+
+    ir_file_t *ir_file = NULL;
+    ir_instruction_list_t *ir = NULL;
+    if(pipelined) {
+        size_t len;
+        if(!source) source = read_source(job->input, driver->io->in, &len);
+        if(!source) return 1;
+    }
+    else {
+        ir = load_ir(job->input, driver->io->in, source, &ir_file);
+        if(!ir) return 1;
+        ir = drop_dead_functions(ir, driver->options);
+    }
+
+    // line tables name the original source, also when compiling a .ir
+    codegen_options_t options = *driver->options;
+    options.source_name = ir_file && ir_file->source ? ir_file->source : job->input;
+
+    FILE *output_f = to_stdout ? driver->io->out : fopen(job->output, driver->kind == OUTPUT_ASSEMBLY ? "w" : "wb");
+    if(!output_f) {
+        fprintf(diag_stream(), "Failed to open output file '%s'.\n", job->output);
+        ir_file_close(ir_file);
+        return 1;
+    }
+
+    int status = 0;
+    if(driver->kind == OUTPUT_IR) {
+        phase_t outer = report_enter(PHASE_OUTPUT);
+        status = ir_write_binary(ir, options.source_name, output_f);
+        report_leave(outer);
+    }
+    else if(driver->kind == OUTPUT_INTERFACE) {
+        phase_t outer = report_enter(PHASE_OUTPUT);
+        status = module_write_interface(ir, output_f);
+        report_leave(outer);
+    }
+    else if(driver->kind == OUTPUT_ASSEMBLY) {
+        asm_writer_t out;
+        if(to_stdout && output_f == stdout) asm_writer_init_fd(&out, fileno(stdout));
+        else asm_writer_init_file(&out, output_f);
+        if(pipelined) status = pipeline_compile(source, &out, NULL, &options);
+        else generate_x64_code(ir, &out, &options);
+        phase_t outer = report_enter(PHASE_OUTPUT);
+        if(asm_writer_close(&out) != 0) status = 1;
+        report_leave(outer);
+    }
+    else {
+        x64_code_t code = {0};
+        if(pipelined) status = pipeline_compile(source, NULL, &code, &options);
+        else generate_x64_binary(ir, &code, &options);
+        phase_t outer = report_enter(PHASE_OUTPUT);
+        if(status == 0) status = elf_write_object(output_f, &code, options.source_name);
+        report_leave(outer);
+        x64_code_free(&code);
+    }
+    if(!to_stdout) fclose(output_f);
+    else fflush(output_f);
+    ir_file_close(ir_file);
+
+    // the pipeline finds errors after it started writing
+    if(status != 0 && pipelined && !to_stdout) unlink(job->output);
+
+    // only files can be read back into the cache
+    if(driver->cache && status == 0 && !to_stdout) {
+        fflush(diag_stream());
+        cache_store(driver->cache, key, job->output, job->diagnostics, job->diagnostics_len);
+    }
+
+    job->peephole_stats = options.peephole_stats;
+    return status == 0 ? 0 : 1;
+}
+
+static int load_unit(driver_t *driver, compile_job_t *job) {
+    job->ir = load_ir(job->input, driver->io->in, NULL, &job->ir_file);
+    return job->ir ? 0 : 1;
+}
+
+// -flto: every input's IR as one program, through the interprocedural
+// passes and codegen once
+static int link_units(driver_t *driver, compile_job_t *job) {
+    size_t count = driver->input_count;
+    lto_unit_t *units = mem_calloc(count, sizeof(lto_unit_t));
+    for(size_t i = 0; i < count; i++) {
+        units[i] = (lto_unit_t) {driver->jobs[i].input, driver->jobs[i].ir};
+    }
+
+    phase_t outer = report_enter(PHASE_IPA);
+    ir_instruction_list_t *ir = lto_merge(units, count, driver->whole_program);
+    if(ir) {
+        ipa_optimize(ir, driver->options->profile, &driver->ipa_stats);
+        if(!driver->options->keep_static_functions) ir = ir_drop_dead_functions(ir, &driver->ipa_stats.dropped);
+    }
+    report_leave(outer);
+    mem_free(units);
+    if(!ir) return 1;
+
+    // one line table, named after the first input
+    compile_job_t *first = &driver->jobs[0];
+    codegen_options_t options = *driver->options;
+    options.source_name = first->ir_file && first->ir_file->source ? first->ir_file->source : first->input;
+
+    int to_stdout = strcmp(job->output, "-") == 0;
+    FILE *output_f = to_stdout ? driver->io->out : fopen(job->output, driver->kind == OUTPUT_ASSEMBLY ? "w" : "wb");
+    if(!output_f) {
+        fprintf(diag_stream(), "Failed to open output file '%s'.\n", job->output);
+        return 1;
+    }
+
+    int status = 0;
+    if(driver->kind == OUTPUT_IR) {
+        outer = report_enter(PHASE_OUTPUT);
+        status = ir_write_binary(ir, options.source_name, output_f);
+        report_leave(outer);
+    }
+    else if(driver->kind == OUTPUT_INTERFACE) {
+        outer = report_enter(PHASE_OUTPUT);
+        status = module_write_interface(ir, output_f);
+        report_leave(outer);
+    }
+    else if(driver->kind == OUTPUT_ASSEMBLY) {
+        asm_writer_t out;
+        if(to_stdout && output_f == stdout) asm_writer_init_fd(&out, fileno(stdout));
+        else asm_writer_init_file(&out, output_f);
+        generate_x64_code(ir, &out, &options);
+        outer = report_enter(PHASE_OUTPUT);
+        status = asm_writer_close(&out);
+        report_leave(outer);
+    }
+    else {
+        // profile counters and ordering span the whole program
+        int partitions = options.profile || options.profile_generate ? 1 : driver->lto_partitions;
+        x64_code_t code = {0};
+        lto_generate_binary(ir, &code, &options, partitions, driver->report ? &job->report : NULL);
+        outer = report_enter(PHASE_OUTPUT);
+        status = elf_write_object(output_f, &code, options.source_name);
+        report_leave(outer);
+        x64_code_free(&code);
+    }
+    if(!to_stdout) fclose(output_f);
+    else fflush(output_f);
 
-    ir_instruction_list_t *ir = generate_ir(statement);
-    // print_ir(ir);
+    job->peephole_stats = options.peephole_stats;
+    return status == 0 ? 0 : 1;
+}
 
-    FILE *output_f = fopen("out.s", "w");
-    generate_x64_code(ir, output_f);
-    fclose(output_f);
+typedef int (*job_body_t)(driver_t *driver, compile_job_t *job);
+
+// a job's diagnostics and report are kept apart from the others'
+static void run_job(driver_t *driver, compile_job_t *job, job_body_t body) {
+    FILE *previous = diag_stream();
+    FILE *diagnostics = open_memstream(&job->diagnostics, &job->diagnostics_len);
+    diag_set_stream(diagnostics);
+    module_set_path(driver->import_dirs, driver->import_dir_count);
+    if(driver->report) report_start(&job->report);
+    job->status = body(driver, job);
+    report_stop();
+    diag_set_stream(previous);
+    fclose(diagnostics);
+}
+
+static void compile_job(void *arg, size_t index) {
+    driver_t *driver = arg;
+    run_job(driver, &driver->jobs[index], driver->lto ? load_unit : compile_file);
+}
+
+// dir/name.dc -> dir/name<extension>
+static char *output_name(const char *input, const char *extension) {
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char *dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t) (dot - input) : strlen(input);
+
+    char *name = mem_alloc(stem + strlen(extension) + 1);
+    memcpy(name, input, stem);
+    strcpy(name + stem, extension);
+    return name;
+}
+
+static int run_driver(int argc, char *argv[], driver_io_t *io) {
+    char **inputs = mem_calloc((size_t) argc, sizeof(char *));
+    size_t input_count = 0;
+    char *output = NULL;
+    int run = 0;
+    int jit = 0;
+    int assembly = 0;
+    int emit_ir = 0;
+    int emit_interface = 0;
+    char **import_dirs = mem_calloc((size_t) argc, sizeof(char *));
+    size_t import_dir_count = 0;
+    int peephole_stats = 0;
+    int time_report = 0;
+    int mem_report = 0;
+    report_format_t report_format = REPORT_TEXT;
+    int threads = 1;
+    const char *profile_use = NULL;
+    int cache_stats = 0;
+    int pipeline = 0;
+    int lto = 0;
+    int lto_partitions = 0;
+    int whole_program = 0;
+    int ipa_stats = 0;
+    cache_t cache = {.dir = NULL, .max_size = CACHE_DEFAULT_SIZE};
+    codegen_options_t options = {0};
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--run") == 0) {
+            run = 1;
+        }
+        else if(strcmp(argv[i], "--jit") == 0) {
+            jit = 1;
+        }
+        else if(strcmp(argv[i], "--emit-ir") == 0) {
+            emit_ir = 1;
+        }
+        else if(strcmp(argv[i], "--emit-interface") == 0) {
+            emit_interface = 1;
+        }
+        else if(strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+            import_dirs[import_dir_count++] = argv[++i];
+        }
+        else if(strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0') {
+            import_dirs[import_dir_count++] = argv[i] + 2;
+        }
+        else if(strcmp(argv[i], "-fno-peephole") == 0) {
+            options.no_peephole = 1;
+        }
+        else if(strcmp(argv[i], "-fno-regalloc") == 0) {
+            options.no_regalloc = 1;
+        }
+        else if(strcmp(argv[i], "-fstack-reuse=none") == 0) {
+            options.no_stack_reuse = 1;
+        }
+        else if(strcmp(argv[i], "-fomit-frame-pointer") == 0) {
+            options.frame.omit_frame_pointer = 1;
+        }
+        else if(strcmp(argv[i], "-mno-omit-leaf-frame-pointer") == 0) {
+            options.frame.keep_leaf_frame = 1;
+        }
+        else if(strcmp(argv[i], "-fno-shrink-wrap") == 0) {
+            options.frame.no_shrink_wrap = 1;
+        }
+        else if(strcmp(argv[i], "-fprofile-generate") == 0) {
+            options.profile_generate = PROFILE_DEFAULT_FILE;
+        }
+        else if(strncmp(argv[i], "-fprofile-generate=", 19) == 0) {
+            options.profile_generate = argv[i] + 19;
+        }
+        else if(strcmp(argv[i], "-fprofile-use") == 0) {
+            profile_use = PROFILE_DEFAULT_FILE;
+        }
+        else if(strncmp(argv[i], "-fprofile-use=", 14) == 0) {
+            profile_use = argv[i] + 14;
+        }
+        else if(strcmp(argv[i], "-g") == 0) {
+            options.debug_info = 1;
+        }
+        else if(strcmp(argv[i], "-fkeep-static-functions") == 0) {
+            options.keep_static_functions = 1;
+        }
+        else if(strcmp(argv[i], "-flto") == 0) {
+            lto = 1;
+        }
+        else if(strncmp(argv[i], "-flto=", 6) == 0) {
+            lto = 1;
+            lto_partitions = atoi(argv[i] + 6);
+        }
+        else if(strcmp(argv[i], "-fwhole-program") == 0) {
+            whole_program = 1;
+        }
+        else if(strcmp(argv[i], "--ipa-stats") == 0) {
+            ipa_stats = 1;
+        }
+        else if(strcmp(argv[i], "-fpipeline") == 0) {
+            pipeline = 1;
+        }
+        else if(strcmp(argv[i], "--cache") == 0) {
+            cache.dir = cache_default_dir();
+        }
+        else if(strncmp(argv[i], "--cache=", 8) == 0) {
+            cache.dir = argv[i] + 8;
+        }
+        else if(strncmp(argv[i], "--cache-size=", 13) == 0) {
+            char *unit;
+            cache.max_size = strtoull(argv[i] + 13, &unit, 10);
+            if(*unit == 'K' || *unit == 'k') cache.max_size <<= 10;
+            else if(*unit == 'M' || *unit == 'm') cache.max_size <<= 20;
+            else if(*unit == 'G' || *unit == 'g') cache.max_size <<= 30;
+        }
+        else if(strcmp(argv[i], "--cache-stats") == 0) {
+            cache_stats = 1;
+        }
+        else if(strcmp(argv[i], "-ftime-report") == 0 || strcmp(argv[i], "-ftime-report=json") == 0) {
+            time_report = 1;
+            if(argv[i][13] == '=') report_format = REPORT_JSON;
+        }
+        else if(strcmp(argv[i], "-fmem-report") == 0 || strcmp(argv[i], "-fmem-report=json") == 0) {
+            mem_report = 1;
+            if(argv[i][12] == '=') report_format = REPORT_JSON;
+        }
+        else if(strcmp(argv[i], "--peephole-stats") == 0) {
+            peephole_stats = 1;
+        }
+        else if(strcmp(argv[i], "-S") == 0) {
+            assembly = 1;
+        }
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        }
+        else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+        else if(strncmp(argv[i], "-j", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '9') {
+            threads = atoi(argv[i] + 2);
+        }
+        else {
+            inputs[input_count++] = argv[i];
+        }
+    }
+
+    if(cache_stats && !cache.dir) cache.dir = cache_default_dir();
+    if(input_count == 0 && cache_stats) {
+        return cache_print_stats(&cache, io->out);
+    }
 
+    if(input_count == 0) {
+        fprintf(io->out, "Usage: %s [--server[=<socket>] | --client[=<socket>] | --lsp] [--run | --jit | -S | --emit-ir | --emit-interface] [-I <dir>] [-j <jobs>] [-o <output>] [--cache[=<dir>]] [-fpipeline] [-flto[=<partitions>]] <file>...\n", argv[0]);
+        return 1;
+    }
+
+    if((run || jit) && input_count > 1) {
+        fprintf(io->err, "--run and --jit take a single input\n");
+        return 1;
+    }
+
+    if(output && input_count > 1 && !lto) {
+        fprintf(io->err, "-o can't be used with more than one input\n");
+        return 1;
+    }
+
+    module_set_path(import_dirs, import_dir_count);
+
+    if(run || jit) {
+        ir_file_t *ir_file;
+        if(io->served) {
+            fprintf(io->err, "--run and --jit aren't served, run them without --client\n");
+            return 1;
+        }
+        ir_instruction_list_t *ir = drop_dead_functions(load_ir(inputs[0], io->in, NULL, &ir_file), &options);
+        if(!ir) return 1;
+        return run ? run_program(ir) : jit_program(ir);
+    }
+
+    if(profile_use) {
+        options.profile = profile_read(profile_use);
+        if(!options.profile) return 1;
+    }
+
+    output_kind_t kind = emit_interface ? OUTPUT_INTERFACE : emit_ir ? OUTPUT_IR : assembly ? OUTPUT_ASSEMBLY : OUTPUT_OBJECT;
+    const char *extension = emit_interface ? MODULE_EXTENSION : emit_ir ? ".ir" : assembly ? ".s" : ".o";
+
+    // a single input keeps the old out.* default, several get one output
+    // each; with -flto the link step after the inputs writes the only one
+    size_t job_count = input_count + (lto ? 1 : 0);
+    compile_job_t *jobs = mem_calloc(job_count, sizeof(compile_job_t));
+    for(size_t i = 0; i < input_count; i++) {
+        jobs[i].input = inputs[i];
+        if(lto) continue;
+        if(output) jobs[i].output = mem_strdup(output);
+        // an interface is found by its module's name, never out.dci
+        else if(input_count == 1 && kind != OUTPUT_INTERFACE) jobs[i].output = output_name("out", extension);
+        else jobs[i].output = output_name(inputs[i], extension);
+    }
+    if(lto) jobs[input_count].output = output ? mem_strdup(output) : output_name("out", extension);
+
+    // the server compiles requests side by side already, and job threads
+    // wouldn't allocate from the request's arena
+    if(io->served) threads = 1;
+
+    // the link step reads the IR, not the sources the cache is keyed on
+    driver_t driver = {.jobs = jobs, .kind = kind, .options = &options, .cache = cache.dir && !lto ? &cache : NULL,
+                       .report = time_report || mem_report, .pipeline = pipeline, .io = io,
+                       .import_dirs = import_dirs, .import_dir_count = import_dir_count};
+    driver.lto = lto;
+    driver.lto_partitions = lto_partitions > 0 ? lto_partitions : threads;
+    if(io->served) driver.lto_partitions = 1;
+    driver.whole_program = whole_program;
+    driver.input_count = input_count;
+    jobs_run(input_count, threads, compile_job, &driver);
+    if(driver.cache) cache_flush(driver.cache);
+
+    if(lto) {
+        int loaded = 1;
+        for(size_t i = 0; i < input_count; i++) loaded = loaded && jobs[i].status == 0;
+        if(loaded) run_job(&driver, &jobs[input_count], link_units);
+        else jobs[input_count].status = 1;
+        for(size_t i = 0; i < input_count; i++) ir_file_close(jobs[i].ir_file);
+    }
+
+    int status = 0;
+    peephole_stats_t stats = {0};
+    report_t report = {0};
+    for(size_t i = 0; i < job_count; i++) {
+        fwrite(jobs[i].diagnostics, 1, jobs[i].diagnostics_len, io->err);
+        if(jobs[i].status != 0) status = 1;
+        peephole_stats_add(&stats, &jobs[i].peephole_stats);
+        report_add(&report, &jobs[i].report);
+        mem_free(jobs[i].diagnostics);
+        mem_free(jobs[i].output);
+    }
+    mem_free(jobs);
+    mem_free(inputs);
+    profile_free(options.profile);
+
+    if(peephole_stats) {
+        peephole_print_stats(io->err, &stats);
+    }
+
+    if(ipa_stats) {
+        ipa_stats_t *ipa = &driver.ipa_stats;
+        fprintf(io->err, "ipa: %zu calls inlined, %zu operations folded, %zu constant parameters, %zu functions dropped\n",
+                ipa->inlined, ipa->folded, ipa->params, ipa->dropped);
+    }
+
+    if(time_report || mem_report) {
+        report_print(io->err, &report, time_report, mem_report, report_format);
+    }
+
+    if(cache_stats) {
+        cache_print_stats(&cache, io->out);
+    }
+
+    return status;
+}
+
+// "-" as an input, not as the argument of -o
+static int reads_stdin(int argc, char *argv[]) {
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-j") == 0) i++;
+        else if(strcmp(argv[i], "-") == 0) return 1;
+    }
+    return 0;
+}
+
+static int runs_program(int argc, char *argv[]) {
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--run") == 0 || strcmp(argv[i], "--jit") == 0) return 1;
+    }
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    // --server and --client go first, the rest is an ordinary command line
+    if(argc > 1 && (strcmp(argv[1], "--server") == 0 || strncmp(argv[1], "--server=", 9) == 0)) {
+        return server_run(argv[1][8] ? argv[1] + 9 : server_default_socket(), run_driver);
+    }
+
+    // the language server reads requests on stdin until the editor exits;
+    // -I is the only option it takes, for imports
+    if(argc > 1 && strcmp(argv[1], "--lsp") == 0) {
+        char **import_dirs = mem_calloc((size_t) argc, sizeof(char *));
+        size_t import_dir_count = 0;
+        for(int i = 2; i < argc; i++) {
+            if(strcmp(argv[i], "-I") == 0 && i + 1 < argc) import_dirs[import_dir_count++] = argv[++i];
+            else if(strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0') import_dirs[import_dir_count++] = argv[i] + 2;
+        }
+        int status = lsp_serve(stdin, stdout, import_dirs, import_dir_count);
+        mem_free(import_dirs);
+        return status;
+    }
+
+    if(argc > 1 && (strcmp(argv[1], "--client") == 0 || strncmp(argv[1], "--client=", 9) == 0)) {
+        const char *socket_path = argv[1][8] ? argv[1] + 9 : server_default_socket();
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+
+        // the program runs here either way, and without a server so does the compile
+        int status;
+        if(!runs_program(argc, argv) && client_run(socket_path, argc, argv, reads_stdin(argc, argv), &status)) {
+            return status;
+        }
+    }
+
+    driver_io_t io = {stdin, stdout, stderr, 0};
+    return run_driver(argc, argv, &io);
+}
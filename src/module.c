@@ -0,0 +1,296 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "diag.h"
+#include "ir.h"
+#include "module.h"
+
+static uint32_t name_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while(*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Writer
+
+typedef struct interface_writer {
+    module_symbol_t *symbols;
+    uint32_t symbol_count;
+    uint32_t symbol_cap;
+
+    module_param_t *params;
+    uint32_t param_count;
+    uint32_t param_cap;
+
+    char *strings;
+    uint32_t string_size;
+    uint32_t string_cap;
+} interface_writer_t;
+
+#define GROW(array, count, cap) \
+    do { \
+        if((count) == (cap)) { \
+            (cap) = (cap) ? (cap) * 2 : 64; \
+            (array) = mem_realloc((array), sizeof(*(array)) * (cap)); \
+        } \
+    } while(0)
+
+static uint32_t add_string(interface_writer_t *w, const char *s) {
+    uint32_t len = (uint32_t) strlen(s) + 1;
+    while(w->string_size + len > w->string_cap) {
+        w->string_cap = w->string_cap ? w->string_cap * 2 : 1024;
+        w->strings = mem_realloc(w->strings, w->string_cap);
+    }
+    memcpy(w->strings + w->string_size, s, len);
+    w->string_size += len;
+    return w->string_size - len;
+}
+
+static inline uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+static void write_padding(FILE *f, uint64_t from, uint64_t to) {
+    while(from++ < to) fputc(0, f);
+}
+
+int module_write_interface(ir_instruction_list_t *ir, FILE *f) {
+    interface_writer_t w = {0};
+
+    for(ir_instruction_list_t *cur = ir; cur && cur->instruction; cur = cur->next) {
+        ir_instruction_t *inst = cur->instruction;
+        if(inst->opcode != IR_FUNC_START || inst->func.is_static) continue;
+
+        module_symbol_t sym = {0};
+        sym.name = add_string(&w, inst->func.func_name);
+        sym.hash = name_hash(inst->func.func_name);
+        sym.kind = MODULE_FUNCTION;
+        sym.type = (uint32_t) inst->func.return_type;
+        sym.params = w.param_count;
+        sym.param_count = (uint32_t) inst->func.param_count;
+        for(size_t i = 0; i < inst->func.param_count; i++) {
+            ir_operand_t *param = inst->func.params[i];
+            GROW(w.params, w.param_count, w.param_cap);
+            w.params[w.param_count].name = add_string(&w, param->var_name ? param->var_name : "");
+            w.params[w.param_count].type = (uint32_t) param->type;
+            w.param_count++;
+        }
+
+        GROW(w.symbols, w.symbol_count, w.symbol_cap);
+        w.symbols[w.symbol_count++] = sym;
+    }
+
+    // the first definition of a name wins, as it does in the symbol table
+    uint32_t slot_count = 16;
+    while(slot_count < w.symbol_count * 2) slot_count *= 2;
+    uint32_t *slots = mem_calloc(slot_count, sizeof(uint32_t));
+    for(uint32_t i = 0; i < w.symbol_count; i++) {
+        uint32_t slot = w.symbols[i].hash & (slot_count - 1);
+        int taken = 0;
+        while(slots[slot]) {
+            module_symbol_t *other = &w.symbols[slots[slot] - 1];
+            if(other->hash == w.symbols[i].hash && strcmp(w.strings + other->name, w.strings + w.symbols[i].name) == 0) {
+                taken = 1;
+                break;
+            }
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        if(!taken) slots[slot] = i + 1;
+    }
+
+    module_header_t header = {0};
+    memcpy(header.magic, MODULE_MAGIC, 4);
+    header.version = MODULE_VERSION;
+    header.symbol_count = w.symbol_count;
+    header.slot_count = slot_count;
+    header.param_count = w.param_count;
+    header.slots = align8(sizeof(header));
+    header.symbols = align8(header.slots + sizeof(uint32_t) * slot_count);
+    header.params = align8(header.symbols + sizeof(module_symbol_t) * w.symbol_count);
+    header.string_data = align8(header.params + sizeof(module_param_t) * w.param_count);
+    header.string_size = w.string_size;
+    header.file_size = header.string_data + w.string_size;
+
+    fwrite(&header, sizeof(header), 1, f);
+    write_padding(f, sizeof(header), header.slots);
+    fwrite(slots, sizeof(uint32_t), slot_count, f);
+    write_padding(f, header.slots + sizeof(uint32_t) * slot_count, header.symbols);
+    fwrite(w.symbols, sizeof(module_symbol_t), w.symbol_count, f);
+    write_padding(f, header.symbols + sizeof(module_symbol_t) * w.symbol_count, header.params);
+    fwrite(w.params, sizeof(module_param_t), w.param_count, f);
+    write_padding(f, header.params + sizeof(module_param_t) * w.param_count, header.string_data);
+    fwrite(w.strings, 1, w.string_size, f);
+
+    mem_free(slots);
+    mem_free(w.symbols);
+    mem_free(w.params);
+    mem_free(w.strings);
+
+    return ferror(f) ? -1 : 0;
+}
+
+// Reader
+
+static _Thread_local char **search_dirs;
+static _Thread_local size_t search_dir_count;
+
+void module_set_path(char **dirs, size_t count) {
+    search_dirs = dirs;
+    search_dir_count = count;
+}
+
+static int is_identifier(const char *name) {
+    if(!*name || isdigit((unsigned char) *name)) return 0;
+    for(; *name; name++) {
+        if(!isalnum((unsigned char) *name) && *name != '_') return 0;
+    }
+    return 1;
+}
+
+char *module_find(const char *name) {
+    // a name is never a path, `import ../x` can't reach outside the search path
+    if(!is_identifier(name)) return NULL;
+
+    for(size_t i = 0; i <= search_dir_count; i++) {
+        const char *dir = i == 0 ? "." : search_dirs[i - 1];
+        size_t len = strlen(dir) + strlen(name) + sizeof(MODULE_EXTENSION) + 1;
+        char *path = mem_alloc(len);
+        snprintf(path, len, "%s/%s%s", dir, name, MODULE_EXTENSION);
+        if(access(path, R_OK) == 0) return path;
+        mem_free(path);
+    }
+    return NULL;
+}
+
+static int read_error(const char *path, const char *msg) {
+    fprintf(diag_stream(), "Module error: %s: %s\n", path, msg);
+    return -1;
+}
+
+static int table_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / size && offset % 4 == 0;
+}
+
+static int validate_header(const char *path, module_header_t *h, size_t size) {
+    if(size < sizeof(module_header_t) || memcmp(h->magic, MODULE_MAGIC, 4) != 0) {
+        return read_error(path, "not a DivC module interface");
+    }
+    if(h->version != MODULE_VERSION) {
+        return read_error(path, "unsupported interface version");
+    }
+    if(h->file_size > size
+        || h->slot_count == 0 || (h->slot_count & (h->slot_count - 1)) != 0
+        || !table_fits(h->slots, h->slot_count, sizeof(uint32_t), size)
+        || !table_fits(h->symbols, h->symbol_count, sizeof(module_symbol_t), size)
+        || !table_fits(h->params, h->param_count, sizeof(module_param_t), size)
+        || !table_fits(h->string_data, h->string_size, 1, size)) {
+        return read_error(path, "truncated or corrupt interface");
+    }
+    return 0;
+}
+
+module_t *module_open(const char *name) {
+    char *path = module_find(name);
+    if(!path) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(module_header_t)) {
+        if(fd >= 0) close(fd);
+        read_error(path, "not a DivC module interface");
+        mem_free(path);
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        read_error(path, "mmap failed");
+        mem_free(path);
+        return NULL;
+    }
+    if(validate_header(path, (module_header_t *) map, size) != 0) {
+        munmap(map, size);
+        mem_free(path);
+        return NULL;
+    }
+
+    module_t *module = mem_calloc(1, sizeof(module_t));
+    module->name = mem_strdup(name);
+    module->path = path;
+    module->map = map;
+    module->size = size;
+    return module;
+}
+
+void module_close(module_t *module) {
+    if(!module) return;
+    munmap(module->map, module->size);
+    mem_free(module->name);
+    mem_free(module->path);
+    mem_free(module);
+}
+
+const module_symbol_t *module_lookup(module_t *module, const char *name) {
+    module_header_t *h = (module_header_t *) module->map;
+    uint32_t *slots = (uint32_t *) (module->map + h->slots);
+    module_symbol_t *symbols = (module_symbol_t *) (module->map + h->symbols);
+    const char *strings = (const char *) module->map + h->string_data;
+
+    uint32_t hash = name_hash(name);
+    size_t len = strlen(name);
+    uint32_t slot = hash & (h->slot_count - 1);
+    for(uint32_t probes = 0; probes < h->slot_count && slots[slot]; probes++) {
+        uint32_t index = slots[slot] - 1;
+        if(index >= h->symbol_count) return NULL;
+
+        // the name is only trusted as far as the string data goes
+        module_symbol_t *sym = &symbols[index];
+        if(sym->hash == hash && sym->name < h->string_size && h->string_size - sym->name > len
+            && memcmp(strings + sym->name, name, len + 1) == 0) {
+            return sym;
+        }
+        slot = (slot + 1) & (h->slot_count - 1);
+    }
+    return NULL;
+}
+
+static int word_char(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+char *module_scan_import(const char *source, size_t len, size_t *at) {
+    static const char keyword[] = "import";
+    size_t klen = sizeof(keyword) - 1;
+
+    for(size_t i = *at; i + klen < len; i++) {
+        if(memcmp(source + i, keyword, klen) != 0) continue;
+        if((i > 0 && word_char(source[i - 1])) || word_char(source[i + klen])) continue;
+
+        size_t start = i + klen;
+        while(start < len && isspace((unsigned char) source[start])) start++;
+        size_t end = start;
+        while(end < len && word_char(source[end])) end++;
+        *at = end;
+        if(end == start) continue;
+
+        char *name = mem_alloc(end - start + 1);
+        memcpy(name, source + start, end - start);
+        name[end - start] = '\0';
+        return name;
+    }
+    *at = len;
+    return NULL;
+}
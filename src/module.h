@@ -0,0 +1,81 @@
+#ifndef _MODULE_H
+#define _MODULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ir.h"
+
+#define MODULE_MAGIC "DVMI"
+#define MODULE_VERSION 1
+#define MODULE_EXTENSION ".dci"
+
+// A module's interface: what `import name;` makes callable, read from
+// name.dci. On disk layout, little endian, every table 8 byte aligned:
+//   header | slots | symbols | params | string data
+// The slots are an open addressing table over the symbol names, so an
+// importer maps the file and finds a name in a probe or two. Nothing but
+// the header is read until a name is looked up, and then only its record.
+typedef struct module_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t symbol_count;
+    uint32_t slot_count; // a power of two, at least twice symbol_count
+    uint32_t param_count;
+    uint32_t pad;
+    uint64_t slots; // file offsets of each table
+    uint64_t symbols;
+    uint64_t params;
+    uint64_t string_data;
+    uint64_t string_size;
+    uint64_t file_size;
+} module_header_t;
+
+typedef struct module_symbol {
+    uint32_t name; // offset into the string data
+    uint32_t hash; // of the name, most probes end here
+    uint32_t kind; // MODULE_FUNCTION
+    uint32_t type; // return type
+    uint32_t params; // first index into the params
+    uint32_t param_count;
+} module_symbol_t;
+
+typedef struct module_param {
+    uint32_t name; // offset into the string data
+    uint32_t type;
+} module_param_t;
+
+#define MODULE_FUNCTION 0u
+
+// A mapped interface, imports of one file are chained in import order
+typedef struct module {
+    char *name;
+    char *path;
+    uint8_t *map;
+    size_t size;
+    struct module *next;
+} module_t;
+
+// every function that isn't static, with its signature
+int module_write_interface(ir_instruction_list_t *ir, FILE *f);
+
+// Where the calling thread looks for interfaces: the current directory,
+// then `dirs` in order (-I). The array has to outlive the compile.
+void module_set_path(char **dirs, size_t count);
+// path of the first name.dci on the search path, NULL if there is none
+char *module_find(const char *name);
+// NULL if there's no interface for `name`, or it's unreadable (reported)
+module_t *module_open(const char *name);
+void module_close(module_t *module);
+
+// the exported symbol called `name`, NULL if the module has none
+const module_symbol_t *module_lookup(module_t *module, const char *name);
+
+// The modules a source may import, read off the text without lexing it:
+// the identifier after every `import` that's a word of its own. Comments
+// can add names that aren't imported, which costs the cache a file to hash.
+// Returns the next name from *at on (malloc'd), NULL once there's none.
+char *module_scan_import(const char *source, size_t len, size_t *at);
+
+#endif
@@ -1,35 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "alloc.h"
+#include "diag.h"
 #include "parser.h"
 #include "lexer.h"
 
-#define show_error_msg(msg, ...) fprintf(stderr, "Syntax error: " msg "\n", __VA_ARGS__);
+// syntax errors reported on this thread, ast_parse adds up its own
+static _Thread_local int errors;
+
+#define show_error_msg(msg, ...) do { errors++; fprintf(diag_stream(), "Syntax error: " msg "\n", __VA_ARGS__); } while(0)
 
 void show_error_expected(token_t *token, char *expected) {
-    fprintf(stderr, "Syntax error: Expected '%s', found '%s' on line %d:%d\n", expected, token->value, token->pos.line, token->pos.column);
+    errors++;
+    fprintf(diag_stream(), "Syntax error: Expected '%s', found '%s' on line %d:%d\n", expected, token->value, token->pos.line, token->pos.column);
 }
 
 void show_error_unexpected(token_t *token) {
-    fprintf(stderr, "Syntax error: Unexpected token '%s' on line %d:%d\n", token->value, token->pos.line, token->pos.column);
-}
-
-struct statement_list *ast_parse(token_t *list) {
-    token_t *current = list->next;
-
-    struct statement_list *statements = malloc(sizeof(struct statement_list));
-    struct statement_list *statements_head = statements;
-
-    while(current->type != TOKEN_EOF) {
-        statements->statement = ast_statement(&current);
-
-        statements->next = malloc(sizeof(struct statement_list));
-        statements->next->statement = NULL;
-        statements->next->next = NULL;
-        statements = statements->next;
-    }
-
-    return statements_head;
+    errors++;
+    fprintf(diag_stream(), "Syntax error: Unexpected token '%s' on line %d:%d\n", token->value, token->pos.line, token->pos.column);
 }
 
 int expect(token_t **token, token_type_t type) {
@@ -45,16 +34,66 @@ int expect_move(token_t **token, token_type_t type) {
     return 0;
 }
 
+// stops on the EOF token, so a statement cut short can't run off the list
 void next(token_t **token) {
-    if(*token != NULL) {
+    if(*token != NULL && (*token)->next != NULL) {
         *token = (*token)->next;
     }
 }
 
+// After a statement that didn't parse: on past its ';' or the '}' closing a
+// body it opened, or up to the '}' ending the block it's in. Its error is
+// reported already, nothing it skips is.
+static void skip_statement(token_t **token) {
+    int depth = 0;
+    while(!expect(token, TOKEN_EOF)) {
+        if(expect(token, LEFT_CURLY)) depth++;
+        else if(expect(token, RIGHT_CURLY)) {
+            if(depth == 0) return;
+            if(--depth == 0) {
+                next(token);
+                return;
+            }
+        }
+        else if(depth == 0 && expect(token, SEMICOLON)) {
+            next(token);
+            return;
+        }
+        next(token);
+    }
+}
+
+struct statement_list *ast_parse(token_t *list, int *error_count) {
+    token_t *current = list->next;
+    int before = errors;
+
+    struct statement_list *statements = mem_calloc(1, sizeof(struct statement_list));
+    struct statement_list *statements_head = statements;
+
+    while(current->type != TOKEN_EOF) {
+        ast_statement_t *statement = ast_statement(&current);
+        if(statement == NULL) {
+            // a '}' without its '{' is reported by ast_statement
+            skip_statement(&current);
+            expect_move(&current, RIGHT_CURLY);
+            continue;
+        }
+        statements->statement = statement;
+
+        statements->next = mem_alloc(sizeof(struct statement_list));
+        statements->next->statement = NULL;
+        statements->next->next = NULL;
+        statements = statements->next;
+    }
+
+    *error_count += errors - before;
+    return statements_head;
+}
+
 ast_node_t *factor(token_t **token) {
     switch((*token)->type) {
         case NUMBER: {
-            ast_node_t *node = malloc(sizeof(ast_node_t));
+            ast_node_t *node = mem_alloc(sizeof(ast_node_t));
             node->pos = (*token)->pos;
             node->type = AST_NUMBER;
             node->expr.integer = atoi((*token)->value);
@@ -62,7 +101,7 @@ ast_node_t *factor(token_t **token) {
             return node;
         }
         case IDENTIFIER: {
-            ast_node_t *node = malloc(sizeof(ast_node_t));
+            ast_node_t *node = mem_alloc(sizeof(ast_node_t));
             node->pos = (*token)->pos;
             char *id = (*token)->value;
             next(token);
@@ -72,14 +111,17 @@ ast_node_t *factor(token_t **token) {
 
                 size_t arg_c = 0;
                 ast_node_t **args = NULL;
-                do {
-                    args = realloc(args, sizeof(ast_node_t*) * (arg_c+1));
-                    args[arg_c] = expression(token);
-                    arg_c++;
-                } while(expect_move(token, COMMA));
+                if(!expect_move(token, RIGHT_PAREN)) {
+                    do {
+                        args = mem_realloc(args, sizeof(ast_node_t*) * (arg_c+1));
+                        args[arg_c] = expression(token);
+                        if(args[arg_c] == NULL) return NULL;
+                        arg_c++;
+                    } while(expect_move(token, COMMA));
+                    expect_move(token, RIGHT_PAREN);
+                }
                 node->expr.call.arg_count = arg_c;
                 node->expr.call.args = args;
-                expect_move(token, RIGHT_PAREN);
             }
             else {
                 node->type = AST_IDENTIFIER;
@@ -90,6 +132,7 @@ ast_node_t *factor(token_t **token) {
         case LEFT_PAREN: {
             next(token);
             ast_node_t *node = expression(token);
+            if(node == NULL) return NULL;
             node->pos = (*token)->pos;
 
             if (!expect_move(token, RIGHT_PAREN)) {
@@ -111,13 +154,14 @@ ast_node_t *term(token_t **token) {
     if(f == NULL) return NULL;
 
     while(expect(token, STAR) || expect(token, SLASH)) {
-        ast_node_t *node = malloc(sizeof(ast_node_t));
+        ast_node_t *node = mem_alloc(sizeof(ast_node_t));
         node->pos = (*token)->pos;
         node->type=AST_BINARY_OP;
         node->expr.binary_op.left = f;
         node->expr.binary_op.op = (*token)->type;
         next(token);
         node->expr.binary_op.right = factor(token);
+        if(node->expr.binary_op.right == NULL) return NULL;
 
         f = node;
     }
@@ -130,7 +174,7 @@ ast_node_t *expression(token_t **token) {
     if(t == NULL) return NULL;
 
     while(expect(token, PLUS) || expect(token, MINUS)) {
-        ast_node_t *node = malloc(sizeof(ast_node_t));
+        ast_node_t *node = mem_alloc(sizeof(ast_node_t));
 
         node->pos = (*token)->pos;
         node->type=AST_BINARY_OP;
@@ -138,6 +182,7 @@ ast_node_t *expression(token_t **token) {
         node->expr.binary_op.op = (*token)->type;
         next(token);
         node->expr.binary_op.right = term(token);
+        if(node->expr.binary_op.right == NULL) return NULL;
 
         t = node;
     }
@@ -147,7 +192,7 @@ ast_node_t *expression(token_t **token) {
 
 
 ast_statement_t *ast_var_declaration(token_t **token, expr_type_t type, char *name, pos_t pos) {
-    ast_statement_t *var = malloc(sizeof(ast_statement_t));
+    ast_statement_t *var = mem_alloc(sizeof(ast_statement_t));
 
     var->pos = pos;
     var->type = AST_VAR_DECLARATION;
@@ -155,10 +200,12 @@ ast_statement_t *ast_var_declaration(token_t **token, expr_type_t type, char *na
     var->statement.declaration.t = type;
 
     if(expect_move(token, ASSIGN)) {
-        ast_statement_t *assignment = malloc(sizeof(ast_statement_t));
+        // no position of its own, the value's lines cover it in -g
+        ast_statement_t *assignment = mem_calloc(1, sizeof(ast_statement_t));
         assignment->type = AST_VAR_ASSIGNMENT;
         assignment->statement.assignment.identifier = name;
         assignment->statement.assignment.value = expression(token);
+        if(assignment->statement.assignment.value == NULL) return NULL;
 
         var->statement.declaration.initializer = assignment;
     }
@@ -167,48 +214,52 @@ ast_statement_t *ast_var_declaration(token_t **token, expr_type_t type, char *na
     }
     else {
         show_error_unexpected(*token);
+        return NULL;
     }
 
     if(!expect_move(token, SEMICOLON)) {
+        // the name is kept, so its uses further down aren't errors as well
         show_error_expected(*token, ";");
+        skip_statement(token);
     }
 
     return var;
 }
 
 ast_statement_t *ast_var_assignment(token_t **token, char *name, pos_t pos) {
-    ast_statement_t *var = malloc(sizeof(ast_statement_t));
+    ast_statement_t *var = mem_alloc(sizeof(ast_statement_t));
     var->pos = pos;
 
     if(expect_move(token, ASSIGN)) {
         var->type = AST_VAR_ASSIGNMENT;
         var->statement.assignment.identifier = name;
         var->statement.assignment.value = expression(token);
+        if(var->statement.assignment.value == NULL) return NULL;
     }
     else {
         show_error_expected(*token, "=");
+        return NULL;
     }
 
-    if(!expect(token, SEMICOLON)) {
+    if(!expect_move(token, SEMICOLON)) {
         show_error_unexpected(*token);
-    } else {
-        next(token);
+        return NULL;
     }
 
     return var;
 }
 
 ast_statement_t *ast_return(token_t **token, pos_t pos) {
-    ast_statement_t *node = malloc(sizeof(ast_statement_t));
+    ast_statement_t *node = mem_alloc(sizeof(ast_statement_t));
 
     node->pos = pos;
     node->type = AST_RETURN_STMT;
     node->statement.ret.value = expression(token);
+    if(node->statement.ret.value == NULL) return NULL;
 
-    if(!expect(token, SEMICOLON)) {
+    if(!expect_move(token, SEMICOLON)) {
         show_error_unexpected(*token);
-    } else {
-        next(token);
+        return NULL;
     }
 
     return node;
@@ -224,30 +275,39 @@ struct block_member *ast_block(token_t **token) {
         return NULL;
     }
 
-    struct block_member *block = malloc(sizeof(struct block_member));
+    struct block_member *block = mem_alloc(sizeof(struct block_member));
     struct block_member *head = block;
     head->stack_size = 0;
 
     while(!expect_move(token, RIGHT_CURLY)) {
+        if(expect(token, TOKEN_EOF)) {
+            show_error_expected(*token, "}");
+            break;
+        }
         ast_statement_t *statement = ast_statement(token);
-        if(statement == NULL) continue;
+        if(statement == NULL) {
+            skip_statement(token);
+            continue;
+        }
 
         if(statement->type == AST_VAR_DECLARATION) head->stack_size += get_type_size(statement->statement.declaration.t);
 
         block->value = statement;
-        block->next = malloc(sizeof(struct block_member));
+        block->next = mem_alloc(sizeof(struct block_member));
         block = block->next;
         block->value = 0;
+        block->next = NULL;
     }
     return head;
 }
 
 ast_statement_t *ast_function(token_t **token, expr_type_t type, char *name, pos_t pos) {
-    ast_statement_t *func = malloc(sizeof(ast_statement_t));
+    ast_statement_t *func = mem_alloc(sizeof(ast_statement_t));
 
     func->pos = pos;
     func->statement.function.type = type;
     func->statement.function.identifier = name;
+    func->statement.function.is_static = 0;
 
     expect_move(token, LEFT_PAREN);
 
@@ -265,12 +325,14 @@ ast_statement_t *ast_function(token_t **token, expr_type_t type, char *name, pos
     else {
         do {
             expr_type_t type = ast_type(token);
-            char *id = NULL;
-            if(expect(token, IDENTIFIER)) {
-                id = (*token)->value;
-                next(token);
+            if(type == UNKNOWN_TYPE) return NULL;
+            if(!expect(token, IDENTIFIER)) {
+                show_error_expected(*token, "IDENTIFIER");
+                return NULL;
             }
-            args = realloc(args, sizeof(struct arg) * (arg_c+1));
+            char *id = (*token)->value;
+            next(token);
+            args = mem_realloc(args, sizeof(struct arg) * (arg_c+1));
             args[arg_c].identifier = id;
             args[arg_c].type = type;
             arg_c++;
@@ -278,6 +340,7 @@ ast_statement_t *ast_function(token_t **token, expr_type_t type, char *name, pos
 
         if(!expect_move(token, RIGHT_PAREN)) {
             show_error_expected(*token, ")");
+            return NULL;
         }
     }
     func->statement.function.args = args;
@@ -293,7 +356,9 @@ ast_statement_t *ast_function(token_t **token, expr_type_t type, char *name, pos
         }
     }
     else {
-        func->statement.function.block = NULL;
+        // there are no prototypes, the pre-pass makes every function known
+        show_error_expected(*token, "{");
+        return NULL;
     }
 
     expect_move(token, SEMICOLON);
@@ -316,6 +381,7 @@ ast_statement_t *ast_statement(token_t **token) {
         case LONG:
         case UNSIGNED: {
             expr_type_t type = ast_type(token);
+            if(type == UNKNOWN_TYPE) return NULL;
 
             if (!expect(token, IDENTIFIER)) {
                 show_error_expected(*token, "IDENTIFIER");
@@ -334,7 +400,6 @@ ast_statement_t *ast_statement(token_t **token) {
                 }
                 else {
                     show_error_unexpected(*token);
-                    next(token);
                     return NULL;
                 }
             }
@@ -348,7 +413,6 @@ ast_statement_t *ast_statement(token_t **token) {
             }
             else {
                 show_error_unexpected(*token);
-                next(token);
                 return NULL;
             }
             break;
@@ -358,10 +422,43 @@ ast_statement_t *ast_statement(token_t **token) {
             next(token);
             return ast_return(token, pos);
         }
+
+        case IMPORT: {
+            next(token);
+            if(!expect(token, IDENTIFIER)) {
+                show_error_expected(*token, "IDENTIFIER");
+                return NULL;
+            }
+            ast_statement_t *stmt = mem_alloc(sizeof(ast_statement_t));
+            stmt->pos = pos;
+            stmt->type = AST_IMPORT;
+            stmt->statement.import.module = (*token)->value;
+            next(token);
+
+            if(!expect(token, SEMICOLON)) {
+                show_error_expected(*token, ";");
+                return NULL;
+            }
+            next(token);
+            return stmt;
+        }
+
+        case STATIC: {
+            next(token);
+            ast_statement_t *stmt = ast_statement(token);
+            if(stmt == NULL) return NULL;
+            // the statement is parsed up to its end, so it's kept
+            if(stmt->type != AST_FUNC_DECLARATION) {
+                show_error_msg("'static' only applies to functions on line %d:%d", pos.line, pos.column);
+            }
+            else {
+                stmt->statement.function.is_static = 1;
+            }
+            return stmt;
+        }
         default: {
             if((*token)->type != TOKEN_EOF) {
                 show_error_unexpected(*token);
-                next(token);
                 return NULL;
             }
         }
@@ -399,8 +496,12 @@ expr_type_t ast_type(token_t **token) {
                 case INT64:
                     res = UINT64;
                     break;
+                case UNKNOWN_TYPE:
+                    res = UNKNOWN_TYPE;
+                    break;
                 default:
-                    printf("Unexpected after unsigned\n");
+                    errors++;
+                    fprintf(diag_stream(), "Unexpected after unsigned\n");
                     res =  UNKNOWN_TYPE;
                     break;
             }
@@ -453,7 +554,10 @@ expr_type_t ast_type(token_t **token) {
             res = VOID_T;
             break;
         }
-        default: printf("Unknown type\n"); return UNKNOWN_TYPE;
+        default:
+            errors++;
+            fprintf(diag_stream(), "Unknown type\n");
+            return UNKNOWN_TYPE;
     }
 
     if(expect_move(token, STAR)) {
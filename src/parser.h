@@ -25,6 +25,7 @@ enum ast_stmt_type {
     AST_FUNC_DECLARATION,
     AST_RETURN_STMT,
     AST_EXPRESSION_STMT,
+    AST_IMPORT,
 };
 
 typedef enum expr_type {
@@ -108,8 +109,13 @@ typedef struct ast_statement {
             size_t arg_count;
             size_t stack_size;
             struct block_member *block;
+            int is_static; // internal, dropped when nothing calls it
         } function;
 
+        struct {
+            char *module; // name.dci on the module search path
+        } import;
+
     } statement;
 } ast_statement_t;
 
@@ -125,7 +131,8 @@ struct block_member {
 };
 
 
-struct statement_list *ast_parse(token_t *list);
+// statements that failed to parse are left out, their errors added to *errors
+struct statement_list *ast_parse(token_t *list, int *errors);
 ast_statement_t *ast_statement(token_t **token);
 expr_type_t ast_type(token_t **token);
 ast_node_t *expression(token_t **token);
@@ -0,0 +1,394 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "peephole.h"
+#include "x64.h"
+
+// Rule based clean up of one function's instruction list before it is printed
+// or encoded. Every rule only looks at a couple of neighbouring instructions,
+// register liveness is a forward scan that follows jumps inside the function.
+
+#define REG_BIT(r) (1u << (r))
+
+static const uint32_t arg_regs = REG_BIT(REG_RDI) | REG_BIT(REG_RSI) | REG_BIT(REG_RDX)
+    | REG_BIT(REG_RCX) | REG_BIT(REG_R8) | REG_BIT(REG_R9);
+
+static const uint32_t caller_saved = REG_BIT(REG_RAX) | REG_BIT(REG_RCX) | REG_BIT(REG_RDX)
+    | REG_BIT(REG_RSI) | REG_BIT(REG_RDI) | REG_BIT(REG_R8) | REG_BIT(REG_R9)
+    | REG_BIT(REG_10) | REG_BIT(REG_11);
+
+// the caller expects these back, so they are live at every exit
+static const uint32_t callee_saved = REG_BIT(REG_RBX) | REG_BIT(REG_R12) | REG_BIT(REG_R13)
+    | REG_BIT(REG_R14) | REG_BIT(REG_R15);
+
+static uint32_t operand_regs(x64_operand_t *op) {
+    if(op->kind == X64_REG) return REG_BIT(op->reg);
+    if(op->kind == X64_MEM) return REG_BIT(op->mem.base) | (op->mem.scale ? REG_BIT(op->mem.index) : 0);
+    return 0;
+}
+
+// registers read by inst, and registers it overwrites without reading
+static void inst_effects(x64_inst_t *inst, uint32_t *reads, uint32_t *kills) {
+    *reads = 0;
+    *kills = 0;
+
+    switch(inst->op) {
+        case X64_MOV:
+            *reads = operand_regs(&inst->src);
+            if(inst->dst.kind == X64_MEM) {
+                *reads |= REG_BIT(inst->dst.mem.base);
+            }
+            else if(inst->dst.size >= 4) {
+                *kills = REG_BIT(inst->dst.reg);
+            }
+            else {
+                *reads |= REG_BIT(inst->dst.reg); // partial write keeps the upper bits
+            }
+            break;
+
+        case X64_IMUL:
+            if(inst->src2.kind != X64_NONE) {
+                // imul r, r/m, imm writes all of r's low 32 bits or more
+                *reads = operand_regs(&inst->src);
+                *kills = REG_BIT(inst->dst.reg);
+                break;
+            }
+            // fallthrough
+        case X64_ADD:
+        case X64_SUB:
+            *reads = operand_regs(&inst->dst) | operand_regs(&inst->src);
+            break;
+
+        case X64_LEA:
+            *reads = operand_regs(&inst->src);
+            *kills = REG_BIT(inst->dst.reg);
+            break;
+
+        case X64_PUSH:
+            *reads = REG_BIT(inst->dst.reg) | REG_BIT(REG_RSP);
+            break;
+
+        case X64_POP:
+            *reads = REG_BIT(REG_RSP);
+            *kills = REG_BIT(inst->dst.reg);
+            break;
+
+        case X64_CALL:
+            *reads = arg_regs | REG_BIT(REG_RSP);
+            *kills = caller_saved;
+            break;
+
+        case X64_LEAVE:
+            *reads = REG_BIT(REG_RBP) | REG_BIT(REG_RSP);
+            break;
+
+        case X64_RET:
+            *reads = REG_BIT(REG_RAX) | REG_BIT(REG_RSP) | callee_saved;
+            break;
+
+        case X64_SYSCALL:
+            *reads = REG_BIT(REG_RAX) | REG_BIT(REG_RDI) | REG_BIT(REG_RSI) | REG_BIT(REG_RDX)
+                | REG_BIT(REG_10) | REG_BIT(REG_R8) | REG_BIT(REG_R9);
+            *kills = REG_BIT(REG_RCX) | REG_BIT(REG_11);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static size_t find_label(x64_inst_t *insts, size_t count, const char *name) {
+    for(size_t i = 0; i < count; i++) {
+        if(insts[i].op == X64_LABEL && strcmp(insts[i].dst.sym, name) == 0) return i;
+    }
+    return count;
+}
+
+static int reg_live_after(x64_inst_t *insts, size_t count, size_t index, x64_registers_t reg) {
+    uint32_t bit = REG_BIT(reg);
+    size_t steps = 0;
+
+    for(size_t i = index + 1; i < count && steps++ < 2 * count; i++) {
+        x64_inst_t *inst = &insts[i];
+
+        if(inst->op == X64_JMP) {
+            size_t target = find_label(insts, count, inst->dst.sym);
+            if(target == count) {
+                // tail call out of the function, only the arguments survive
+                return (bit & (arg_regs | REG_BIT(REG_RSP) | callee_saved)) != 0;
+            }
+            i = target;
+            continue;
+        }
+
+        uint32_t reads, kills;
+        inst_effects(inst, &reads, &kills);
+        if(reads & bit) return 1;
+        if(kills & bit) return 0;
+    }
+
+    return 0;
+}
+
+static size_t next_inst(x64_inst_t *insts, size_t count, size_t i) {
+    for(i++; i < count; i++) {
+        if(insts[i].op != X64_DELETED && insts[i].op != X64_COMMENT) return i;
+    }
+    return count;
+}
+
+static int same_mem(x64_operand_t *a, x64_operand_t *b) {
+    return a->kind == X64_MEM && b->kind == X64_MEM && a->size == b->size
+        && a->mem.base == b->mem.base && a->mem.disp == b->mem.disp
+        && a->mem.scale == 0 && b->mem.scale == 0;
+}
+
+static int is_frame_reg(x64_registers_t reg) {
+    return reg == REG_RSP || reg == REG_RBP;
+}
+
+// Frame bytes read anywhere in the function, one map per frame register so a
+// dead store check is a lookup instead of a scan over the whole function.
+typedef struct frame_reads {
+    int32_t low[2];
+    int32_t high[2];
+    uint8_t *bytes[2];
+} frame_reads_t;
+
+static int is_read(x64_inst_t *inst, x64_operand_t **mem) {
+    if(inst->op == X64_DELETED || inst->op == X64_LEA) return 0;
+    if(inst->src.kind == X64_MEM) {
+        *mem = &inst->src;
+        return 1;
+    }
+    // read-modify-write
+    if(inst->op != X64_MOV && inst->dst.kind == X64_MEM) {
+        *mem = &inst->dst;
+        return 1;
+    }
+    return 0;
+}
+
+static void frame_reads_build(frame_reads_t *reads, x64_inst_t *insts, size_t count) {
+    for(int f = 0; f < 2; f++) {
+        reads->low[f] = INT32_MAX;
+        reads->high[f] = INT32_MIN;
+    }
+
+    x64_operand_t *mem;
+    for(size_t i = 0; i < count; i++) {
+        if(!is_read(&insts[i], &mem) || !is_frame_reg(mem->mem.base)) continue;
+        int f = mem->mem.base == REG_RBP;
+        if(mem->mem.disp < reads->low[f]) reads->low[f] = mem->mem.disp;
+        if(mem->mem.disp + mem->size > reads->high[f]) reads->high[f] = mem->mem.disp + mem->size;
+    }
+
+    for(int f = 0; f < 2; f++) {
+        size_t len = reads->high[f] > reads->low[f] ? (size_t) (reads->high[f] - reads->low[f]) : 0;
+        reads->bytes[f] = mem_calloc(len + 1, 1);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        if(!is_read(&insts[i], &mem) || !is_frame_reg(mem->mem.base)) continue;
+        int f = mem->mem.base == REG_RBP;
+        memset(reads->bytes[f] + (mem->mem.disp - reads->low[f]), 1, mem->size);
+    }
+}
+
+static int mem_is_loaded(frame_reads_t *reads, x64_operand_t *mem) {
+    int f = mem->mem.base == REG_RBP;
+    for(int32_t b = mem->mem.disp; b < mem->mem.disp + mem->size; b++) {
+        if(b >= reads->low[f] && b < reads->high[f] && reads->bytes[f][b - reads->low[f]]) return 1;
+    }
+    return 0;
+}
+
+static void frame_reads_free(frame_reads_t *reads) {
+    mem_free(reads->bytes[0]);
+    mem_free(reads->bytes[1]);
+}
+
+static int reg_operand(x64_operand_t *op, x64_registers_t reg) {
+    return op->kind == X64_REG && op->reg == reg;
+}
+
+static int uses_reg(x64_inst_t *inst, x64_registers_t reg) {
+    return ((operand_regs(&inst->dst) | operand_regs(&inst->src) | operand_regs(&inst->src2)) & REG_BIT(reg)) != 0;
+}
+
+// For insts[def], a mov or lea writing all of r: the mov r2, r further on
+// that can go if r2 takes the value in r's place. r is only in plain
+// operands of the copy's size up to there, r2 in none of them and r dead
+// after the copy. count if there's none.
+static size_t find_copy(x64_inst_t *insts, size_t count, size_t def) {
+    x64_inst_t *inst = &insts[def];
+    if(inst->op != X64_MOV && inst->op != X64_LEA) return count;
+    x64_registers_t reg = inst->dst.reg;
+    int size = inst->dst.size;
+    if((operand_regs(&inst->src) | operand_regs(&inst->src2)) & REG_BIT(reg)) return count;
+
+    for(size_t k = next_inst(insts, count, def); k < count; k = next_inst(insts, count, k)) {
+        x64_inst_t *cur = &insts[k];
+        if(cur->part != X64_BODY) return count;
+        if(cur->op != X64_MOV && cur->op != X64_ADD && cur->op != X64_SUB
+            && cur->op != X64_IMUL && cur->op != X64_LEA) return count;
+
+        if(cur->op == X64_MOV && cur->dst.kind == X64_REG && reg_operand(&cur->src, reg)
+            && cur->dst.reg != reg && cur->dst.size == size && cur->src.size == size
+            && !is_frame_reg(cur->dst.reg)) {
+            x64_registers_t to = cur->dst.reg;
+            for(size_t m = def + 1; m < k; m++) {
+                if(insts[m].op != X64_DELETED && insts[m].op != X64_COMMENT && uses_reg(&insts[m], to)) return count;
+            }
+            return reg_live_after(insts, count, k, reg) ? count : k;
+        }
+
+        // r's value only moves through whole register operands
+        x64_operand_t *ops[] = {&cur->dst, &cur->src, &cur->src2};
+        for(int o = 0; o < 3; o++) {
+            if(ops[o]->kind == X64_MEM && (operand_regs(ops[o]) & REG_BIT(reg))) return count;
+            if(reg_operand(ops[o], reg) && ops[o]->size != size) return count;
+        }
+        // overwritten, the value the copy would take is another one
+        uint32_t reads, kills;
+        inst_effects(cur, &reads, &kills);
+        if(kills & REG_BIT(reg)) return count;
+    }
+    return count;
+}
+
+static void rename_reg(x64_inst_t *insts, size_t from, size_t to, x64_registers_t reg, x64_registers_t into) {
+    for(size_t m = from; m < to; m++) {
+        if(insts[m].op == X64_DELETED || insts[m].op == X64_COMMENT) continue;
+        x64_operand_t *ops[] = {&insts[m].dst, &insts[m].src, &insts[m].src2};
+        for(int o = 0; o < 3; o++) {
+            if(reg_operand(ops[o], reg)) ops[o]->reg = into;
+        }
+    }
+}
+
+size_t peephole_optimize(x64_inst_t *insts, size_t count, peephole_stats_t *stats) {
+    peephole_stats_t local = {0};
+    if(!stats) stats = &local;
+
+    int changed = 1;
+    while(changed) {
+        changed = 0;
+
+        // only goes stale by losing loads, which the next round picks up
+        frame_reads_t reads;
+        frame_reads_build(&reads, insts, count);
+
+        for(size_t i = 0; i < count; i++) {
+            x64_inst_t *inst = &insts[i];
+            if(inst->op == X64_DELETED || inst->op == X64_COMMENT) continue;
+
+            size_t j = next_inst(insts, count, i);
+            x64_inst_t *next = j < count ? &insts[j] : NULL;
+
+            // jmp L ; L:
+            if(inst->op == X64_JMP && next && next->op == X64_LABEL
+                && strcmp(inst->dst.sym, next->dst.sym) == 0) {
+                inst->op = X64_DELETED;
+                stats->jump_next++;
+                changed = 1;
+                continue;
+            }
+
+            // mov/lea r, x ; ... ; mov r2, r  with r dead afterwards: r2 takes the
+            // value from the start, so chains of copies through temps go
+            if(inst->dst.kind == X64_REG && inst->dst.size >= 4 && inst->part == X64_BODY
+                && !is_frame_reg(inst->dst.reg)) {
+                size_t copy = find_copy(insts, count, i);
+                if(copy < count) {
+                    rename_reg(insts, i, copy, inst->dst.reg, insts[copy].dst.reg);
+                    insts[copy].op = X64_DELETED;
+                    stats->copy++;
+                    changed = 1;
+                    continue;
+                }
+            }
+
+            if(inst->op != X64_MOV) continue;
+
+            // mov [m], r ; mov r2, [m]  (or add/sub/imul r2, [m])
+            if(inst->dst.kind == X64_MEM && inst->src.kind == X64_REG
+                && next && (next->op == X64_MOV || next->op == X64_ADD || next->op == X64_SUB || next->op == X64_IMUL)
+                && next->dst.kind == X64_REG
+                && same_mem(&inst->dst, &next->src)) {
+                if(next->op == X64_MOV && next->dst.reg == inst->src.reg) {
+                    next->op = X64_DELETED;
+                }
+                else {
+                    next->src = x64_reg(inst->src.reg, next->dst.size);
+                }
+                stats->store_load++;
+                changed = 1;
+                continue;
+            }
+
+            // mov rcx, imm ; op rax, rcx
+            if(inst->dst.kind == X64_REG && inst->src.kind == X64_IMM
+                && inst->src.imm >= INT32_MIN && inst->src.imm <= INT32_MAX
+                && next && (next->op == X64_ADD || next->op == X64_SUB || next->op == X64_IMUL)
+                && next->src.kind == X64_REG && next->src.reg == inst->dst.reg && next->src2.kind == X64_NONE
+                && next->dst.kind == X64_REG && next->dst.reg != inst->dst.reg
+                && next->src.size == inst->dst.size
+                && !reg_live_after(insts, count, j, inst->dst.reg)) {
+                next->src = x64_imm(inst->src.imm, next->src.size);
+                inst->op = X64_DELETED;
+                stats->const_operand++;
+                changed = 1;
+                continue;
+            }
+
+            // mov r, x with r never read again
+            if(inst->dst.kind == X64_REG && inst->dst.size >= 4 && !is_frame_reg(inst->dst.reg)
+                && !reg_live_after(insts, count, i, inst->dst.reg)) {
+                inst->op = X64_DELETED;
+                stats->dead_move++;
+                changed = 1;
+                continue;
+            }
+
+            // mov [m], r with [m] never loaded in this function
+            if(inst->dst.kind == X64_MEM && is_frame_reg(inst->dst.mem.base)
+                && !mem_is_loaded(&reads, &inst->dst)) {
+                inst->op = X64_DELETED;
+                stats->dead_store++;
+                changed = 1;
+                continue;
+            }
+        }
+
+        frame_reads_free(&reads);
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(insts[i].op != X64_DELETED) insts[kept++] = insts[i];
+    }
+    return kept;
+}
+
+void peephole_stats_add(peephole_stats_t *total, peephole_stats_t *stats) {
+    total->store_load += stats->store_load;
+    total->const_operand += stats->const_operand;
+    total->dead_move += stats->dead_move;
+    total->dead_store += stats->dead_store;
+    total->jump_next += stats->jump_next;
+    total->copy += stats->copy;
+}
+
+void peephole_print_stats(FILE *f, peephole_stats_t *stats) {
+    fprintf(f, "peephole: store-load %zu, const-operand %zu, dead-move %zu, dead-store %zu, jump-next %zu, copy %zu\n",
+            stats->store_load,
+            stats->const_operand,
+            stats->dead_move,
+            stats->dead_store,
+            stats->jump_next,
+            stats->copy);
+}
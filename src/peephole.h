@@ -0,0 +1,22 @@
+#ifndef _PEEPHOLE_H
+#define _PEEPHOLE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "x64.h"
+
+typedef struct peephole_stats {
+    size_t store_load;    // mov [m], r ; op r2, [m]  ->  mov [m], r ; op r2, r
+    size_t const_operand; // mov rcx, imm ; add rax, rcx  ->  add rax, imm
+    size_t dead_move;     // mov r, x with r dead afterwards
+    size_t dead_store;    // mov [m], r with [m] never loaded
+    size_t jump_next;     // jmp L ; L:
+    size_t copy;          // mov r, x ; op r, y ; mov r2, r  ->  mov r2, x ; op r2, y  with r dead afterwards
+} peephole_stats_t;
+
+size_t peephole_optimize(x64_inst_t *insts, size_t count, peephole_stats_t *stats);
+void peephole_stats_add(peephole_stats_t *total, peephole_stats_t *stats);
+void peephole_print_stats(FILE *f, peephole_stats_t *stats);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "callgraph.h"
+#include "diag.h"
+#include "ir.h"
+#include "lexer.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "report.h"
+#include "semantic.h"
+
+// the name a top-level item declares and what it is, read off its first
+// tokens the way ast_statement tells them apart; `token` is left on the name
+static int declaration_header(token_t **at, enum symbol_kind *kind, char **id, expr_type_t *type) {
+    token_t *token = *at;
+    switch(token->type) {
+        case I8: case I16: case I32: case I64:
+        case U8: case U16: case U32: case U64:
+        case SHORT: case LONG: case UNSIGNED:
+            break;
+        default:
+            return 0;
+    }
+
+    *type = ast_type(&token);
+    if(token == NULL || token->type != IDENTIFIER || token->next == NULL) return 0;
+    *id = token->value;
+    *at = token;
+    token_type_t after = token->next->type;
+    if(after == LEFT_PAREN) *kind = SYMBOL_FUNC;
+    else if(after == ASSIGN || after == SEMICOLON) *kind = SYMBOL_VAR;
+    else return 0;
+    return 1;
+}
+
+// global symbols outlive the item that declares them, so they're made in
+// the caller's memory rather than the item's arena
+static void declare(symbol_table_t *table, arena_t *outer, ast_statement_t *stmt) {
+    arena_t *item = arena_swap(outer);
+    if(stmt->type == AST_FUNC_DECLARATION) {
+        semantic_declare(table, SYMBOL_FUNC, stmt->statement.function.identifier, stmt->statement.function.type);
+    }
+    else if(stmt->type == AST_VAR_DECLARATION) {
+        semantic_declare(table, SYMBOL_VAR, stmt->statement.declaration.identifier, stmt->statement.declaration.t);
+    }
+    arena_swap(item);
+}
+
+int pipeline_compile(char *source, asm_writer_t *out, x64_code_t *code, codegen_options_t *options) {
+    arena_t *outer = arena_swap(NULL);
+    arena_swap(outer);
+    arena_t *arena = arena_create();
+    FILE *null = fopen("/dev/null", "w");
+    if(!arena || !null) {
+        if(arena) arena_destroy(arena);
+        if(null) fclose(null);
+        fprintf(diag_stream(), "Failed to set up the pipeline\n");
+        return 1;
+    }
+
+    symbol_table_t table;
+    semantic_begin(&table);
+    callgraph_t graph;
+    callgraph_init(&graph);
+    int drop = !options || !options->keep_static_functions;
+
+    // calls may go to functions further down, so every item's header is read
+    // first; its diagnostics come again on the real pass. The calls in it make
+    // the call graph, an identifier followed by ( is all a call looks like
+    phase_t phase = report_enter(PHASE_LEX);
+    FILE *diag = diag_stream();
+    diag_set_stream(null);
+    lexer_t lexer;
+    lexer_start(&lexer, source);
+    for(;;) {
+        arena_swap(arena);
+        token_t *tokens = lexer_parse_item(&lexer);
+        enum symbol_kind kind;
+        char *id;
+        expr_type_t type;
+        token_t *token = tokens->next;
+        int found = token->type != TOKEN_EOF;
+        int is_static = found && token->type == STATIC;
+        if(is_static) token = token->next;
+        int declares = found && declaration_header(&token, &kind, &id, &type);
+
+        arena_swap(outer);
+        if(declares) semantic_declare(&table, kind, id, type);
+        if(found && token->type == IMPORT && token->next->type == IDENTIFIER) {
+            // the real pass has nothing more to say about an import
+            diag_set_stream(diag);
+            semantic_import(&table, token->next->value, token->pos);
+            diag_set_stream(null);
+        }
+        if(drop && found) {
+            callgraph_function(&graph, declares && kind == SYMBOL_FUNC ? id : NULL, is_static);
+            if(declares) token = token->next;
+            for(; token->type != TOKEN_EOF; token = token->next) {
+                if(token->type == IDENTIFIER && token->next->type == LEFT_PAREN) callgraph_call(&graph, token->value);
+            }
+        }
+        arena_reset(arena);
+        if(!found) break;
+    }
+    diag_set_stream(diag);
+    fclose(null);
+    if(drop) callgraph_solve(&graph);
+
+    codegen_context_t ctx;
+    codegen_begin(&ctx, out, code, options);
+
+    // after the first error, syntax or semantic, nothing more is lowered but
+    // what follows is still checked
+    ir_context_t ir = {0};
+    lexer_start(&lexer, source);
+    for(;;) {
+        arena_swap(arena);
+        report_enter(PHASE_LEX);
+        token_t *tokens = lexer_parse_item(&lexer);
+        if(tokens->next->type == TOKEN_EOF) {
+            arena_swap(outer);
+            break;
+        }
+
+        report_enter(PHASE_PARSE);
+        struct statement_list *statements = ast_parse(tokens, &table.errors);
+
+        for(struct statement_list *current = statements; current->next; current = current->next) {
+            ast_statement_t *stmt = current->statement;
+
+            report_enter(PHASE_SEMANTIC);
+            declare(&table, outer, stmt);
+            semantic_check_statement(stmt, &table);
+            if(table.errors) continue;
+            if(drop && stmt->type == AST_FUNC_DECLARATION && stmt->statement.function.is_static
+                && callgraph_dead(&graph, stmt->statement.function.identifier)) continue;
+
+            report_enter(PHASE_IR_GEN);
+            ir_instruction_list_t *list = generate_ir_statement(&ir, stmt);
+            arena_swap(outer);
+            report_enter(phase);
+            codegen_functions(&ctx, list);
+            arena_swap(arena);
+        }
+        arena_swap(outer);
+        report_enter(phase);
+        arena_reset(arena);
+    }
+    report_leave(phase);
+
+    codegen_end(&ctx);
+    semantic_end(&table);
+    callgraph_free(&graph);
+    arena_destroy(arena);
+    return table.errors;
+}
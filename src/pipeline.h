@@ -0,0 +1,15 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "code_gen.h"
+
+// Compiles a source one top-level item at a time: each function is lexed,
+// parsed, checked, lowered and handed to codegen before the next one is
+// read, in an arena that's reset in between. Memory stays at the largest
+// function plus the source and the output, instead of growing with the
+// whole file's tokens, AST and IR. Writes NASM to `out` or encodes into
+// `code` like generate_x64_*, and returns the number of semantic errors;
+// whatever was written is incomplete if that's not 0.
+int pipeline_compile(char *source, asm_writer_t *out, x64_code_t *code, codegen_options_t *options);
+
+#endif
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "diag.h"
+#include "profile.h"
+
+// Counter images for -fprofile-generate and function layout for -fprofile-use.
+// DivC has no branches, so counting every function entry and call site is
+// the whole edge profile.
+
+static uint32_t add_string(profile_counters_t *counters, const char *s) {
+    size_t len = strlen(s) + 1;
+    while(counters->string_len + len > counters->string_cap) {
+        counters->string_cap = counters->string_cap ? counters->string_cap * 2 : 256;
+        counters->strings = mem_realloc(counters->strings, counters->string_cap);
+    }
+    uint32_t offset = (uint32_t) counters->string_len;
+    memcpy(counters->strings + offset, s, len);
+    counters->string_len += len;
+    return offset;
+}
+
+static size_t add_record(profile_counters_t *counters, uint32_t callee) {
+    if(counters->record_count == counters->record_cap) {
+        counters->record_cap = counters->record_cap ? counters->record_cap * 2 : 64;
+        counters->records = mem_realloc(counters->records, sizeof(profile_record_t) * counters->record_cap);
+    }
+    counters->records[counters->record_count] = (profile_record_t) {0, counters->function, callee};
+    return sizeof(profile_header_t) + sizeof(profile_record_t) * counters->record_count++;
+}
+
+size_t profile_add_function(profile_counters_t *counters, const char *name) {
+    counters->function = add_string(counters, name);
+    return add_record(counters, PROFILE_NO_CALLEE);
+}
+
+size_t profile_add_call(profile_counters_t *counters, const char *callee) {
+    return add_record(counters, add_string(counters, callee));
+}
+
+uint8_t *profile_image(profile_counters_t *counters, size_t *len) {
+    size_t records = sizeof(profile_record_t) * counters->record_count;
+    *len = sizeof(profile_header_t) + records + counters->string_len;
+
+    uint8_t *image = mem_alloc(*len);
+    profile_header_t header = {
+        .version = PROFILE_VERSION,
+        .record_count = (uint32_t) counters->record_count,
+        .size = (uint32_t) *len,
+    };
+    memcpy(header.magic, PROFILE_MAGIC, 4);
+    memcpy(image, &header, sizeof(header));
+    memcpy(image + sizeof(header), counters->records, records);
+    memcpy(image + sizeof(header) + records, counters->strings, counters->string_len);
+    return image;
+}
+
+void profile_counters_free(profile_counters_t *counters) {
+    mem_free(counters->records);
+    mem_free(counters->strings);
+    memset(counters, 0, sizeof(profile_counters_t));
+}
+
+static int compare_edge(const void *a, const void *b) {
+    const profile_edge_t *x = a;
+    const profile_edge_t *y = b;
+    int order = strcmp(x->caller, y->caller);
+    if(order != 0 || x->callee == y->callee) return order;
+    if(!x->callee || !y->callee) return x->callee ? 1 : -1;
+    return strcmp(x->callee, y->callee);
+}
+
+static profile_t *profile_error(const char *path, const char *msg, profile_t *profile) {
+    fprintf(diag_stream(), "Profile error: %s: %s\n", path, msg);
+    profile_free(profile);
+    return NULL;
+}
+
+profile_t *profile_read(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if(!f) return profile_error(path, "cannot open", NULL);
+
+    profile_t *profile = mem_calloc(1, sizeof(profile_t));
+    size_t size = 0, cap = 0;
+    for(;;) {
+        if(size == cap) {
+            cap = cap ? cap * 2 : 4096;
+            profile->data = mem_realloc(profile->data, cap);
+        }
+        size_t got = fread(profile->data + size, 1, cap - size, f);
+        if(got == 0) break;
+        size += got;
+    }
+    fclose(f);
+
+    profile_header_t header;
+    if(size < sizeof(header)) return profile_error(path, "not a profile", profile);
+    memcpy(&header, profile->data, sizeof(header));
+    if(memcmp(header.magic, PROFILE_MAGIC, 4) != 0) return profile_error(path, "not a profile", profile);
+    if(header.version != PROFILE_VERSION) return profile_error(path, "unsupported version", profile);
+
+    size_t strings = sizeof(header) + sizeof(profile_record_t) * (size_t) header.record_count;
+    if(header.size > size || strings > header.size || profile->data[header.size - 1] != '\0') {
+        return profile_error(path, "truncated", profile);
+    }
+    profile->size = header.size;
+
+    profile->functions = mem_calloc(header.record_count + 1, sizeof(profile_edge_t));
+    profile->calls = mem_calloc(header.record_count + 1, sizeof(profile_edge_t));
+    for(uint32_t i = 0; i < header.record_count; i++) {
+        profile_record_t record;
+        memcpy(&record, profile->data + sizeof(header) + sizeof(record) * i, sizeof(record));
+        if(strings + record.function >= header.size
+            || (record.callee != PROFILE_NO_CALLEE && strings + record.callee >= header.size)) {
+            return profile_error(path, "corrupt record", profile);
+        }
+
+        const char *function = (const char *) profile->data + strings + record.function;
+        if(record.callee == PROFILE_NO_CALLEE) {
+            profile->functions[profile->function_count++] = (profile_edge_t) {function, NULL, record.count};
+        }
+        else {
+            const char *callee = (const char *) profile->data + strings + record.callee;
+            profile->calls[profile->call_count++] = (profile_edge_t) {function, callee, record.count};
+            if(record.count > profile->hottest_call) profile->hottest_call = record.count;
+        }
+    }
+
+    // for the lookups by name, the two lists above keep the image's order
+    profile->sorted_count = profile->function_count + profile->call_count;
+    profile->sorted = mem_alloc(sizeof(profile_edge_t) * (profile->sorted_count + 1));
+    memcpy(profile->sorted, profile->functions, sizeof(profile_edge_t) * profile->function_count);
+    memcpy(profile->sorted + profile->function_count, profile->calls, sizeof(profile_edge_t) * profile->call_count);
+    qsort(profile->sorted, profile->sorted_count, sizeof(profile_edge_t), compare_edge);
+    return profile;
+}
+
+void profile_free(profile_t *profile) {
+    if(!profile) return;
+    mem_free(profile->data);
+    mem_free(profile->functions);
+    mem_free(profile->calls);
+    mem_free(profile->sorted);
+    mem_free(profile);
+}
+
+// the count of every record for caller -> callee, the entry for a NULL callee
+static int sum_edges(profile_t *profile, const char *caller, const char *callee, uint64_t *count) {
+    profile_edge_t key = {caller, callee, 0};
+    size_t low = 0, high = profile->sorted_count;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        if(compare_edge(&profile->sorted[middle], &key) < 0) low = middle + 1;
+        else high = middle;
+    }
+
+    int found = 0;
+    *count = 0;
+    for(size_t i = low; i < profile->sorted_count && compare_edge(&profile->sorted[i], &key) == 0; i++) {
+        *count += profile->sorted[i].count;
+        found = 1;
+    }
+    return found;
+}
+
+int profile_entry_count(profile_t *profile, const char *function, uint64_t *count) {
+    return sum_edges(profile, function, NULL, count);
+}
+
+int profile_call_count(profile_t *profile, const char *caller, const char *callee, uint64_t *count) {
+    return sum_edges(profile, caller, callee, count);
+}
+
+typedef struct named_index {
+    const char *name;
+    size_t index;
+} named_index_t;
+
+static int compare_name(const void *a, const void *b) {
+    return strcmp(((const named_index_t *) a)->name, ((const named_index_t *) b)->name);
+}
+
+static int compare_count(const void *a, const void *b) {
+    const profile_edge_t *x = a;
+    const profile_edge_t *y = b;
+    if(x->count != y->count) return x->count > y->count ? -1 : 1;
+    return x < y ? -1 : 1;
+}
+
+// index of `name` in the sorted table, count if it isn't one of ours
+static size_t find_name(named_index_t *sorted, size_t count, const char *name) {
+    named_index_t key = {name, 0};
+    named_index_t *found = bsearch(&key, sorted, count, sizeof(named_index_t), compare_name);
+    return found ? found->index : count;
+}
+
+typedef struct chain {
+    size_t head;
+    size_t tail;
+    size_t first; // lowest function index, keeps source order among equals
+    uint64_t heat; // hottest entry count in the chain
+    int known;     // some function in it is in the profile
+} chain_t;
+
+static int compare_chain(const void *a, const void *b) {
+    const chain_t *x = a;
+    const chain_t *y = b;
+    // hot, then unknown, then never run
+    int rank_x = x->heat > 0 ? 0 : !x->known ? 1 : 2;
+    int rank_y = y->heat > 0 ? 0 : !y->known ? 1 : 2;
+    if(rank_x != rank_y) return rank_x - rank_y;
+    if(rank_x == 0 && x->heat != y->heat) return x->heat > y->heat ? -1 : 1;
+    return x->first < y->first ? -1 : 1;
+}
+
+// Pettis-Hansen style: walk call sites hottest first and append the callee's
+// chain to the caller's, so hot callers and callees end up next to each other
+void profile_order(profile_t *profile, const char **names, size_t count, size_t *order) {
+    named_index_t *sorted = mem_alloc(sizeof(named_index_t) * (count + 1));
+    for(size_t i = 0; i < count; i++) sorted[i] = (named_index_t) {names[i], i};
+    qsort(sorted, count, sizeof(named_index_t), compare_name);
+
+    size_t *next = mem_alloc(sizeof(size_t) * (count + 1));
+    size_t *chain_of = mem_alloc(sizeof(size_t) * (count + 1));
+    chain_t *chains = mem_alloc(sizeof(chain_t) * (count + 1));
+    for(size_t i = 0; i < count; i++) {
+        next[i] = count;
+        chain_of[i] = i;
+        chains[i] = (chain_t) {i, i, i, 0, 0};
+    }
+
+    for(size_t i = 0; i < profile->function_count; i++) {
+        size_t fn = find_name(sorted, count, profile->functions[i].caller);
+        if(fn == count) continue;
+        chains[fn].known = 1;
+        if(profile->functions[i].count > chains[fn].heat) chains[fn].heat = profile->functions[i].count;
+    }
+
+    profile_edge_t *calls = mem_alloc(sizeof(profile_edge_t) * (profile->call_count + 1));
+    memcpy(calls, profile->calls, sizeof(profile_edge_t) * profile->call_count);
+    qsort(calls, profile->call_count, sizeof(profile_edge_t), compare_count);
+
+    for(size_t i = 0; i < profile->call_count && calls[i].count > 0; i++) {
+        size_t caller = find_name(sorted, count, calls[i].caller);
+        size_t callee = find_name(sorted, count, calls[i].callee);
+        if(caller == count || callee == count) continue;
+        size_t into = chain_of[caller];
+        size_t from = chain_of[callee];
+        if(into == from) continue;
+
+        next[chains[into].tail] = chains[from].head;
+        chains[into].tail = chains[from].tail;
+        if(chains[from].first < chains[into].first) chains[into].first = chains[from].first;
+        if(chains[from].heat > chains[into].heat) chains[into].heat = chains[from].heat;
+        chains[into].known |= chains[from].known;
+        for(size_t fn = chains[from].head; fn != count; fn = next[fn]) chain_of[fn] = into;
+        chains[from].head = count; // merged away
+    }
+
+    size_t chain_count = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(chains[i].head != count) chains[chain_count++] = chains[i];
+    }
+    qsort(chains, chain_count, sizeof(chain_t), compare_chain);
+
+    size_t placed = 0;
+    for(size_t i = 0; i < chain_count; i++) {
+        for(size_t fn = chains[i].head; fn != count; fn = next[fn]) order[placed++] = fn;
+    }
+
+    mem_free(calls);
+    mem_free(chains);
+    mem_free(chain_of);
+    mem_free(next);
+    mem_free(sorted);
+}
@@ -0,0 +1,78 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROFILE_MAGIC "DVPF"
+#define PROFILE_VERSION 1
+#define PROFILE_NO_CALLEE 0xFFFFFFFFu
+#define PROFILE_DEFAULT_FILE "divc.prof"
+
+// An instrumented program writes its counter image to the profile file as is:
+//   header | records | strings
+// Record counts are the counters the generated code increments.
+typedef struct profile_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t size; // of the whole image, what the exit hook writes
+} profile_header_t;
+
+typedef struct profile_record {
+    uint64_t count;
+    uint32_t function; // string offset
+    uint32_t callee;   // string offset for a call site, PROFILE_NO_CALLEE for the entry
+} profile_record_t;
+
+// Counters handed out while generating instrumented code
+typedef struct profile_counters {
+    profile_record_t *records;
+    size_t record_count;
+    size_t record_cap;
+    char *strings;
+    size_t string_len;
+    size_t string_cap;
+    uint32_t function; // string offset of the current function
+} profile_counters_t;
+
+// Offset of the new counter inside the image
+size_t profile_add_function(profile_counters_t *counters, const char *name);
+size_t profile_add_call(profile_counters_t *counters, const char *callee);
+uint8_t *profile_image(profile_counters_t *counters, size_t *len);
+void profile_counters_free(profile_counters_t *counters);
+
+typedef struct profile_edge {
+    const char *caller;
+    const char *callee;
+    uint64_t count;
+} profile_edge_t;
+
+// A profile read back for -fprofile-use, names point into `data`
+typedef struct profile {
+    uint8_t *data;
+    size_t size;
+    profile_edge_t *functions; // callee unused
+    size_t function_count;
+    profile_edge_t *calls;
+    size_t call_count;
+    profile_edge_t *sorted; // both, by caller then callee, entries first
+    size_t sorted_count;
+    uint64_t hottest_call;  // the highest call site count
+} profile_t;
+
+profile_t *profile_read(const char *path);
+void profile_free(profile_t *profile);
+
+// How often `function` ran, and how often `caller` called `callee` summed
+// over its call sites. 0 if the profile doesn't know the function or the
+// call, not knowing isn't the same as never running.
+int profile_entry_count(profile_t *profile, const char *function, uint64_t *count);
+int profile_call_count(profile_t *profile, const char *caller, const char *callee, uint64_t *count);
+
+// Layout order for the functions named: call chains that ran hot first,
+// hottest chain leading, functions the profile doesn't know next, and
+// functions that never ran last. order[i] is an index into names.
+void profile_order(profile_t *profile, const char **names, size_t count, size_t *order);
+
+#endif
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "code_gen.h"
+#include "regalloc.h"
+
+// Linear scan (Poletto & Sarkar) over the temps of one function.
+// The IR has no branches so a temp's live interval is just [definition, last use].
+//
+// Register pools:
+//  - rsi, rdi, rdx, r8, r9 are argument registers, loading a call's arguments
+//    overwrites them. Only for temps no call reads or runs across.
+//  - r10, r11 are caller-saved and never used for arguments, so loading call
+//    arguments can't clobber them. Only for temps that don't live across a call.
+//  - rbx, r12-r15 are preserved by callees, code_gen saves the ones we use in
+//    the prologue. Temps live across a call can only go here.
+// rax and rcx stay free as scratch registers for code_gen.
+
+#define REG_BIT(r) (1u << (r))
+
+static const x64_registers_t arg_regs[] = {REG_RSI, REG_RDI, REG_RDX, REG_R8, REG_R9};
+static const x64_registers_t caller_saved_regs[] = {REG_10, REG_11};
+const x64_registers_t callee_saved_regs[] = {REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15};
+const size_t callee_saved_count = sizeof(callee_saved_regs) / sizeof(callee_saved_regs[0]);
+
+#define CALLER_SAVED_COUNT (sizeof(caller_saved_regs) / sizeof(caller_saved_regs[0]))
+#define ARG_REG_COUNT (sizeof(arg_regs) / sizeof(arg_regs[0]))
+
+static int operand_temp(ir_operand_t *op) {
+    return op && op->kind == IR_OPERAND_TEMP ? op->temp_id : -1;
+}
+
+typedef void (*temp_visitor_t)(void *arg, int temp_id, int pos);
+
+// every temp the instruction reads or writes, IR_CALL's src1 only carries the callee name
+static void visit_temps(ir_instruction_t *inst, temp_visitor_t fn, void *arg, int pos) {
+    switch(inst->opcode) {
+        case IR_ADD:
+        case IR_MINUS:
+        case IR_MULT:
+            fn(arg, operand_temp(inst->src1), pos);
+            fn(arg, operand_temp(inst->src2), pos);
+            fn(arg, operand_temp(inst->dst), pos);
+            break;
+
+        case IR_CALL:
+            for(size_t i = 0; i < inst->call.arg_count; i++) {
+                fn(arg, operand_temp(inst->call.args[i]), pos);
+            }
+            fn(arg, operand_temp(inst->dst), pos);
+            break;
+
+        case IR_STORE:
+        case IR_RETURN:
+            fn(arg, operand_temp(inst->src1), pos);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void widen_range(void *arg, int id, int pos) {
+    (void) pos;
+    int *range = arg; // min, max
+    if(id < 0) return;
+    if(range[0] < 0 || id < range[0]) range[0] = id;
+    if(id > range[1]) range[1] = id;
+}
+
+static void extend_interval(void *arg, int id, int pos) {
+    regalloc_t *ra = arg;
+    if(id < 0) return;
+    live_interval_t *it = &ra->intervals[id - ra->base_temp];
+    if(it->start < 0) it->start = pos;
+    if(pos > it->end) it->end = pos;
+}
+
+static int compare_start(const void *a, const void *b) {
+    const live_interval_t *x = *(live_interval_t * const *) a;
+    const live_interval_t *y = *(live_interval_t * const *) b;
+    if(x->start != y->start) return x->start - y->start;
+    return x->temp_id - y->temp_id;
+}
+
+int regalloc_tail_jump(ir_instruction_t *call, const char *function) {
+    return call->call.tail && call->call.arg_count <= MAX_REG_ARGS && strcmp(function, "_start") != 0;
+}
+
+static void build_intervals(ir_instruction_list_t *start, regalloc_t *ra) {
+    int range[2] = {-1, -1};
+    int length = 0;
+
+    // temp ids are global, but the ones of a single function are close together
+    for(ir_instruction_list_t *node = start; node; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst) continue;
+        if(inst->opcode == IR_FUNC_END) break;
+        visit_temps(inst, widen_range, range, 0);
+        length++;
+    }
+
+    ra->base_temp = range[0] < 0 ? 0 : range[0];
+    ra->temp_count = range[0] < 0 ? 0 : range[1] - range[0] + 1;
+    if((size_t) ra->temp_count > ra->interval_cap) {
+        ra->interval_cap = ra->temp_count;
+        ra->intervals = mem_realloc(ra->intervals, sizeof(live_interval_t) * ra->interval_cap);
+    }
+    for(int i = 0; i < ra->temp_count; i++) {
+        ra->intervals[i] = (live_interval_t) {.temp_id = ra->base_temp + i, .start = -1, .end = -1};
+    }
+
+    // calls_before[p] = number of calls at positions < p
+    int *calls_before = mem_alloc(sizeof(int) * (length + 1));
+    calls_before[0] = 0;
+
+    int pos = 0;
+    for(ir_instruction_list_t *node = start; node && pos < length; node = node->next) {
+        ir_instruction_t *inst = node->instruction;
+        if(!inst) continue;
+        calls_before[pos + 1] = calls_before[pos] + (inst->opcode == IR_CALL);
+
+        if(inst->opcode == IR_CALL && regalloc_tail_jump(inst, start->instruction->func.func_name)) {
+            for(size_t i = 0; i < inst->call.arg_count; i++) {
+                extend_interval(ra, operand_temp(inst->call.args[i]), pos);
+            }
+            break;
+        }
+        visit_temps(inst, extend_interval, ra, pos);
+        if(inst->opcode == IR_CALL && operand_temp(inst->dst) >= 0) {
+            ra->intervals[inst->dst->temp_id - ra->base_temp].call_result = 1;
+        }
+        pos++;
+    }
+
+    // a temp whose interval strictly contains a call has to survive it, one
+    // that ends at a call is its argument
+    for(int i = 0; i < ra->temp_count; i++) {
+        live_interval_t *it = &ra->intervals[i];
+        if(it->start < 0) continue;
+        if(calls_before[it->end] - calls_before[it->start + 1] > 0) it->crosses_call = 1;
+        if(calls_before[it->end + 1] - calls_before[it->start + 1] > 0) it->near_call = 1;
+    }
+
+    mem_free(calls_before);
+}
+
+static int take_free(uint32_t *busy, const x64_registers_t *regs, size_t count, x64_registers_t *out) {
+    for(size_t i = 0; i < count; i++) {
+        if(!(*busy & REG_BIT(regs[i]))) {
+            *busy |= REG_BIT(regs[i]);
+            *out = regs[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_callee_saved(x64_registers_t reg) {
+    for(size_t i = 0; i < callee_saved_count; i++) {
+        if(callee_saved_regs[i] == reg) return 1;
+    }
+    return 0;
+}
+
+static int is_arg_reg(x64_registers_t reg) {
+    for(size_t i = 0; i < ARG_REG_COUNT; i++) {
+        if(arg_regs[i] == reg) return 1;
+    }
+    return 0;
+}
+
+void regalloc_function(ir_instruction_list_t *start, regalloc_t *ra, int spill_all) {
+    ra->used_callee_saved = 0;
+    build_intervals(start, ra);
+
+    live_interval_t **order = mem_alloc(sizeof(live_interval_t*) * (ra->temp_count + 1));
+    live_interval_t **active = mem_alloc(sizeof(live_interval_t*) * (ra->temp_count + 1));
+    size_t count = 0, active_count = 0;
+
+    for(int i = 0; i < ra->temp_count; i++) {
+        live_interval_t *it = &ra->intervals[i];
+        if(it->start < 0) continue;
+        if(spill_all) {
+            it->spilled = 1;
+            continue;
+        }
+        order[count++] = it;
+    }
+    qsort(order, count, sizeof(live_interval_t*), compare_start);
+
+    uint32_t busy = 0;
+    for(size_t i = 0; i < count; i++) {
+        live_interval_t *cur = order[i];
+
+        // expire intervals that ended before this one starts, the destination
+        // never shares a register with the sources of the same instruction.
+        // A call's result is the exception, it's stored after the arguments
+        // are loaded, so it can take the register of one that ends there.
+        size_t kept = 0;
+        for(size_t j = 0; j < active_count; j++) {
+            if(active[j]->end < cur->start || (cur->call_result && active[j]->end == cur->start)) {
+                busy &= ~REG_BIT(active[j]->reg);
+            }
+            else {
+                active[kept++] = active[j];
+            }
+        }
+        active_count = kept;
+
+        // the argument registers first, r10 and r11 are the only ones left
+        // for the temps around calls
+        x64_registers_t reg;
+        int found = 0;
+        if(!cur->near_call) found = take_free(&busy, arg_regs, ARG_REG_COUNT, &reg);
+        if(!found && !cur->crosses_call) found = take_free(&busy, caller_saved_regs, CALLER_SAVED_COUNT, &reg);
+        if(!found) found = take_free(&busy, callee_saved_regs, callee_saved_count, &reg);
+
+        if(found) {
+            cur->reg = reg;
+            active[active_count++] = cur;
+            continue;
+        }
+
+        // spill whichever usable interval ends last
+        live_interval_t *victim = NULL;
+        size_t victim_index = 0;
+        for(size_t j = 0; j < active_count; j++) {
+            if(cur->crosses_call && !is_callee_saved(active[j]->reg)) continue;
+            if(cur->near_call && is_arg_reg(active[j]->reg)) continue;
+            if(!victim || active[j]->end > victim->end) {
+                victim = active[j];
+                victim_index = j;
+            }
+        }
+
+        if(victim && victim->end > cur->end) {
+            cur->reg = victim->reg;
+            victim->spilled = 1;
+            active[victim_index] = cur;
+        }
+        else {
+            cur->spilled = 1;
+        }
+        ra->spill_count++;
+    }
+
+    for(int i = 0; i < ra->temp_count; i++) {
+        live_interval_t *it = &ra->intervals[i];
+        if(it->start >= 0 && !it->spilled && is_callee_saved(it->reg)) {
+            ra->used_callee_saved |= REG_BIT(it->reg);
+        }
+    }
+
+    mem_free(order);
+    mem_free(active);
+}
+
+live_interval_t *regalloc_lookup(regalloc_t *ra, int temp_id) {
+    int index = temp_id - ra->base_temp;
+    if(index < 0 || index >= ra->temp_count) return NULL;
+    if(ra->intervals[index].start < 0) return NULL;
+    return &ra->intervals[index];
+}
+
+void regalloc_free(regalloc_t *ra) {
+    mem_free(ra->intervals);
+    memset(ra, 0, sizeof(regalloc_t));
+}
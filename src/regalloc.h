@@ -0,0 +1,46 @@
+#ifndef _REGALLOC_H
+#define _REGALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+#include "x64.h"
+
+// Live range of one IR temp, positions are instruction indices counted from
+// the function's IR_FUNC_START.
+typedef struct live_interval {
+    int temp_id;
+    int start; // -1 if the temp does not appear in the function
+    int end;
+    int crosses_call; // live across an IR_CALL, needs a preserved register
+    int near_call;    // an IR_CALL reads it, or runs while it's live
+    int call_result;  // defined by an IR_CALL, after the call read its arguments
+    int spilled;      // lives in a stack slot
+    x64_registers_t reg;
+} live_interval_t;
+
+typedef struct regalloc {
+    live_interval_t *intervals; // indexed by temp_id - base_temp
+    int base_temp;
+    int temp_count;
+    size_t interval_cap;
+
+    uint32_t used_callee_saved; // bit per x64_registers_t
+    size_t spill_count;
+} regalloc_t;
+
+extern const x64_registers_t callee_saved_regs[];
+extern const size_t callee_saved_count;
+
+// `start` is the IR_FUNC_START node, allocation stops at the matching IR_FUNC_END.
+// With `spill_all` every temp gets a stack slot (-fno-regalloc).
+void regalloc_function(ir_instruction_list_t *start, regalloc_t *ra, int spill_all);
+// A tail call code_gen turns into a jump: every argument goes in a register
+// and there's a caller to return to. Nothing after it runs, so its result is
+// never stored and gets no register.
+int regalloc_tail_jump(ir_instruction_t *call, const char *function);
+live_interval_t *regalloc_lookup(regalloc_t *ra, int temp_id);
+void regalloc_free(regalloc_t *ra);
+
+#endif
@@ -0,0 +1,157 @@
+#include <stddef.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "report.h"
+
+static const char *phase_names[PHASE_COUNT] = {
+    [PHASE_DRIVER] = "driver",
+    [PHASE_LEX] = "lex",
+    [PHASE_PARSE] = "parse",
+    [PHASE_SEMANTIC] = "semantic",
+    [PHASE_IR_GEN] = "ir-gen",
+    [PHASE_IR_READ] = "ir-read",
+    [PHASE_IPA] = "ipa",
+    [PHASE_REGALLOC] = "regalloc",
+    [PHASE_ISEL] = "isel",
+    [PHASE_PEEPHOLE] = "peephole",
+    [PHASE_STACK_SLOTS] = "stack-slots",
+    [PHASE_FRAME] = "frame",
+    [PHASE_EMIT] = "emit",
+    [PHASE_OUTPUT] = "output",
+};
+
+const char *report_phase_name(phase_t phase) {
+    return phase_names[phase];
+}
+
+// per thread, so -j jobs each fill their own report
+static _Thread_local report_t *active;
+static _Thread_local phase_t current;
+static _Thread_local uint64_t wall_since;
+static _Thread_local uint64_t cpu_since;
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// everything since the last switch goes to the current phase
+static void charge(void) {
+    uint64_t wall = now_ns(CLOCK_MONOTONIC);
+    uint64_t cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    active->phases[current].wall_ns += wall - wall_since;
+    active->phases[current].cpu_ns += cpu - cpu_since;
+    wall_since = wall;
+    cpu_since = cpu;
+}
+
+void report_start(report_t *report) {
+    active = report;
+    current = PHASE_DRIVER;
+    wall_since = now_ns(CLOCK_MONOTONIC);
+    cpu_since = now_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void report_stop(void) {
+    if(!active) return;
+    charge();
+    active = NULL;
+}
+
+phase_t report_enter(phase_t phase) {
+    phase_t previous = current;
+    if(!active) return previous;
+    charge();
+    current = phase;
+    return previous;
+}
+
+void report_leave(phase_t previous) {
+    if(!active) return;
+    charge();
+    current = previous;
+}
+
+void report_allocation(size_t size, int blocks) {
+    if(!active) return;
+    active->phases[current].bytes += size;
+    active->phases[current].allocations += blocks;
+}
+
+void report_add(report_t *total, report_t *report) {
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        total->phases[i].wall_ns += report->phases[i].wall_ns;
+        total->phases[i].cpu_ns += report->phases[i].cpu_ns;
+        total->phases[i].bytes += report->phases[i].bytes;
+        total->phases[i].allocations += report->phases[i].allocations;
+    }
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss; // KiB on Linux
+}
+
+static void print_json_stats(FILE *f, phase_stats_t *stats, int time, int mem) {
+    const char *sep = "";
+    if(time) {
+        fprintf(f, "\"wall_us\": %llu, \"cpu_us\": %llu",
+                (unsigned long long) stats->wall_ns / 1000, (unsigned long long) stats->cpu_ns / 1000);
+        sep = ", ";
+    }
+    if(mem) {
+        fprintf(f, "%s\"bytes\": %llu, \"allocations\": %llu", sep,
+                (unsigned long long) stats->bytes, (unsigned long long) stats->allocations);
+    }
+}
+
+static void print_text_stats(FILE *f, const char *name, phase_stats_t *stats, phase_stats_t *total, int time, int mem) {
+    fprintf(f, " %-12s", name);
+    if(time) {
+        fprintf(f, " %10.3f ms (%3.0f%%) %10.3f ms (%3.0f%%)",
+                (double) stats->wall_ns / 1e6, total->wall_ns ? 100.0 * (double) stats->wall_ns / (double) total->wall_ns : 0.0,
+                (double) stats->cpu_ns / 1e6, total->cpu_ns ? 100.0 * (double) stats->cpu_ns / (double) total->cpu_ns : 0.0);
+    }
+    if(mem) {
+        fprintf(f, " %12llu B %9llu", (unsigned long long) stats->bytes, (unsigned long long) stats->allocations);
+    }
+    fprintf(f, "\n");
+}
+
+void report_print(FILE *f, report_t *report, int time, int mem, report_format_t format) {
+    phase_stats_t total = {0};
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        total.wall_ns += report->phases[i].wall_ns;
+        total.cpu_ns += report->phases[i].cpu_ns;
+        total.bytes += report->phases[i].bytes;
+        total.allocations += report->phases[i].allocations;
+    }
+
+    if(format == REPORT_JSON) {
+        fprintf(f, "{\"phases\": [");
+        for(int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(f, "%s{\"name\": \"%s\", ", i ? ", " : "", phase_names[i]);
+            print_json_stats(f, &report->phases[i], time, mem);
+            fprintf(f, "}");
+        }
+        fprintf(f, "], \"total\": {");
+        print_json_stats(f, &total, time, mem);
+        fprintf(f, "}");
+        if(mem) fprintf(f, ", \"peak_rss_kb\": %ld", peak_rss_kb());
+        fprintf(f, "}\n");
+        return;
+    }
+
+    fprintf(f, " %-12s", "phase");
+    if(time) fprintf(f, " %20s %20s", "wall", "cpu");
+    if(mem) fprintf(f, " %14s %9s", "allocated", "allocs");
+    fprintf(f, "\n");
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        print_text_stats(f, phase_names[i], &report->phases[i], &total, time, mem);
+    }
+    print_text_stats(f, "total", &total, &total, time, mem);
+    if(mem) fprintf(f, " peak RSS %ld KiB\n", peak_rss_kb());
+}
@@ -0,0 +1,63 @@
+#ifndef _REPORT_H
+#define _REPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Where a compile spends its time and memory, for -ftime-report and
+// -fmem-report. Phases are exclusive: entering a nested one (a pass inside
+// codegen) stops charging the outer one until it's left again.
+typedef enum {
+    PHASE_DRIVER, // reading the input, the cache, anything not below
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_SEMANTIC,
+    PHASE_IR_GEN,
+    PHASE_IR_READ, // a serialized .ir instead of the four above
+    PHASE_IPA,     // -flto, linking the IR and the passes over all of it
+    PHASE_REGALLOC,
+    PHASE_ISEL,
+    PHASE_PEEPHOLE,
+    PHASE_STACK_SLOTS,
+    PHASE_FRAME,
+    PHASE_EMIT,   // encoding or printing the lowered instructions
+    PHASE_OUTPUT, // object file, assembly flush or .ir written out
+    PHASE_COUNT,
+} phase_t;
+
+typedef struct phase_stats {
+    uint64_t wall_ns;
+    uint64_t cpu_ns; // of the compiling thread
+    uint64_t bytes;  // requested through alloc.h, what a realloc grew by
+    uint64_t allocations;
+} phase_stats_t;
+
+typedef struct report {
+    phase_stats_t phases[PHASE_COUNT];
+} report_t;
+
+typedef enum {
+    REPORT_TEXT,
+    REPORT_JSON,
+} report_format_t;
+
+// Charges this thread's work to `report` until report_stop, starting in
+// PHASE_DRIVER. Without an active report entering a phase costs a branch.
+void report_start(report_t *report);
+void report_stop(void);
+
+// returns the phase to hand back to report_leave
+phase_t report_enter(phase_t phase);
+void report_leave(phase_t previous);
+
+// called by alloc.h for every allocation, `blocks` is 0 for a realloc
+void report_allocation(size_t size, int blocks);
+
+// "lex", "ir-gen", ... as in the report
+const char *report_phase_name(phase_t phase);
+void report_add(report_t *total, report_t *report);
+// time and/or memory columns, the peak RSS goes with memory
+void report_print(FILE *f, report_t *report, int time, int mem, report_format_t format);
+
+#endif
@@ -1,23 +1,46 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "alloc.h"
+#include "diag.h"
 #include "semantic.h"
 #include "hashmap.h"
 #include "lexer.h"
 #include "parser.h"
 
 void show_warning_redeclaration(ast_statement_t *stmt, char *id) {
-  fprintf(stderr, "Semantic warning: Redefinition of '%s' on line %d:%d\n",
+  fprintf(diag_stream(), "Semantic warning: Redefinition of '%s' on line %d:%d\n",
           id, stmt->pos.line, stmt->pos.column);
 }
 
 void show_error_unknown(ast_node_t *node) {
-  fprintf(stderr, "Semantic error: Variable '%s' not found on line %d:%d\n",
+  fprintf(diag_stream(), "Semantic error: Variable '%s' not found on line %d:%d\n",
           node->expr.identifier, node->pos.line, node->pos.column);
 }
 
+// a function the file doesn't declare, from the first import exporting it;
+// it's added to the global scope, so each name is looked up once
+static symbol_t *lookup_function(symbol_table_t *table, char *id) {
+    symbol_t *sym = map_get(table->global_scope, id);
+    if(sym) return sym;
+
+    for(module_t *module = table->imports; module != NULL; module = module->next) {
+        const module_symbol_t *found = module_lookup(module, id);
+        if(found == NULL || found->kind != MODULE_FUNCTION) continue;
+
+        sym = mem_calloc(1, sizeof(symbol_t));
+        sym->kind = SYMBOL_FUNC;
+        sym->identifier = mem_strdup(id);
+        sym->type = (expr_type_t) found->type;
+        map_add(table->global_scope, sym->identifier, sym);
+        return sym;
+    }
+    return NULL;
+}
+
 void enter_scope(symbol_table_t *table) {
-    struct scope *s = calloc(1, sizeof(struct scope));
+    struct scope *s = mem_calloc(1, sizeof(struct scope));
     s->level = table->current_scope->level+1;
     s->parent = table->current_scope;
     table->current_scope = s;
@@ -28,7 +51,7 @@ void exit_scope(symbol_table_t *table) {
 
     struct scope *s = table->current_scope->parent;
     // TODO: proper free
-    free(table->current_scope);
+    mem_free(table->current_scope);
     table->current_scope = s;
 }
 
@@ -56,6 +79,7 @@ void semantic_check_node(ast_node_t *node, symbol_table_t *table) {
             symbol_t *sym = map_get(table->current_scope, node->expr.identifier);
             if(sym == NULL) {
                 show_error_unknown(node);
+                table->errors++;
                 break;
             }
             node->resolved_type = sym->type;
@@ -66,7 +90,9 @@ void semantic_check_node(ast_node_t *node, symbol_table_t *table) {
             for(size_t i = 0; i < node->expr.call.arg_count; i++) {
                 semantic_check_node(node->expr.call.args[i], table);
             }
-            // TODO: add return type
+            // functions we don't know, like write, return int as in C
+            symbol_t *sym = lookup_function(table, node->expr.call.identifier);
+            node->resolved_type = sym && sym->kind == SYMBOL_FUNC ? sym->type : INT32;
             break;
         }
 
@@ -82,10 +108,14 @@ void semantic_check_statement(ast_statement_t *stmt, symbol_table_t *table) {
     switch(stmt->type) {
         case AST_VAR_DECLARATION: {
             char *id = stmt->statement.declaration.identifier;
-            if(map_get(table->current_scope, id) != NULL) {
+            symbol_t *declared = map_get(table->current_scope, id);
+            if(declared && declared->ahead) {
+                declared->ahead = 0;
+            }
+            else if(declared) {
                 show_warning_redeclaration(stmt, id);
             } else {
-                symbol_t *sym = malloc(sizeof(symbol_t));
+                symbol_t *sym = mem_calloc(1, sizeof(symbol_t));
                 sym->kind = SYMBOL_VAR;
                 sym->identifier = id;
                 sym->scope_level = table->current_scope->level;
@@ -99,11 +129,15 @@ void semantic_check_statement(ast_statement_t *stmt, symbol_table_t *table) {
         case AST_FUNC_DECLARATION: {
             char *id = stmt->statement.function.identifier;
 
-            if(map_get(table->current_scope, id) != NULL) {
+            symbol_t *declared = map_get(table->current_scope, id);
+            if(declared && declared->ahead) {
+                declared->ahead = 0;
+            }
+            else if(declared) {
                 show_warning_redeclaration(stmt, stmt->statement.function.identifier);
             }
             else {
-                symbol_t *sym = malloc(sizeof(symbol_t));
+                symbol_t *sym = mem_calloc(1, sizeof(symbol_t));
                 sym->kind = SYMBOL_FUNC;
                 sym->identifier = id;
                 sym->scope_level = table->current_scope->level;
@@ -115,7 +149,7 @@ void semantic_check_statement(ast_statement_t *stmt, symbol_table_t *table) {
 
             struct arg *args = stmt->statement.function.args;
             for(size_t i = 0; i < stmt->statement.function.arg_count; i++) {
-                symbol_t *sym = malloc(sizeof(symbol_t));
+                symbol_t *sym = mem_calloc(1, sizeof(symbol_t));
                 sym->kind = SYMBOL_VAR;
                 sym->identifier = args[i].identifier;
                 sym->scope_level = table->current_scope->level;
@@ -142,7 +176,8 @@ void semantic_check_statement(ast_statement_t *stmt, symbol_table_t *table) {
             }
             else {
                 stmt->statement.assignment.resolved_var_type = UNKNOWN_TYPE;
-                fprintf(stderr, "Semantic error: Variable '%s' not found on line %d:%d", stmt->statement.assignment.identifier, stmt->pos.line, stmt->pos.column);
+                fprintf(diag_stream(), "Semantic error: Variable '%s' not found on line %d:%d\n", stmt->statement.assignment.identifier, stmt->pos.line, stmt->pos.column);
+                table->errors++;
             }
             semantic_check_node(stmt->statement.assignment.value, table);
             break;
@@ -153,18 +188,83 @@ void semantic_check_statement(ast_statement_t *stmt, symbol_table_t *table) {
             break;
         }
 
+        case AST_IMPORT: {
+            // done by the pre-pass, at file scope that is
+            if(table->current_scope != table->global_scope) {
+                fprintf(diag_stream(), "Semantic error: 'import' only applies at file scope on line %d:%d\n", stmt->pos.line, stmt->pos.column);
+                table->errors++;
+            }
+            break;
+        }
+
         default: {
             break;
         }
     }
 }
 
-void semantic_check(struct statement_list *ast) {
-    symbol_table_t table = {0};
-    table.global_scope = calloc(1, sizeof(struct scope));
-    table.global_scope->level = 0;
-    table.global_scope->parent = NULL;
-    table.current_scope = table.global_scope;
+void semantic_begin(symbol_table_t *table) {
+    *table = (symbol_table_t) {0};
+    table->global_scope = mem_calloc(1, sizeof(struct scope));
+    table->global_scope->level = 0;
+    table->global_scope->parent = NULL;
+    table->current_scope = table->global_scope;
+}
+
+// the first declaration of a name wins, later ones warn when they're checked
+void semantic_declare(symbol_table_t *table, enum symbol_kind kind, char *id, expr_type_t type) {
+    if(id == NULL || map_get(table->global_scope, id) != NULL) return;
+
+    symbol_t *sym = mem_calloc(1, sizeof(symbol_t));
+    sym->kind = kind;
+    sym->identifier = mem_strdup(id);
+    sym->type = type;
+    sym->ahead = 1;
+    map_add(table->global_scope, sym->identifier, sym);
+}
+
+void semantic_import(symbol_table_t *table, char *name, pos_t pos) {
+    module_t **last = &table->imports;
+    for(; *last != NULL; last = &(*last)->next) {
+        if(strcmp((*last)->name, name) == 0) return;
+    }
+
+    // one that's there but unreadable has been reported by module_open
+    *last = module_open(name);
+    if(*last == NULL) {
+        char *path = module_find(name);
+        if(path == NULL) fprintf(diag_stream(), "Semantic error: Module '%s' not found on line %d:%d\n", name, pos.line, pos.column);
+        mem_free(path);
+        table->errors++;
+    }
+}
+
+void semantic_end(symbol_table_t *table) {
+    while(table->imports != NULL) {
+        module_t *next = table->imports->next;
+        module_close(table->imports);
+        table->imports = next;
+    }
+}
+
+int semantic_check(struct statement_list *ast) {
+    symbol_table_t table;
+    semantic_begin(&table);
+
+    // calls see the callee's return type wherever it's defined
+    for(struct statement_list *current = ast; current != NULL; current = current->next) {
+        ast_statement_t *stmt = current->statement;
+        if(stmt == NULL) continue;
+        if(stmt->type == AST_FUNC_DECLARATION) {
+            semantic_declare(&table, SYMBOL_FUNC, stmt->statement.function.identifier, stmt->statement.function.type);
+        }
+        else if(stmt->type == AST_VAR_DECLARATION) {
+            semantic_declare(&table, SYMBOL_VAR, stmt->statement.declaration.identifier, stmt->statement.declaration.t);
+        }
+        else if(stmt->type == AST_IMPORT) {
+            semantic_import(&table, stmt->statement.import.module, stmt->pos);
+        }
+    }
 
     struct statement_list *current = ast;
     while (current != NULL) {
@@ -173,4 +273,6 @@ void semantic_check(struct statement_list *ast) {
         }
         current = current->next;
     }
+    semantic_end(&table);
+    return table.errors;
 }
@@ -2,6 +2,7 @@
 #define _SEMANTIC_H
 
 #include "hashmap.h"
+#include "module.h"
 #include "parser.h"
 
 enum symbol_kind {
@@ -21,6 +22,8 @@ struct symbol {
     expr_type_t type;
 
     int scope_level;
+    int ahead; // declared by the pre-pass, its statement hasn't been checked yet
+    ast_statement_t *declaration; // the first one of its name, kept by the language server
 };
 
 struct node {
@@ -32,8 +35,25 @@ struct node {
 typedef struct symbol_table {
     struct scope *current_scope;
     struct scope *global_scope;
+    int errors;
+
+    // searched in import order for calls to names the file doesn't declare
+    module_t *imports;
 } symbol_table_t;
 
-void semantic_check(struct statement_list *ast);
+// number of errors reported, warnings don't count
+int semantic_check(struct statement_list *ast);
+
+// Statement at a time, for the pipelined driver: every top-level name is
+// declared before any statement is checked, the way semantic_check does it,
+// and the errors add up in table->errors. The global scope keeps its own
+// copies of the names, so the statements can be freed after their check.
+void semantic_begin(symbol_table_t *table);
+void semantic_declare(symbol_table_t *table, enum symbol_kind kind, char *id, expr_type_t type);
+void semantic_check_statement(ast_statement_t *stmt, symbol_table_t *table);
+// imports apply to the whole file, so they're read with the declarations
+void semantic_import(symbol_table_t *table, char *module, pos_t pos);
+// unmaps the imports, the symbols taken from them stay
+void semantic_end(symbol_table_t *table);
 
 #endif
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "cache.h"
+#include "diag.h"
+#include "lexer.h"
+#include "server.h"
+
+// A long running divc that keeps what every invocation would otherwise
+// rebuild: the keyword trie, a heap that's already grown and recently used
+// cache entries. Clients are the same binary with --client.
+
+const char *server_default_socket(void) {
+    static char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if(runtime && *runtime) snprintf(path, sizeof(path), "%s/divc.sock", runtime);
+    else snprintf(path, sizeof(path), "/tmp/divc-%u.sock", (unsigned) getuid());
+    return path;
+}
+
+static int read_all(int fd, void *data, size_t len) {
+    uint8_t *bytes = data;
+    while(len > 0) {
+        ssize_t n = read(fd, bytes, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        bytes += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    while(len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        bytes += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static int socket_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr->sun_path)) return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+typedef struct connection {
+    int fd;
+    driver_fn_t driver;
+} connection_t;
+
+// arenas of finished requests, so a new thread starts on warm chunks
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static arena_t *idle[16];
+static int idle_count;
+
+static arena_t *take_arena(void) {
+    pthread_mutex_lock(&idle_lock);
+    arena_t *arena = idle_count ? idle[--idle_count] : NULL;
+    pthread_mutex_unlock(&idle_lock);
+    return arena ? arena : arena_create();
+}
+
+static void give_arena(arena_t *arena) {
+    arena_reset(arena);
+    pthread_mutex_lock(&idle_lock);
+    if(idle_count < (int) (sizeof(idle) / sizeof(idle[0]))) {
+        idle[idle_count++] = arena;
+        arena = NULL;
+    }
+    pthread_mutex_unlock(&idle_lock);
+    if(arena) arena_destroy(arena);
+}
+
+static void respond(int fd, int status, const char *out, size_t out_len, const char *err, size_t err_len) {
+    server_response_t response = {.status = status, .out_len = out_len, .err_len = err_len};
+    memcpy(response.magic, SERVER_MAGIC, 4);
+    if(write_all(fd, &response, sizeof(response)) == 0 && write_all(fd, out, out_len) == 0) {
+        write_all(fd, err, err_len);
+    }
+}
+
+static void *serve(void *arg) {
+    connection_t *conn = arg;
+    int fd = conn->fd;
+    driver_fn_t driver = conn->driver;
+    mem_free(conn);
+
+    server_request_t request;
+    if(read_all(fd, &request, sizeof(request)) != 0
+        || memcmp(request.magic, SERVER_MAGIC, 4) != 0 || request.version != SERVER_VERSION
+        || request.cwd_len > SERVER_MAX_CWD || request.args_len > SERVER_MAX_ARGS
+        || request.stdin_len > SERVER_MAX_STDIN || request.argc > request.args_len) {
+        close(fd);
+        return NULL;
+    }
+
+    // everything the compiler allocates for the request from here on, its
+    // leaks included, goes when the arena is reset
+    arena_t *arena = take_arena();
+    arena_swap(arena);
+
+    char *cwd = mem_calloc(1, request.cwd_len + 1);
+    char *args = mem_alloc(request.args_len + request.stdin_len + 1);
+    char *source = args + request.args_len;
+    // the last argument has to end in its NUL, not run on into stdin
+    if(read_all(fd, cwd, request.cwd_len) != 0 || read_all(fd, args, request.args_len + request.stdin_len) != 0
+        || (request.args_len > 0 && source[-1] != '\0')) {
+        arena_swap(NULL);
+        give_arena(arena);
+        close(fd);
+        return NULL;
+    }
+
+    // relative paths, getcwd for -g and the cache key all see the client's
+    // directory, without touching the other requests' threads
+    if(unshare(CLONE_FS) != 0 || chdir(cwd) != 0) {
+        static const char msg[] = "Server error: cannot enter the client's directory\n";
+        respond(fd, 1, NULL, 0, msg, sizeof(msg) - 1);
+        arena_swap(NULL);
+        give_arena(arena);
+        close(fd);
+        return NULL;
+    }
+
+    char **argv = mem_calloc(request.argc + 2, sizeof(char *));
+    argv[0] = "divc";
+    char *p = args;
+    uint32_t argc = 0;
+    while(argc < request.argc && p < source) {
+        argv[++argc] = p;
+        p += strlen(p) + 1;
+    }
+
+    char *out = NULL, *err = NULL;
+    size_t out_len = 0, err_len = 0;
+    driver_io_t io = {
+        .in = request.stdin_len ? fmemopen(source, request.stdin_len, "r") : fopen("/dev/null", "r"),
+        .out = open_memstream(&out, &out_len),
+        .err = open_memstream(&err, &err_len),
+        .served = 1,
+    };
+    diag_set_stream(io.err);
+    int status = driver((int) argc + 1, argv, &io);
+    diag_set_stream(NULL);
+    fclose(io.in);
+    fclose(io.out);
+    fclose(io.err);
+
+    respond(fd, status, out, out_len, err, err_len);
+    mem_free(out);
+    mem_free(err);
+    arena_swap(NULL);
+    give_arena(arena);
+    close(fd);
+    return NULL;
+}
+
+static const char *listening;
+
+static void stop(int sig) {
+    (void) sig;
+    unlink(listening);
+    _exit(0);
+}
+
+int server_run(const char *socket_path, driver_fn_t driver) {
+    struct sockaddr_un addr;
+    if(socket_address(socket_path, &addr) != 0) {
+        fprintf(stderr, "Server error: %s: path too long\n", socket_path);
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "Server error: %s: a server is already running\n", socket_path);
+        close(fd);
+        return 1;
+    }
+    if(fd >= 0) close(fd);
+    unlink(socket_path); // left behind by one that didn't shut down
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(0077); // only our user gets to make us write files
+    int bound = fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+    umask(mask);
+    if(!bound || listen(fd, 64) != 0) {
+        fprintf(stderr, "Server error: %s: %s\n", socket_path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return 1;
+    }
+
+    listening = socket_path;
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    signal(SIGPIPE, SIG_IGN); // a client that went away only fails its write
+
+    // keep the heap between requests instead of handing it back each time
+    mallopt(M_TRIM_THRESHOLD, 256 << 20);
+    mallopt(M_TOP_PAD, 16 << 20);
+    cache_keep_in_memory(SERVER_MEMORY_CACHE);
+    lexer_init();
+
+    fprintf(stderr, "divc server listening on %s\n", socket_path);
+    for(;;) {
+        int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if(client < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "Server error: accept: %s\n", strerror(errno));
+            continue;
+        }
+
+        connection_t *conn = mem_alloc(sizeof(connection_t));
+        *conn = (connection_t) {client, driver};
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, serve, conn) != 0) {
+            close(client);
+            mem_free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+static char *read_stdin(size_t *len) {
+    size_t cap = 4096;
+    char *data = mem_alloc(cap);
+    *len = 0;
+    for(;;) {
+        if(*len == cap) data = mem_realloc(data, cap *= 2);
+        size_t got = fread(data + *len, 1, cap - *len, stdin);
+        if(got == 0) break;
+        *len += got;
+    }
+    return data;
+}
+
+int client_run(const char *socket_path, int argc, char *argv[], int forward_stdin, int *status) {
+    struct sockaddr_un addr;
+    if(socket_address(socket_path, &addr) != 0) return 0;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return 0;
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    char cwd[4096];
+    if(!getcwd(cwd, sizeof(cwd))) {
+        close(fd);
+        return 0;
+    }
+
+    size_t args_len = 0;
+    for(int i = 1; i < argc; i++) args_len += strlen(argv[i]) + 1;
+    if(strlen(cwd) > SERVER_MAX_CWD || args_len > SERVER_MAX_ARGS) {
+        close(fd);
+        return 0;
+    }
+    size_t stdin_len = 0;
+    char *source = forward_stdin ? read_stdin(&stdin_len) : NULL;
+    if(stdin_len > SERVER_MAX_STDIN) {
+        fprintf(stderr, "Server error: stdin is over the request limit\n");
+        mem_free(source);
+        close(fd);
+        *status = 1;
+        return 1;
+    }
+
+    server_request_t request = {
+        .version = SERVER_VERSION,
+        .argc = (uint32_t) (argc - 1),
+        .cwd_len = (uint32_t) strlen(cwd),
+        .args_len = args_len,
+        .stdin_len = stdin_len,
+    };
+    memcpy(request.magic, SERVER_MAGIC, 4);
+
+    signal(SIGPIPE, SIG_IGN);
+    int ok = write_all(fd, &request, sizeof(request)) == 0 && write_all(fd, cwd, request.cwd_len) == 0;
+    for(int i = 1; ok && i < argc; i++) ok = write_all(fd, argv[i], strlen(argv[i]) + 1) == 0;
+    if(ok && stdin_len) ok = write_all(fd, source, stdin_len) == 0;
+    mem_free(source);
+
+    server_response_t response;
+    ok = ok && read_all(fd, &response, sizeof(response)) == 0 && memcmp(response.magic, SERVER_MAGIC, 4) == 0;
+    if(!ok) {
+        // the server died on us, stdin is gone if we forwarded it
+        close(fd);
+        if(forward_stdin) {
+            fprintf(stderr, "Server error: %s: no response\n", socket_path);
+            *status = 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    // copied through in chunks, the object file can be large when it's -o -
+    char buffer[65536];
+    uint64_t lens[2] = {response.out_len, response.err_len};
+    FILE *streams[2] = {stdout, stderr};
+    for(int s = 0; s < 2; s++) {
+        for(uint64_t left = lens[s]; left > 0;) {
+            size_t want = left < sizeof(buffer) ? (size_t) left : sizeof(buffer);
+            if(read_all(fd, buffer, want) != 0) {
+                close(fd);
+                *status = 1;
+                return 1;
+            }
+            fwrite(buffer, 1, want, streams[s]);
+            left -= want;
+        }
+        fflush(streams[s]);
+    }
+    close(fd);
+    *status = response.status;
+    return 1;
+}
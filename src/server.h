@@ -0,0 +1,58 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SERVER_MAGIC "DVSV"
+#define SERVER_VERSION 1
+#define SERVER_MEMORY_CACHE (64ull << 20) // cache entries kept warm by the server
+
+// Where a driver run reads and writes: the process's stdio from the command
+// line, buffers that go back to the client when the server runs it
+typedef struct driver_io {
+    FILE *in;  // source of the input "-"
+    FILE *out;
+    FILE *err;
+    int served; // running inside the server, --run and --jit are refused
+} driver_io_t;
+
+typedef int (*driver_fn_t)(int argc, char *argv[], driver_io_t *io);
+
+// A request is the client's working directory, its command line and, when
+// an input is "-", its stdin:
+//   header | cwd | args, each NUL terminated | stdin
+typedef struct server_request {
+    char magic[4];
+    uint32_t version;
+    uint32_t argc;
+    uint32_t cwd_len;
+    uint64_t args_len;
+    uint64_t stdin_len;
+} server_request_t;
+
+// the most a request may carry, the server drops one asking for more
+#define SERVER_MAX_CWD 4096
+#define SERVER_MAX_ARGS (1u << 20)
+#define SERVER_MAX_STDIN (1ull << 30)
+
+// followed by what the driver wrote to stdout and stderr
+typedef struct server_response {
+    char magic[4];
+    int32_t status;
+    uint64_t out_len;
+    uint64_t err_len;
+} server_response_t;
+
+// $XDG_RUNTIME_DIR/divc.sock, else /tmp/divc-<uid>.sock
+const char *server_default_socket(void);
+
+// Serves requests until killed, each one on its own thread with its own
+// working directory. Returns only if the socket can't be set up.
+int server_run(const char *socket_path, driver_fn_t driver);
+
+// Runs argv[1..] on the server and passes its output and exit status on.
+// Returns 0 if nothing answered, so the caller compiles locally.
+int client_run(const char *socket_path, int argc, char *argv[], int forward_stdin, int *status);
+
+#endif
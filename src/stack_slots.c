@@ -0,0 +1,204 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "stack_slots.h"
+
+// Stack slot coloring over one function's instruction list.
+// The code has no branches, so an object is live from the first instruction
+// touching it to the last one. Objects of the same size whose ranges don't
+// overlap get the same slot, like linear scan hands out registers. Slots are
+// laid out largest first so none of them needs padding.
+
+#define SIZE_CLASSES 4 // 1, 2, 4 and 8 bytes, anything else gets its own slot
+
+typedef struct slot {
+    int32_t size;
+    int32_t offset;
+    int32_t next_free; // free list of the size class, -1 ends it
+} slot_t;
+
+typedef struct live_object {
+    size_t first;
+    size_t last;
+    int32_t slot; // -1 while unassigned or never accessed
+} live_object_t;
+
+static int size_class(int32_t size) {
+    switch(size) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: return -1;
+    }
+}
+
+typedef struct start_key {
+    size_t first;
+    size_t object;
+} start_key_t;
+
+static int compare_first(const void *a, const void *b) {
+    const start_key_t *x = a;
+    const start_key_t *y = b;
+    if(x->first != y->first) return x->first < y->first ? -1 : 1;
+    return x->object < y->object ? -1 : 1;
+}
+
+static int compare_size(const void *a, const void *b) {
+    const slot_t *x = *(slot_t * const *) a;
+    const slot_t *y = *(slot_t * const *) b;
+    if(x->size != y->size) return y->size - x->size;
+    return x < y ? -1 : 1;
+}
+
+// min-heap of active objects by their last access
+typedef struct active_heap {
+    size_t *items;
+    size_t count;
+} active_heap_t;
+
+static void heap_push(active_heap_t *heap, live_object_t *objects, size_t object) {
+    size_t i = heap->count++;
+    heap->items[i] = object;
+    while(i > 0) {
+        size_t parent = (i - 1) / 2;
+        if(objects[heap->items[parent]].last <= objects[heap->items[i]].last) break;
+        size_t tmp = heap->items[parent];
+        heap->items[parent] = heap->items[i];
+        heap->items[i] = tmp;
+        i = parent;
+    }
+}
+
+static size_t heap_pop(active_heap_t *heap, live_object_t *objects) {
+    size_t top = heap->items[0];
+    heap->items[0] = heap->items[--heap->count];
+    size_t i = 0;
+    for(;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+        if(left < heap->count && objects[heap->items[left]].last < objects[heap->items[smallest]].last) smallest = left;
+        if(right < heap->count && objects[heap->items[right]].last < objects[heap->items[smallest]].last) smallest = right;
+        if(smallest == i) break;
+        size_t tmp = heap->items[smallest];
+        heap->items[smallest] = heap->items[i];
+        heap->items[i] = tmp;
+        i = smallest;
+    }
+    return top;
+}
+
+// object + 1 for every offset an object starts at, 0 elsewhere
+static int32_t *build_lookup(frame_object_t *objects, size_t object_count, int32_t *depth) {
+    *depth = 0;
+    for(size_t i = 0; i < object_count; i++) {
+        if(-objects[i].offset > *depth) *depth = -objects[i].offset;
+    }
+    int32_t *lookup = mem_calloc((size_t) *depth + 1, sizeof(int32_t));
+    for(size_t i = 0; i < object_count; i++) {
+        lookup[-objects[i].offset] = (int32_t) i + 1;
+    }
+    return lookup;
+}
+
+// the object an rbp access goes to, -1 for anything that isn't one of ours
+static int32_t accessed_object(x64_operand_t *op, int32_t *lookup, int32_t depth) {
+    if(op->kind != X64_MEM || op->mem.base != REG_RBP || op->mem.disp >= 0) return -1;
+    if(-op->mem.disp > depth) return -2;
+    return lookup[-op->mem.disp] - 1 >= 0 ? lookup[-op->mem.disp] - 1 : -2;
+}
+
+int32_t stack_slots_color(x64_inst_t *insts, size_t count, frame_object_t *objects, size_t object_count, int share) {
+    int32_t depth;
+    int32_t *lookup = build_lookup(objects, object_count, &depth);
+    live_object_t *live = mem_alloc(sizeof(live_object_t) * (object_count + 1));
+    for(size_t i = 0; i < object_count; i++) {
+        live[i] = (live_object_t) {SIZE_MAX, 0, -1};
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        x64_operand_t *ops[] = {&insts[i].dst, &insts[i].src};
+        for(int k = 0; k < 2; k++) {
+            int32_t object = accessed_object(ops[k], lookup, depth);
+            if(object == -2) {
+                // an access into the middle of an object, keep the frame as it is
+                mem_free(lookup);
+                mem_free(live);
+                return depth;
+            }
+            if(object < 0) continue;
+            if(live[object].first == SIZE_MAX) live[object].first = i;
+            live[object].last = i;
+        }
+    }
+
+    start_key_t *order = mem_alloc(sizeof(start_key_t) * (object_count + 1));
+    size_t used = 0;
+    for(size_t i = 0; i < object_count; i++) {
+        if(live[i].first != SIZE_MAX) order[used++] = (start_key_t) {live[i].first, i};
+    }
+    qsort(order, used, sizeof(start_key_t), compare_first);
+
+    slot_t *slots = mem_alloc(sizeof(slot_t) * (used + 1));
+    size_t slot_count = 0;
+    int32_t free_list[SIZE_CLASSES] = {-1, -1, -1, -1};
+    active_heap_t active = {mem_alloc(sizeof(size_t) * (used + 1)), 0};
+
+    for(size_t n = 0; n < used; n++) {
+        size_t object = order[n].object;
+        int32_t size = objects[object].size;
+        int class = size_class(size);
+
+        // slots of objects that are done before this one starts are free again,
+        // one instruction never touches two objects so `<` is enough
+        while(share && active.count > 0 && live[active.items[0]].last < live[object].first) {
+            size_t done = heap_pop(&active, live);
+            int32_t slot = live[done].slot;
+            int done_class = size_class(slots[slot].size);
+            if(done_class < 0) continue;
+            slots[slot].next_free = free_list[done_class];
+            free_list[done_class] = slot;
+        }
+
+        if(class >= 0 && free_list[class] >= 0) {
+            live[object].slot = free_list[class];
+            free_list[class] = slots[free_list[class]].next_free;
+        }
+        else {
+            live[object].slot = (int32_t) slot_count;
+            slots[slot_count++] = (slot_t) {size, 0, -1};
+        }
+        if(share) heap_push(&active, live, object);
+    }
+
+    // largest first, every offset stays aligned to its size
+    slot_t **layout = mem_alloc(sizeof(slot_t *) * (slot_count + 1));
+    for(size_t i = 0; i < slot_count; i++) layout[i] = &slots[i];
+    qsort(layout, slot_count, sizeof(slot_t *), compare_size);
+
+    int32_t offset = 0;
+    for(size_t i = 0; i < slot_count; i++) {
+        int32_t alignment = layout[i]->size >= 8 ? 8 : layout[i]->size >= 4 ? 4 : layout[i]->size >= 2 ? 2 : 1;
+        offset = (offset - layout[i]->size) & -alignment;
+        layout[i]->offset = offset;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        x64_operand_t *ops[] = {&insts[i].dst, &insts[i].src};
+        for(int k = 0; k < 2; k++) {
+            int32_t object = accessed_object(ops[k], lookup, depth);
+            if(object >= 0) ops[k]->mem.disp = slots[live[object].slot].offset;
+        }
+    }
+
+    mem_free(layout);
+    mem_free(active.items);
+    mem_free(slots);
+    mem_free(order);
+    mem_free(live);
+    mem_free(lookup);
+    return -offset;
+}
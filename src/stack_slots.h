@@ -0,0 +1,21 @@
+#ifndef _STACK_SLOTS_H
+#define _STACK_SLOTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "x64.h"
+
+// A local, spilled temp or register save slot as code_gen handed it out:
+// every object gets its own rbp offset first, coloring packs them afterwards.
+typedef struct frame_object {
+    int32_t offset;
+    int32_t size;
+} frame_object_t;
+
+// Moves objects whose accesses don't overlap into shared slots (only
+// separate ones with `share` off), drops objects that are never accessed and
+// rewrites the rbp displacements in insts. Returns the bytes needed below rbp.
+int32_t stack_slots_color(x64_inst_t *insts, size_t count, frame_object_t *objects, size_t object_count, int share);
+
+#endif
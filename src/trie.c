@@ -1,5 +1,6 @@
 #include <stdlib.h>
 
+#include "alloc.h"
 #include "lexer.h"
 #include "trie.h"
 
@@ -13,7 +14,7 @@ int trie_index(char c) {
 
 void trie_insert(struct trie *t, char *s, unsigned long type) {
     if(t->children == NULL) {
-        t->children = calloc(TRIE_CHILDERN, sizeof(struct trie*));
+        t->children = mem_calloc(TRIE_CHILDERN, sizeof(struct trie*));
     }
 
     while((*s) != '\0') {
@@ -21,8 +22,8 @@ void trie_insert(struct trie *t, char *s, unsigned long type) {
         if(idx < 0) return;
 
         if(t->children[idx] == NULL) {
-            t->children[idx] = calloc(1, sizeof(struct trie));
-            t->children[idx]->children = calloc(TRIE_CHILDERN, sizeof(struct trie*));
+            t->children[idx] = mem_calloc(1, sizeof(struct trie));
+            t->children[idx]->children = mem_calloc(TRIE_CHILDERN, sizeof(struct trie*));
         }
 
         t = t->children[idx];
@@ -0,0 +1,500 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "vm.h"
+#include "ir.h"
+#include "parser.h"
+
+// Register bytecode for running IR without nasm/ld.
+// Every IR var and temp of a function gets its own register, values are kept
+// normalized to the width the x64 backend would load/store them with.
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+typedef struct vm_builder {
+    vm_program_t *program;
+    vm_function_t *fn;
+    size_t next_function;
+    size_t code_cap;
+    size_t constant_cap;
+
+    char **vars; // index = register
+    size_t var_count;
+    size_t var_cap;
+    uint32_t *var_regs;
+
+    int *temps;
+    size_t temp_count;
+    size_t temp_cap;
+    uint32_t *temp_regs;
+} vm_builder_t;
+
+static uint8_t vm_type(expr_type_t type) {
+    int size = get_type_size(type);
+    if(size <= 0 || (type & TYPE_POINTER)) return 8;
+
+    switch(type) {
+        case UINT8:
+        case UINT16:
+        case UINT32:
+        case UINT64:
+            return size | VM_TYPE_UNSIGNED;
+        default:
+            return size;
+    }
+}
+
+static inline int64_t vm_norm(uint64_t value, unsigned type) {
+    switch(type) {
+        case 1: return (int8_t) value;
+        case 2: return (int16_t) value;
+        case 4: return (int32_t) value;
+        case 1 | VM_TYPE_UNSIGNED: return (uint8_t) value;
+        case 2 | VM_TYPE_UNSIGNED: return (uint16_t) value;
+        case 4 | VM_TYPE_UNSIGNED: return (uint32_t) value;
+        default: return (int64_t) value;
+    }
+}
+
+static void vm_emit(vm_builder_t *b, uint32_t word) {
+    vm_function_t *fn = b->fn;
+    if(fn->code_len == b->code_cap) {
+        b->code_cap = b->code_cap ? b->code_cap * 2 : 64;
+        fn->code = mem_realloc(fn->code, sizeof(uint32_t) * b->code_cap);
+    }
+    fn->code[fn->code_len++] = word;
+}
+
+static uint32_t vm_new_reg(vm_builder_t *b) {
+    return (uint32_t) b->fn->reg_count++;
+}
+
+static uint32_t vm_var_reg(vm_builder_t *b, char *name, int declare) {
+    // search backwards so redeclarations shadow older slots, like find_local
+    if(!declare) {
+        for(size_t i = b->var_count; i > 0; i--) {
+            if(strcmp(b->vars[i-1], name) == 0) return b->var_regs[i-1];
+        }
+    }
+
+    if(b->var_count == b->var_cap) {
+        b->var_cap = b->var_cap ? b->var_cap * 2 : 16;
+        b->vars = mem_realloc(b->vars, sizeof(char*) * b->var_cap);
+        b->var_regs = mem_realloc(b->var_regs, sizeof(uint32_t) * b->var_cap);
+    }
+    b->vars[b->var_count] = name;
+    b->var_regs[b->var_count] = vm_new_reg(b);
+    return b->var_regs[b->var_count++];
+}
+
+static uint32_t vm_temp_reg(vm_builder_t *b, int id) {
+    for(size_t i = 0; i < b->temp_count; i++) {
+        if(b->temps[i] == id) return b->temp_regs[i];
+    }
+
+    if(b->temp_count == b->temp_cap) {
+        b->temp_cap = b->temp_cap ? b->temp_cap * 2 : 16;
+        b->temps = mem_realloc(b->temps, sizeof(int) * b->temp_cap);
+        b->temp_regs = mem_realloc(b->temp_regs, sizeof(uint32_t) * b->temp_cap);
+    }
+    b->temps[b->temp_count] = id;
+    b->temp_regs[b->temp_count] = vm_new_reg(b);
+    return b->temp_regs[b->temp_count++];
+}
+
+static uint32_t vm_constant(vm_builder_t *b, int64_t value) {
+    vm_function_t *fn = b->fn;
+    if(fn->constant_count == b->constant_cap) {
+        b->constant_cap = b->constant_cap ? b->constant_cap * 2 : 16;
+        fn->constants = mem_realloc(fn->constants, sizeof(int64_t) * b->constant_cap);
+    }
+    fn->constants[fn->constant_count] = value;
+    return VM_CONST_BIT | (uint32_t) fn->constant_count++;
+}
+
+static uint32_t vm_operand(vm_builder_t *b, ir_operand_t *op) {
+    switch(op->kind) {
+        case IR_OPERAND_CONST: return vm_constant(b, op->constant.int_val);
+        case IR_OPERAND_VAR: return vm_var_reg(b, op->var_name, 0);
+        case IR_OPERAND_TEMP: return vm_temp_reg(b, op->temp_id);
+        default: return vm_constant(b, 0);
+    }
+}
+
+int vm_find_function(vm_program_t *program, const char *name) {
+    for(size_t i = 0; i < program->function_count; i++) {
+        if(strcmp(program->functions[i].name, name) == 0) return (int) i;
+    }
+    return -1;
+}
+
+static void vm_begin_function(vm_builder_t *b, ir_instruction_t *inst) {
+    b->fn = &b->program->functions[b->next_function++];
+    memset(b->fn, 0, sizeof(vm_function_t));
+    b->fn->name = inst->func.func_name;
+    b->code_cap = 0;
+    b->constant_cap = 0;
+    b->var_count = 0;
+    b->temp_count = 0;
+
+    // params come first so callers can copy args to regs[0..n)
+    b->fn->param_count = inst->func.param_count;
+    b->fn->param_types = mem_alloc(inst->func.param_count + 1);
+    for(size_t i = 0; i < inst->func.param_count; i++) {
+        vm_var_reg(b, inst->func.params[i]->var_name, 1);
+        b->fn->param_types[i] = vm_type(inst->func.params[i]->type);
+    }
+}
+
+static int vm_lower_instruction(vm_builder_t *b, ir_instruction_t *inst) {
+    switch(inst->opcode) {
+        case IR_ADD:
+        case IR_MINUS:
+        case IR_MULT: {
+            vm_opcode_t op = inst->opcode == IR_ADD ? VM_ADD : inst->opcode == IR_MINUS ? VM_SUB : VM_MUL;
+            uint32_t src1 = vm_operand(b, inst->src1);
+            uint32_t src2 = vm_operand(b, inst->src2);
+            vm_emit(b, op | vm_type(inst->dst->type) << 8);
+            vm_emit(b, vm_operand(b, inst->dst));
+            vm_emit(b, src1);
+            vm_emit(b, src2);
+            break;
+        }
+
+        case IR_ALLOC: {
+            vm_var_reg(b, inst->dst->var_name, 1);
+            break;
+        }
+
+        case IR_STORE: {
+            uint32_t src = vm_operand(b, inst->src1);
+            vm_emit(b, VM_MOV | vm_type(inst->dst->type) << 8);
+            vm_emit(b, vm_operand(b, inst->dst));
+            vm_emit(b, src);
+            break;
+        }
+
+        case IR_CALL: {
+            char *name = inst->src1->func_name;
+            int func = vm_find_function(b->program, name);
+            vm_opcode_t op = VM_CALL;
+
+            if(func < 0) {
+                if(strcmp(name, "write") != 0) {
+                    fprintf(stderr, "VM error: Call to undefined function '%s'\n", name);
+                    return -1;
+                }
+                op = VM_WRITE;
+            }
+            else if(inst->call.tail && strcmp(b->fn->name, "_start") != 0) {
+                op = VM_TAILCALL;
+            }
+
+            uint32_t *args = mem_alloc(sizeof(uint32_t) * (inst->call.arg_count + 1));
+            for(size_t i = 0; i < inst->call.arg_count; i++) {
+                args[i] = vm_operand(b, inst->call.args[i]);
+            }
+
+            vm_emit(b, op | vm_type(inst->dst->type) << 8);
+            if(op != VM_TAILCALL) vm_emit(b, vm_operand(b, inst->dst));
+            if(op != VM_WRITE) vm_emit(b, (uint32_t) func);
+            vm_emit(b, (uint32_t) inst->call.arg_count);
+            for(size_t i = 0; i < inst->call.arg_count; i++) {
+                vm_emit(b, args[i]);
+            }
+            mem_free(args);
+            break;
+        }
+
+        case IR_RETURN: {
+            if(!inst->src1) {
+                vm_emit(b, VM_RET_VOID);
+                break;
+            }
+            // the x64 backend returns a dword in eax, see IR_RETURN in code_gen.c
+            uint32_t src = vm_operand(b, inst->src1);
+            vm_emit(b, VM_RET | vm_type(INT32) << 8);
+            vm_emit(b, src);
+            break;
+        }
+
+        case IR_FUNC_START: {
+            vm_begin_function(b, inst);
+            break;
+        }
+
+        case IR_FUNC_END: {
+            vm_emit(b, VM_RET_VOID);
+            break;
+        }
+
+        default:
+            fprintf(stderr, "VM error: Unknown opcode: %d\n", inst->opcode);
+            return -1;
+    }
+
+    return 0;
+}
+
+vm_program_t *vm_compile(ir_instruction_list_t *ir) {
+    vm_program_t *program = mem_calloc(1, sizeof(vm_program_t));
+
+    size_t functions = 0;
+    for(ir_instruction_list_t *cur = ir; cur && cur->instruction; cur = cur->next) {
+        if(cur->instruction->opcode == IR_FUNC_START) functions++;
+    }
+
+    // names first, so calls can be resolved to indices in a single pass
+    program->functions = mem_calloc(functions + 1, sizeof(vm_function_t));
+    size_t i = 0;
+    for(ir_instruction_list_t *cur = ir; cur && cur->instruction; cur = cur->next) {
+        if(cur->instruction->opcode == IR_FUNC_START) {
+            program->functions[i++].name = cur->instruction->func.func_name;
+        }
+    }
+    program->function_count = functions;
+
+    vm_builder_t b = {0};
+    b.program = program;
+
+    int failed = 0;
+    for(ir_instruction_list_t *cur = ir; cur && cur->instruction; cur = cur->next) {
+        ir_instruction_t *inst = cur->instruction;
+        if(inst->opcode != IR_FUNC_START && b.fn == NULL) continue;
+        if(vm_lower_instruction(&b, inst) != 0) {
+            failed = 1;
+            break;
+        }
+    }
+
+    mem_free(b.vars);
+    mem_free(b.var_regs);
+    mem_free(b.temps);
+    mem_free(b.temp_regs);
+
+    if(failed) {
+        vm_free(program);
+        return NULL;
+    }
+    return program;
+}
+
+void vm_free(vm_program_t *program) {
+    if(!program) return;
+    for(size_t i = 0; i < program->function_count; i++) {
+        mem_free(program->functions[i].code);
+        mem_free(program->functions[i].constants);
+        mem_free(program->functions[i].param_types);
+    }
+    mem_free(program->functions);
+    mem_free(program);
+}
+
+static int64_t vm_write(size_t argc, const int64_t *args) {
+    // the same libc call the x64 backend makes, the second arg is an address
+    // like any other pointer the program made up, so bad ones fail the same way
+    int fd = argc > 0 ? (int) args[0] : 0;
+    const void *buf = (const void *) (uintptr_t) (argc > 1 ? args[1] : 0);
+    size_t count = argc > 2 ? (size_t) args[2] : 0;
+    return write(fd, buf, count);
+}
+
+typedef struct vm_frame {
+    vm_function_t *fn;
+    const uint32_t *pc; // return address in the caller
+    int64_t *regs;
+    uint32_t dst;
+    uint32_t dst_type;
+} vm_frame_t;
+
+#if defined(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+int vm_run(vm_program_t *program, const char *entry, int64_t *result) {
+    int index = vm_find_function(program, entry);
+    if(index < 0) {
+        fprintf(stderr, "VM error: Entry point '%s' not found\n", entry);
+        return -1;
+    }
+
+    int64_t *stack = mem_calloc(VM_STACK_SIZE, sizeof(int64_t));
+    int64_t *stack_end = stack + VM_STACK_SIZE;
+    vm_frame_t *frames = mem_alloc(sizeof(vm_frame_t) * VM_MAX_FRAMES);
+    size_t fp = 0;
+    int status = 0;
+
+    vm_function_t *fn = &program->functions[index];
+    const uint32_t *pc = fn->code;
+    const int64_t *k = fn->constants;
+    int64_t *regs = stack;
+    frames[0] = (vm_frame_t) {fn, NULL, regs, 0, 8};
+
+    if(regs + fn->reg_count > stack_end) goto stack_overflow;
+
+#define RK(x) (((x) & VM_CONST_BIT) ? k[(x) & ~VM_CONST_BIT] : regs[(x)])
+#define TYPE() (*pc >> 8)
+
+#if defined(VM_COMPUTED_GOTO)
+    static void *dispatch[VM_OPCODE_COUNT] = {
+        [VM_MOV] = &&op_VM_MOV,
+        [VM_ADD] = &&op_VM_ADD,
+        [VM_SUB] = &&op_VM_SUB,
+        [VM_MUL] = &&op_VM_MUL,
+        [VM_CALL] = &&op_VM_CALL,
+        [VM_TAILCALL] = &&op_VM_TAILCALL,
+        [VM_WRITE] = &&op_VM_WRITE,
+        [VM_RET] = &&op_VM_RET,
+        [VM_RET_VOID] = &&op_VM_RET_VOID,
+    };
+#define CASE(op) op_##op:
+#define NEXT() goto *dispatch[*pc & 0xff]
+    NEXT();
+#else
+#define CASE(op) case op:
+#define NEXT() continue
+    for(;;) switch(*pc & 0xff) {
+#endif
+
+    CASE(VM_MOV) {
+        regs[pc[1]] = vm_norm(RK(pc[2]), TYPE());
+        pc += 3;
+        NEXT();
+    }
+
+    CASE(VM_ADD) {
+        regs[pc[1]] = vm_norm((uint64_t) RK(pc[2]) + (uint64_t) RK(pc[3]), TYPE());
+        pc += 4;
+        NEXT();
+    }
+
+    CASE(VM_SUB) {
+        regs[pc[1]] = vm_norm((uint64_t) RK(pc[2]) - (uint64_t) RK(pc[3]), TYPE());
+        pc += 4;
+        NEXT();
+    }
+
+    CASE(VM_MUL) {
+        regs[pc[1]] = vm_norm((uint64_t) RK(pc[2]) * (uint64_t) RK(pc[3]), TYPE());
+        pc += 4;
+        NEXT();
+    }
+
+    CASE(VM_CALL) {
+        vm_function_t *callee = &program->functions[pc[2]];
+        uint32_t argc = pc[3];
+        int64_t *callee_regs = regs + fn->reg_count;
+
+        if(fp + 1 >= VM_MAX_FRAMES || callee_regs + callee->reg_count > stack_end) goto stack_overflow;
+
+        for(uint32_t i = 0; i < argc && i < callee->param_count; i++) {
+            callee_regs[i] = vm_norm(RK(pc[4+i]), callee->param_types[i]);
+        }
+
+        frames[fp].pc = pc + 4 + argc;
+        frames[++fp] = (vm_frame_t) {callee, NULL, callee_regs, pc[1], TYPE()};
+
+        fn = callee;
+        k = fn->constants;
+        regs = callee_regs;
+        pc = fn->code;
+        NEXT();
+    }
+
+    CASE(VM_TAILCALL) {
+        vm_function_t *callee = &program->functions[pc[1]];
+        uint32_t argc = pc[2];
+        int64_t *scratch = regs + fn->reg_count;
+
+        if(scratch + argc > stack_end || regs + callee->reg_count > stack_end) goto stack_overflow;
+
+        // args may read our own registers, stage them above the frame first
+        for(uint32_t i = 0; i < argc && i < callee->param_count; i++) {
+            scratch[i] = vm_norm(RK(pc[3+i]), callee->param_types[i]);
+        }
+        for(uint32_t i = 0; i < argc && i < callee->param_count; i++) {
+            regs[i] = scratch[i];
+        }
+
+        frames[fp].fn = callee;
+        fn = callee;
+        k = fn->constants;
+        pc = fn->code;
+        NEXT();
+    }
+
+    CASE(VM_WRITE) {
+        uint32_t argc = pc[2];
+        int64_t args[3] = {0};
+        for(uint32_t i = 0; i < argc && i < 3; i++) {
+            args[i] = RK(pc[3+i]);
+        }
+        regs[pc[1]] = vm_norm(vm_write(argc, args), TYPE());
+        pc += 3 + argc;
+        NEXT();
+    }
+
+    CASE(VM_RET) {
+        int64_t value = vm_norm(RK(pc[1]), TYPE());
+        vm_frame_t *done = &frames[fp];
+        if(fp == 0) {
+            *result = value;
+            goto out;
+        }
+        fp--;
+        fn = frames[fp].fn;
+        k = fn->constants;
+        regs = frames[fp].regs;
+        pc = frames[fp].pc;
+        regs[done->dst] = vm_norm(value, done->dst_type);
+        NEXT();
+    }
+
+    CASE(VM_RET_VOID) {
+        vm_frame_t *done = &frames[fp];
+        if(fp == 0) {
+            *result = 0;
+            goto out;
+        }
+        fp--;
+        fn = frames[fp].fn;
+        k = fn->constants;
+        regs = frames[fp].regs;
+        pc = frames[fp].pc;
+        regs[done->dst] = 0;
+        NEXT();
+    }
+
+#if !defined(VM_COMPUTED_GOTO)
+    default:
+        fprintf(stderr, "VM error: Bad opcode %u in '%s'\n", *pc & 0xff, fn->name);
+        status = -1;
+        goto out;
+    }
+#endif
+
+#undef CASE
+#undef NEXT
+#undef TYPE
+#undef RK
+
+stack_overflow:
+    fprintf(stderr, "VM error: Stack overflow in '%s'\n", fn->name);
+    status = -1;
+
+out:
+    mem_free(frames);
+    mem_free(stack);
+    return status;
+}
+
+#if defined(VM_COMPUTED_GOTO)
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,54 @@
+#ifndef _VM_H
+#define _VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+#define VM_STACK_SIZE (1 << 20) // registers, shared by all frames
+#define VM_MAX_FRAMES 65536
+#define VM_CONST_BIT 0x80000000u // operand refers to the constant table
+
+// Instruction stream is a flat uint32_t array:
+//   word 0: opcode | type << 8
+//   then the operands, registers or VM_CONST_BIT | constant index (RK)
+typedef enum {
+    VM_MOV,      // a = rk(b)
+    VM_ADD,      // a = rk(b) + rk(c)
+    VM_SUB,      // a = rk(b) - rk(c)
+    VM_MUL,      // a = rk(b) * rk(c)
+    VM_CALL,     // a = call func(argc, rk(args)...)
+    VM_TAILCALL, // return call func(argc, rk(args)...), reusing the frame
+    VM_WRITE,    // a = write(argc, rk(args)...), the libc call
+    VM_RET,      // return rk(a)
+    VM_RET_VOID, // return 0
+
+    VM_OPCODE_COUNT,
+} vm_opcode_t;
+
+// type byte: size in bytes, VM_TYPE_UNSIGNED when zero extending
+#define VM_TYPE_UNSIGNED 0x10
+
+typedef struct vm_function {
+    char *name;
+    uint32_t *code;
+    size_t code_len;
+    int64_t *constants;
+    size_t constant_count;
+    uint8_t *param_types;
+    size_t param_count;
+    size_t reg_count;
+} vm_function_t;
+
+typedef struct vm_program {
+    vm_function_t *functions;
+    size_t function_count;
+} vm_program_t;
+
+vm_program_t *vm_compile(ir_instruction_list_t *ir);
+int vm_find_function(vm_program_t *program, const char *name);
+int vm_run(vm_program_t *program, const char *entry, int64_t *result);
+void vm_free(vm_program_t *program);
+
+#endif
@@ -0,0 +1,648 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "x64.h"
+
+const char *get_register(x64_registers_t reg, int size) {
+    static const char *reg_64[] = {"rax", "rbx", "rcx", "rdx", "rsi", "rdi",
+        "rsp", "rbp", "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+
+    static const char *reg_32[] = {"eax", "ebx", "ecx", "edx", "esi", "edi",
+        "esp", "ebp", "r8d",  "r9d",  "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+
+    static const char *reg_16[] = {"ax", "bx", "cx", "dx", "si", "di",
+        "sp", "bp", "r8w",  "r9w",  "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+
+    static const char *reg_8[] = {"al", "bl", "cl", "dl", "sil", "dil",
+        "spl", "bpl", "r8b",  "r9b",  "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+
+    switch(size) {
+        case 1: return reg_8[reg];
+        case 2: return reg_16[reg];
+        case 4: return reg_32[reg];
+        case 8: return reg_64[reg];
+        default: return reg_64[reg];
+    }
+}
+
+const char *get_size_spec(int size) {
+    switch(size) {
+        case 1: return "byte";
+        case 2: return "word";
+        case 4: return "dword";
+        case 8: return "qword";
+        default: return "dword";
+    }
+}
+
+// name and length, so printing never calls strlen or a format parser
+typedef struct x64_name {
+    const char *text;
+    size_t len;
+} x64_name_t;
+
+#define NAME(s) {s, sizeof(s) - 1}
+
+static const x64_name_t mnemonics[] = {
+    [X64_MOV] = NAME("    mov"),
+    [X64_ADD] = NAME("    add"),
+    [X64_SUB] = NAME("    sub"),
+    [X64_IMUL] = NAME("    imul"),
+    [X64_LEA] = NAME("    lea"),
+    [X64_INC] = NAME("    inc"),
+    [X64_PUSH] = NAME("    push"),
+    [X64_POP] = NAME("    pop"),
+    [X64_CALL] = NAME("    call"),
+    [X64_JMP] = NAME("    jmp"),
+    [X64_LEAVE] = NAME("    leave"),
+    [X64_RET] = NAME("    ret"),
+    [X64_SYSCALL] = NAME("    syscall"),
+};
+
+// register names per size, [0] = 8 bit ... [3] = 64 bit
+static const x64_name_t reg_names[4][REG_R15 + 1] = {
+    {
+        NAME("al"), NAME("bl"), NAME("cl"), NAME("dl"), NAME("sil"), NAME("dil"), NAME("spl"), NAME("bpl"),
+        NAME("r8b"), NAME("r9b"), NAME("r10b"), NAME("r11b"), NAME("r12b"), NAME("r13b"), NAME("r14b"), NAME("r15b"),
+    },
+    {
+        NAME("ax"), NAME("bx"), NAME("cx"), NAME("dx"), NAME("si"), NAME("di"), NAME("sp"), NAME("bp"),
+        NAME("r8w"), NAME("r9w"), NAME("r10w"), NAME("r11w"), NAME("r12w"), NAME("r13w"), NAME("r14w"), NAME("r15w"),
+    },
+    {
+        NAME("eax"), NAME("ebx"), NAME("ecx"), NAME("edx"), NAME("esi"), NAME("edi"), NAME("esp"), NAME("ebp"),
+        NAME("r8d"), NAME("r9d"), NAME("r10d"), NAME("r11d"), NAME("r12d"), NAME("r13d"), NAME("r14d"), NAME("r15d"),
+    },
+    {
+        NAME("rax"), NAME("rbx"), NAME("rcx"), NAME("rdx"), NAME("rsi"), NAME("rdi"), NAME("rsp"), NAME("rbp"),
+        NAME("r8"), NAME("r9"), NAME("r10"), NAME("r11"), NAME("r12"), NAME("r13"), NAME("r14"), NAME("r15"),
+    },
+};
+
+// "byte [", "word [", ...
+static const x64_name_t mem_prefix[] = {
+    NAME("byte ["), NAME("word ["), NAME("dword ["), NAME("qword ["),
+};
+
+static inline int size_index(int size) {
+    switch(size) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        default: return 3;
+    }
+}
+
+// there is no 8 bit two operand imul, the low byte of the 32 bit one is the same
+static inline int x64_op_size(x64_inst_t *inst, int size) {
+    return (inst->op == X64_IMUL && size == 1) ? 4 : size;
+}
+
+static inline void write_name(asm_writer_t *w, const x64_name_t *name) {
+    asm_write(w, name->text, name->len);
+}
+
+static void x64_print_operand(asm_writer_t *w, x64_inst_t *inst, x64_operand_t *op) {
+    switch(op->kind) {
+        case X64_REG:
+            write_name(w, &reg_names[size_index(x64_op_size(inst, op->size))][op->reg]);
+            break;
+        case X64_IMM:
+            asm_write_int(w, op->imm);
+            break;
+        case X64_MEM:
+            // unknown sizes print as dword, same as get_size_spec
+            if(inst->op == X64_LEA) asm_putc(w, '[');
+            else write_name(w, &mem_prefix[op->size == 8 ? 3 : op->size == 2 ? 1 : op->size == 1 ? 0 : 2]);
+            write_name(w, &reg_names[3][op->mem.base]);
+            if(op->mem.scale) {
+                asm_putc(w, '+');
+                write_name(w, &reg_names[3][op->mem.index]);
+                if(op->mem.scale > 1) {
+                    asm_putc(w, '*');
+                    asm_putc(w, '0' + op->mem.scale);
+                }
+            }
+            if(op->mem.disp != 0) {
+                if(op->mem.disp > 0) asm_putc(w, '+');
+                asm_write_int(w, op->mem.disp);
+            }
+            asm_putc(w, ']');
+            break;
+        case X64_SYM:
+            asm_write(w, op->sym, strlen(op->sym));
+            break;
+        case X64_RIP:
+            if(inst->op == X64_LEA) asm_putc(w, '[');
+            else write_name(w, &mem_prefix[size_index(op->size)]);
+            asm_puts(w, "rel ");
+            asm_write(w, op->rip.label, strlen(op->rip.label));
+            if(op->rip.disp != 0) {
+                if(op->rip.disp > 0) asm_putc(w, '+');
+                asm_write_int(w, op->rip.disp);
+            }
+            asm_putc(w, ']');
+            break;
+        default:
+            break;
+    }
+}
+
+void x64_print(asm_writer_t *w, x64_inst_t *inst) {
+    switch(inst->op) {
+        case X64_FUNC: {
+            // ELF type and size, the caller prints the ..@name.end label after the body
+            size_t len = strlen(inst->dst.sym);
+            if(inst->src.kind == X64_IMM && inst->src.imm) {
+                // nasm takes no type or size for a local symbol
+                asm_putc(w, '\n');
+                asm_write(w, inst->dst.sym, len);
+                asm_puts(w, ":\n");
+                return;
+            }
+            asm_puts(w, "\nglobal ");
+            asm_write(w, inst->dst.sym, len);
+            asm_puts(w, ":function (..@");
+            asm_write(w, inst->dst.sym, len);
+            asm_puts(w, ".end - ");
+            asm_write(w, inst->dst.sym, len);
+            asm_puts(w, ")\n");
+            asm_write(w, inst->dst.sym, len);
+            asm_puts(w, ":\n");
+            return;
+        }
+        case X64_LABEL:
+            asm_write(w, inst->dst.sym, strlen(inst->dst.sym));
+            asm_puts(w, ":\n");
+            return;
+        case X64_COMMENT:
+            asm_puts(w, "    ; ");
+            asm_write(w, inst->dst.sym, strlen(inst->dst.sym));
+            asm_putc(w, '\n');
+            return;
+        case X64_DELETED:
+        case X64_CFI: // NASM has no .cfi directives, see eh_frame.c
+            return;
+        default:
+            break;
+    }
+
+    write_name(w, &mnemonics[inst->op]);
+    if(inst->dst.kind != X64_NONE) {
+        asm_putc(w, ' ');
+        x64_print_operand(w, inst, &inst->dst);
+    }
+    if(inst->src.kind != X64_NONE) {
+        asm_puts(w, ", ");
+        x64_print_operand(w, inst, &inst->src);
+    }
+    if(inst->src2.kind != X64_NONE) {
+        asm_puts(w, ", ");
+        x64_print_operand(w, inst, &inst->src2);
+    }
+    asm_putc(w, '\n');
+}
+
+// Encoding
+
+static const uint8_t hw_reg[] = {
+    [REG_RAX] = 0, [REG_RCX] = 1, [REG_RDX] = 2, [REG_RBX] = 3,
+    [REG_RSP] = 4, [REG_RBP] = 5, [REG_RSI] = 6, [REG_RDI] = 7,
+    [REG_R8] = 8, [REG_R9] = 9, [REG_10] = 10, [REG_11] = 11,
+    [REG_R12] = 12, [REG_R13] = 13, [REG_R14] = 14, [REG_R15] = 15,
+};
+
+static void emit_byte(x64_code_t *code, uint8_t byte) {
+    if(code->len == code->cap) {
+        code->cap = code->cap ? code->cap * 2 : 4096;
+        code->data = mem_realloc(code->data, code->cap);
+    }
+    code->data[code->len++] = byte;
+}
+
+static void emit_imm(x64_code_t *code, int64_t value, int size) {
+    for(int i = 0; i < size; i++) {
+        emit_byte(code, (value >> (8 * i)) & 0xff);
+    }
+}
+
+static inline int fits_i8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static inline int fits_i32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// spl, bpl, sil and dil only exist with a REX prefix
+static inline int needs_rex_byte(x64_operand_t *op) {
+    return op->kind == X64_REG && op->size == 1 && hw_reg[op->reg] >= 4 && hw_reg[op->reg] < 8;
+}
+
+// [66] [REX] opcode modrm [sib] [disp] for an r/m operand, `reg` is a register or /digit
+static void emit_rm(x64_code_t *code, const uint8_t *opcode, int opcode_len, int size,
+                    int reg, int force_rex, x64_operand_t *rm) {
+    int base = rm->kind == X64_REG ? hw_reg[rm->reg] : rm->kind == X64_MEM ? hw_reg[rm->mem.base] : 0;
+    int scaled = rm->kind == X64_MEM && rm->mem.scale;
+    int index = scaled ? hw_reg[rm->mem.index] : 0;
+    uint8_t rex = 0x40;
+    if(size == 8) rex |= 0x08;
+    if(reg >= 8) rex |= 0x04;
+    if(index >= 8) rex |= 0x02;
+    if(base >= 8) rex |= 0x01;
+    if(needs_rex_byte(rm)) force_rex = 1;
+
+    if(size == 2) emit_byte(code, 0x66);
+    if(rex != 0x40 || force_rex) emit_byte(code, rex);
+    for(int i = 0; i < opcode_len; i++) emit_byte(code, opcode[i]);
+
+    if(rm->kind == X64_REG) {
+        emit_byte(code, 0xC0 | (reg & 7) << 3 | (base & 7));
+        return;
+    }
+
+    if(rm->kind == X64_RIP) {
+        emit_byte(code, (reg & 7) << 3 | 5);
+        if(code->data_ref_count == code->data_ref_cap) {
+            code->data_ref_cap = code->data_ref_cap ? code->data_ref_cap * 2 : 64;
+            code->data_refs = mem_realloc(code->data_refs, sizeof(x64_data_ref_t) * code->data_ref_cap);
+        }
+        code->data_refs[code->data_ref_count++] = (x64_data_ref_t) {code->len, rm->rip.disp};
+        emit_imm(code, 0, 4);
+        return;
+    }
+
+    int32_t disp = rm->mem.disp;
+    int mod = 2;
+    if(disp == 0 && (base & 7) != 5) mod = 0;
+    else if(fits_i8(disp)) mod = 1;
+
+    if(scaled) {
+        static const uint8_t scale_bits[] = {[1] = 0, [2] = 1, [4] = 2, [8] = 3};
+        emit_byte(code, mod << 6 | (reg & 7) << 3 | 4);
+        emit_byte(code, scale_bits[rm->mem.scale] << 6 | (index & 7) << 3 | (base & 7));
+    }
+    else {
+        emit_byte(code, mod << 6 | (reg & 7) << 3 | (base & 7));
+        if((base & 7) == 4) emit_byte(code, 0x24); // rsp/r12 base needs a SIB
+    }
+    if(mod == 1) emit_imm(code, disp, 1);
+    if(mod == 2) emit_imm(code, disp, 4);
+}
+
+static void add_fixup(x64_code_t *code, const char *target) {
+    if(code->fixup_count == code->fixup_cap) {
+        code->fixup_cap = code->fixup_cap ? code->fixup_cap * 2 : 64;
+        code->fixups = mem_realloc(code->fixups, sizeof(x64_label_t) * code->fixup_cap);
+    }
+    code->fixups[code->fixup_count++] = (x64_label_t) {mem_strdup(target), code->len};
+}
+
+static void add_label(x64_code_t *code, const char *name) {
+    if(code->label_count == code->label_cap) {
+        code->label_cap = code->label_cap ? code->label_cap * 2 : 64;
+        code->labels = mem_realloc(code->labels, sizeof(x64_label_t) * code->label_cap);
+    }
+    code->labels[code->label_count++] = (x64_label_t) {mem_strdup(name), code->len};
+}
+
+static void close_symbol(x64_code_t *code) {
+    if(code->symbol_count > 0) {
+        x64_symbol_t *last = &code->symbols[code->symbol_count - 1];
+        last->size = code->len - last->offset;
+    }
+}
+
+static void add_symbol(x64_code_t *code, const char *name, int local) {
+    close_symbol(code);
+    if(code->symbol_count == code->symbol_cap) {
+        code->symbol_cap = code->symbol_cap ? code->symbol_cap * 2 : 16;
+        code->symbols = mem_realloc(code->symbols, sizeof(x64_symbol_t) * code->symbol_cap);
+    }
+    code->symbols[code->symbol_count++] = (x64_symbol_t) {mem_strdup(name), code->len, 0, local};
+}
+
+static void encode_mov(x64_code_t *code, x64_inst_t *inst) {
+    x64_operand_t *dst = &inst->dst;
+    x64_operand_t *src = &inst->src;
+    int size = dst->size;
+
+    if(src->kind == X64_IMM) {
+        if(dst->kind == X64_REG && (size == 4 || size == 2 || size == 1 || !fits_i32(src->imm))) {
+            // mov r, imm (B0+r / B8+r)
+            int r = hw_reg[dst->reg];
+            uint8_t rex = 0x40 | (size == 8 ? 0x08 : 0) | (r >= 8 ? 0x01 : 0);
+            if(size == 2) emit_byte(code, 0x66);
+            if(rex != 0x40 || needs_rex_byte(dst)) emit_byte(code, rex);
+            emit_byte(code, (size == 1 ? 0xB0 : 0xB8) + (r & 7));
+            emit_imm(code, src->imm, size);
+            return;
+        }
+        // mov r/m, imm32 (sign extended for qwords)
+        uint8_t opcode = size == 1 ? 0xC6 : 0xC7;
+        emit_rm(code, &opcode, 1, size, 0, 0, dst);
+        emit_imm(code, src->imm, size == 8 ? 4 : size);
+        return;
+    }
+
+    if(dst->kind == X64_REG && (src->kind == X64_MEM || src->kind == X64_RIP)) {
+        uint8_t opcode = size == 1 ? 0x8A : 0x8B;
+        emit_rm(code, &opcode, 1, size, hw_reg[dst->reg], needs_rex_byte(dst), src);
+        return;
+    }
+
+    // mov r/m, r
+    uint8_t opcode = size == 1 ? 0x88 : 0x89;
+    emit_rm(code, &opcode, 1, size, hw_reg[src->reg], needs_rex_byte(src), dst);
+}
+
+static void encode_alu(x64_code_t *code, x64_inst_t *inst, uint8_t base_opcode, int digit) {
+    x64_operand_t *dst = &inst->dst;
+    x64_operand_t *src = &inst->src;
+    int size = dst->size;
+
+    if(src->kind == X64_IMM) {
+        uint8_t opcode = 0x81;
+        if(size == 1) opcode = 0x80;
+        else if(fits_i8(src->imm)) opcode = 0x83;
+
+        emit_rm(code, &opcode, 1, size, digit, 0, dst);
+        if(opcode == 0x81) emit_imm(code, src->imm, size == 8 ? 4 : size);
+        else emit_imm(code, src->imm, 1);
+        return;
+    }
+
+    if(dst->kind == X64_REG && src->kind == X64_MEM) {
+        uint8_t opcode = base_opcode + (size == 1 ? 2 : 3);
+        emit_rm(code, &opcode, 1, size, hw_reg[dst->reg], needs_rex_byte(dst), src);
+        return;
+    }
+
+    uint8_t opcode = base_opcode + (size == 1 ? 0 : 1);
+    emit_rm(code, &opcode, 1, size, hw_reg[src->reg], needs_rex_byte(src), dst);
+}
+
+static void encode_imul(x64_code_t *code, x64_inst_t *inst) {
+    int size = x64_op_size(inst, inst->dst.size);
+    x64_operand_t src = inst->src;
+    src.size = size;
+
+    if(src.kind == X64_IMM || inst->src2.kind == X64_IMM) {
+        // imul r, r/m, imm, the two operand form is imul r, r, imm
+        int64_t imm = inst->src2.kind == X64_IMM ? inst->src2.imm : src.imm;
+        x64_operand_t rm = inst->src2.kind == X64_IMM ? src : inst->dst;
+        rm.size = size;
+        uint8_t opcode = fits_i8(imm) ? 0x6B : 0x69;
+        emit_rm(code, &opcode, 1, size, hw_reg[inst->dst.reg], 0, &rm);
+        emit_imm(code, imm, opcode == 0x6B ? 1 : (size == 8 ? 4 : size));
+        return;
+    }
+
+    static const uint8_t opcode[] = {0x0F, 0xAF};
+    emit_rm(code, opcode, 2, size, hw_reg[inst->dst.reg], 0, &src);
+}
+
+static void encode_branch(x64_code_t *code, uint8_t opcode, const char *target) {
+    emit_byte(code, opcode);
+    add_fixup(code, target);
+    emit_imm(code, 0, 4);
+}
+
+static void add_line(x64_code_t *code, x64_inst_t *inst) {
+    if(code->line_count > 0) {
+        x64_line_t *last = &code->lines[code->line_count - 1];
+        if(last->line == inst->line && last->column == inst->column) return;
+        if(last->offset == code->len) {
+            // nothing was encoded for the previous position
+            last->line = inst->line;
+            last->column = inst->column;
+            return;
+        }
+    }
+    if(code->line_count == code->line_cap) {
+        code->line_cap = code->line_cap ? code->line_cap * 2 : 256;
+        code->lines = mem_realloc(code->lines, sizeof(x64_line_t) * code->line_cap);
+    }
+    code->lines[code->line_count++] = (x64_line_t) {code->len, inst->line, inst->column};
+}
+
+void x64_encode(x64_code_t *code, x64_inst_t *inst) {
+    if(code->debug_lines && inst->line > 0 && inst->op < X64_FUNC) add_line(code, inst);
+
+    switch(inst->op) {
+        case X64_MOV:
+            encode_mov(code, inst);
+            break;
+
+        case X64_ADD:
+            encode_alu(code, inst, 0x00, 0);
+            break;
+
+        case X64_SUB:
+            encode_alu(code, inst, 0x28, 5);
+            break;
+
+        case X64_IMUL:
+            encode_imul(code, inst);
+            break;
+
+        case X64_LEA: {
+            static const uint8_t opcode = 0x8D;
+            emit_rm(code, &opcode, 1, inst->dst.size, hw_reg[inst->dst.reg], 0, &inst->src);
+            break;
+        }
+
+        case X64_INC: {
+            uint8_t opcode = inst->dst.size == 1 ? 0xFE : 0xFF;
+            emit_rm(code, &opcode, 1, inst->dst.size, 0, 0, &inst->dst);
+            break;
+        }
+
+        case X64_PUSH:
+        case X64_POP: {
+            int r = hw_reg[inst->dst.reg];
+            if(r >= 8) emit_byte(code, 0x41);
+            emit_byte(code, (inst->op == X64_PUSH ? 0x50 : 0x58) + (r & 7));
+            break;
+        }
+
+        case X64_CALL:
+            encode_branch(code, 0xE8, inst->dst.sym);
+            break;
+
+        case X64_JMP:
+            encode_branch(code, 0xE9, inst->dst.sym);
+            break;
+
+        case X64_LEAVE:
+            emit_byte(code, 0xC9);
+            break;
+
+        case X64_RET:
+            emit_byte(code, 0xC3);
+            break;
+
+        case X64_SYSCALL:
+            emit_byte(code, 0x0F);
+            emit_byte(code, 0x05);
+            break;
+
+        case X64_FUNC:
+            add_symbol(code, inst->dst.sym, inst->src.kind == X64_IMM && inst->src.imm);
+            add_label(code, inst->dst.sym);
+            break;
+
+        case X64_LABEL:
+            add_label(code, inst->dst.sym);
+            break;
+
+        case X64_CFI:
+            if(code->cfi_count == code->cfi_cap) {
+                code->cfi_cap = code->cfi_cap ? code->cfi_cap * 2 : 64;
+                code->cfi = mem_realloc(code->cfi, sizeof(x64_cfi_t) * code->cfi_cap);
+            }
+            code->cfi[code->cfi_count++] = (x64_cfi_t) {
+                code->len, (x64_cfi_op_t) inst->dst.imm, inst->src.mem.base, inst->src.mem.disp
+            };
+            break;
+
+        case X64_COMMENT:
+        case X64_DELETED:
+            break;
+    }
+}
+
+int x64_find_label(x64_code_t *code, const char *name, size_t *offset) {
+    for(size_t i = 0; i < code->label_count; i++) {
+        if(strcmp(code->labels[i].name, name) == 0) {
+            *offset = code->labels[i].offset;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static size_t label_hash(const char *name) {
+    size_t h = 14695981039346656037ull;
+    for(; *name; name++) h = (h ^ (unsigned char) *name) * 1099511628211ull;
+    return h;
+}
+
+size_t x64_resolve(x64_code_t *code) {
+    close_symbol(code);
+
+    // hashed, a whole program has as many labels as it has calls; the first
+    // of two equal names wins, as with x64_find_label
+    size_t cap = 16;
+    while(cap < code->label_count * 2) cap *= 2;
+    uint32_t *slots = mem_calloc(cap, sizeof(uint32_t));
+    for(size_t i = 0; i < code->label_count; i++) {
+        size_t s = label_hash(code->labels[i].name) & (cap - 1);
+        while(slots[s] && strcmp(code->labels[slots[s] - 1].name, code->labels[i].name) != 0) s = (s + 1) & (cap - 1);
+        if(!slots[s]) slots[s] = (uint32_t) i + 1;
+    }
+
+    size_t unresolved = 0;
+    for(size_t i = 0; i < code->fixup_count; i++) {
+        x64_label_t *fixup = &code->fixups[i];
+        size_t s = label_hash(fixup->name) & (cap - 1);
+        while(slots[s] && strcmp(code->labels[slots[s] - 1].name, fixup->name) != 0) s = (s + 1) & (cap - 1);
+        size_t target = slots[s] ? code->labels[slots[s] - 1].offset : 0;
+        if(slots[s] && code->cold && (target >= code->cold) != (fixup->offset >= code->cold)) {
+            if(code->cross_count == code->cross_cap) {
+                code->cross_cap = code->cross_cap ? code->cross_cap * 2 : 16;
+                code->cross = mem_realloc(code->cross, sizeof(x64_data_ref_t) * code->cross_cap);
+            }
+            code->cross[code->cross_count++] = (x64_data_ref_t) {fixup->offset, (int32_t) target};
+            mem_free(fixup->name);
+        }
+        else if(slots[s]) {
+            int64_t rel = (int64_t) target - (int64_t) (fixup->offset + 4);
+            memcpy(code->data + fixup->offset, &(int32_t) {(int32_t) rel}, 4);
+            mem_free(fixup->name);
+        }
+        else {
+            code->fixups[unresolved++] = *fixup;
+        }
+    }
+    code->fixup_count = unresolved;
+    mem_free(slots);
+
+    return unresolved;
+}
+
+#define APPEND(field, count, cap) do { \
+        if(dst->count + src->count > dst->cap) { \
+            dst->cap = dst->count + src->count; \
+            dst->field = mem_realloc(dst->field, sizeof(*dst->field) * dst->cap); \
+        } \
+        if(src->count) memcpy(dst->field + dst->count, src->field, sizeof(*dst->field) * src->count); \
+    } while(0)
+
+void x64_code_append(x64_code_t *dst, x64_code_t *src) {
+    close_symbol(src);
+    size_t base = dst->len;
+    size_t rw_base = dst->rw_len;
+
+    APPEND(symbols, symbol_count, symbol_cap);
+    for(size_t i = 0; i < src->symbol_count; i++) dst->symbols[dst->symbol_count + i].offset += base;
+    dst->symbol_count += src->symbol_count;
+
+    APPEND(labels, label_count, label_cap);
+    for(size_t i = 0; i < src->label_count; i++) dst->labels[dst->label_count + i].offset += base;
+    dst->label_count += src->label_count;
+
+    APPEND(fixups, fixup_count, fixup_cap);
+    for(size_t i = 0; i < src->fixup_count; i++) dst->fixups[dst->fixup_count + i].offset += base;
+    dst->fixup_count += src->fixup_count;
+
+    APPEND(cfi, cfi_count, cfi_cap);
+    for(size_t i = 0; i < src->cfi_count; i++) dst->cfi[dst->cfi_count + i].offset += base;
+    dst->cfi_count += src->cfi_count;
+
+    APPEND(lines, line_count, line_cap);
+    for(size_t i = 0; i < src->line_count; i++) dst->lines[dst->line_count + i].offset += base;
+    dst->line_count += src->line_count;
+
+    APPEND(data_refs, data_ref_count, data_ref_cap);
+    for(size_t i = 0; i < src->data_ref_count; i++) {
+        dst->data_refs[dst->data_ref_count + i].offset += base;
+        dst->data_refs[dst->data_ref_count + i].target += (int32_t) rw_base;
+    }
+    dst->data_ref_count += src->data_ref_count;
+
+    APPEND(data, len, cap);
+    dst->len += src->len;
+    if(src->rw_len) {
+        dst->rw = mem_realloc(dst->rw, dst->rw_len + src->rw_len);
+        memcpy(dst->rw + dst->rw_len, src->rw, src->rw_len);
+        dst->rw_len += src->rw_len;
+    }
+    if(!dst->fini) dst->fini = src->fini;
+    if(!dst->cold && src->cold) dst->cold = base + src->cold;
+    dst->debug_lines |= src->debug_lines;
+
+    // the names moved over with the records
+    src->symbol_count = src->label_count = src->fixup_count = 0;
+    x64_code_free(src);
+}
+#undef APPEND
+
+void x64_code_free(x64_code_t *code) {
+    for(size_t i = 0; i < code->symbol_count; i++) mem_free(code->symbols[i].name);
+    for(size_t i = 0; i < code->label_count; i++) mem_free(code->labels[i].name);
+    for(size_t i = 0; i < code->fixup_count; i++) mem_free(code->fixups[i].name);
+    mem_free(code->symbols);
+    mem_free(code->labels);
+    mem_free(code->fixups);
+    mem_free(code->cfi);
+    mem_free(code->lines);
+    mem_free(code->rw);
+    mem_free(code->data_refs);
+    mem_free(code->cross);
+    mem_free(code->data);
+    memset(code, 0, sizeof(x64_code_t));
+}
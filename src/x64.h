@@ -0,0 +1,232 @@
+#ifndef _X64_H
+#define _X64_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "asm_writer.h"
+
+typedef enum {
+    REG_RAX, // return value, arithmetic
+    REG_RBX, // preserved
+    REG_RCX, // arg 4
+    REG_RDX, // arg 3
+    REG_RSI, // arg 2
+    REG_RDI, // arg 1
+    REG_RSP, // stack pointer
+    REG_RBP, // base pointer (stack frame)
+    REG_R8,  // arg 5
+    REG_R9,  // arg 6
+    REG_10,  // temp
+    REG_11,  // temp
+    REG_R12, // preserved
+    REG_R13, // preserved
+    REG_R14, // preserved
+    REG_R15, // preserved
+} x64_registers_t;
+
+typedef enum {
+    X64_MOV,
+    X64_ADD,
+    X64_SUB,
+    X64_IMUL,
+    X64_LEA,
+    X64_INC,
+    X64_PUSH,
+    X64_POP,
+    X64_CALL,
+    X64_JMP,
+    X64_LEAVE,
+    X64_RET,
+    X64_SYSCALL,
+
+    // pseudo instructions
+    X64_FUNC,    // global name + name:, src.imm is 1 for a static one
+    X64_LABEL,   // name:
+    X64_COMMENT,
+    X64_DELETED, // removed by the peephole pass
+    X64_CFI,     // unwind rule change at this point, dst.imm is the x64_cfi_op_t
+} x64_opcode_t;
+
+// Call frame information, written to .eh_frame. Offsets are relative to the
+// CFA (rsp before the call pushed the return address), like .cfi_offset.
+typedef enum {
+    CFI_DEF_CFA,          // cfa = reg + value
+    CFI_DEF_CFA_OFFSET,   // cfa = (same register) + value
+    CFI_DEF_CFA_REGISTER, // cfa = reg + (same offset)
+    CFI_OFFSET,           // reg saved at cfa + value
+    CFI_RESTORE,          // reg holds the caller's value again
+    CFI_REMEMBER_STATE,
+    CFI_RESTORE_STATE,
+} x64_cfi_op_t;
+
+// where an instruction belongs, frame lowering moves and rewrites the frame ones
+typedef enum {
+    X64_BODY,
+    X64_PROLOGUE,
+    X64_EPILOGUE,
+} x64_frame_part_t;
+
+typedef enum {
+    X64_NONE,
+    X64_REG,
+    X64_IMM,
+    X64_MEM,
+    X64_SYM,
+    X64_RIP, // [rel label+disp], label is in .data
+} x64_operand_kind_t;
+
+typedef struct x64_operand {
+    x64_operand_kind_t kind;
+    int size; // bytes
+    union {
+        x64_registers_t reg;
+        int64_t imm;
+        struct {
+            x64_registers_t base;
+            x64_registers_t index; // only with scale != 0
+            int scale;             // 0, 1, 2, 4 or 8
+            int32_t disp;
+        } mem;
+        const char *sym;
+        struct {
+            const char *label;
+            int32_t disp; // offset into x64_code_t.rw when encoding
+        } rip;
+    };
+} x64_operand_t;
+
+typedef struct x64_inst {
+    x64_opcode_t op;
+    x64_operand_t dst;
+    x64_operand_t src;
+    x64_frame_part_t part;
+    x64_operand_t src2; // imm of `imul r, r/m, imm`, X64_NONE otherwise
+    int32_t line; // source position the instruction came from, 0 if none
+    int32_t column;
+} x64_inst_t;
+
+static inline x64_operand_t x64_reg(x64_registers_t reg, int size) {
+    return (x64_operand_t) {.kind = X64_REG, .size = size, .reg = reg};
+}
+
+static inline x64_operand_t x64_imm(int64_t value, int size) {
+    return (x64_operand_t) {.kind = X64_IMM, .size = size, .imm = value};
+}
+
+static inline x64_operand_t x64_mem(x64_registers_t base, int32_t disp, int size) {
+    return (x64_operand_t) {.kind = X64_MEM, .size = size, .mem = {.base = base, .disp = disp}};
+}
+
+// [base + index*scale + disp], only lea uses these
+static inline x64_operand_t x64_addr(x64_registers_t base, x64_registers_t index, int scale, int32_t disp, int size) {
+    return (x64_operand_t) {.kind = X64_MEM, .size = size, .mem = {base, index, scale, disp}};
+}
+
+// rip-relative data, nothing may follow the displacement in the encoding
+static inline x64_operand_t x64_rip(const char *label, int32_t disp, int size) {
+    return (x64_operand_t) {.kind = X64_RIP, .size = size, .rip = {label, disp}};
+}
+
+static inline x64_operand_t x64_sym(const char *name) {
+    return (x64_operand_t) {.kind = X64_SYM, .size = 8, .sym = name};
+}
+
+// X64_CFI operands: the op in dst, register and value in src as if it were [reg+value]
+static inline x64_inst_t x64_cfi(x64_cfi_op_t op, x64_registers_t reg, int32_t value) {
+    return (x64_inst_t) {.op = X64_CFI, .dst = x64_imm(op, 8), .src = x64_mem(reg, value, 8), .part = X64_BODY};
+}
+
+// Machine code produced by x64_encode.
+// Calls and jumps are rel32 fixups against labels, x64_resolve patches the ones
+// defined in the buffer and leaves the rest (external symbols) in `fixups`.
+// Calls between .text and .text.unlikely can't be patched, the linker places
+// the two apart.
+typedef struct x64_label {
+    char *name;
+    size_t offset;
+} x64_label_t;
+
+typedef struct x64_symbol {
+    char *name;
+    size_t offset;
+    size_t size;
+    int local; // static, no STB_GLOBAL
+} x64_symbol_t;
+
+typedef struct x64_cfi {
+    size_t offset; // code offset, or label number when printing NASM
+    x64_cfi_op_t op;
+    x64_registers_t reg;
+    int32_t value;
+} x64_cfi_t;
+
+// a row of the line table, code from `offset` on belongs to line:column
+typedef struct x64_line {
+    size_t offset;
+    int32_t line;
+    int32_t column;
+} x64_line_t;
+
+typedef struct x64_data_ref {
+    size_t offset;
+    int32_t target;
+} x64_data_ref_t;
+
+typedef struct x64_code {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+
+    x64_symbol_t *symbols; // functions
+    size_t symbol_count;
+    size_t symbol_cap;
+
+    x64_label_t *labels;
+    size_t label_count;
+    size_t label_cap;
+
+    x64_label_t *fixups; // offset of the rel32 field, target name
+    size_t fixup_count;
+    size_t fixup_cap;
+
+    x64_cfi_t *cfi; // in code order
+    size_t cfi_count;
+    size_t cfi_cap;
+
+    // .data, X64_RIP operands are rel32 fields at data_refs[i].offset that
+    // point at rw + data_refs[i].target
+    uint8_t *rw;
+    size_t rw_len;
+    x64_data_ref_t *data_refs;
+    size_t data_ref_count;
+    size_t data_ref_cap;
+    const char *fini; // label of a function for .fini_array, NULL if none
+    // functions from here on go into .text.unlikely, 0 if none do; calls
+    // across are moved to `cross` (rel32 field, target code offset) for the
+    // object writer to relocate
+    size_t cold;
+    x64_data_ref_t *cross;
+    size_t cross_count;
+    size_t cross_cap;
+
+    int debug_lines; // record `lines` while encoding
+    x64_line_t *lines; // in code order
+    size_t line_count;
+    size_t line_cap;
+} x64_code_t;
+
+const char *get_register(x64_registers_t reg, int size);
+const char *get_size_spec(int size);
+
+void x64_print(asm_writer_t *w, x64_inst_t *inst);
+void x64_encode(x64_code_t *code, x64_inst_t *inst);
+int x64_find_label(x64_code_t *code, const char *name, size_t *offset);
+size_t x64_resolve(x64_code_t *code);
+// moves everything of `src` to the end of `dst`, offsets and all, and leaves
+// `src` empty; calls between the two are resolved by x64_resolve later
+void x64_code_append(x64_code_t *dst, x64_code_t *src);
+void x64_code_free(x64_code_t *code);
+
+#endif
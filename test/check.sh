@@ -0,0 +1,232 @@
+#!/bin/sh
+# make check: every program in test/ built every way divc can build it.
+# A program's first line says what main returns, `// expect: N`; the native
+# binary under each code generation flag, --run and --jit all have to agree
+# with it. Then what an exit status doesn't show: unwind and line tables,
+# profiles, corrupt IR, static functions, modules, -flto, -j, the cache,
+# the compile server and the language server. The files in test/errors
+# have to fail, with as many errors as their first line says,
+# `// errors: N`. Last, the runtime kernels are checked against gcc.
+# usage: check.sh    DIVC=./divc CC=gcc
+
+DIVC=${DIVC:-./divc}
+CC=${CC:-gcc}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d) || exit 1
+SERVER=
+trap 'rm -rf "$TMP"; [ -n "$SERVER" ] && kill $SERVER 2> /dev/null' EXIT
+
+status=0
+fail() {
+    echo "FAIL: $*"
+    status=1
+}
+
+# readelf complains about .eh_frame and .debug_line it can't follow
+check_tables() {
+    command -v readelf > /dev/null || return 0
+    if readelf --debug-dump=frames,rawline "$1" 2>&1 | grep -qi 'warning\|error'; then
+        fail "$2: readelf doesn't accept the unwind or line tables"
+    fi
+}
+
+# builds $1 into an object with the rest of the arguments, links and runs it
+run_native() {
+    source=$1
+    shift
+    rm -f "$TMP/p.o" "$TMP/p"
+    "$DIVC" "$@" "$source" -o "$TMP/p.o" || return 255
+    check_tables "$TMP/p.o" "$source [$*]"
+    "$CC" "$TMP/p.o" -o "$TMP/p" || return 255
+    "$TMP/p" > /dev/null
+}
+
+expected() {
+    sed -n "1s|^// $2: ||p" "$1"
+}
+
+for source in "$DIR"/test.dc "$DIR"/programs/*.dc; do
+    want=$(expected "$source" expect)
+
+    "$DIVC" --run "$source" > /dev/null
+    got=$?
+    [ $got = "$want" ] || fail "$source: --run returned $got, expected $want"
+    "$DIVC" --jit "$source" > /dev/null
+    got=$?
+    [ $got = "$want" ] || fail "$source: --jit returned $got, expected $want"
+
+    for flags in "" -fno-regalloc -fno-peephole "-fno-regalloc -fno-peephole" -fomit-frame-pointer \
+        -mno-omit-leaf-frame-pointer -fno-shrink-wrap -fstack-reuse=none -g "-g -fomit-frame-pointer" \
+        -fpipeline -flto -fwhole-program -fkeep-static-functions; do
+        run_native "$source" $flags
+        got=$?
+        [ $got = "$want" ] || fail "$source [$flags]: returned $got, expected $want"
+    done
+
+    # the NASM output, when there's a nasm to take it
+    if command -v nasm > /dev/null; then
+        "$DIVC" -S -g "$source" -o "$TMP/p.s" && nasm -f elf64 -g -F dwarf "$TMP/p.s" -o "$TMP/p.o" \
+            && "$CC" "$TMP/p.o" -o "$TMP/p" && "$TMP/p" > /dev/null
+        got=$?
+        [ $got = "$want" ] || fail "$source [-S]: returned $got, expected $want"
+    fi
+
+    # the binary IR, read back in place of the source
+    "$DIVC" --emit-ir "$source" -o "$TMP/p.ir" && "$DIVC" --run "$TMP/p.ir" > /dev/null
+    got=$?
+    [ $got = "$want" ] || fail "$source [--emit-ir]: returned $got, expected $want"
+
+    # a profile of the instrumented run lays out the next build
+    rm -f "$TMP/p.prof"
+    run_native "$source" -fprofile-generate="$TMP/p.prof"
+    got=$?
+    [ $got = "$want" ] || fail "$source [-fprofile-generate]: returned $got, expected $want"
+    [ -s "$TMP/p.prof" ] || fail "$source: -fprofile-generate wrote no profile"
+    run_native "$source" -fprofile-use="$TMP/p.prof"
+    got=$?
+    [ $got = "$want" ] || fail "$source [-fprofile-use]: returned $got, expected $want"
+done
+
+# a truncated or corrupt .ir is turned away with a diagnostic, and no byte
+# of one crashes the compiler
+"$DIVC" --emit-ir "$DIR"/programs/args.dc -o "$TMP/p.ir" || fail "args.dc: no IR"
+size=$(wc -c < "$TMP/p.ir")
+head -c $((size / 2)) "$TMP/p.ir" > "$TMP/bad.ir"
+"$DIVC" "$TMP/bad.ir" -o "$TMP/bad.o" 2> "$TMP/bad.err" && fail "a truncated .ir compiled"
+grep -q "IR error" "$TMP/bad.err" || fail "a truncated .ir gave no diagnostic"
+# the first instruction's opcode, the table's offset is at 64 in the header
+opcode=$(od -An -t u8 -j 64 -N 8 "$TMP/p.ir" | tr -d ' ')
+cp "$TMP/p.ir" "$TMP/bad.ir"
+printf '\377' | dd of="$TMP/bad.ir" bs=1 seek="$opcode" conv=notrunc 2> /dev/null
+"$DIVC" "$TMP/bad.ir" -o "$TMP/bad.o" 2> "$TMP/bad.err" && fail "a .ir with a bad opcode compiled"
+grep -q "IR error" "$TMP/bad.err" || fail "a .ir with a bad opcode gave no diagnostic"
+offset=0
+while [ $offset -lt "$size" ]; do
+    cp "$TMP/p.ir" "$TMP/bad.ir"
+    printf '\377' | dd of="$TMP/bad.ir" bs=1 seek=$offset conv=notrunc 2> /dev/null
+    # --run exits with whatever the program returns, only signals count
+    for flags in "" --run; do
+        "$DIVC" $flags "$TMP/bad.ir" -o "$TMP/bad.o" > /dev/null 2>&1
+        case $? in
+            134|135|136|139) fail "a .ir with byte $offset set to 0xff crashed [$flags]" ;;
+        esac
+    done
+    offset=$((offset + 2))
+done
+
+# a static function nothing calls is dropped, one that's called is local
+"$DIVC" "$DIR"/programs/static.dc -o "$TMP/s.o" || fail "static.dc doesn't compile"
+nm "$TMP/s.o" | grep -qw unused && fail "static.dc: the unused static function is still there"
+nm "$TMP/s.o" | grep -q ' t helper$' || fail "static.dc: helper isn't a local symbol"
+"$DIVC" -fkeep-static-functions "$DIR"/programs/static.dc -o "$TMP/s.o"
+nm "$TMP/s.o" | grep -qw unused || fail "static.dc: -fkeep-static-functions dropped a function"
+
+# -fprofile-use: what never ran goes into .text.unlikely, and only the hot
+# call site inlines a callee past the default limit
+source="$DIR"/programs/profile.dc
+rm -f "$TMP/p.prof"
+run_native "$source" -fprofile-generate="$TMP/p.prof"
+[ -s "$TMP/p.prof" ] || fail "profile.dc: the instrumented build wrote no profile"
+"$DIVC" -fprofile-use="$TMP/p.prof" "$source" -o "$TMP/u.o" || fail "profile.dc: -fprofile-use failed"
+objdump -t "$TMP/u.o" | grep -q '\.text\.unlikely.* cold$' || fail "profile.dc: cold isn't in .text.unlikely"
+objdump -t "$TMP/u.o" | grep -q '\.text	.* big$' || fail "profile.dc: big isn't in .text"
+"$DIVC" -flto --ipa-stats "$source" -o "$TMP/u.o" 2>&1 | grep -q ' 0 calls inlined' \
+    || fail "profile.dc: big is inlined without a profile"
+"$DIVC" -flto --ipa-stats -fprofile-use="$TMP/p.prof" "$source" -o "$TMP/u.o" 2>&1 | grep -q ' 1 calls inlined' \
+    || fail "profile.dc: -fprofile-use didn't inline the hot call alone"
+
+# modules: main.dc only gets scale's i64 return type from lib's interface
+want=$(expected "$DIR"/modules/main.dc expect)
+"$DIVC" --emit-interface "$DIR"/modules/lib.dc -o "$TMP/lib.dci" || fail "lib.dc: no interface"
+for flags in "" -fpipeline; do
+    "$DIVC" $flags -I "$TMP" "$DIR"/modules/main.dc -o "$TMP/main.o" && "$DIVC" "$DIR"/modules/lib.dc -o "$TMP/lib.o" \
+        && "$CC" "$TMP/main.o" "$TMP/lib.o" -o "$TMP/m" && "$TMP/m"
+    got=$?
+    [ $got = "$want" ] || fail "modules [$flags]: returned $got, expected $want"
+done
+"$DIVC" -flto -I "$TMP" "$DIR"/modules/main.dc "$DIR"/modules/lib.dc -o "$TMP/m.o" && "$CC" "$TMP/m.o" -o "$TMP/m" && "$TMP/m"
+got=$?
+[ $got = "$want" ] || fail "modules [-flto]: returned $got, expected $want"
+"$DIVC" "$DIR"/modules/main.dc -o "$TMP/m.o" 2> /dev/null && "$DIVC" "$DIR"/modules/lib.dc -o "$TMP/lib.o" \
+    && fail "modules: main.dc compiles without lib's interface"
+
+# a syntax or semantic error fails the build and leaves no output, each
+# error reported once
+for source in "$DIR"/errors/*.dc; do
+    want=$(expected "$source" errors)
+    for flags in "" -fpipeline -flto; do
+        rm -f "$TMP/e.o"
+        if "$DIVC" $flags "$source" -o "$TMP/e.o" 2> "$TMP/e.err"; then
+            fail "$source [$flags]: compiled"
+        fi
+        [ -e "$TMP/e.o" ] && fail "$source [$flags]: left an output behind"
+        got=$(grep -c error "$TMP/e.err")
+        [ "$got" = "$want" ] || fail "$source [$flags]: $got errors, expected $want"
+    done
+done
+
+# -j under a make jobserver, a fifo holding two tokens: the same objects as
+# one at a time, and both tokens handed back
+mkdir "$TMP/j" "$TMP/serial"
+for name in args pressure tail widths; do
+    cp "$DIR/programs/$name.dc" "$TMP/j"
+done
+"$DIVC" "$TMP"/j/*.dc || fail "-j: serial build failed"
+mv "$TMP"/j/*.o "$TMP/serial"
+mkfifo "$TMP/jobserver"
+exec 3<> "$TMP/jobserver"
+printf '++' >&3
+MAKEFLAGS=" -j3 --jobserver-auth=fifo:$TMP/jobserver" "$DIVC" -j3 "$TMP"/j/*.dc || fail "-j: build failed"
+for object in "$TMP"/serial/*.o; do
+    cmp -s "$object" "$TMP/j/${object##*/}" || fail "-j: ${object##*/} differs"
+done
+# one read takes whatever is there, the marker keeps it from waiting
+printf 'xx' >&3
+tokens=$(dd bs=4 count=1 <&3 2> /dev/null)
+[ "$tokens" = "++xx" ] || fail "-j: the jobserver's tokens didn't come back"
+exec 3>&-
+
+# the cache hands back what it stored, and never stores a failed build
+source="$DIR"/programs/pressure.dc
+"$DIVC" --cache="$TMP/cache" "$source" -o "$TMP/c1.o" && "$DIVC" --cache="$TMP/cache" "$source" -o "$TMP/c2.o" \
+    && "$DIVC" "$source" -o "$TMP/c3.o" || fail "--cache: build failed"
+cmp -s "$TMP/c1.o" "$TMP/c3.o" && cmp -s "$TMP/c2.o" "$TMP/c3.o" || fail "--cache: output differs"
+"$DIVC" --cache="$TMP/cache" --cache-stats | grep -q 'hits *1$' || fail "--cache: no hit"
+"$DIVC" --cache="$TMP/cache" "$DIR"/errors/prototype.dc -o "$TMP/c4.o" 2> /dev/null
+"$DIVC" --cache="$TMP/cache" "$DIR"/errors/prototype.dc -o "$TMP/c4.o" 2> /dev/null && fail "--cache: a failed build was stored"
+
+# the compile server builds the same objects and fails the same way
+"$DIVC" --server="$TMP/sock" > /dev/null 2>&1 &
+SERVER=$!
+tries=0
+while [ ! -S "$TMP/sock" ] && [ $tries -lt 50 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+[ -S "$TMP/sock" ] || fail "--server: no socket"
+"$DIVC" --client="$TMP/sock" "$source" -o "$TMP/c5.o" && cmp -s "$TMP/c5.o" "$TMP/c3.o" || fail "--server: output differs"
+"$DIVC" --client="$TMP/sock" "$DIR"/errors/initializer.dc -o "$TMP/c6.o" 2> /dev/null && fail "--server: a syntax error compiled"
+kill $SERVER
+SERVER=
+
+# the language server: one diagnostic for the syntax error, and the call to
+# g on line 4 goes to its definition on line 1 (0-based on the wire)
+frame() {
+    printf 'Content-Length: %d\r\n\r\n%s' ${#1} "$1"
+}
+text='int g(int a) {\n    return a;\n}\nint main(void) { return g(1); }\nint bad() { int q = (; return 1; }\n'
+{
+    frame '{"jsonrpc":"2.0","id":1,"method":"initialize","params":{}}'
+    frame '{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"file:///check.dc","text":"'"$text"'"}}}'
+    frame '{"jsonrpc":"2.0","id":2,"method":"textDocument/definition","params":{"textDocument":{"uri":"file:///check.dc"},"position":{"line":3,"character":24}}}'
+    frame '{"jsonrpc":"2.0","id":3,"method":"shutdown"}'
+    frame '{"jsonrpc":"2.0","method":"exit"}'
+} | "$DIVC" --lsp > "$TMP/lsp.out" || fail "--lsp: exit status $?"
+[ "$(grep -o 'Syntax error' "$TMP/lsp.out" | wc -l)" = 1 ] || fail "--lsp: expected one syntax error"
+grep -q '"id":2,"result":{"uri":"file:///check.dc","range":{"start":{"line":0' "$TMP/lsp.out" || fail "--lsp: no definition for g"
+
+# the runtime kernels, checksums against gcc -O2
+DIVC="$DIVC" CC="$CC" sh "$DIR"/../bench/runtime/run.sh 1000 > "$TMP/runtime.out" || { cat "$TMP/runtime.out"; fail "runtime kernels"; }
+
+[ $status = 0 ] && echo "check passed"
+exit $status